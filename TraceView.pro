@@ -1,14 +1,60 @@
-QT += gui widgets core5compat
+QT += gui widgets core5compat concurrent network
 TARGET = TraceView
 TEMPLATE = app
 SOURCES += main.cpp \
     mainwindow.cpp \
     traceview.cpp \
-    tracedata.cpp
+    tracedata.cpp \
+    traceingest.cpp \
+    tracereplay.cpp \
+    tracepyramid.cpp \
+    tracepreview.cpp \
+    tracecli.cpp \
+    traceattrs.cpp \
+    tracequery.cpp \
+    tracestats.cpp \
+    traceflow.cpp \
+    traceoverview.cpp \
+    tracehotspots.cpp \
+    tracediff.cpp \
+    traceexport.cpp \
+    tracegroups.cpp \
+    tracecompress.cpp \
+    tracejson.cpp \
+    tracecategories.cpp \
+    tracerank.cpp \
+    traceworkspace.cpp \
+    tracetime.cpp \
+    tracememory.cpp \
+    traceselection.cpp
 HEADERS += mainwindow.h \
     traceview.h \
-    tracedata.h
+    tracedata.h \
+    traceingest.h \
+    tracereplay.h \
+    spscqueue.h \
+    tracepyramid.h \
+    tracepreview.h \
+    tracecli.h \
+    traceattrs.h \
+    tracequery.h \
+    tracestats.h \
+    traceflow.h \
+    traceoverview.h \
+    tracehotspots.h \
+    tracediff.h \
+    traceexport.h \
+    tracegroups.h \
+    tracecompress.h \
+    tracejson.h \
+    tracecategories.h \
+    tracerank.h \
+    traceworkspace.h \
+    tracetime.h \
+    tracememory.h \
+    traceselection.h
 FORMS += mainwindow.ui
+LIBS += -lz -lzstd
 
 macx {
     ICON += TraceView.icns
@@ -1,8 +1,26 @@
 #include <QApplication>
+#include <string.h>
 #include "mainwindow.h"
+#include "tracereplay.h"
+#include "tracecli.h"
 
 int main(int argc, char *argv[])
 {
+    if(argc > 1 && !strcmp(argv[1], "--replay"))
+    {
+        QCoreApplication a(argc, argv);
+        return runReplay(a);
+    }
+
+    if(argc > 1 && !strcmp(argv[1], "--cli"))
+    {
+        // image export draws text, which needs a GUI application but no display
+        if(!qEnvironmentVariableIsSet("QT_QPA_PLATFORM"))
+            qputenv("QT_QPA_PLATFORM", "offscreen");
+        QGuiApplication a(argc, argv);
+        return runCli(a);
+    }
+
     QApplication a(argc, argv);
     MainWindow w;
     w.show();
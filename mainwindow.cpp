@@ -1,16 +1,28 @@
 #include "mainwindow.h"
 #include "ui_mainwindow.h"
 #include "tracedata.h"
+#include "traceingest.h"
+#include "tracepreview.h"
+#include "tracestats.h"
+#include "traceflow.h"
+#include "traceexport.h"
+#include "tracegroups.h"
+#include "tracememory.h"
+#include "traceselection.h"
 
 #define ORG_NAME "MHughes"
 #define APP_NAME "TraceView"
 
 #define KEY_LAST_FILENAME "lastFileName"
 #define KEY_WINDOW_GEOMETRY "windowGeometry"
+#define KEY_MEMORY_BUDGET "memoryBudget"
 
 #include <QMessageBox>
 #include <QFileDialog>
 #include <QFile>
+#include <QFileInfo>
+#include <QDir>
+#include <QInputDialog>
 #include <QList>
 #include <QPair>
 #include <QtAlgorithms>
@@ -21,6 +33,12 @@
 #include <QVBoxLayout>
 #include <QSplitter>
 #include <QSettings>
+#include <QStatusBar>
+#include <QHeaderView>
+#include <QApplication>
+#include <QtConcurrent>
+#include <math.h>
+#include <limits.h>
 
 TraceFile gTraceFile;
 
@@ -28,6 +46,29 @@ TraceFile gTraceFile;
 
 #define MAX_LIST_EVENTS 500
 
+#define MAX_HOTSPOTS_LISTED 200
+
+#define ATTR_DETECT_SAMPLES 4096
+#define MAX_ATTR_LANES      256
+
+#define PREVIEW_SAMPLES     8192
+
+// text or Chrome trace-event JSON, either optionally compressed
+#define TRACE_FILE_PATTERNS { "*.txt", "*.txt.gz", "*.txt.zst", "*.json", "*.json.gz", "*.json.zst" }
+#define TRACE_FILE_FILTER   "Trace files (*.txt *.txt.gz *.txt.zst *.json *.json.gz *.json.zst)"
+#define PREVIEW_REFRESH_MS  100
+#define WORKSPACE_FILTER    "Workspaces (*.tvw)"
+
+#define STREAM_FRAME_MS             33
+#define STREAM_DEFAULT_CAPACITY     (1024*1024)
+#define STREAM_DEFAULT_RETENTION    60.0
+#define STREAM_MAX_EVENTS_PER_FRAME 200000
+#define STREAM_OVERVIEW_REFRESH_MS  500
+
+#define RANK_MIN_INTERVAL_MS        100
+#define RANK_BUDGET_FRACTION        0.05    // of the time between live re-ranks spent ranking
+
+#define MEMORY_REFRESH_MS           1000
 #define EVENT_LIST_DEFAULT_TEXT_COLOR   QColor(200,200,200)
 // #define EVENT_LIST_BG_COLOR             Qt::black // stylesheet is used
 
@@ -69,15 +110,18 @@ private:
 };
 
 MainWindow::MainWindow(QWidget *parent)
-    : QMainWindow(parent), ui(new Ui::MainWindow)
+    : QMainWindow(parent), ui(new Ui::MainWindow),
+      _cropped(false), _preview(NULL), _flowIndex(NULL), _baseline(NULL), _ingest(NULL), _streamRetention(STREAM_DEFAULT_RETENTION), _streamCapacity(STREAM_DEFAULT_CAPACITY), _streamHaveData(false), _streamBaseTicks(0)
 {
     ui->setupUi(this);
     QSplitter* split = new QSplitter(Qt::Vertical, ui->centralWidget);
     QLayout* layout = new QVBoxLayout();
     ui->centralWidget->setLayout(layout);
-    layout->addWidget(split);
     split->setSizePolicy(QSizePolicy::Expanding, QSizePolicy::Expanding);
     view = new TraceView(split);
+    overview = new TraceOverview(view, ui->centralWidget);
+    layout->addWidget(overview);
+    layout->addWidget(split);
     //layout->addWidget(view);
     view->setSizePolicy(QSizePolicy::Expanding, QSizePolicy::Expanding);
     eventList = new QListView(split);
@@ -96,17 +140,94 @@ MainWindow::MainWindow(QWidget *parent)
     szList.append(1);
     split->setSizes(szList);
 
+    statsTable = new QTableWidget(0, 12);
+    statsTable->setHorizontalHeaderLabels(QStringList() << "Lane" << "Events" << "Rate"
+                                          << "Gap p50" << "p90" << "p99" << "max"
+                                          << "Spans" << "Span p50" << "p90" << "p99" << "max");
+    statsTable->verticalHeader()->hide();
+    statsTable->setEditTriggers(QAbstractItemView::NoEditTriggers);
+    statsTable->setFocusPolicy(Qt::NoFocus);
+    statsDock = new QDockWidget("Statistics", this);
+    statsDock->setObjectName("statsDock");
+    statsDock->setWidget(statsTable);
+    addDockWidget(Qt::BottomDockWidgetArea, statsDock);
+    statsDock->hide();
+    connect(statsDock, SIGNAL(visibilityChanged(bool)), ui->actionStatistics, SLOT(setChecked(bool)));
+
+    hotspotsTree = new QTreeWidget();
+    hotspotsTree->setHeaderLabels(QStringList() << "Lane" << "Length" << "At");
+    hotspotsTree->setFocusPolicy(Qt::NoFocus);
+    hotspotsDock = new QDockWidget("Hotspots", this);
+    hotspotsDock->setObjectName("hotspotsDock");
+    hotspotsDock->setWidget(hotspotsTree);
+    addDockWidget(Qt::RightDockWidgetArea, hotspotsDock);
+    hotspotsDock->hide();
+    connect(hotspotsDock, SIGNAL(visibilityChanged(bool)), ui->actionHotspots, SLOT(setChecked(bool)));
+    connect(hotspotsTree, SIGNAL(itemActivated(QTreeWidgetItem*,int)), this, SLOT(onHotspotActivated(QTreeWidgetItem*)));
+
+    diffTable = new QTableWidget(0, 7);
+    diffTable->setHorizontalHeaderLabels(QStringList() << "Lane" << "Baseline" << "Candidate" << "Delta"
+                                         << "Baseline rate" << "Candidate rate" << "Rate delta");
+    diffTable->verticalHeader()->hide();
+    diffTable->setEditTriggers(QAbstractItemView::NoEditTriggers);
+    diffTable->setFocusPolicy(Qt::NoFocus);
+    diffDock = new QDockWidget("Comparison", this);
+    diffDock->setObjectName("diffDock");
+    diffDock->setWidget(diffTable);
+    addDockWidget(Qt::BottomDockWidgetArea, diffDock);
+    diffDock->hide();
+
+    memoryTable = new QTableWidget(0, 4);
+    memoryTable->setHorizontalHeaderLabels(QStringList() << "Component" << "Size" << "Evictable" << "Clients");
+    memoryTable->verticalHeader()->hide();
+    memoryTable->setEditTriggers(QAbstractItemView::NoEditTriggers);
+    memoryTable->setFocusPolicy(Qt::NoFocus);
+    memoryDock = new QDockWidget("Memory", this);
+    memoryDock->setObjectName("memoryDock");
+    memoryDock->setWidget(memoryTable);
+    addDockWidget(Qt::RightDockWidgetArea, memoryDock);
+    memoryDock->hide();
+    connect(memoryDock, SIGNAL(visibilityChanged(bool)), ui->actionMemory_usage, SLOT(setChecked(bool)));
+
     connect(view, SIGNAL(selectionChanged(bool)), this, SLOT(onSelectionChanged(bool)));
+    _lister = new SelectionLister(&gTraceFile, MAX_LIST_EVENTS, this);
+    connect(_lister, SIGNAL(finished()), this, SLOT(onSelectionListed()));
+    connect(&_statsWatcher, SIGNAL(finished()), this, SLOT(updateStats()));
+    // lanes are deleted only after they leave the view
+    connect(view, SIGNAL(lanesChanged()), this, SLOT(onLanesChanged()));
+    connect(view, SIGNAL(viewTimeChanged()), this, SLOT(onViewTimeChanged()));
+
+    ui->actionLoad_visible_range->setEnabled(false);
+    ui->actionStop_comparing->setEnabled(false);
+
+    _streamTimer = new QTimer(this);
+    connect(_streamTimer, SIGNAL(timeout()), this, SLOT(onStreamTimer()));
+
+    _rankMode = LaneRanking::EventsInView;
+    _rankCostMs = 0;
+    _rankTimer = new QTimer(this);
+    _rankTimer->setSingleShot(true);
+    connect(_rankTimer, SIGNAL(timeout()), this, SLOT(onRankTimer()));
 
     QSettings settings(ORG_NAME, APP_NAME);
-    _fileName = settings.value(KEY_LAST_FILENAME).toString();
+    _fileNames = settings.value(KEY_LAST_FILENAME).toStringList();
     restoreGeometry(settings.value(KEY_WINDOW_GEOMETRY).toByteArray());
+    MemoryBudget::setLimit(settings.value(KEY_MEMORY_BUDGET, DEFAULT_MEMORY_BUDGET).toLongLong());
+
+    _memoryTimer = new QTimer(this);
+    connect(_memoryTimer, SIGNAL(timeout()), this, SLOT(onMemoryTimer()));
+    _memoryTimer->start(MEMORY_REFRESH_MS);
 }
 
 MainWindow::~MainWindow()
 {
+    _lister->cancel();
+    _statsWatcher.waitForFinished();
+    stopListening();
+    stopFlowIndex();
+    stopComparing();
     QSettings settings(ORG_NAME, APP_NAME);
-    settings.setValue(KEY_LAST_FILENAME, _fileName);
+    settings.setValue(KEY_LAST_FILENAME, _fileNames);
     delete ui;
 }
 
@@ -114,185 +235,1820 @@ void MainWindow::on_actionLoad_triggered(void)
 {
     QString fileName = QFileDialog::getOpenFileName(this, "Open File",
                                                     QString(),
-                                                    "Trace files (*.txt *.bin)");
+                                                    TRACE_FILE_FILTER);
 
     if(fileName.isNull())
         return;
 
-    _fileName = fileName;
+    WorkspaceFiles files;
+    files.fileNames = QStringList(fileName);
+    files.cropped = false;
+    loadTrace(files, true);
+}
+
+void MainWindow::on_actionLoad_multiple_triggered(void)
+{
+    QStringList fileNames = QFileDialog::getOpenFileNames(this, "Open Files",
+                                                          QString(),
+                                                          TRACE_FILE_FILTER);
+
+    if(fileNames.isEmpty())
+        return;
 
-    on_actionReload_triggered();
+    WorkspaceFiles files;
+    if(askClockOffsets(fileNames, &files))
+        loadTrace(files, true);
 }
 
-void MainWindow::on_actionReload_triggered()
+void MainWindow::on_actionLoad_directory_triggered(void)
 {
-    if(_fileName.isNull())
+    QString dirName = QFileDialog::getExistingDirectory(this, "Open Directory");
+
+    if(dirName.isNull())
+        return;
+
+    QStringList fileNames;
+    QDir dir(dirName);
+    for(const QString& name: dir.entryList(QStringList(TRACE_FILE_PATTERNS), QDir::Files, QDir::Name))
+        fileNames.append(dir.filePath(name));
+
+    if(fileNames.isEmpty())
     {
-        on_actionLoad_triggered();
+        QMessageBox::warning(this, "Open Directory", "No trace files found in " + dirName);
+        return;
+    }
+
+    WorkspaceFiles files;
+    if(askClockOffsets(fileNames, &files))
+        loadTrace(files, true);
+}
+
+// Files are only taken into files, and the window's files only replaced
+// once they load.
+bool MainWindow::askClockOffsets(const QStringList& fileNames, WorkspaceFiles* files)
+{
+    QString txt;
+    for(const QString& fileName: fileNames)
+        txt += QString("0 %1\n").arg(fileName);
+
+    if(fileNames.size() > 1)
+    {
+        bool ok;
+        txt = QInputDialog::getMultiLineText(this, "Clock offsets",
+                                             "Clock offset in seconds added to each file (OFFSET FILE):",
+                                             txt, &ok);
+        if(!ok)
+            return false;
+    }
+
+    QStringList newFileNames;
+    QList<double> newOffsets;
+    for(const QString& line: txt.split('\n', Qt::SkipEmptyParts))
+    {
+        int sep = line.indexOf(' ');
+        bool ok = false;
+        double offset = (sep > 0) ? line.left(sep).toDouble(&ok) : 0;
+        if(!ok)
+        {
+            QMessageBox::warning(this, "Clock offsets", "Invalid line: " + line);
+            return false;
+        }
+        newFileNames.append(line.mid(sep+1).trimmed());
+        newOffsets.append(offset);
+    }
+
+    files->fileNames = newFileNames;
+    files->clockOffsets = newOffsets;
+    files->cropped = false;
+    return !files->fileNames.isEmpty();
+}
+
+void MainWindow::on_actionOpen_range_triggered()
+{
+    QStringList fileNames = QFileDialog::getOpenFileNames(this, "Open Range",
+                                                          QString(),
+                                                          TRACE_FILE_FILTER);
+
+    WorkspaceFiles files;
+    if(fileNames.isEmpty() || !askClockOffsets(fileNames, &files))
+        return;
+
+    QString span;
+    double spanBegin = HUGE_VAL, spanEnd = -HUGE_VAL;
+    for(int n = 0; n < files.fileNames.size(); n++)
+    {
+        double first, last;
+        if(TraceFile::probeTimeSpan(files.fileNames[n], &first, &last))
+        {
+            spanBegin = qMin(spanBegin, first + files.clockOffsets[n]);
+            spanEnd = qMax(spanEnd, last + files.clockOffsets[n]);
+        }
+    }
+    if(spanBegin <= spanEnd)
+        span = QString("%1 %2").arg(spanBegin, 0, 'f', 9).arg(spanEnd, 0, 'f', 9);
+
+    bool ok;
+    QString txt = QInputDialog::getText(this, "Open Range",
+                                        "Time range to load in seconds (BEGIN END).\n"
+                                        "Timestamps should be roughly monotonic.",
+                                        QLineEdit::Normal, span, &ok);
+    if(!ok)
+        return;
+
+    QStringList parts = txt.split(' ', Qt::SkipEmptyParts);
+    bool beginOk = false, endOk = false;
+    double begin = 0, end = 0;
+    if(parts.size() == 2)
+    {
+        begin = parts[0].toDouble(&beginOk);
+        end = parts[1].toDouble(&endOk);
     }
-    else if(_fileName.endsWith(".txt"))
+    if(!beginOk || !endOk || end < begin)
+    {
+        QMessageBox::warning(this, "Open Range", "Invalid range: " + txt);
+        return;
+    }
+
+    files.cropped = true;
+    files.cropRange = QPair<double,double>(begin, end);
+    loadTrace(files, true);
+}
+
+// Extends a cropped trace to cover the visible time range, parsing only the
+// regions of the file next to what is already loaded.
+void MainWindow::on_actionLoad_visible_range_triggered()
+{
+    if(!gTraceFile.isCropped())
+        return;
+
+    Range<double> viewRange = view->viewTimeRange();
+
+    QProgressDialog progDlg(this);
+    progDlg.setLabelText("Loading visible range...");
+    progDlg.setAutoClose(false);
+    progDlg.setAutoReset(false);
+    progDlg.setWindowModality(Qt::WindowModal);
+    progDlg.show();
+
+    view->clearSelection();
+    stopComparing();
+    view->setLanes(QList<Lane>());
+    stopFlowIndex();
+
+    if(!gTraceFile.widenRange(gTraceFile.fromViewTime(viewRange.begin), gTraceFile.fromViewTime(viewRange.end), &progDlg))
+        QMessageBox::warning(this, "Load", "Failed to read " + _fileNames.join(", "));
+
+    _cropRange = gTraceFile.getCropRange();
+    view->setLanes(buildLanes(&progDlg, NULL));
+    addQueryLanes(&progDlg);
+    findHotspots(&progDlg);
+    startFlowIndex();
+
+    progDlg.hide();
+}
+
+void MainWindow::on_actionReload_triggered()
+{
+    if(_fileNames.isEmpty())
+        on_actionLoad_triggered();
+    else
+        loadTrace(loadedFiles(), true);
+}
+
+// Loads files in place of the trace, and makes them the window's files
+// once they are loaded. With keepLanes, the lanes as arranged are put back
+// if the same files were loaded again, or failing that the query lanes are
+// evaluated again; without it, as when a workspace is about to replace
+// them, only the default lanes are built.
+void MainWindow::loadTrace(const WorkspaceFiles& files, bool keepLanes)
+{
+    bool isText = !files.fileNames.isEmpty();
+    for(const QString& fileName: files.fileNames)
+        isText = isText && QDir::match(QStringList(TRACE_FILE_PATTERNS), QFileInfo(fileName).fileName());
+
+    if(isText)
     {
         QProgressDialog progDlg(this);
         progDlg.setLabelText("Loading trace file...");
         progDlg.setAutoClose(false);
         progDlg.setAutoReset(false);
+        progDlg.setWindowModality(Qt::WindowModal);
         progDlg.show();
 
-        gTraceFile.openText(_fileName, &progDlg);
+        // the lanes as arranged now, put back if the same files are loaded
+        QByteArray snapshot;
+        if(keepLanes && gTraceFile.numEvents() > 0)
+            snapshot = saveWorkspace();
 
-        QList<Lane> lanes;
+        stopListening();
+        stopFlowIndex();
+        view->clearSelection();
+        stopComparing();
+        view->setLanes(QList<Lane>());
+        releaseStreamLanes();
+        releaseTraceLanes();
+        delete _preview;
+        _preview = NULL;
 
-        progDlg.setLabelText("Building lanes...");
-
-        QMap<QString,FilteredTrace*> laneMap;
-        QMap<QString,QString> laneNameMap;
-        progDlg.reset();
-        progDlg.setRange(0, gTraceFile.numEvents());
-        char tmpStrBuf[256];
-        int traceIdx = 0;
-        for(int n = 0; n < gTraceFile.numEvents(); n++)
+        // show a sampled estimate of the whole trace while it is parsed
+        QTimer previewTimer;
+        if(!files.cropped)
         {
-            int ofs = 0;
-            const char* txt = gTraceFile.getEventText(n, false);
-            if(txt && (sscanf(txt, "%s%n", tmpStrBuf, &ofs) >= 1))
+            _preview = new TracePreview(files.fileNames, files.clockOffsets, TraceFile::probeBaseTicks(files.fileNames, files.clockOffsets));
+            if(_preview->sample(PREVIEW_SAMPLES))
             {
-                QString laneID(tmpStrBuf);
-                QMap<QString,FilteredTrace*>::const_iterator iter;
-                FilteredTrace* data;
-
-                if(sscanf(txt+ofs, " THREAD_NAME=%n%s", &ofs, tmpStrBuf) >= 1)
-                {
-                    laneNameMap[laneID] = QString(tmpStrBuf);
-                }
-
-                iter = laneMap.find(laneID);
-                if(iter == laneMap.end())
-                {
-                    data = new FilteredTrace(&gTraceFile);
-                    data->setIndex(traceIdx++);
-                    laneMap[laneID] = data;
-                    QColor color = QColor::fromHsv((data->getIndex()*35)%255,255,255);
-                    lanes.push_back(Lane(data, laneID, color));
-                }
-                else
-                {
-                    data = iter.value();
-                }
-                data->addEvent(n);
+                addPreviewLanes();
+                view->zoomAll();
+                connect(&previewTimer, SIGNAL(timeout()), this, SLOT(onPreviewTimer()));
+                previewTimer.start(PREVIEW_REFRESH_MS);
+            }
+            else
+            {
+                delete _preview;
+                _preview = NULL;
             }
-            progDlg.setValue(n);
         }
 
-        progDlg.setLabelText("Filtering trace data...");
+        bool ok;
+        gTraceFile.setPreview(_preview);
+        if(files.cropped)
+            ok = gTraceFile.openTextRange(files.fileNames, files.clockOffsets, files.cropRange.first, files.cropRange.second, &progDlg);
+        else
+            ok = gTraceFile.openText(files.fileNames, files.clockOffsets, &progDlg);
+        gTraceFile.setPreview(NULL);
+        previewTimer.stop();
 
-        //...
+        if(ok && _preview)
+            _preview->finish();
 
-        for(auto& l: lanes)
+        if(!ok)
         {
-            auto iter = laneNameMap.find(l.name);
-            if(iter != laneNameMap.end())
-            {
-                l.name = iter.value();
-            }
+            view->setLanes(QList<Lane>());
+            delete _preview;
+            _preview = NULL;
+            progDlg.hide();
+            QMessageBox::warning(this, "Load", "Failed to open " + files.fileNames.join(", "));
+            return;
         }
 
-        view->setLanes(lanes);
-        view->zoomAll();
+        _fileNames = files.fileNames;
+        _clockOffsets = files.clockOffsets;
+        _cropped = files.cropped;
+        _cropRange = files.cropRange;
+
+        TraceFile::OrderStats orderStats = gTraceFile.getOrderStats();
+        if(orderStats.numOutOfOrder > 0)
+        {
+            statusBar()->showMessage(QString("Timestamps not monotonic: %1 sorted runs, %2 of %3 events stepped back in time (max %4)")
+                                     .arg(orderStats.numRuns).arg(orderStats.numOutOfOrder).arg(gTraceFile.numEvents())
+                                     .arg(timeToString(orderStats.maxStepBack, false)));
+        }
+        else
+        {
+            statusBar()->clearMessage();
+        }
+
+        view->setLanes(buildLanes(&progDlg, _preview));
+        Workspace workspace;
+        bool restored = keepLanes && workspace.parse((const uchar*)snapshot.constData(), snapshot.size()) &&
+                        restoreWorkspace(workspace, &progDlg);
+        if(!restored)
+        {
+            if(keepLanes)
+                addQueryLanes(&progDlg);
+            if(!_preview)
+                view->zoomAll();
+        }
+        findHotspots(&progDlg);
+        startFlowIndex();
+        ui->actionLoad_visible_range->setEnabled(gTraceFile.isCropped());
 
         progDlg.hide();
     }
 }
 
-void MainWindow::on_actionZoom_in_triggered(void)
+void MainWindow::on_actionOpen_workspace_triggered()
 {
-    view->zoomBy(ZOOM_FACTOR);
+    QString fileName = QFileDialog::getOpenFileName(this, "Open workspace", QString(), WORKSPACE_FILTER);
+    if(fileName.isNull())
+        return;
+
+    // the workspace is read in place; the mapping lasts until file closes
+    QFile file(fileName);
+    const uchar* data = file.open(QIODevice::ReadOnly) ? file.map(0, file.size()) : NULL;
+    Workspace workspace;
+    if(!workspace.parse(data, file.size()))
+    {
+        QMessageBox::warning(this, "Open workspace", "Failed to read workspace " + fileName);
+        return;
+    }
+
+    const WorkspaceFiles& files = workspace.files();
+    if(gTraceFile.numEvents() == 0 || files.fileNames != _fileNames || files.clockOffsets != _clockOffsets ||
+       files.cropped != _cropped || (files.cropped && files.cropRange != _cropRange))
+    {
+        loadTrace(files, false);
+        if(gTraceFile.numEvents() == 0)
+            return;
+    }
+
+    QProgressDialog progDlg(this);
+    progDlg.setLabelText("Restoring workspace...");
+    progDlg.setAutoClose(false);
+    progDlg.setAutoReset(false);
+    progDlg.setWindowModality(Qt::WindowModal);
+    progDlg.show();
+
+    bool exact = workspace.matches(&gTraceFile);
+    restoreWorkspace(workspace, &progDlg);
+
+    progDlg.hide();
+
+    if(!exact)
+        statusBar()->showMessage("The trace changed since the workspace was saved; lanes were rebuilt from it");
 }
 
-void MainWindow::on_actionZoom_out_triggered(void)
+void MainWindow::on_actionSave_workspace_triggered()
 {
-    view->zoomBy(1/ZOOM_FACTOR);
+    if(gTraceFile.numEvents() == 0)
+    {
+        QMessageBox::warning(this, "Save workspace", "No trace loaded");
+        return;
+    }
+
+    QString fileName = QFileDialog::getSaveFileName(this, "Save workspace", QString(), WORKSPACE_FILTER);
+    if(fileName.isNull())
+        return;
+
+    QByteArray data = saveWorkspace();
+    QFile file(fileName);
+    if(!file.open(QIODevice::WriteOnly | QIODevice::Truncate) || file.write(data) != data.size())
+    {
+        QMessageBox::warning(this, "Save workspace", "Failed to write " + fileName);
+        return;
+    }
+    statusBar()->showMessage(QString("Saved workspace of %1 lanes").arg(view->numLanes()), 5000);
 }
 
-void MainWindow::on_actionZoom_to_selection_triggered(void)
+WorkspaceFiles MainWindow::loadedFiles() const
 {
-    view->zoomToSelection();
+    WorkspaceFiles files;
+    files.fileNames = _fileNames;
+    files.clockOffsets = _clockOffsets;
+    files.cropped = _cropped;
+    files.cropRange = _cropRange;
+    return files;
 }
 
-void MainWindow::on_actionZoom_all_triggered(void)
+QByteArray MainWindow::saveWorkspace()
 {
-    view->zoomAll();
+    return Workspace::save(&gTraceFile, loadedFiles(), _traceLanes, view);
 }
 
-static bool eventLessThan(const std::tuple<double,QString,QColor> &e1, const std::tuple<double,QString,QColor> &e2)
+// Replaces the lanes with those of a workspace saved from the files now
+// loaded, returning false if it was saved from other files. Query and
+// attribute lanes the workspace couldn't restore as they were are
+// evaluated or split again.
+bool MainWindow::restoreWorkspace(const Workspace& workspace, QProgressDialog* progDlg)
 {
-    return std::get<0>(e1) < std::get<0>(e2);
+    if(workspace.files().fileNames != _fileNames || workspace.files().clockOffsets != _clockOffsets)
+        return false;
+
+    QList<QueryTrace*> queryLanes;
+    QList<FilteredTrace*> attrLanes;
+    QList<TracePyramid*> pyramids;
+    QList<Lane> lanes = workspace.restore(&gTraceFile, _traceLanes, &queryLanes, &attrLanes, &pyramids);
+
+    QStringList keys = _attrs.keys();
+    bool stale = false;
+    for(QueryTrace* lane: queryLanes)
+    {
+        if(lane->isCurrent())
+            continue;
+        stale = true;
+        for(const QString& key: lane->getQuery()->attributeKeys())
+        {
+            if(!keys.contains(key))
+                keys.append(key);
+        }
+    }
+    QList<FilteredTrace*> unsplit;
+    for(FilteredTrace* lane: attrLanes)
+    {
+        if(lane->numEvents() > 0)
+            continue;
+        unsplit.append(lane);
+        if(!keys.contains(lane->attributeKey()))
+            keys.append(lane->attributeKey());
+    }
+    if(stale || !unsplit.isEmpty())
+        refreshAttributes(keys, progDlg);
+    if(stale)
+    {
+        progDlg->setLabelText("Evaluating queries...");
+        for(QueryTrace* lane: queryLanes)
+            lane->update(_traceLanes, &_attrs, progDlg);
+    }
+    for(FilteredTrace* lane: unsplit)
+        _attrs.fill(lane);
+
+    view->clearSelection();
+    view->setLanes(lanes);
+
+    // stats are kept per lane, and the old query lanes go with this
+    _statsWatcher.waitForFinished();
+    qDeleteAll(_laneStats);
+    _laneStats.clear();
+    qDeleteAll(_queryLanes);
+    _queryLanes = queryLanes;
+    qDeleteAll(_attrLanes);
+    _attrLanes = attrLanes;
+    qDeleteAll(_groupPyramids);
+    _groupPyramids = pyramids;
+    _categories.clear();
+    view->setCategoryLegend(QStringList(), -1);
+
+    workspace.restoreView(view);
+    return true;
 }
 
-void MainWindow::onSelectionChanged(bool hasSelection)
+// Renders the visible time range of the selected lanes, or of all lanes,
+// to an image file at any size.
+void MainWindow::on_actionExport_image_triggered()
 {
-    EventListModel* model = (EventListModel*)eventList->model();
-    QStringList itemStrings;
-    QList<std::tuple<double,QString,QColor> > items;
-    int totalEventCount = 0;
+    QList<Lane> lanes;
+    Range<int> laneRange = view->selectedLaneRange();
+    if(!view->hasSelection() || laneRange.begin == -1 || laneRange.end == -1)
+    {
+        laneRange.begin = 0;
+        laneRange.end = view->numLanes() - 1;
+    }
+    for(int laneIdx = laneRange.begin; laneIdx <= laneRange.end; ++laneIdx)
+    {
+        if(!view->getLane(laneIdx)->hidden)
+            lanes.append(*view->getLane(laneIdx));
+    }
+    if(lanes.isEmpty())
+    {
+        QMessageBox::warning(this, "Export image", "No lanes to export");
+        return;
+    }
 
-    if(hasSelection)
+    QString fileName = QFileDialog::getSaveFileName(this, "Export image", QString(),
+                                                    "PNG image (*.png);;SVG image (*.svg)");
+    if(fileName.isNull())
+        return;
+
+    bool ok;
+    QString size = QInputDialog::getText(this, "Export image", "Size in pixels (width x height):",
+                                         QLineEdit::Normal, QString("%1x%2").arg(view->width()*4).arg(view->height()*4), &ok);
+    if(!ok)
+        return;
+    QStringList dims = size.split('x');
+    int width = (dims.size() == 2) ? dims[0].trimmed().toInt() : 0;
+    int height = (dims.size() == 2) ? dims[1].trimmed().toInt() : 0;
+    if(width <= 0 || height <= 0)
     {
-        Range<int> laneRange = view->selectedLaneRange();
-        Range<double> timeRange = view->selectedTimeRange();
+        QMessageBox::warning(this, "Export image", "Invalid size " + size);
+        return;
+    }
 
-        if(laneRange.begin == -1 || laneRange.end == -1)
+    QProgressDialog progDlg(this);
+    progDlg.setLabelText("Rendering image...");
+    progDlg.setAutoClose(false);
+    progDlg.setAutoReset(false);
+    progDlg.setWindowModality(Qt::WindowModal);
+    progDlg.show();
+
+    // streamed lanes must not change while they're rendered
+    bool streaming = _streamTimer->isActive();
+    _streamTimer->stop();
+
+    Range<double> viewRange = view->viewTimeRange();
+    if(!TraceExport::writeImage(fileName, lanes, viewRange.begin, viewRange.end, width, height, &progDlg))
+        QMessageBox::warning(this, "Export image", "Failed to write " + fileName);
+
+    if(streaming)
+        _streamTimer->start(STREAM_FRAME_MS);
+    progDlg.hide();
+}
+
+void MainWindow::addPreviewLanes()
+{
+    QStringList laneIDs = _preview->laneIDs();
+    for(int n = view->numLanes(); n < laneIDs.size(); n++)
+    {
+        QColor color = QColor::fromHsv((n*35)%255,255,255);
+        view->addLane(Lane(NULL, laneIDs[n], color, _preview->getPyramid(laneIDs[n])));
+    }
+}
+
+void MainWindow::onPreviewTimer()
+{
+    if(_preview->applyPending())
+    {
+        addPreviewLanes();
+        view->update();
+        overview->invalidate();
+    }
+}
+
+QList<Lane> MainWindow::buildLanes(QProgressDialog* progDlg, TracePreview* preview)
+{
+    QList<Lane> lanes;
+
+    progDlg->setLabelText("Building lanes...");
+
+    // the old lanes have left the view by now
+    releaseTraceLanes();
+    qDeleteAll(_groupPyramids);
+    _groupPyramids.clear();
+    _categories.clear();
+    view->setCategoryLegend(QStringList(), -1);
+
+    _traceLanes = gTraceFile.splitLanes(progDlg);
+    for(const TraceLane& traceLane: _traceLanes)
+    {
+        QColor color = QColor::fromHsv((traceLane.data->getIndex()*35)%255,255,255);
+        TracePyramid* pyramid = preview ? preview->getPyramid(traceLane.id) : NULL;
+        lanes.push_back(Lane(traceLane.data, traceLane.name, color, pyramid));
+    }
+
+    return lanes;
+}
+
+void MainWindow::on_actionExtract_attributes_triggered()
+{
+    if(gTraceFile.numEvents() == 0)
+    {
+        QMessageBox::warning(this, "Extract attributes", "No trace loaded");
+        return;
+    }
+
+    QStringList keys = _attrs.keys();
+    if(keys.isEmpty())
+        keys = AttributeStore::detectKeys(&gTraceFile, ATTR_DETECT_SAMPLES);
+
+    bool ok;
+    QString text = QInputDialog::getText(this, "Extract attributes", "Keys of key=value attributes to extract:", QLineEdit::Normal, keys.join(" "), &ok);
+    if(!ok)
+        return;
+    keys = text.split(QRegExp("[\\s,]+"), Qt::SkipEmptyParts);
+    keys.removeDuplicates();
+
+    QProgressDialog progDlg(this);
+    progDlg.setLabelText("Extracting attributes...");
+    progDlg.setAutoClose(false);
+    progDlg.setAutoReset(false);
+    progDlg.setWindowModality(Qt::WindowModal);
+    progDlg.show();
+
+    _attrs.extract(&gTraceFile, keys, &progDlg);
+
+    progDlg.hide();
+
+    QStringList summary;
+    for(const QString& key: _attrs.keys())
+    {
+        AttributeColumn* col = _attrs.column(key);
+        if(col->type == AttributeColumn::Numeric)
+            summary.append(key + " (numeric)");
+        else
+            summary.append(QString("%1 (%2 values)").arg(key).arg(col->dictionary.size()));
+    }
+    statusBar()->showMessage("Extracted " + summary.join(", "));
+}
+
+void MainWindow::on_actionLanes_by_attribute_triggered()
+{
+    if(!ensureAttributes())
+        return;
+
+    bool ok;
+    QString key = QInputDialog::getItem(this, "Lanes by attribute", "Add a lane for each value of:", _attrs.keys(), 0, false, &ok);
+    if(!ok)
+        return;
+
+    AttributeColumn* col = _attrs.column(key);
+    QList<FilteredTrace*> lanes;
+    QStringList names;
+
+    if(col->type == AttributeColumn::String)
+    {
+        if(col->dictionary.size() > MAX_ATTR_LANES)
         {
-            laneRange.begin = 0;
-            laneRange.end = view->numLanes() - 1;
+            QMessageBox::warning(this, "Lanes by attribute", QString("%1 has %2 distinct values, more than %3 lanes").arg(key).arg(col->dictionary.size()).arg(MAX_ATTR_LANES));
+            return;
         }
-        
-        for(int laneIdx = laneRange.begin; laneIdx <= laneRange.end; ++laneIdx)
+
+        for(const QByteArray& value: col->dictionary)
         {
-            const Lane* lane = view->getLane(laneIdx);
-            int eventIdx = 0;
-            Trace* data = lane->data;
-            int eventCount = data->eventsInRange(timeRange.begin, timeRange.end, &eventIdx);
-            totalEventCount += eventCount;
-            if(totalEventCount > MAX_LIST_EVENTS)
-            {
-                break;
-            }
-            else if(eventCount > 0)
+            lanes.append(new FilteredTrace(&gTraceFile));
+            lanes.last()->setAttribute(key, QString::fromUtf8(value));
+            names.append(key + "=" + QString::fromUtf8(value));
+        }
+        for(int n = 0; n < col->codes.size(); n++)
+        {
+            if(col->codes[n])
+                lanes[col->codes[n]-1]->addEvent(n);
+        }
+    }
+    else
+    {
+        QMap<double,FilteredTrace*> laneForValue;
+        for(int n = 0; n < col->numbers.size(); n++)
+        {
+            double v = col->numbers[n];
+            if(isnan(v))
+                continue;
+            FilteredTrace* lane = laneForValue.value(v);
+            if(!lane)
             {
-                for(int n = 0; n < eventCount; n++)
+                if(laneForValue.size() >= MAX_ATTR_LANES)
                 {
-                    double timestamp = data->getEventTime(eventIdx+n);
-                    QString str = data->getEventText(eventIdx+n, true);
-                    items.append(std::make_tuple(timestamp,str,lane->color));
+                    qDeleteAll(laneForValue);
+                    QMessageBox::warning(this, "Lanes by attribute", QString("%1 has more than %2 distinct values").arg(key).arg(MAX_ATTR_LANES));
+                    return;
                 }
+                lane = new FilteredTrace(&gTraceFile);
+                lane->setAttribute(key, QString::number(v, 'g', 17));
+                laneForValue[v] = lane;
             }
+            lane->addEvent(n);
         }
-    }
-
-    model->clearColors();
-
-    if(totalEventCount <= MAX_LIST_EVENTS)
-    {
-        std::stable_sort(items.begin(), items.end(), eventLessThan);
-
-        uint32_t i = 0;
-        for(auto iter = items.begin(); iter != items.end(); ++iter)
+        for(auto iter = laneForValue.begin(); iter != laneForValue.end(); ++iter)
         {
-            itemStrings.append(std::get<1>(*iter));
-            model->setData(model->index(i), std::get<2>(*iter), Qt::ForegroundRole);
-            ++i;
+            lanes.append(iter.value());
+            names.append(key + "=" + QString::number(iter.key(), 'g', 15));
         }
     }
-    else
+
+    for(int n = 0; n < lanes.size(); n++)
     {
-        itemStrings.append(QString("Selected %1 events").arg(totalEventCount));
-        model->setData(model->index(0), EVENT_LIST_DEFAULT_TEXT_COLOR, Qt::ForegroundRole);
+        int idx = view->numLanes();
+        lanes[n]->setIndex(idx);
+        lanes[n]->updateMemoryUsed();
+        _attrLanes.append(lanes[n]);
+        view->addLane(Lane(lanes[n], names[n], QColor::fromHsv((idx*35)%255,255,255)));
     }
-
-    model->setStringList(itemStrings);
 }
 
+void MainWindow::on_actionNew_query_lane_triggered()
+{
+    if(gTraceFile.numEvents() == 0)
+    {
+        QMessageBox::warning(this, "New query lane", "No trace loaded");
+        return;
+    }
 
+    bool ok;
+    QString text = QInputDialog::getText(this, "New query lane",
+                                         "Add a lane of events matching, e.g.\n"
+                                         "lane == net && status != 200 && (size > 4096 || text ~ /retry/)",
+                                         QLineEdit::Normal, QString(), &ok);
+    if(!ok || text.trimmed().isEmpty())
+        return;
+
+    QString error;
+    TraceQuery* query = new TraceQuery();
+    if(!query->parse(text, &error))
+    {
+        delete query;
+        QMessageBox::warning(this, "New query lane", error);
+        return;
+    }
+
+    QProgressDialog progDlg(this);
+    progDlg.setLabelText("Evaluating query...");
+    progDlg.setAutoClose(false);
+    progDlg.setAutoReset(false);
+    progDlg.setWindowModality(Qt::WindowModal);
+    progDlg.show();
+
+    QStringList keys = _attrs.keys();
+    for(const QString& key: query->attributeKeys())
+    {
+        if(!keys.contains(key))
+            keys.append(key);
+    }
+    refreshAttributes(keys, &progDlg);
+
+    QueryTrace* lane = new QueryTrace(&gTraceFile, query);
+    lane->update(_traceLanes, &_attrs, &progDlg);
+    _queryLanes.append(lane);
+
+    int idx = view->numLanes();
+    lane->setIndex(idx);
+    view->addLane(Lane(lane, text.simplified(), QColor::fromHsv((idx*35)%255,255,255)));
+
+    progDlg.hide();
+}
+
+// Re-extracts the attribute columns if the keys changed or the trace was
+// reloaded since they were extracted.
+bool MainWindow::refreshAttributes(const QStringList& keys, QProgressDialog* progDlg)
+{
+    if(keys.isEmpty() || (keys == _attrs.keys() && _attrs.getGeneration() == gTraceFile.getGeneration()))
+        return false;
+
+    progDlg->setLabelText("Extracting attributes...");
+    _attrs.extract(&gTraceFile, keys, progDlg);
+    return true;
+}
+
+// Asks for the keys only if none were extracted yet; columns that were
+// evicted or extracted from an older trace are extracted again with the
+// same keys.
+bool MainWindow::ensureAttributes()
+{
+    if(_attrs.keys().isEmpty())
+        on_actionExtract_attributes_triggered();
+    else if(_attrs.getGeneration() != gTraceFile.getGeneration())
+    {
+        QProgressDialog progDlg(this);
+        progDlg.setAutoClose(false);
+        progDlg.setAutoReset(false);
+        progDlg.setWindowModality(Qt::WindowModal);
+        progDlg.show();
+        refreshAttributes(_attrs.keys(), &progDlg);
+        progDlg.hide();
+    }
+    return !_attrs.keys().isEmpty() && _attrs.getGeneration() == gTraceFile.getGeneration();
+}
+
+// Brings the query lanes up to date with a newly loaded or widened trace
+// and adds them after the regular lanes.
+void MainWindow::addQueryLanes(QProgressDialog* progDlg)
+{
+    QStringList keys = _attrs.keys();
+    for(auto lane: _queryLanes)
+    {
+        for(const QString& key: lane->getQuery()->attributeKeys())
+        {
+            if(!keys.contains(key))
+                keys.append(key);
+        }
+    }
+    refreshAttributes(keys, progDlg);
+
+    progDlg->setLabelText("Evaluating queries...");
+    for(auto lane: _queryLanes)
+    {
+        lane->update(_traceLanes, &_attrs, progDlg);
+
+        int idx = view->numLanes();
+        lane->setIndex(idx);
+        view->addLane(Lane(lane, lane->getQuery()->expression().simplified(), QColor::fromHsv((idx*35)%255,255,255)));
+    }
+}
+
+void MainWindow::on_actionZoom_in_triggered(void)
+{
+    view->zoomBy(ZOOM_FACTOR);
+}
+
+void MainWindow::on_actionZoom_out_triggered(void)
+{
+    view->zoomBy(1/ZOOM_FACTOR);
+}
+
+void MainWindow::on_actionZoom_to_selection_triggered(void)
+{
+    view->zoomToSelection();
+}
+
+void MainWindow::on_actionZoom_all_triggered(void)
+{
+    view->zoomAll();
+}
+
+static bool eventLessThan(const std::tuple<double,QString,QColor> &e1, const std::tuple<double,QString,QColor> &e2)
+{
+    return std::get<0>(e1) < std::get<0>(e2);
+}
+
+// Ranges of the loaded trace are listed in the background, so the list and
+// statistics follow once the selection is settled; an earlier listing still
+// running is cancelled, and the trace and lanes can change when none is.
+void MainWindow::onSelectionChanged(bool hasSelection)
+{
+    QList<std::tuple<double,QString,QColor> > items;
+    int totalEventCount = 0;
+
+    _lister->cancel();
+
+    if(hasSelection && !view->selectedFlow().isEmpty() && _flowIndex)
+    {
+        QMap<Trace*,QColor> laneColors;
+        for(int laneIdx = 0; laneIdx < view->numLanes(); ++laneIdx)
+            laneColors[view->getLane(laneIdx)->data] = view->getLane(laneIdx)->color;
+
+        for(const FlowIndex::EventRef& ref: view->selectedFlow())
+        {
+            Trace* data = _flowIndex->getLane(ref.lane);
+            if(++totalEventCount > MAX_LIST_EVENTS)
+                break;
+            items.append(std::make_tuple(data->getEventTime(ref.idx), QString(data->getEventText(ref.idx, true)),
+                                         laneColors.value(data, EVENT_LIST_DEFAULT_TEXT_COLOR)));
+        }
+        std::stable_sort(items.begin(), items.end(), eventLessThan);
+    }
+    else if(hasSelection)
+    {
+        Range<int> laneRange = view->selectedLaneRange();
+        Range<double> timeRange = view->selectedTimeRange();
+
+        if(laneRange.begin == -1 || laneRange.end == -1)
+        {
+            laneRange.begin = 0;
+            laneRange.end = view->numLanes() - 1;
+        }
+        
+        QList<Trace*> traces;
+        QList<QColor> colors;
+        for(int laneIdx = laneRange.begin; laneIdx <= laneRange.end; ++laneIdx)
+        {
+            const Lane* lane = view->getLane(laneIdx);
+            if(!lane || !lane->data)
+                continue;
+            traces.append(lane->data);
+            colors.append(lane->color);
+        }
+
+        if(_lister->canList(traces))
+        {
+            // the previous list no longer matches the selection
+            EventListModel* model = (EventListModel*)eventList->model();
+            model->clearColors();
+            model->setStringList(QStringList("Listing events..."));
+            model->setData(model->index(0), EVENT_LIST_DEFAULT_TEXT_COLOR, Qt::ForegroundRole);
+            _lister->submit(traces, colors, timeRange.begin, timeRange.end);
+            updateStats();
+            return;
+        }
+
+        // live lanes change under a worker, so are listed here
+        for(int n = 0; n < traces.size() && totalEventCount <= MAX_LIST_EVENTS; ++n)
+        {
+            int eventIdx = 0;
+            totalEventCount += traces[n]->eventsInRange(timeRange.begin, timeRange.end, &eventIdx);
+        }
+
+        // merged in time order, ties in lane order, so no sort is needed
+        if(totalEventCount <= MAX_LIST_EVENTS)
+        {
+            TraceMerge merge(traces);
+            for(merge.seek(timeRange.begin); !merge.atEnd() && merge.time() < timeRange.end; merge.next())
+            {
+                Trace* data = traces[merge.trace()];
+                items.append(std::make_tuple(merge.time(), QString(data->getEventText(merge.event(), true)),
+                                             colors[merge.trace()]));
+            }
+        }
+    }
+
+    showEventList(items, totalEventCount);
+    updateStats();
+}
+
+// A listing of the old lanes is cancelled before they can be deleted, and
+// the selection is listed again from the lanes now in the view.
+void MainWindow::onLanesChanged()
+{
+    _lister->cancel();
+    _statsWatcher.waitForFinished();
+    onSelectionChanged(view->hasSelection());
+}
+
+void MainWindow::onSelectionListed()
+{
+    QList<std::tuple<double,QString,QColor> > items;
+    for(const SelectionLister::Item& item: _lister->items())
+        items.append(std::make_tuple(item.time, item.text, item.color));
+    showEventList(items, _lister->numEvents());
+}
+
+void MainWindow::showEventList(const QList<std::tuple<double,QString,QColor> >& items, int totalEventCount)
+{
+    EventListModel* model = (EventListModel*)eventList->model();
+    QStringList itemStrings;
+
+    model->clearColors();
+
+    if(totalEventCount <= MAX_LIST_EVENTS)
+    {
+        uint32_t i = 0;
+        for(auto iter = items.begin(); iter != items.end(); ++iter)
+        {
+            itemStrings.append(std::get<1>(*iter));
+            model->setData(model->index(i), std::get<2>(*iter), Qt::ForegroundRole);
+            ++i;
+        }
+    }
+    else
+    {
+        itemStrings.append(QString("Selected %1 events").arg(totalEventCount));
+        model->setData(model->index(0), EVENT_LIST_DEFAULT_TEXT_COLOR, Qt::ForegroundRole);
+    }
+
+    model->setStringList(itemStrings);
+}
+
+void MainWindow::on_actionSelect_whole_flow_triggered()
+{
+    // an index evicted to stay within the memory budget is built again
+    if(_flowIndex && !_flowIndex->isReady() && !_flowIndex->isRunning())
+    {
+        statusBar()->showMessage("Indexing flows...");
+        _flowIndex->start(QThread::LowPriority);
+        return;
+    }
+    view->selectHoveredFlow();
+}
+
+// Indexes correlation IDs of the loaded lanes in the background. The view
+// gets the index once it is complete.
+void MainWindow::startFlowIndex()
+{
+    stopFlowIndex();
+    _flowIndex = new FlowIndex(&gTraceFile, _traceLanes, this);
+    connect(_flowIndex, SIGNAL(finished()), this, SLOT(onFlowIndexFinished()));
+    _flowIndex->start(QThread::LowPriority);
+}
+
+// Must be called before the trace changes, as the index reads its text.
+void MainWindow::stopFlowIndex()
+{
+    view->setFlowIndex(NULL);
+    delete _flowIndex;
+    _flowIndex = NULL;
+}
+
+void MainWindow::onFlowIndexFinished()
+{
+    if(sender() != _flowIndex || !_flowIndex->isReady())
+        return;
+
+    view->setFlowIndex(_flowIndex);
+    if(_flowIndex->numFlows() > 0)
+        statusBar()->showMessage(QString("Linked %1 flows by %2<id>").arg(_flowIndex->numFlows()).arg(FLOW_KEY), 5000);
+}
+
+void MainWindow::on_actionHotspots_toggled(bool checked)
+{
+    hotspotsDock->setVisible(checked);
+}
+
+void MainWindow::on_actionMemory_usage_toggled(bool checked)
+{
+    memoryDock->setVisible(checked);
+    if(checked)
+        updateMemory();
+}
+
+void MainWindow::on_actionMemory_budget_triggered()
+{
+    bool ok;
+    QString text = QInputDialog::getText(this, "Memory budget", "Memory for caches and indices (e.g. 8G, 512M):",
+                                         QLineEdit::Normal, MemoryBudget::formatBytes(MemoryBudget::limit()), &ok);
+    if(!ok)
+        return;
+
+    qint64 limit;
+    if(!MemoryBudget::parseBytes(text, &limit) || limit <= 0)
+    {
+        QMessageBox::warning(this, "Memory budget", "Not a size: " + text);
+        return;
+    }
+
+    MemoryBudget::setLimit(limit);
+    QSettings settings(ORG_NAME, APP_NAME);
+    settings.setValue(KEY_MEMORY_BUDGET, limit);
+    onMemoryTimer();
+}
+
+// Evicts caches over the budget, unless an operation is under way (they all
+// run behind a modal progress dialog, except statistics builds) and may be
+// using them.
+void MainWindow::onMemoryTimer()
+{
+    if(!QApplication::activeModalWidget() && !_statsWatcher.isRunning())
+    {
+        qint64 freed = MemoryBudget::trim();
+        if(freed > 0)
+            statusBar()->showMessage(QString("Freed %1 of caches to stay within the %2 memory budget")
+                                     .arg(MemoryBudget::formatBytes(freed)).arg(MemoryBudget::formatBytes(MemoryBudget::limit())), 5000);
+    }
+    updateMemory();
+}
+
+// Fills the memory panel with usage by component, under a total row.
+void MainWindow::updateMemory()
+{
+    if(!memoryDock->isVisible())
+        return;
+
+    QList<MemoryBudget::Usage> usage = MemoryBudget::breakdown();
+    qint64 totalEvictable = 0;
+    for(const MemoryBudget::Usage& component: usage)
+        totalEvictable += component.evictable;
+
+    memoryTable->setRowCount(0);
+    auto addRow = [&](const QString& name, qint64 bytes, qint64 evictable, const QString& clients) {
+        QStringList cells = QStringList() << name << MemoryBudget::formatBytes(bytes)
+                                          << MemoryBudget::formatBytes(evictable) << clients;
+        int row = memoryTable->rowCount();
+        memoryTable->insertRow(row);
+        for(int col = 0; col < cells.size(); col++)
+            memoryTable->setItem(row, col, new QTableWidgetItem(cells[col]));
+    };
+
+    addRow(QString("Total of %1").arg(MemoryBudget::formatBytes(MemoryBudget::limit())),
+           MemoryBudget::used(), totalEvictable, QString());
+    if(MemoryBudget::isOver())
+        memoryTable->item(0, 1)->setForeground(Qt::red);
+    for(const MemoryBudget::Usage& component: usage)
+    {
+        if(component.bytes > 0)
+            addRow(component.component, component.bytes, component.evictable, QString::number(component.clients));
+    }
+    memoryTable->resizeColumnsToContents();
+}
+
+// Finds the largest gaps and densest bursts of every loaded lane and lists
+// the worst of them across all lanes as a jump list.
+void MainWindow::findHotspots(QProgressDialog* progDlg)
+{
+    QList<Trace*> lanes;
+    for(const TraceLane& traceLane: _traceLanes)
+        lanes.append(traceLane.data);
+
+    progDlg->setLabelText("Finding gaps and bursts...");
+    QList<LaneHotspots> found = LaneHotspots::find(lanes, progDlg);
+
+    QList<QPair<Trace*,Hotspot> > gaps, bursts;
+    for(const LaneHotspots& lane: found)
+    {
+        for(const Hotspot& gap: lane.gaps)
+            gaps.append(qMakePair(lane.lane, gap));
+        for(const Hotspot& burst: lane.bursts)
+            bursts.append(qMakePair(lane.lane, burst));
+    }
+
+    auto length = [](const QPair<Trace*,Hotspot>& h) { return h.second.end - h.second.begin; };
+    std::stable_sort(gaps.begin(), gaps.end(), [&](const QPair<Trace*,Hotspot>& a, const QPair<Trace*,Hotspot>& b) {
+        return length(a) > length(b);
+    });
+    std::stable_sort(bursts.begin(), bursts.end(), [&](const QPair<Trace*,Hotspot>& a, const QPair<Trace*,Hotspot>& b) {
+        return length(a) < length(b);
+    });
+
+    QMap<Trace*,TraceLane> laneInfo;
+    for(const TraceLane& traceLane: _traceLanes)
+        laneInfo[traceLane.data] = traceLane;
+
+    hotspotsTree->clear();
+    _hotspots.clear();
+
+    QTreeWidgetItem* gapsItem = new QTreeWidgetItem(hotspotsTree, QStringList() << "Largest gaps");
+    QTreeWidgetItem* burstsItem = new QTreeWidgetItem(hotspotsTree, QStringList() << QString("Densest bursts of %1 events").arg(HOTSPOT_BURST_EVENTS));
+    for(int pass = 0; pass < 2; pass++)
+    {
+        const QList<QPair<Trace*,Hotspot> >& list = pass ? bursts : gaps;
+        for(int n = 0; n < list.size() && n < MAX_HOTSPOTS_LISTED; n++)
+        {
+            QStringList cells;
+            cells << laneInfo.value(list[n].first).name << timeToString(length(list[n]), false)
+                  << timeToString(list[n].second.begin, true, list[n].first->getBaseTicks());
+            QTreeWidgetItem* item = new QTreeWidgetItem(pass ? burstsItem : gapsItem, cells);
+            item->setData(0, Qt::UserRole, _hotspots.size());
+            _hotspots.append(list[n]);
+        }
+    }
+    gapsItem->setExpanded(true);
+    burstsItem->setExpanded(true);
+    hotspotsTree->resizeColumnToContents(0);
+}
+
+// Zooms to a gap or burst, with some context either side, and selects it.
+void MainWindow::onHotspotActivated(QTreeWidgetItem* item)
+{
+    QVariant idx = item->data(0, Qt::UserRole);
+    if(!idx.isValid())
+        return;
+
+    const QPair<Trace*,Hotspot>& hotspot = _hotspots[idx.toInt()];
+    int laneIdx = view->laneForData(hotspot.first);
+    double length = hotspot.second.end - hotspot.second.begin;
+    double margin = qMax(length, 1e-9);
+
+    view->setViewTimeRange(hotspot.second.begin - margin, hotspot.second.end + margin);
+    if(laneIdx != -1)
+        view->setSelection(laneIdx, laneIdx, hotspot.second.begin, hotspot.second.end);
+}
+
+// Returns the time of the first event matching the anchor query, or of the
+// first event if there is no query.
+static bool findAnchorTime(TraceQuery* query, TraceFile* trace, const QList<TraceLane>& lanes,
+                           const AttributeStore* attrs, QProgressDialog* progDlg, double* t)
+{
+    if(trace->numEvents() == 0)
+        return false;
+
+    if(!query)
+    {
+        *t = trace->getEventTime(0);
+        return true;
+    }
+
+    QList<int> found;
+    query->evaluate(trace, lanes, attrs, NULL, &found, progDlg);
+    if(found.isEmpty())
+        return false;
+    *t = trace->getEventTime(found.first());
+    return true;
+}
+
+void MainWindow::on_actionCompare_with_baseline_triggered()
+{
+    if(gTraceFile.numEvents() == 0)
+    {
+        QMessageBox::warning(this, "Compare", "No trace loaded");
+        return;
+    }
+
+    QStringList fileNames = QFileDialog::getOpenFileNames(this, "Open Baseline",
+                                                          QString(),
+                                                          TRACE_FILE_FILTER);
+    if(fileNames.isEmpty())
+        return;
+
+    bool ok;
+    QString anchor = QInputDialog::getText(this, "Compare",
+                                           "Align both traces at the first event matching, e.g.\n"
+                                           "lane == main && text ~ /frame start/\n"
+                                           "Leave empty to align the first events.",
+                                           QLineEdit::Normal, QString(), &ok);
+    if(!ok)
+        return;
+
+    QString error;
+    TraceQuery query;
+    bool haveAnchor = !anchor.trimmed().isEmpty();
+    if(haveAnchor && !query.parse(anchor, &error))
+    {
+        QMessageBox::warning(this, "Compare", error);
+        return;
+    }
+
+    QProgressDialog progDlg(this);
+    progDlg.setLabelText("Loading baseline...");
+    progDlg.setAutoClose(false);
+    progDlg.setAutoReset(false);
+    progDlg.setWindowModality(Qt::WindowModal);
+    progDlg.show();
+
+    stopComparing();
+
+    _baseline = new TraceFile();
+    if(!_baseline->openText(fileNames, QList<double>(), &progDlg))
+    {
+        stopComparing();
+        progDlg.hide();
+        QMessageBox::warning(this, "Compare", "Failed to open " + fileNames.join(", "));
+        return;
+    }
+    _baselineLanes = _baseline->splitLanes(&progDlg);
+
+    progDlg.setLabelText("Finding anchor events...");
+    AttributeStore baselineAttrs;
+    if(haveAnchor && !query.attributeKeys().isEmpty())
+    {
+        QStringList keys = _attrs.keys();
+        for(const QString& key: query.attributeKeys())
+        {
+            if(!keys.contains(key))
+                keys.append(key);
+        }
+        refreshAttributes(keys, &progDlg);
+        baselineAttrs.extract(_baseline, query.attributeKeys(), &progDlg);
+    }
+
+    double candidateAnchor, baselineAnchor;
+    if(!findAnchorTime(haveAnchor ? &query : NULL, &gTraceFile, _traceLanes, &_attrs, &progDlg, &candidateAnchor) ||
+       !findAnchorTime(haveAnchor ? &query : NULL, _baseline, _baselineLanes, &baselineAttrs, &progDlg, &baselineAnchor))
+    {
+        stopComparing();
+        progDlg.hide();
+        QMessageBox::warning(this, "Compare", "No anchor event found in both traces");
+        return;
+    }
+
+    progDlg.setLabelText("Comparing lanes...");
+    _diff.compare(_traceLanes, _baselineLanes, candidateAnchor - baselineAnchor, &progDlg);
+
+    // draw the matched lanes as differences and add the lanes that only the
+    // baseline has after the others
+    QList<Lane> lanes;
+    for(int n = 0; n < view->numLanes(); n++)
+        lanes.append(*view->getLane(n));
+    for(const LaneDiff& diff: _diff.lanes())
+    {
+        if(!diff.candidate)
+        {
+            int idx = lanes.size();
+            Lane lane(NULL, diff.name + " (baseline only)", QColor::fromHsv((idx*35)%255,255,255), diff.candidatePyramid);
+            lane.baseline = diff.baselinePyramid;
+            lanes.append(lane);
+            continue;
+        }
+        for(Lane& lane: lanes)
+        {
+            if(lane.data == diff.candidate)
+            {
+                _pyramidsBeforeDiff[lane.data] = lane.pyramid;
+                lane.pyramid = diff.candidatePyramid;
+                lane.baseline = diff.baselinePyramid;
+            }
+        }
+    }
+    view->setLanes(lanes);
+
+    diffTable->setRowCount(0);
+    for(const LaneDiff& diff: _diff.lanes())
+    {
+        double rateDelta = (diff.baselineRate > 0) ? (diff.candidateRate / diff.baselineRate - 1) * 100 : 0;
+        QStringList cells;
+        cells << diff.name << QString::number(diff.baselineCount) << QString::number(diff.candidateCount)
+              << QString("%1%2").arg(diff.candidateCount >= diff.baselineCount ? "+" : "").arg(diff.candidateCount - diff.baselineCount)
+              << QString("%1/s").arg(diff.baselineRate, 0, 'g', 4)
+              << QString("%1/s").arg(diff.candidateRate, 0, 'g', 4)
+              << ((diff.baselineRate > 0) ? QString("%1%2%").arg(rateDelta >= 0 ? "+" : "").arg(rateDelta, 0, 'f', 1) : QString());
+
+        int row = diffTable->rowCount();
+        diffTable->insertRow(row);
+        for(int col = 0; col < cells.size(); col++)
+            diffTable->setItem(row, col, new QTableWidgetItem(cells[col]));
+    }
+    diffTable->resizeColumnsToContents();
+    diffDock->show();
+    ui->actionStop_comparing->setEnabled(true);
+
+    statusBar()->showMessage(QString("Comparing with %1, baseline shifted by %2")
+                             .arg(fileNames.join(", "))
+                             .arg(timeToString(_diff.offset() + ticksToSeconds(gTraceFile.getBaseTicks() - _baseline->getBaseTicks()), false)));
+    progDlg.hide();
+}
+
+void MainWindow::on_actionStop_comparing_triggered()
+{
+    stopComparing();
+    statusBar()->clearMessage();
+}
+
+// Returns the lanes to normal drawing and releases the baseline trace.
+void MainWindow::stopComparing()
+{
+    if(!_baseline)
+        return;
+
+    QList<Lane> lanes;
+    for(int n = 0; n < view->numLanes(); n++)
+    {
+        Lane lane = *view->getLane(n);
+        if(lane.baseline)
+        {
+            if(!lane.data)
+                continue;
+            lane.pyramid = _pyramidsBeforeDiff.value(lane.data);
+            lane.baseline = NULL;
+        }
+        lanes.append(lane);
+    }
+    view->setLanes(lanes);
+
+    _pyramidsBeforeDiff.clear();
+    _diff.clear();
+    for(const TraceLane& lane: _baselineLanes)
+        delete lane.data;
+    _baselineLanes.clear();
+    delete _baseline;
+    _baseline = NULL;
+
+    diffTable->setRowCount(0);
+    diffDock->hide();
+    ui->actionStop_comparing->setEnabled(false);
+}
+
+// Groups the lanes by a regex capture of their names, or by the value an
+// attribute has in each lane's first event that has it.
+void MainWindow::on_actionGroup_lanes_triggered()
+{
+    if(_ingest)
+    {
+        QMessageBox::warning(this, "Group lanes", "Lanes can't be grouped while listening");
+        return;
+    }
+
+    QStringList modes;
+    modes << "By name" << "By attribute";
+    bool ok;
+    QString mode = QInputDialog::getItem(this, "Group lanes", "Group lanes:", modes, 0, false, &ok);
+    if(!ok)
+        return;
+
+    QList<Lane> lanes;
+    for(int n = 0; n < view->numLanes(); n++)
+        lanes.append(*view->getLane(n));
+    lanes = LaneGroups::remove(lanes);
+
+    QStringList groupForLane;
+    if(mode == modes[0])
+    {
+        QString pattern = QInputDialog::getText(this, "Group lanes",
+                                                "Group lanes by the first capture of, e.g.\n"
+                                                "^(\\w+)[-_./:]",
+                                                QLineEdit::Normal, "^(\\w+)[-_./:]", &ok);
+        if(!ok)
+            return;
+        QRegExp regEx(pattern);
+        if(!regEx.isValid())
+        {
+            QMessageBox::warning(this, "Group lanes", "Invalid regex " + pattern);
+            return;
+        }
+        for(const Lane& lane: lanes)
+        {
+            QString group;
+            if(regEx.indexIn(lane.name) != -1)
+                group = regEx.captureCount() > 0 ? regEx.cap(1) : regEx.cap(0);
+            groupForLane.append(group);
+        }
+    }
+    else
+    {
+        if(!ensureAttributes())
+            return;
+
+        QString key = QInputDialog::getItem(this, "Group lanes", "Group lanes by the value of:", _attrs.keys(), 0, false, &ok);
+        if(!ok)
+            return;
+        AttributeColumn* col = _attrs.column(key);
+        for(const Lane& lane: lanes)
+        {
+            QString group;
+            SubTrace* subTrace = dynamic_cast<SubTrace*>(lane.data);
+            if(subTrace && subTrace->getParent() == &gTraceFile)
+            {
+                for(int n = 0; n < subTrace->numEvents(); n++)
+                {
+                    int idx = subTrace->getParentIndex(n);
+                    if(col->hasValue(idx))
+                    {
+                        group = key + "=" + col->valueString(idx);
+                        break;
+                    }
+                }
+            }
+            groupForLane.append(group);
+        }
+    }
+
+    QProgressDialog progDlg(this);
+    progDlg.setLabelText("Grouping lanes...");
+    progDlg.setAutoClose(false);
+    progDlg.setAutoReset(false);
+    progDlg.setWindowModality(Qt::WindowModal);
+    progDlg.show();
+
+    QList<TracePyramid*> oldPyramids = _groupPyramids;
+    _groupPyramids.clear();
+    view->setLanes(LaneGroups::build(lanes, groupForLane, &_groupPyramids, &progDlg));
+    qDeleteAll(oldPyramids);
+
+    progDlg.hide();
+}
+
+void MainWindow::on_actionUngroup_lanes_triggered()
+{
+    QList<Lane> lanes;
+    for(int n = 0; n < view->numLanes(); n++)
+        lanes.append(*view->getLane(n));
+    view->setLanes(LaneGroups::remove(lanes));
+    qDeleteAll(_groupPyramids);
+    _groupPyramids.clear();
+}
+
+void MainWindow::on_actionColor_by_triggered()
+{
+    if(gTraceFile.numEvents() == 0)
+    {
+        QMessageBox::warning(this, "Color by", "No trace loaded");
+        return;
+    }
+
+    QStringList modes;
+    modes << "Regex capture" << "Attribute" << "Template";
+    bool ok;
+    QString mode = QInputDialog::getItem(this, "Color by", "Color events by:", modes, 0, false, &ok);
+    if(!ok)
+        return;
+
+    TraceCategories::Source source;
+    QString arg;
+    if(mode == modes[0])
+    {
+        source = TraceCategories::Regex;
+        arg = QInputDialog::getText(this, "Color by",
+                                    "Color events by the first capture of, e.g.\n"
+                                    "\\b(GET|PUT|POST|DELETE)\\b",
+                                    QLineEdit::Normal, "\\b(GET|PUT|POST|DELETE)\\b", &ok);
+        if(!ok)
+            return;
+        if(!QRegExp(arg).isValid())
+        {
+            QMessageBox::warning(this, "Color by", "Invalid regex " + arg);
+            return;
+        }
+    }
+    else if(mode == modes[1])
+    {
+        source = TraceCategories::Attribute;
+        if(!ensureAttributes())
+            return;
+        arg = QInputDialog::getItem(this, "Color by", "Color events by the value of:", _attrs.keys(), 0, false, &ok);
+        if(!ok)
+            return;
+    }
+    else
+        source = TraceCategories::Template;
+
+    // the old categories are freed by the build, so stop drawing them first
+    on_actionPlain_colors_triggered();
+
+    QProgressDialog progDlg(this);
+    progDlg.setLabelText("Categorizing events...");
+    progDlg.setAutoClose(false);
+    progDlg.setAutoReset(false);
+    progDlg.setWindowModality(Qt::WindowModal);
+    progDlg.show();
+
+    bool built = _categories.build(&gTraceFile, _traceLanes, source, arg, &_attrs, &progDlg);
+
+    progDlg.hide();
+
+    for(int n = 0; n < view->numLanes(); n++)
+    {
+        Lane* lane = view->getLane(n);
+        lane->categories = _categories.forLane(lane->data);
+    }
+    view->setCategoryLegend(_categories.names(), _categories.other());
+
+    if(built)
+        statusBar()->showMessage(QString("%1 categories: %2").arg(_categories.names().size()).arg(_categories.names().join(", ")));
+    else
+        statusBar()->showMessage("No events categorized");
+}
+
+void MainWindow::on_actionPlain_colors_triggered()
+{
+    for(int n = 0; n < view->numLanes(); n++)
+        view->getLane(n)->categories = NULL;
+    view->setCategoryLegend(QStringList(), -1);
+    _categories.clear();
+}
+
+void MainWindow::on_actionSort_lanes_triggered()
+{
+    QStringList modes = LaneRanking::modeNames();
+    bool ok;
+    QString mode = QInputDialog::getItem(this, "Sort lanes", "Sort lanes by:", modes, (int)_rankMode, false, &ok);
+    if(!ok)
+        return;
+
+    _rankMode = (LaneRanking::Mode)modes.indexOf(mode);
+    if(view->hasSelection() && view->selectedLaneRange().begin != -1)
+        view->clearSelection();
+    rankLanes();
+}
+
+void MainWindow::on_actionRerank_live_toggled(bool checked)
+{
+    if(checked)
+        rankLanes();
+    else
+        _rankTimer->stop();
+}
+
+// Live re-ranks are spaced by the cost of the last one over
+// RANK_BUDGET_FRACTION, so however many lanes there are, ranking takes no
+// more than that share of the time while the view moves.
+void MainWindow::onViewTimeChanged()
+{
+    if(!ui->actionRerank_live->isChecked() || _rankTimer->isActive())
+        return;
+    _rankTimer->start(qMax(RANK_MIN_INTERVAL_MS, (int)(_rankCostMs / RANK_BUDGET_FRACTION)));
+}
+
+void MainWindow::onRankTimer()
+{
+    // lane selections are by position, so hold the order while one is made
+    if(view->hasSelection() && view->selectedLaneRange().begin != -1)
+        return;
+    rankLanes();
+}
+
+void MainWindow::rankLanes()
+{
+    QElapsedTimer timer;
+    timer.start();
+
+    QList<Lane> lanes;
+    for(int n = 0; n < view->numLanes(); n++)
+        lanes.append(*view->getLane(n));
+    Range<double> viewTime = view->viewTimeRange();
+    view->reorderLanes(LaneRanking::order(lanes, _rankMode, viewTime.begin, viewTime.end));
+
+    _rankCostMs = timer.nsecsElapsed() / 1e6;
+}
+
+void MainWindow::on_actionStatistics_toggled(bool checked)
+{
+    statsDock->setVisible(checked);
+    if(checked)
+        updateStats();
+}
+
+// Fills the statistics panel for the selected lanes and time range. Lanes of
+// the loaded trace are indexed the first time they're selected; each lane is
+// then reduced in parallel and the results merged into the total row.
+void MainWindow::updateStats()
+{
+    if(!statsDock->isVisible())
+        return;
+
+    statsTable->setRowCount(0);
+    if(!view->hasSelection())
+        return;
+
+    Range<int> laneRange = view->selectedLaneRange();
+    Range<double> timeRange = view->selectedTimeRange();
+    if(laneRange.begin == -1 || laneRange.end == -1)
+    {
+        laneRange.begin = 0;
+        laneRange.end = view->numLanes() - 1;
+    }
+    if(timeRange.delta() <= 0)
+        return;
+
+    QList<Lane*> lanes;
+    QList<LaneStats*> toBuild;
+    for(int laneIdx = laneRange.begin; laneIdx <= laneRange.end; ++laneIdx)
+    {
+        Lane* lane = view->getLane(laneIdx);
+        if(!lane || !lane->data)
+            continue;
+        lanes.append(lane);
+
+        SubTrace* subTrace = dynamic_cast<SubTrace*>(lane->data);
+        if(subTrace && subTrace->getParent() == &gTraceFile && !_laneStats.contains(lane->data) && gTraceFile.numEvents() > 0)
+        {
+            double begin = gTraceFile.getEventTime(0);
+            double end = nextafter(gTraceFile.getEventTime(gTraceFile.numEvents()-1), INFINITY);
+            LaneStats* stats = new LaneStats(subTrace, begin, end);
+            _laneStats[lane->data] = stats;
+            toBuild.append(stats);
+        }
+        else if(_laneStats.contains(lane->data) && !_laneStats[lane->data]->isBuilt())
+        {
+            toBuild.append(_laneStats[lane->data]);
+        }
+    }
+
+    // lanes seen for the first time are indexed in the background, and the
+    // statistics filled in when that is done; one build runs at a time
+    if(_statsWatcher.isRunning() || !toBuild.isEmpty())
+    {
+        if(!_statsWatcher.isRunning())
+        {
+            _statsWatcher.setFuture(QtConcurrent::run([toBuild]() {
+                LaneStats::buildAll(toBuild, &gTraceFile);
+            }));
+        }
+        statsTable->insertRow(0);
+        statsTable->setItem(0, 0, new QTableWidgetItem("Indexing lanes for statistics..."));
+        return;
+    }
+
+    QVector<SelectionStats> results(lanes.size());
+    SelectionStats* resultData = results.data();
+    QList<int> laneIndices;
+    for(int n = 0; n < lanes.size(); n++)
+        laneIndices.append(n);
+    QtConcurrent::blockingMap(laneIndices, [&](int n) {
+        LaneStats* stats = _laneStats.value(lanes[n]->data);
+        if(stats)
+            stats->collect(timeRange.begin, timeRange.end, &resultData[n]);
+        else
+            LaneStats::collectExact(lanes[n]->data, timeRange.begin, timeRange.end, &resultData[n]);
+    });
+
+    SelectionStats total;
+    for(const SelectionStats& result: results)
+        total.merge(result);
+
+    auto addRow = [&](const QString& name, const QColor& color, const SelectionStats& stats) {
+        auto quantile = [](const QuantileSketch& sketch, double q) {
+            return sketch.isEmpty() ? QString() : timeToString(sketch.quantile(q), false);
+        };
+        QStringList cells;
+        cells << name << QString::number(stats.numEvents)
+              << QString("%1/s").arg(stats.numEvents / timeRange.delta(), 0, 'g', 4)
+              << quantile(stats.gaps, 0.5) << quantile(stats.gaps, 0.9) << quantile(stats.gaps, 0.99) << quantile(stats.gaps, 1)
+              << QString::number(stats.durations.count())
+              << quantile(stats.durations, 0.5) << quantile(stats.durations, 0.9) << quantile(stats.durations, 0.99) << quantile(stats.durations, 1);
+
+        int row = statsTable->rowCount();
+        statsTable->insertRow(row);
+        for(int col = 0; col < cells.size(); col++)
+            statsTable->setItem(row, col, new QTableWidgetItem(cells[col]));
+        if(color.isValid())
+            statsTable->item(row, 0)->setForeground(color);
+    };
+
+    if(lanes.size() > 1)
+        addRow("All selected", QColor(), total);
+    for(int n = 0; n < lanes.size(); n++)
+        addRow(lanes[n]->name, lanes[n]->color, results[n]);
+    statsTable->resizeColumnsToContents();
+}
+
+
+
+void MainWindow::on_actionListen_triggered()
+{
+    bool ok;
+    QString address = QInputDialog::getText(this, "Listen",
+                                            "Local socket name or localhost TCP port:",
+                                            QLineEdit::Normal, _streamAddress, &ok);
+    if(!ok || address.isEmpty())
+        return;
+
+    double retention = QInputDialog::getDouble(this, "Listen", "Retention window (seconds):",
+                                               _streamRetention, 0.001, 1e9, 3, &ok);
+    if(!ok)
+        return;
+
+    int capacity = QInputDialog::getInt(this, "Listen", "Most events kept per lane:",
+                                        _streamCapacity, 1, INT_MAX, 1, &ok);
+    if(!ok)
+        return;
+
+    stopListening();
+    stopFlowIndex();
+    view->clearSelection();
+    stopComparing();
+    view->setLanes(QList<Lane>());
+    releaseStreamLanes();
+
+    // nothing derived from the closed trace is kept
+    releaseTraceLanes();
+    qDeleteAll(_queryLanes);
+    _queryLanes.clear();
+    qDeleteAll(_groupPyramids);
+    _groupPyramids.clear();
+    _categories.clear();
+    view->setCategoryLegend(QStringList(), -1);
+    _attrs.clear();
+    gTraceFile.close();
+    delete _preview;
+    _preview = NULL;
+
+    _streamAddress = address;
+    _streamRetention = retention;
+    _streamCapacity = capacity;
+    _streamHaveData = false;
+
+    _ingest = new TraceIngest(address, this);
+    connect(_ingest, SIGNAL(error(QString)), this, SLOT(onIngestError(QString)));
+    _ingest->start();
+    _streamTimer->start(STREAM_FRAME_MS);
+
+    statusBar()->showMessage("Listening on " + address);
+}
+
+void MainWindow::on_actionStop_listening_triggered()
+{
+    stopListening();
+}
+
+void MainWindow::onIngestError(const QString& msg)
+{
+    stopListening();
+    QMessageBox::warning(this, "Listen", msg);
+}
+
+void MainWindow::stopListening()
+{
+    _streamTimer->stop();
+    if(_ingest)
+    {
+        _ingest->stop();
+        delete _ingest;
+        _ingest = NULL;
+        statusBar()->showMessage("Stopped listening on " + _streamAddress);
+    }
+}
+
+void MainWindow::releaseStreamLanes()
+{
+    qDeleteAll(_streamLanes);
+    _streamLanes.clear();
+}
+
+// Frees the lanes split from the loaded trace and by attribute, with what
+// is kept per lane, once they have left the view.
+void MainWindow::releaseTraceLanes()
+{
+    _lister->cancel();
+    _statsWatcher.waitForFinished();
+    qDeleteAll(_laneStats);
+    _laneStats.clear();
+    hotspotsTree->clear();
+    _hotspots.clear();
+    for(const TraceLane& lane: _traceLanes)
+        delete lane.data;
+    _traceLanes.clear();
+    qDeleteAll(_attrLanes);
+    _attrLanes.clear();
+}
+
+// Drains the ingest queue once per frame, so the view refreshes at a capped
+// rate however fast events arrive.
+void MainWindow::onStreamTimer()
+{
+    TraceIngest::Event ev;
+    char laneBuf[256];
+    char nameBuf[256];
+    int numEvents = 0;
+    TraceTicks latestTime = LLONG_MIN;
+
+    while(numEvents < STREAM_MAX_EVENTS_PER_FRAME && _ingest->popEvent(&ev))
+    {
+        int ofs = 0;
+        if(sscanf(ev.line.constData(), "%*s %255s%n", laneBuf, &ofs) < 1)
+            continue;
+
+        QString laneID(laneBuf);
+        StreamTrace* data = _streamLanes.value(laneID);
+        if(!data)
+        {
+            if(_streamLanes.isEmpty())
+                _streamBaseTicks = ev.timestamp;
+            data = new StreamTrace(_streamCapacity, _streamRetention, _streamBaseTicks);
+            data->setIndex(_streamLanes.size());
+            _streamLanes[laneID] = data;
+            QColor color = QColor::fromHsv((data->getIndex()*35)%255,255,255);
+            view->addLane(Lane(data, laneID, color));
+        }
+
+        if(sscanf(ev.line.constData()+ofs, " THREAD_NAME=%255s", nameBuf) == 1)
+        {
+            for(int n = 0; n < view->numLanes(); n++)
+            {
+                if(view->getLane(n)->data == data)
+                    view->getLane(n)->name = QString(nameBuf);
+            }
+        }
+
+        data->append(ev.timestamp, ev.line);
+        if(ev.timestamp > latestTime)
+            latestTime = ev.timestamp;
+        ++numEvents;
+    }
+
+    if(numEvents == 0)
+        return;
+
+    for(auto data: _streamLanes)
+        data->expire(latestTime);
+
+    if(!_streamHaveData)
+    {
+        view->zoomAll();
+        _streamHaveData = true;
+    }
+    view->followTime(ticksToSeconds(latestTime - _streamBaseTicks));
+    view->update();
+    if(!_overviewAge.isValid() || _overviewAge.elapsed() >= STREAM_OVERVIEW_REFRESH_MS)
+    {
+        overview->invalidate();
+        _overviewAge.start();
+    }
+
+    statusBar()->showMessage(QString("Listening on %1: %2 events this frame, %3 dropped")
+                             .arg(_streamAddress).arg(numEvents).arg(_ingest->numDropped()));
+}
 
 void MainWindow::on_actionControls_triggered()
 {
@@ -301,7 +2057,10 @@ void MainWindow::on_actionControls_triggered()
             "  Left mouse + drag: Select events\n"
             "  Right mouse + drag left/right: Scroll\n"
             "  Mouse wheel: Zoom\n"
-            "  Right mouse + shift + drag up/down: Fine zoom";
+            "  Right mouse + shift + drag up/down: Fine zoom\n"
+            "  Click left edge of a lane: Collapse lane or group\n"
+            "  F: Select the whole flow of the hovered event\n"
+            "  Left/right arrow: Step to the previous/next event in the selected lanes";
     QMessageBox::about(this, "Help: Controls", txt);
 }
 
@@ -318,7 +2077,16 @@ void MainWindow::on_actionFile_format_triggered()
             "  time in seconds, LANE is a symbolic name (string with no spaces)\n"
             "  identifying which lane the event should be displayed in, and DETAIL\n"
             "  is the remainder of the line (which can contain spaces) representing\n"
-            "  text that will be displayed when an event is selected or highlighted.";
+            "  text that will be displayed when an event is selected or highlighted.\n"
+            "\n"
+            "  A DETAIL starting with the word BEGIN or END marks the start or end\n"
+            "  of a span; the statistics panel pairs them up innermost first.\n"
+            "  Events whose DETAIL has the same req=<id> word are linked as a flow.\n"
+            "\n"
+            "  Chrome trace-event JSON (.json) is read as well: each pid/tid is a\n"
+            "  lane, B/E and X events are spans and other events are ticks.\n"
+            "\n"
+            "  Files may be gzip (.gz) or zstd (.zst) compressed.";
     QMessageBox::about(this, "Help: File format", txt);
 }
 
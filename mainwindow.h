@@ -2,8 +2,32 @@
 #define MAINWINDOW_H
 
 #include <QMainWindow>
+#include <QDockWidget>
 #include <QListView>
+#include <QMap>
+#include <QPair>
+#include <QProgressDialog>
+#include <QElapsedTimer>
+#include <QFutureWatcher>
+#include <QTableWidget>
+#include <QTreeWidget>
+#include <QTimer>
+#include <tuple>
 #include "traceview.h"
+#include "traceoverview.h"
+#include "traceattrs.h"
+#include "tracequery.h"
+#include "tracehotspots.h"
+#include "tracediff.h"
+#include "tracecategories.h"
+#include "tracerank.h"
+#include "traceworkspace.h"
+
+class TraceIngest;
+class TracePreview;
+class LaneStats;
+class FlowIndex;
+class SelectionLister;
 
 namespace Ui
 {
@@ -23,25 +47,126 @@ protected:
 
 private slots:
     void on_actionLoad_triggered(void);
+    void on_actionLoad_multiple_triggered(void);
+    void on_actionLoad_directory_triggered(void);
+    void on_actionOpen_range_triggered();
+    void on_actionLoad_visible_range_triggered();
     void on_actionZoom_in_triggered(void);
     void on_actionZoom_out_triggered(void);
     void on_actionZoom_to_selection_triggered(void);
     void on_actionZoom_all_triggered(void);
 
     void onSelectionChanged(bool hasSelection);
+    void onSelectionListed();
+    void updateStats();
+    void onLanesChanged();
+    void on_actionStatistics_toggled(bool checked);
+    void on_actionSelect_whole_flow_triggered();
+    void on_actionGroup_lanes_triggered();
+    void on_actionUngroup_lanes_triggered();
+    void on_actionColor_by_triggered();
+    void on_actionPlain_colors_triggered();
+    void on_actionSort_lanes_triggered();
+    void on_actionRerank_live_toggled(bool checked);
+    void onViewTimeChanged();
+    void onRankTimer();
+    void on_actionHotspots_toggled(bool checked);
+    void on_actionMemory_usage_toggled(bool checked);
+    void on_actionMemory_budget_triggered();
+    void onMemoryTimer();
+    void onHotspotActivated(QTreeWidgetItem* item);
+    void onFlowIndexFinished();
+
+    void on_actionListen_triggered();
+    void on_actionStop_listening_triggered();
+    void on_actionCompare_with_baseline_triggered();
+    void on_actionStop_comparing_triggered();
+    void onStreamTimer();
+    void onIngestError(const QString& msg);
+    void onPreviewTimer();
+
+    void on_actionExtract_attributes_triggered();
+    void on_actionLanes_by_attribute_triggered();
+    void on_actionNew_query_lane_triggered();
 
 
     void on_actionReload_triggered();
+    void on_actionOpen_workspace_triggered();
+    void on_actionSave_workspace_triggered();
+    void on_actionExport_image_triggered();
 
     void on_actionControls_triggered();
 
     void on_actionFile_format_triggered();
 
 private:
+    bool askClockOffsets(const QStringList& fileNames, WorkspaceFiles* files);
+    void loadTrace(const WorkspaceFiles& files, bool keepLanes);
+    QList<Lane> buildLanes(QProgressDialog* progDlg, TracePreview* preview);
+    void addPreviewLanes();
+    void stopListening();
+    void releaseStreamLanes();
+    void releaseTraceLanes();
+    bool refreshAttributes(const QStringList& keys, QProgressDialog* progDlg);
+    bool ensureAttributes();
+    void addQueryLanes(QProgressDialog* progDlg);
+    void showEventList(const QList<std::tuple<double,QString,QColor> >& items, int totalEventCount);
+    void updateMemory();
+    void startFlowIndex();
+    void findHotspots(QProgressDialog* progDlg);
+    void stopFlowIndex();
+    void stopComparing();
+    void rankLanes();
+    WorkspaceFiles loadedFiles() const;
+    QByteArray saveWorkspace();
+    bool restoreWorkspace(const Workspace& workspace, QProgressDialog* progDlg);
+
     Ui::MainWindow *ui;
     TraceView *view;
+    TraceOverview* overview;
     QListView* eventList;
-    QString _fileName;
+    QDockWidget* statsDock;
+    QTableWidget* statsTable;
+    QDockWidget* hotspotsDock;
+    QTreeWidget* hotspotsTree;
+    QDockWidget* memoryDock;
+    QTableWidget* memoryTable;
+    QTimer* _memoryTimer;
+    QStringList _fileNames;
+    QList<double> _clockOffsets;
+    bool _cropped;
+    QPair<double,double> _cropRange;
+    TracePreview* _preview;
+    AttributeStore _attrs;
+    QList<TraceLane> _traceLanes;
+    QList<QueryTrace*> _queryLanes;
+    QList<FilteredTrace*> _attrLanes;      // split by attribute values
+    QMap<Trace*,LaneStats*> _laneStats;
+    QFutureWatcher<void> _statsWatcher;     // builds the stats of new lanes
+    FlowIndex* _flowIndex;
+    SelectionLister* _lister;
+    QList<QPair<Trace*,Hotspot> > _hotspots;
+    QList<TracePyramid*> _groupPyramids;
+    TraceCategories _categories;
+    LaneRanking::Mode _rankMode;
+    QTimer* _rankTimer;
+    double _rankCostMs;     // of the last ranking, to space the next
+    QDockWidget* diffDock;
+    QTableWidget* diffTable;
+    TraceFile* _baseline;
+    QList<TraceLane> _baselineLanes;
+    TraceDiff _diff;
+    QMap<Trace*,TracePyramid*> _pyramidsBeforeDiff;  // put back when comparing stops
+
+    TraceIngest* _ingest;
+    QTimer* _streamTimer;
+    QMap<QString,StreamTrace*> _streamLanes;
+    QString _streamAddress;
+    double _streamRetention;
+    int _streamCapacity;    // events per lane
+    bool _streamHaveData;
+    TraceTicks _streamBaseTicks;    // the first event's, shared by all stream lanes
+    QElapsedTimer _overviewAge;
 };
 
 #endif // MAINWINDOW_H
@@ -0,0 +1,48 @@
+#ifndef SPSCQUEUE_H
+#define SPSCQUEUE_H
+
+#include <atomic>
+#include <vector>
+
+// Bounded lock-free queue for exactly one producer thread and one
+// consumer thread. push() fails rather than blocks when the queue is full.
+template<typename T> class SpscQueue
+{
+public:
+    SpscQueue(size_t capacity) : _head(0), _tail(0)
+    {
+        size_t size = 1;
+        while(size < capacity)
+            size <<= 1;
+        _items.resize(size);
+        _mask = size - 1;
+    }
+
+    bool push(T&& item)
+    {
+        size_t tail = _tail.load(std::memory_order_relaxed);
+        if(tail - _head.load(std::memory_order_acquire) > _mask)
+            return false;
+        _items[tail & _mask] = std::move(item);
+        _tail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool pop(T* item)
+    {
+        size_t head = _head.load(std::memory_order_relaxed);
+        if(head == _tail.load(std::memory_order_acquire))
+            return false;
+        *item = std::move(_items[head & _mask]);
+        _head.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+protected:
+    std::vector<T> _items;
+    size_t _mask;
+    alignas(64) std::atomic<size_t> _head;
+    alignas(64) std::atomic<size_t> _tail;
+};
+
+#endif // SPSCQUEUE_H
@@ -0,0 +1,434 @@
+#include "traceattrs.h"
+#include "tracedata.h"
+#include <math.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <algorithm>
+#include <QHash>
+#include <QMap>
+#include <QThread>
+#include <QElapsedTimer>
+#include <QtConcurrent>
+
+#define ATTR_BLOCK_SZ       (256*1024)
+#define ATTR_TYPE_SAMPLES   4096
+#define PROGRESS_POLL_MS    20
+
+// Calls fn(key, keyLen, value, valueLen) for each key=value word of txt.
+template<typename F> static void forEachKeyValue(const char* txt, F fn)
+{
+    const char* ptr = txt;
+    while(*ptr)
+    {
+        while(isspace((unsigned char)*ptr)) ++ptr;
+        const char* word = ptr;
+        const char* eq = NULL;
+        while(*ptr && !isspace((unsigned char)*ptr))
+        {
+            if(*ptr == '=' && !eq)
+                eq = ptr;
+            ++ptr;
+        }
+        if(eq && eq > word)
+            fn(word, (int)(eq - word), eq + 1, (int)(ptr - eq - 1));
+    }
+}
+
+static bool parseNumber(const char* value, int len, double* out)
+{
+    char buf[64];
+    if(len <= 0 || len >= (int)sizeof(buf))
+        return false;
+    memcpy(buf, value, len);
+    buf[len] = '\0';
+    char* end;
+    *out = strtod(buf, &end);
+    return end == buf + len;
+}
+
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+
+bool AttributeColumn::parseOp(const QString& str, Op* op)
+{
+    if(str == "==" || str == "=") *op = Equal;
+    else if(str == "!=") *op = NotEqual;
+    else if(str == "<") *op = Less;
+    else if(str == "<=") *op = LessEqual;
+    else if(str == ">") *op = Greater;
+    else if(str == ">=") *op = GreaterEqual;
+    else return false;
+    return true;
+}
+
+quint32 AttributeColumn::codeForValue(const QByteArray& value) const
+{
+    return lookup.value(value);
+}
+
+bool AttributeColumn::hasValue(int idx) const
+{
+    if(type == Numeric)
+        return !isnan(numbers[idx]);
+    return codes[idx] != 0;
+}
+
+QString AttributeColumn::valueString(int idx) const
+{
+    if(type == Numeric)
+        return isnan(numbers[idx]) ? QString() : QString::number(numbers[idx], 'g', 15);
+    return codes[idx] ? QString::fromUtf8(dictionary[codes[idx]-1]) : QString();
+}
+
+// Evaluates "key op value" once per distinct value, giving a table indexed
+// by code. Code 0 (key missing) never matches. Values that are numbers on
+// both sides compare as numbers, so a mostly numeric column still orders
+// sensibly.
+QVector<quint8> AttributeColumn::matchCodes(Op op, const QByteArray& value) const
+{
+    QVector<quint8> table(dictionary.size() + 1, 0);
+    double number;
+    bool isNumber = parseNumber(value.constData(), value.size(), &number);
+
+    for(int n = 0; n < dictionary.size(); n++)
+    {
+        double x;
+        if(isNumber && parseNumber(dictionary[n].constData(), dictionary[n].size(), &x))
+        {
+            table[n+1] = compare(op, x, number) ? 1 : 0;
+            continue;
+        }
+
+        int cmp = qstrcmp(dictionary[n], value);
+        bool result = false;
+        switch(op)
+        {
+        case Equal:         result = (cmp == 0); break;
+        case NotEqual:      result = (cmp != 0); break;
+        case Less:          result = (cmp < 0); break;
+        case LessEqual:     result = (cmp <= 0); break;
+        case Greater:       result = (cmp > 0); break;
+        case GreaterEqual:  result = (cmp >= 0); break;
+        }
+        table[n+1] = result ? 1 : 0;
+    }
+    return table;
+}
+
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+
+AttributeStore::AttributeStore()
+    : MemoryClient("attributes", true), _numEvents(0), _generation(-1)
+{
+}
+
+AttributeStore::~AttributeStore()
+{
+    clear();
+}
+
+void AttributeStore::clear()
+{
+    qDeleteAll(_columns);
+    _columns.clear();
+    _numEvents = 0;
+    _generation = -1;
+    setMemoryUsed(0);
+}
+
+qint64 AttributeStore::evict()
+{
+    qint64 bytes = memoryUsed();
+    for(auto col: _columns)
+    {
+        col->numbers = QVector<double>();
+        col->codes = QVector<quint32>();
+        col->dictionary = QList<QByteArray>();
+        col->lookup = QHash<QByteArray,quint32>();
+    }
+    _numEvents = 0;
+    _generation = -1;
+    return bytes;
+}
+
+QStringList AttributeStore::keys() const
+{
+    QStringList list;
+    for(auto col: _columns)
+        list.append(col->key);
+    return list;
+}
+
+// Splits the events of a lane made by attribute out again, from columns of
+// what may be another trace. Numeric values are compared as parsed.
+void AttributeStore::fill(FilteredTrace* lane) const
+{
+    lane->clear();
+    AttributeColumn* col = column(lane->attributeKey());
+    if(col && col->type == AttributeColumn::String)
+    {
+        quint32 code = col->lookup.value(lane->attributeValue().toUtf8());
+        for(int n = 0; code && n < col->codes.size(); n++)
+        {
+            if(col->codes[n] == code)
+                lane->addEvent(n);
+        }
+    }
+    else if(col)
+    {
+        bool ok;
+        double value = lane->attributeValue().toDouble(&ok);
+        for(int n = 0; ok && n < col->numbers.size(); n++)
+        {
+            if(col->numbers[n] == value)
+                lane->addEvent(n);
+        }
+    }
+    lane->updateMemoryUsed();
+}
+
+AttributeColumn* AttributeStore::column(const QString& key) const
+{
+    touch();
+    for(auto col: _columns)
+    {
+        if(col->key == key)
+            return col;
+    }
+    return NULL;
+}
+
+// Keys that appear in evenly spaced sample events, most frequent first.
+QStringList AttributeStore::detectKeys(TraceFile* trace, int numSamples)
+{
+    QMap<QString,int> keyCounts;
+    int numEvents = trace->numEvents();
+    int step = (numEvents > numSamples) ? numEvents / numSamples : 1;
+
+    for(int n = 0; n < numEvents; n += step)
+    {
+        const char* txt = trace->getEventText(n, false);
+        if(!txt)
+            continue;
+        forEachKeyValue(txt, [&](const char* key, int keyLen, const char*, int) {
+            keyCounts[QString::fromUtf8(key, keyLen)]++;
+        });
+    }
+
+    QList<QPair<int,QString> > sorted;
+    for(auto iter = keyCounts.begin(); iter != keyCounts.end(); ++iter)
+        sorted.append(QPair<int,QString>(-iter.value(), iter.key()));
+    std::sort(sorted.begin(), sorted.end());
+
+    QStringList keys;
+    for(auto& entry: sorted)
+        keys.append(entry.second);
+    return keys;
+}
+
+// Pulls the given keys out of every event into columns. A column is numeric
+// if every sampled value of its key parses as a number, and becomes a string
+// column if any other value doesn't. Blocks of events are scanned in
+// parallel, each with its own string dictionaries, which are then merged and
+// the codes remapped. A key given twice gets one column.
+void AttributeStore::extract(TraceFile* trace, const QStringList& keyList, QProgressDialog* progDlg)
+{
+    typedef struct {
+        int begin, end;
+        QList<QHash<QByteArray,quint32> > lookup;   // per column
+        QList<QList<QByteArray> > dictionary;
+    } Block;
+
+    QElapsedTimer timer;
+    timer.start();
+
+    QStringList keys = keyList;
+    keys.removeDuplicates();
+    clear();
+    _numEvents = trace->numEvents();
+    _generation = trace->getGeneration();
+
+    QHash<QByteArray,int> keyIndex;
+    QVector<bool> numeric(keys.size(), true);
+    QVector<bool> seen(keys.size(), false);
+    for(int k = 0; k < keys.size(); k++)
+        keyIndex[keys[k].toUtf8()] = k;
+
+    int step = (_numEvents > ATTR_TYPE_SAMPLES) ? _numEvents / ATTR_TYPE_SAMPLES : 1;
+    for(int n = 0; n < _numEvents; n += step)
+    {
+        const char* txt = trace->getEventText(n, false);
+        if(!txt)
+            continue;
+        forEachKeyValue(txt, [&](const char* key, int keyLen, const char* value, int valueLen) {
+            auto iter = keyIndex.find(QByteArray::fromRawData(key, keyLen));
+            double number;
+            if(iter == keyIndex.end())
+                return;
+            seen[iter.value()] = true;
+            if(!parseNumber(value, valueLen, &number))
+                numeric[iter.value()] = false;
+        });
+    }
+
+    for(int k = 0; k < keys.size(); k++)
+    {
+        AttributeColumn* col = new AttributeColumn(keys[k], (numeric[k] && seen[k]) ? AttributeColumn::Numeric : AttributeColumn::String);
+        if(col->type == AttributeColumn::Numeric)
+            col->numbers.fill(NAN, _numEvents);
+        else
+            col->codes.fill(0, _numEvents);
+        _columns.append(col);
+    }
+
+    // raw column pointers so the workers never touch the containers themselves
+    QVector<double*> numberData(_columns.size(), NULL);
+    QVector<quint32*> codeData(_columns.size(), NULL);
+    for(int k = 0; k < _columns.size(); k++)
+    {
+        if(_columns[k]->type == AttributeColumn::Numeric)
+            numberData[k] = _columns[k]->numbers.data();
+        else
+            codeData[k] = _columns[k]->codes.data();
+    }
+
+    // a numeric column with a value that isn't a number is scanned again,
+    // on its own, as strings
+    QHash<QByteArray,int> scanKeys = keyIndex;
+    while(!scanKeys.isEmpty())
+    {
+        QList<Block> blocks;
+        for(int begin = 0; begin < _numEvents; begin += ATTR_BLOCK_SZ)
+        {
+            Block block;
+            block.begin = begin;
+            block.end = qMin(begin + ATTR_BLOCK_SZ, _numEvents);
+            for(int k = 0; k < keys.size(); k++)
+            {
+                block.lookup.append(QHash<QByteArray,quint32>());
+                block.dictionary.append(QList<QByteArray>());
+            }
+            blocks.append(block);
+        }
+
+        if(progDlg)
+        {
+            progDlg->reset();
+            progDlg->setRange(0, blocks.size());
+        }
+
+        QVector<QAtomicInt> misparsed(keys.size());
+        QAtomicInt blocksDone;
+        QFuture<void> future = QtConcurrent::map(blocks, [&](Block& block) {
+            TraceFile::Reader reader(trace);
+            for(int n = block.begin; n < block.end; n++)
+            {
+                const char* txt = reader.getEventText(n, false);
+                if(!txt)
+                    continue;
+                forEachKeyValue(txt, [&](const char* key, int keyLen, const char* value, int valueLen) {
+                    auto iter = scanKeys.find(QByteArray::fromRawData(key, keyLen));
+                    if(iter == scanKeys.end())
+                        return;
+                    int k = iter.value();
+                    if(numberData[k])
+                    {
+                        double number;
+                        if(parseNumber(value, valueLen, &number))
+                            numberData[k][n] = number;
+                        else
+                            misparsed[k].storeRelaxed(1);
+                    }
+                    else
+                    {
+                        // only values new to the block are copied
+                        quint32 code = block.lookup[k].value(QByteArray::fromRawData(value, valueLen));
+                        if(!code)
+                        {
+                            QByteArray v(value, valueLen);
+                            block.dictionary[k].append(v);
+                            code = block.dictionary[k].size();
+                            block.lookup[k][v] = code;
+                        }
+                        codeData[k][n] = code;
+                    }
+                });
+            }
+            blocksDone.fetchAndAddRelaxed(1);
+        });
+
+        while(!future.isFinished())
+        {
+            if(progDlg)
+                progDlg->setValue(blocksDone.loadRelaxed());
+            QThread::msleep(PROGRESS_POLL_MS);
+        }
+
+        // merge the per-block dictionaries and renumber each block's codes
+        for(int k: scanKeys)
+        {
+            AttributeColumn* col = _columns[k];
+            if(col->type != AttributeColumn::String)
+                continue;
+
+            QList<QVector<quint32> > remaps;
+            for(Block& block: blocks)
+            {
+                QVector<quint32> remap(block.dictionary[k].size() + 1, 0);
+                for(int n = 0; n < block.dictionary[k].size(); n++)
+                {
+                    const QByteArray& v = block.dictionary[k][n];
+                    quint32 code = col->lookup.value(v);
+                    if(!code)
+                    {
+                        col->dictionary.append(v);
+                        code = col->dictionary.size();
+                        col->lookup[v] = code;
+                    }
+                    remap[n+1] = code;
+                }
+                remaps.append(remap);
+            }
+
+            QList<int> blockIndices;
+            for(int b = 0; b < blocks.size(); b++)
+                blockIndices.append(b);
+            QtConcurrent::blockingMap(blockIndices, [&](int b) {
+                const quint32* remap = remaps[b].constData();
+                quint32* codes = codeData[k];
+                for(int n = blocks[b].begin; n < blocks[b].end; n++)
+                    codes[n] = remap[codes[n]];
+            });
+        }
+
+        QHash<QByteArray,int> demoted;
+        for(int k: scanKeys)
+        {
+            if(!misparsed[k].loadRelaxed())
+                continue;
+            AttributeColumn* col = _columns[k];
+            col->type = AttributeColumn::String;
+            col->numbers = QVector<double>();
+            col->codes.fill(0, _numEvents);
+            numberData[k] = NULL;
+            codeData[k] = col->codes.data();
+            demoted[keys[k].toUtf8()] = k;
+        }
+        scanKeys.swap(demoted);
+    }
+
+    qint64 bytes = 0;
+    for(auto col: _columns)
+    {
+        bytes += col->numbers.capacity() * sizeof(double) + col->codes.capacity() * sizeof(quint32);
+        for(const QByteArray& value: col->dictionary)
+            bytes += value.capacity();
+        bytes += col->lookup.capacity() * (sizeof(QByteArray) + sizeof(quint32));
+    }
+    setMemoryUsed(bytes);
+    setRebuildCost(timer.nsecsElapsed() / 1e6);
+    touch();
+}
@@ -0,0 +1,84 @@
+#ifndef TRACEATTRS_H
+#define TRACEATTRS_H
+
+#include <QHash>
+#include <QList>
+#include <QStringList>
+#include <QVector>
+#include <QProgressDialog>
+#include "tracememory.h"
+
+class TraceFile;
+class FilteredTrace;
+
+// One key=value attribute pulled out of the event text of a TraceFile.
+// Numeric columns are packed doubles, NaN where an event lacks the key.
+// String columns are dictionary codes, 0 where an event lacks the key and
+// otherwise an index (+1) into the list of distinct values.
+class AttributeColumn
+{
+public:
+    enum Type { Numeric, String };
+    enum Op { Equal, NotEqual, Less, LessEqual, Greater, GreaterEqual };
+
+    AttributeColumn(const QString& key, Type type) : key(key), type(type) { }
+
+    quint32 codeForValue(const QByteArray& value) const;
+    QString valueString(int idx) const;
+    bool hasValue(int idx) const;
+
+    QVector<quint8> matchCodes(Op op, const QByteArray& value) const;
+
+    static bool parseOp(const QString& str, Op* op);
+    static inline bool compare(Op op, double x, double v)
+    {
+        switch(op)
+        {
+        case Equal:         return x == v;
+        case NotEqual:      return x != v && x == x;
+        case Less:          return x < v;
+        case LessEqual:     return x <= v;
+        case Greater:       return x > v;
+        case GreaterEqual:  return x >= v;
+        }
+        return false;
+    }
+
+public:
+    QString key;
+    Type type;
+    QVector<double> numbers;
+    QVector<quint32> codes;
+    QList<QByteArray> dictionary;
+    QHash<QByteArray,quint32> lookup;   // from dictionary value to code
+};
+
+// The columns are evictable: eviction frees their values but keeps the keys,
+// and marks them extracted from no trace, so they are extracted again where
+// the generation is checked before use.
+class AttributeStore : public MemoryClient
+{
+public:
+    AttributeStore();
+    ~AttributeStore();
+
+    static QStringList detectKeys(TraceFile* trace, int numSamples);
+
+    void extract(TraceFile* trace, const QStringList& keyList, QProgressDialog* progDlg = NULL);
+    void clear();
+
+    QStringList keys() const;
+    AttributeColumn* column(const QString& key) const;
+    void fill(FilteredTrace* lane) const;
+    int numEvents() const { return _numEvents; }
+    int getGeneration() const { return _generation; }
+
+protected:
+    qint64 evict() override;
+
+    QList<AttributeColumn*> _columns;
+    int _numEvents;
+    int _generation;    // of the trace the columns were extracted from
+};
+
+#endif // TRACEATTRS_H
@@ -0,0 +1,285 @@
+#include "tracecategories.h"
+#include "traceattrs.h"
+#include <ctype.h>
+#include <math.h>
+#include <algorithm>
+#include <QHash>
+#include <QRegExp>
+#include <QThread>
+#include <QtConcurrent>
+
+#define PROGRESS_POLL_MS    20
+#define MAX_TEMPLATE_SZ     96
+
+TraceCategories::TraceCategories()
+    : _other(-1), _memory("categories")
+{
+}
+
+TraceCategories::~TraceCategories()
+{
+    clear();
+}
+
+void TraceCategories::clear()
+{
+    for(LaneCategories* lane: _lanes)
+    {
+        qDeleteAll(lane->pyramids);
+        delete lane;
+    }
+    _lanes.clear();
+    _names.clear();
+    _other = -1;
+    _memory.setMemoryUsed(0);
+}
+
+QColor TraceCategories::color(int category, int other)
+{
+    if(category == other)
+        return CATEGORY_OTHER_COLOR;
+    return QColor::fromHsv((category*137)%360, 200, 255);
+}
+
+// The detail of an event with every run of digits, and any hex digits
+// running on from it, replaced by '#'. The lane ID is left out.
+static void templateKey(const char* txt, QByteArray* key)
+{
+    key->clear();
+    const char* p = txt;
+    while(*p && !isspace((uchar)*p))
+        ++p;
+    while(isblank((uchar)*p))
+        ++p;
+
+    while(*p && *p != '\n' && key->size() < MAX_TEMPLATE_SZ)
+    {
+        if(isdigit((uchar)*p))
+        {
+            key->append('#');
+            while(isxdigit((uchar)*p) || *p == 'x' || *p == '.')
+                ++p;
+        }
+        else
+            key->append(*p++);
+    }
+}
+
+// Finds the key of every event in parallel blocks, each with its own
+// dictionary, as AttributeStore::extract does. The most frequent keys
+// become categories. Then every lane gets its codes and pyramids, again in
+// parallel. Returns false if no event has a key.
+bool TraceCategories::build(TraceFile* trace, const QList<TraceLane>& lanes, Source source, const QString& arg,
+                            const AttributeStore* attrs, QProgressDialog* progDlg)
+{
+    typedef struct {
+        int begin, end;
+        QHash<QByteArray,quint32> lookup;
+        QList<QByteArray> dictionary;
+    } Block;
+
+    clear();
+    int numEvents = trace->numEvents();
+    if(numEvents == 0)
+        return false;
+
+    const AttributeColumn* column = NULL;
+    if(source == Attribute)
+    {
+        column = attrs ? attrs->column(arg) : NULL;
+        if(!column || attrs->numEvents() != numEvents)
+            return false;
+    }
+    QRegExp regex(arg);
+    if(source == Regex && !regex.isValid())
+        return false;
+
+    QVector<quint32> eventCodes(numEvents, 0);
+    quint32* codeData = eventCodes.data();
+
+    QList<Block> blocks;
+    for(int begin = 0; begin < numEvents; begin += CATEGORY_BLOCK_SZ)
+    {
+        Block block;
+        block.begin = begin;
+        block.end = qMin(begin + CATEGORY_BLOCK_SZ, numEvents);
+        blocks.append(block);
+    }
+
+    if(progDlg)
+    {
+        progDlg->reset();
+        progDlg->setRange(0, blocks.size() + lanes.size());
+    }
+
+    QAtomicInt done;
+    QFuture<void> future = QtConcurrent::map(blocks, [&](Block& block) {
+        TraceFile::Reader reader(trace);
+        QRegExp rx(regex);      // QRegExp keeps match state, so one per thread
+        QByteArray key;
+
+        for(int n = block.begin; n < block.end; n++)
+        {
+            if(source == Attribute)
+            {
+                if(column->type == AttributeColumn::String)
+                {
+                    if(!column->codes[n])
+                        continue;
+                    key = column->dictionary[column->codes[n]-1];
+                }
+                else
+                {
+                    if(column->numbers[n] != column->numbers[n])
+                        continue;
+                    key = QByteArray::number(column->numbers[n]);
+                }
+            }
+            else
+            {
+                const char* txt = reader.getEventText(n, false);
+                if(!txt)
+                    continue;
+                if(source == Template)
+                    templateKey(txt, &key);
+                else if(rx.indexIn(QString::fromUtf8(txt)) >= 0)
+                    key = rx.cap(rx.captureCount() > 0 ? 1 : 0).toUtf8();
+                else
+                    continue;
+            }
+
+            quint32 code = block.lookup.value(key);
+            if(!code)
+            {
+                block.dictionary.append(key);
+                code = block.dictionary.size();
+                block.lookup[key] = code;
+            }
+            codeData[n] = code;
+        }
+        done.fetchAndAddRelaxed(1);
+    });
+
+    while(!future.isFinished())
+    {
+        if(progDlg)
+            progDlg->setValue(done.loadRelaxed());
+        QThread::msleep(PROGRESS_POLL_MS);
+    }
+
+    // merge the block dictionaries, renumbering each block's codes
+    QHash<QByteArray,quint32> lookup;
+    QList<QByteArray> dictionary;
+    QList<QVector<quint32> > remaps;
+    for(Block& block: blocks)
+    {
+        QVector<quint32> remap(block.dictionary.size() + 1, 0);
+        for(int n = 0; n < block.dictionary.size(); n++)
+        {
+            quint32 code = lookup.value(block.dictionary[n]);
+            if(!code)
+            {
+                dictionary.append(block.dictionary[n]);
+                code = dictionary.size();
+                lookup[block.dictionary[n]] = code;
+            }
+            remap[n+1] = code;
+        }
+        remaps.append(remap);
+    }
+
+    QVector<qint64> counts(dictionary.size() + 1, 0);
+    for(int b = 0; b < blocks.size(); b++)
+    {
+        const quint32* remap = remaps[b].constData();
+        for(int n = blocks[b].begin; n < blocks[b].end; n++)
+        {
+            codeData[n] = remap[codeData[n]];
+            counts[codeData[n]]++;
+        }
+    }
+
+    // with every event in "other" there is nothing to color by
+    if(dictionary.isEmpty())
+        return false;
+
+    // the most frequent keys get their own category, the rest share one
+    QVector<int> order;
+    for(int code = 1; code <= dictionary.size(); code++)
+        order.append(code);
+    std::stable_sort(order.begin(), order.end(), [&](int a, int b) { return counts[a] > counts[b]; });
+
+    bool needOther = counts[0] > 0 || order.size() > MAX_CATEGORIES;
+    int numNamed = qMin(order.size(), needOther ? MAX_CATEGORIES-1 : MAX_CATEGORIES);
+    int numCategories = numNamed + (needOther ? 1 : 0);
+    _other = needOther ? numNamed : -1;
+
+    QVector<quint8> categoryForCode(dictionary.size() + 1, (quint8)qMax(_other, 0));
+    for(int n = 0; n < numNamed; n++)
+    {
+        categoryForCode[order[n]] = n;
+        _names.append(QString::fromUtf8(dictionary[order[n]-1]));
+    }
+    if(needOther)
+        _names.append("other");
+
+    const quint8* categoryData = categoryForCode.constData();
+    double begin = trace->getEventTime(0);
+    double end = nextafter(trace->getEventTime(numEvents-1), INFINITY);
+
+    QList<QPair<SubTrace*,LaneCategories*> > work;
+    for(const TraceLane& traceLane: lanes)
+    {
+        if(traceLane.data->getParent() != trace)
+            continue;
+        LaneCategories* lane = new LaneCategories;
+        lane->other = _other;
+        _lanes[traceLane.data] = lane;
+        work.append(qMakePair((SubTrace*)traceLane.data, lane));
+    }
+
+    future = QtConcurrent::map(work, [&](QPair<SubTrace*,LaneCategories*>& item) {
+        SubTrace* data = item.first;
+        LaneCategories* lane = item.second;
+        int count = data->numEvents();
+
+        lane->codes.resize(count);
+        QVector<bool> present(numCategories, false);
+        for(int n = 0; n < count; n++)
+        {
+            quint8 category = categoryData[codeData[data->getParentIndex(n)]];
+            lane->codes[n] = category;
+            present[category] = true;
+        }
+
+        int levels = CATEGORY_MIN_LEVELS;
+        while(levels < CATEGORY_MAX_LEVELS && ((qint64)CATEGORY_BUCKET_EVENTS << (levels-1)) < count)
+            levels++;
+        for(int c = 0; c < numCategories; c++)
+            lane->pyramids.append(present[c] ? new TracePyramid(begin, end, levels) : NULL);
+        for(int n = 0; n < count; n++)
+        {
+            TracePyramid* pyramid = lane->pyramids[lane->codes[n]];
+            pyramid->add(pyramid->bucketForTime(data->getEventTime(n)), 1);
+        }
+        for(TracePyramid* pyramid: lane->pyramids)
+        {
+            if(pyramid)
+                pyramid->update();
+        }
+        done.fetchAndAddRelaxed(1);
+    });
+
+    while(!future.isFinished())
+    {
+        if(progDlg)
+            progDlg->setValue(done.loadRelaxed());
+        QThread::msleep(PROGRESS_POLL_MS);
+    }
+
+    qint64 bytes = 0;
+    for(LaneCategories* lane: _lanes)
+        bytes += lane->codes.capacity();
+    _memory.setMemoryUsed(bytes);
+    return true;
+}
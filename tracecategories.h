@@ -0,0 +1,62 @@
+#ifndef TRACECATEGORIES_H
+#define TRACECATEGORIES_H
+
+#include <QColor>
+#include <QList>
+#include <QMap>
+#include <QStringList>
+#include <QVector>
+#include <QProgressDialog>
+#include "tracedata.h"
+#include "tracepyramid.h"
+
+#define CATEGORY_MIN_LEVELS     12
+#define CATEGORY_MAX_LEVELS     20
+#define CATEGORY_BUCKET_EVENTS  8       // per level 0 bucket of a lane, on average, above the fewest levels
+#define MAX_CATEGORIES          12      // the most frequent, the rest drawn as one "other"
+#define CATEGORY_BLOCK_SZ       65536
+#define CATEGORY_OTHER_COLOR    QColor(160,160,160)
+
+class AttributeStore;
+
+// The category of each event of one lane, and a count pyramid per category
+// so that zoomed out frames cost pixels times categories, not events. The
+// pyramids are as fine as the lane's event count calls for, so by the time
+// a view is zoomed in past them there are few events left in it to count.
+typedef struct {
+    QVector<quint8> codes;
+    QList<TracePyramid*> pyramids;  // per category, NULL where the lane has none
+    int other;                      // the "other" category, or -1
+} LaneCategories;
+
+// Sorts the events of a trace into categories for colouring: by the first
+// capture (or the whole match) of a regular expression over the event text,
+// by the value of an extracted attribute, or by template, the event text
+// with every run of digits masked. Events that don't match fall into
+// "other" along with the less frequent categories.
+class TraceCategories
+{
+public:
+    enum Source { Regex, Attribute, Template };
+
+    TraceCategories();
+    ~TraceCategories();
+
+    bool build(TraceFile* trace, const QList<TraceLane>& lanes, Source source, const QString& arg,
+               const AttributeStore* attrs, QProgressDialog* progDlg = NULL);
+    void clear();
+
+    const LaneCategories* forLane(Trace* lane) const { return _lanes.value(lane, NULL); }
+    const QStringList& names() const { return _names; }
+    int other() const { return _other; }
+
+    static QColor color(int category, int other);
+
+protected:
+    QMap<Trace*,LaneCategories*> _lanes;
+    QStringList _names;
+    int _other;
+    MemoryClient _memory;   // of the codes; the pyramids count themselves
+};
+
+#endif // TRACECATEGORIES_H
@@ -0,0 +1,279 @@
+#include "tracecli.h"
+#include "tracedata.h"
+#include "traceexport.h"
+#include "tracememory.h"
+#include <stdio.h>
+#include <math.h>
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QFile>
+#include <QBitArray>
+#include <QSet>
+#include <QThread>
+#include <QtConcurrent>
+
+#define GREP_BLOCK_SZ   65536
+
+static void printLaneTable(QList<TraceLane>& lanes, const QSet<QString>& laneFilter,
+                           double begin, double end, bool rates)
+{
+    double span = end - begin;
+
+    for(const TraceLane& lane: lanes)
+    {
+        if(!laneFilter.isEmpty() && !laneFilter.contains(lane.id) && !laneFilter.contains(lane.name))
+            continue;
+
+        int first;
+        int count = lane.data->eventsInRange(begin, end, &first);
+        if(rates)
+        {
+            double rate = (span > 0) ? count / span : 0;
+            double meanGap = (count > 1)
+                ? (lane.data->getEventTime(first+count-1) - lane.data->getEventTime(first)) / (count-1)
+                : 0;
+            printf("%s\t%d\t%.6f\t%.9f\n", qPrintable(lane.name), count, rate, meanGap);
+        }
+        else
+        {
+            printf("%s\t%d\n", qPrintable(lane.name), count);
+        }
+    }
+}
+
+// Leaves t as it is if the option isn't given.
+static bool parseTimeOption(const QCommandLineParser& parser, const char* name, double* t)
+{
+    if(!parser.isSet(name))
+        return true;
+
+    bool ok;
+    double value = parser.value(name).toDouble(&ok);
+    if(!ok)
+    {
+        fprintf(stderr, "Not a time in seconds: --%s %s\n", name, qPrintable(parser.value(name)));
+        return false;
+    }
+    *t = value;
+    return true;
+}
+
+// Frees what the memory budget doesn't allow and, with --memory, prints the
+// usage by component to stderr after each step.
+static void checkMemory(bool print, const char* step)
+{
+    MemoryBudget::trim();
+    if(!print)
+        return;
+
+    fprintf(stderr, "memory after %s: %s of %s\n", step,
+            qPrintable(MemoryBudget::formatBytes(MemoryBudget::used())),
+            qPrintable(MemoryBudget::formatBytes(MemoryBudget::limit())));
+    for(const MemoryBudget::Usage& usage: MemoryBudget::breakdown())
+    {
+        if(usage.bytes > 0)
+            fprintf(stderr, "  %-20s %10s  (%d)\n", qPrintable(usage.component),
+                    qPrintable(MemoryBudget::formatBytes(usage.bytes)), usage.clients);
+    }
+}
+
+// Prints matching events in time order. Blocks of events are searched in
+// parallel, each with a Reader and regex of its own, a window of blocks at
+// a time so output starts right away and memory stays bounded.
+static void grepEvents(TraceFile& trace, const QString& regEx, const QBitArray& laneMask,
+                       double begin, double end, FILE* out)
+{
+    typedef struct {
+        int begin, end;
+        QList<QByteArray> lines;
+    } Block;
+
+    int first;
+    int count = trace.eventsInRange(begin, end, &first);
+    int window = GREP_BLOCK_SZ * qMax(QThread::idealThreadCount(), 1);
+
+    for(int ofs = 0; ofs < count; ofs += window)
+    {
+        QList<Block> blocks;
+        for(int pos = ofs; pos < count && pos < ofs + window; pos += GREP_BLOCK_SZ)
+        {
+            Block block;
+            block.begin = first + pos;
+            block.end = first + qMin(pos + GREP_BLOCK_SZ, count);
+            blocks.append(block);
+        }
+
+        QtConcurrent::blockingMap(blocks, [&](Block& block) {
+            TraceFile::Reader reader(&trace);
+            QRegExp regex(regEx);
+            for(int n = block.begin; n < block.end; n++)
+            {
+                if(!laneMask.isEmpty() && !laneMask.testBit(n))
+                    continue;
+                if(!regEx.isEmpty())
+                {
+                    const char* msg = reader.getEventText(n, false);
+                    if(!msg || regex.indexIn(msg) == -1)
+                        continue;
+                }
+                const char* txt = reader.getEventText(n, true);
+                if(txt)
+                    block.lines.append(QByteArray(txt));
+            }
+        });
+
+        for(const Block& block: blocks)
+        {
+            for(const QByteArray& line: block.lines)
+                fprintf(out, "%s\n", line.constData());
+        }
+        fflush(out);
+    }
+}
+
+int runCli(QCoreApplication& app)
+{
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Query trace files without the GUI.");
+    parser.addHelpOption();
+    parser.addPositionalArgument("files", "Trace files to load as one timeline.", "FILE...");
+    parser.addOption(QCommandLineOption("cli", "Run headless."));
+    parser.addOption(QCommandLineOption("begin", "Start of the time range in seconds.", "t"));
+    parser.addOption(QCommandLineOption("end", "End of the time range in seconds.", "t"));
+    parser.addOption(QCommandLineOption("crop", "Only parse the part of the files covering --begin/--end."));
+    parser.addOption(QCommandLineOption("lane", "Restrict to a lane ID or name (repeatable).", "id"));
+    parser.addOption(QCommandLineOption("counts", "Print events per lane in the range."));
+    parser.addOption(QCommandLineOption("rates", "Print events, events/s and mean gap per lane in the range."));
+    parser.addOption(QCommandLineOption("grep", "Print events in the range whose text matches a regex.", "regex"));
+    parser.addOption(QCommandLineOption("export", "Write the events in the range to a new trace file.", "file"));
+    parser.addOption(QCommandLineOption("image", "Render the lanes over the range to a .png or .svg file.", "file"));
+    parser.addOption(QCommandLineOption("size", "Size of the --image in pixels (default 4000x1000).", "WxH"));
+    parser.addOption(QCommandLineOption("memory-limit", "Budget for caches and indices, e.g. 8G (default 8G).", "size"));
+    parser.addOption(QCommandLineOption("memory", "Print memory use by component to stderr after each step."));
+    parser.process(app);
+
+    if(parser.isSet("memory-limit"))
+    {
+        qint64 limit;
+        if(!MemoryBudget::parseBytes(parser.value("memory-limit"), &limit) || limit <= 0)
+        {
+            fprintf(stderr, "Not a size: %s\n", qPrintable(parser.value("memory-limit")));
+            return 1;
+        }
+        MemoryBudget::setLimit(limit);
+    }
+    bool printMemory = parser.isSet("memory");
+
+    QStringList fileNames = parser.positionalArguments();
+    if(fileNames.isEmpty())
+        parser.showHelp(1);
+
+    double begin = -HUGE_VAL, end = HUGE_VAL;
+    if(!parseTimeOption(parser, "begin", &begin) || !parseTimeOption(parser, "end", &end))
+        return 1;
+
+    TraceFile trace;
+    bool ok;
+    if(parser.isSet("crop") && parser.isSet("begin") && parser.isSet("end"))
+        ok = trace.openTextRange(fileNames, QList<double>(), begin, end);
+    else
+        ok = trace.openText(fileNames, QList<double>());
+
+    if(!ok)
+    {
+        fprintf(stderr, "Can't open %s\n", qPrintable(fileNames.join(", ")));
+        return 1;
+    }
+    checkMemory(printMemory, "loading");
+
+    // the range is given in absolute seconds, the lanes count from the base
+    if(parser.isSet("begin"))
+        begin = trace.toViewTime(begin);
+    if(parser.isSet("end"))
+        end = trace.toViewTime(end);
+    if(trace.numEvents() > 0)
+    {
+        begin = qMax(begin, trace.getEventTime(0));
+        end = qMin(end, trace.getEventTime(trace.numEvents()-1));
+    }
+
+    QList<TraceLane> lanes;
+    QSet<QString> laneFilter;
+    QBitArray laneMask;
+    for(const QString& lane: parser.values("lane"))
+        laneFilter.insert(lane);
+
+    bool needLanes = parser.isSet("counts") || parser.isSet("rates") || parser.isSet("image") || !laneFilter.isEmpty();
+    if(needLanes)
+        lanes = trace.splitLanes();
+
+    if(!laneFilter.isEmpty())
+    {
+        laneMask.resize(trace.numEvents());
+        for(const TraceLane& lane: lanes)
+        {
+            if(!laneFilter.contains(lane.id) && !laneFilter.contains(lane.name))
+                continue;
+            for(int n = 0; n < lane.data->numEvents(); n++)
+                laneMask.setBit(lane.data->getParentIndex(n));
+        }
+    }
+
+    if(parser.isSet("counts"))
+    {
+        printLaneTable(lanes, laneFilter, begin, end, false);
+        checkMemory(printMemory, "--counts");
+    }
+
+    if(parser.isSet("rates"))
+    {
+        printLaneTable(lanes, laneFilter, begin, end, true);
+        checkMemory(printMemory, "--rates");
+    }
+
+    if(parser.isSet("grep"))
+    {
+        grepEvents(trace, parser.value("grep"), laneMask, begin, end, stdout);
+        checkMemory(printMemory, "--grep");
+    }
+
+    if(parser.isSet("export"))
+    {
+        FILE* out = fopen(qPrintable(parser.value("export")), "w");
+        if(!out)
+        {
+            fprintf(stderr, "Can't write %s\n", qPrintable(parser.value("export")));
+            return 1;
+        }
+        grepEvents(trace, QString(), laneMask, begin, end, out);
+        fclose(out);
+        checkMemory(printMemory, "--export");
+    }
+
+    if(parser.isSet("image"))
+    {
+        QStringList size = parser.value("size").split('x');
+        int width = (size.size() == 2) ? size[0].toInt() : 4000;
+        int height = (size.size() == 2) ? size[1].toInt() : 1000;
+
+        QList<Lane> imageLanes;
+        for(const TraceLane& lane: lanes)
+        {
+            if(!laneFilter.isEmpty() && !laneFilter.contains(lane.id) && !laneFilter.contains(lane.name))
+                continue;
+            int idx = imageLanes.size();
+            imageLanes.append(Lane(lane.data, lane.name, QColor::fromHsv((idx*35)%255,255,255)));
+        }
+
+        if(!TraceExport::writeImage(parser.value("image"), imageLanes, begin, end, width, height))
+        {
+            fprintf(stderr, "Can't write %s\n", qPrintable(parser.value("image")));
+            return 1;
+        }
+        checkMemory(printMemory, "--image");
+    }
+
+    for(const TraceLane& lane: lanes)
+        delete lane.data;
+    return 0;
+}
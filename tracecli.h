@@ -0,0 +1,13 @@
+#ifndef TRACECLI_H
+#define TRACECLI_H
+
+class QCoreApplication;
+
+// Headless batch queries over trace files, for scripts and CI:
+//
+//     TraceView --cli [options] FILE...
+//
+// app must be a QGuiApplication for --image, which draws text.
+int runCli(QCoreApplication& app);
+
+#endif // TRACECLI_H
@@ -0,0 +1,703 @@
+#include "tracecompress.h"
+#include <limits.h>
+#include <string.h>
+#include <zlib.h>
+#include <zstd.h>
+#include <QFile>
+#include <QMutexLocker>
+#include <QElapsedTimer>
+#include <QtConcurrent>
+
+#define COMPRESSED_IN_BUF_SZ    (256*1024)
+#define GZIP_WINDOW_SZ          32768
+#define GZIP_TRAILER_SZ         8
+
+bool CompressedIndex::findPoint(qint64 pos, Point* point)
+{
+    QMutexLocker locker(&_lock);
+
+    int lo = 0, hi = _points.size();
+    while(lo < hi)
+    {
+        int mid = (lo + hi) / 2;
+        if(_points[mid].out <= pos)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    if(lo == 0)
+        return false;
+    *point = _points[lo-1];
+    return true;
+}
+
+void CompressedIndex::addPoint(const Point& point)
+{
+    QMutexLocker locker(&_lock);
+    _points.append(point);
+    _memory.setMemoryUsed(_memory.memoryUsed() + sizeof(Point) + point.window.capacity());
+}
+
+void CompressedIndex::setComplete(qint64 size)
+{
+    _size.storeRelaxed(size);
+    _complete.storeRelease(1);
+}
+
+typedef struct {
+    qint64 in, end;     // compressed range
+    qint64 outSize;     // decompressed, -1 if the header doesn't say
+} ZstdFrame;
+
+static quint64 readLE(const uchar* p, int len)
+{
+    quint64 value = 0;
+    for(int n = len - 1; n >= 0; n--)
+        value = (value << 8) | p[n];
+    return value;
+}
+
+// Walks the frames of a zstd file through their frame and block headers,
+// reading nothing else. Skippable frames are passed over. Returns false if
+// the file isn't a well formed sequence of frames.
+static bool scanZstdFrames(QFile* file, QList<ZstdFrame>* frames)
+{
+    static const int didSizes[4] = { 0, 1, 2, 4 };
+    static const int fcsSizes[4] = { 0, 2, 4, 8 };
+    qint64 fileSize = file->size();
+    qint64 pos = 0;
+    while(pos < fileSize)
+    {
+        uchar hdr[18];
+        if(!file->seek(pos) || file->read((char*)hdr, 8) != 8)
+            return false;
+        quint32 magic = (quint32)readLE(hdr, 4);
+        if((magic & 0xfffffff0) == 0x184d2a50)
+        {
+            pos += 8 + (qint64)readLE(hdr + 4, 4);
+            continue;
+        }
+        if(magic != 0xfd2fb528)
+            return false;
+
+        int fhd = hdr[4];
+        bool singleSegment = (fhd >> 5) & 1;
+        int didSize = didSizes[fhd & 3];
+        int fcsSize = (fhd >> 6) ? fcsSizes[fhd >> 6] : (singleSegment ? 1 : 0);
+        int headerSize = 5 + (singleSegment ? 0 : 1) + didSize + fcsSize;
+        if(!file->seek(pos) || file->read((char*)hdr, headerSize) != headerSize)
+            return false;
+
+        ZstdFrame frame;
+        frame.in = pos;
+        frame.outSize = -1;
+        if(fcsSize > 0)
+        {
+            frame.outSize = (qint64)readLE(hdr + headerSize - fcsSize, fcsSize);
+            if(fcsSize == 2)
+                frame.outSize += 256;
+        }
+
+        qint64 blockPos = pos + headerSize;
+        for(;;)
+        {
+            uchar block[3];
+            if(!file->seek(blockPos) || file->read((char*)block, 3) != 3)
+                return false;
+            quint32 blockHeader = (quint32)readLE(block, 3);
+            int type = (blockHeader >> 1) & 3;
+            if(type == 3)
+                return false;
+            blockPos += 3 + ((type == 1) ? 1 : (blockHeader >> 3));     // RLE blocks hold one byte
+            if(blockHeader & 1)
+                break;
+        }
+        if((fhd >> 2) & 1)
+            blockPos += 4;  // content checksum
+        if(blockPos > fileSize)
+            return false;
+
+        frame.end = blockPos;
+        frames->append(frame);
+        pos = blockPos;
+    }
+    return true;
+}
+
+// Decompressed size of one zstd frame, by decompressing it with nowhere to
+// keep the output.
+static qint64 zstdFrameSize(const QString& fileName, const ZstdFrame& frame)
+{
+    QFile file(fileName);
+    if(!file.open(QIODevice::ReadOnly) || !file.seek(frame.in))
+        return -1;
+    ZSTD_DStream* zs = ZSTD_createDStream();
+    if(!zs || ZSTD_isError(ZSTD_initDStream(zs)))
+    {
+        ZSTD_freeDStream(zs);
+        return -1;
+    }
+
+    QByteArray in(COMPRESSED_IN_BUF_SZ, 0), out((int)ZSTD_DStreamOutSize(), 0);
+    qint64 size = 0;
+    qint64 left = frame.end - frame.in;
+    while(left > 0 && size >= 0)
+    {
+        qint64 n = file.read(in.data(), qMin(left, (qint64)in.size()));
+        if(n <= 0)
+        {
+            size = -1;
+            break;
+        }
+        left -= n;
+
+        ZSTD_inBuffer inBuf = { in.constData(), (size_t)n, 0 };
+        for(;;)
+        {
+            ZSTD_outBuffer outBuf = { out.data(), (size_t)out.size(), 0 };
+            size_t ret = ZSTD_decompressStream(zs, &outBuf, &inBuf);
+            if(ZSTD_isError(ret))
+            {
+                size = -1;
+                break;
+            }
+            size += outBuf.pos;
+            if(inBuf.pos == inBuf.size && outBuf.pos < outBuf.size)
+                break;
+        }
+    }
+    ZSTD_freeDStream(zs);
+    return size;
+}
+
+
+// Decompresses forward from an access point, with its own file handle.
+// When given an index to record into, it adds a point at the first
+// boundary after every COMPRESSED_CHUNK_SZ of output.
+class CompressedDecoder
+{
+public:
+    CompressedDecoder(CompressedIndex::Format format, const QString& fileName, CompressedIndex* record = NULL);
+    ~CompressedDecoder();
+
+    bool start(const CompressedIndex::Point& point);
+    qint64 decode(char* out, qint64 maxOut, bool* eof);
+    bool skip(qint64 count);
+
+    qint64 inPos() const { return _inBase + _inUsed; }
+    qint64 outPos() const { return _out; }
+
+protected:
+    bool refill();
+    bool skipInput(int count);
+    qint64 decodeGzip(char* out, qint64 maxOut, bool* eof);
+    qint64 decodeZstd(char* out, qint64 maxOut, bool* eof);
+    void recordPoint(bool header);
+
+    CompressedIndex::Format _format;
+    QFile _file;
+    CompressedIndex* _record;
+    QByteArray _inBuf;
+    qint64 _inBase;         // file offset of _inBuf
+    int _inLen, _inUsed;
+    qint64 _out;
+    qint64 _lastPoint;
+
+    z_stream _zs;
+    bool _zsInit;
+    bool _raw;              // inside a deflate stream, without the gzip wrapper
+    bool _memberEnded;
+    ZSTD_DStream* _zstd;
+};
+
+CompressedDecoder::CompressedDecoder(CompressedIndex::Format format, const QString& fileName, CompressedIndex* record)
+    : _format(format), _file(fileName), _record(record),
+      _inBase(0), _inLen(0), _inUsed(0), _out(0), _lastPoint(0),
+      _zsInit(false), _raw(false), _memberEnded(false), _zstd(NULL)
+{
+    _inBuf.resize(COMPRESSED_IN_BUF_SZ);
+    memset(&_zs, 0, sizeof(_zs));
+}
+
+CompressedDecoder::~CompressedDecoder()
+{
+    if(_zsInit)
+        inflateEnd(&_zs);
+    if(_zstd)
+        ZSTD_freeDStream(_zstd);
+}
+
+bool CompressedDecoder::start(const CompressedIndex::Point& point)
+{
+    if(!_file.isOpen() && !_file.open(QIODevice::ReadOnly))
+        return false;
+
+    _out = _lastPoint = point.out;
+    _inLen = _inUsed = 0;
+    _memberEnded = false;
+
+    if(_format == CompressedIndex::Zstd)
+    {
+        if(!_zstd)
+            _zstd = ZSTD_createDStream();
+        if(!_zstd || ZSTD_isError(ZSTD_initDStream(_zstd)))
+            return false;
+    }
+    else
+    {
+        if(_zsInit)
+            inflateEnd(&_zs);
+        memset(&_zs, 0, sizeof(_zs));
+        _raw = !point.header;
+        _zsInit = (inflateInit2(&_zs, _raw ? -15 : 15+32) == Z_OK);
+        if(!_zsInit)
+            return false;
+
+        if(_raw && point.bits)
+        {
+            char byte;
+            if(!_file.seek(point.in - 1) || _file.read(&byte, 1) != 1)
+                return false;
+            inflatePrime(&_zs, point.bits, (uchar)byte >> (8 - point.bits));
+        }
+        if(_raw)
+            inflateSetDictionary(&_zs, (const Bytef*)point.window.constData(), point.window.size());
+    }
+
+    _inBase = point.in;
+    return _file.seek(point.in);
+}
+
+bool CompressedDecoder::refill()
+{
+    if(_inUsed < _inLen)
+        return true;
+    _inBase += _inLen;
+    _inLen = (int)qMax(_file.read(_inBuf.data(), _inBuf.size()), (qint64)0);
+    _inUsed = 0;
+    return _inLen > 0;
+}
+
+bool CompressedDecoder::skipInput(int count)
+{
+    while(count > 0)
+    {
+        if(!refill())
+            return false;
+        int n = qMin(count, _inLen - _inUsed);
+        _inUsed += n;
+        count -= n;
+    }
+    return true;
+}
+
+// Discards count bytes of output.
+bool CompressedDecoder::skip(qint64 count)
+{
+    QByteArray scratch(qMin(count, (qint64)COMPRESSED_CHUNK_SZ), 0);
+    while(count > 0)
+    {
+        bool eof;
+        qint64 n = decode(scratch.data(), qMin(count, (qint64)scratch.size()), &eof);
+        if(n <= 0)
+            return false;
+        count -= n;
+    }
+    return true;
+}
+
+void CompressedDecoder::recordPoint(bool header)
+{
+    if(!_record || _out - _lastPoint < COMPRESSED_CHUNK_SZ)
+        return;
+
+    CompressedIndex::Point point;
+    point.in = inPos();
+    point.out = _out;
+    point.bits = header ? 0 : (_zs.data_type & 7);
+    point.header = header;
+    if(!header)
+    {
+        uInt len = GZIP_WINDOW_SZ;
+        point.window.resize(len);
+        inflateGetDictionary(&_zs, (Bytef*)point.window.data(), &len);
+        point.window.resize(len);
+    }
+    _record->addPoint(point);
+    _lastPoint = _out;
+}
+
+// Decompresses up to maxOut bytes, fewer only at the end of the file, which
+// sets eof. Returns -1 on corrupt data.
+qint64 CompressedDecoder::decode(char* out, qint64 maxOut, bool* eof)
+{
+    *eof = false;
+    if(_format == CompressedIndex::Zstd)
+        return decodeZstd(out, maxOut, eof);
+    return decodeGzip(out, maxOut, eof);
+}
+
+qint64 CompressedDecoder::decodeGzip(char* out, qint64 maxOut, bool* eof)
+{
+    qint64 produced = 0;
+    while(produced < maxOut)
+    {
+        if(!refill())
+        {
+            *eof = true;
+            break;
+        }
+
+        _zs.next_in = (Bytef*)_inBuf.data() + _inUsed;
+        _zs.avail_in = _inLen - _inUsed;
+        _zs.next_out = (Bytef*)out + produced;
+        _zs.avail_out = (uInt)qMin(maxOut - produced, (qint64)INT_MAX);
+        uInt availOut = _zs.avail_out;
+
+        // Z_BLOCK stops at every deflate block boundary, where points can go
+        int ret = inflate(&_zs, _record ? Z_BLOCK : Z_NO_FLUSH);
+
+        qint64 n = availOut - _zs.avail_out;
+        produced += n;
+        _out += n;
+        _inUsed = _inLen - _zs.avail_in;
+
+        if(ret == Z_STREAM_END)
+        {
+            // another gzip member may follow
+            if(_raw && !skipInput(GZIP_TRAILER_SZ))
+                return -1;
+            _raw = false;
+            inflateReset2(&_zs, 15+32);
+            _memberEnded = true;
+            recordPoint(true);
+            continue;
+        }
+        if(ret == Z_DATA_ERROR && _memberEnded && n == 0)
+        {
+            // padding after the last member
+            *eof = true;
+            break;
+        }
+        if(ret != Z_OK && ret != Z_BUF_ERROR)
+            return -1;
+        if(n > 0)
+            _memberEnded = false;
+
+        if((_zs.data_type & 128) && !(_zs.data_type & 64))
+            recordPoint(false);
+    }
+    return produced;
+}
+
+qint64 CompressedDecoder::decodeZstd(char* out, qint64 maxOut, bool* eof)
+{
+    qint64 produced = 0;
+    while(produced < maxOut)
+    {
+        if(!refill())
+        {
+            *eof = true;
+            break;
+        }
+
+        ZSTD_inBuffer in = { _inBuf.constData(), (size_t)_inLen, (size_t)_inUsed };
+        ZSTD_outBuffer outBuf = { out + produced, (size_t)(maxOut - produced), 0 };
+        size_t ret = ZSTD_decompressStream(_zstd, &outBuf, &in);
+        if(ZSTD_isError(ret))
+            return -1;
+
+        produced += outBuf.pos;
+        _out += outBuf.pos;
+        _inUsed = (int)in.pos;
+
+        // frames are independent, so each boundary can be a point
+        if(ret == 0)
+            recordPoint(true);
+    }
+    return produced;
+}
+
+
+CompressedFile::CompressedFile(const QString& fileName, QSharedPointer<CompressedIndex> index)
+    : MemoryClient("decompressed chunks", true),
+      _fileName(fileName), _compressedSize(0), _index(index), _pass(NULL), _random(NULL)
+{
+}
+
+CompressedFile::~CompressedFile()
+{
+    close();
+}
+
+bool CompressedFile::isCompressed(const QString& fileName)
+{
+    return fileName.endsWith(".gz", Qt::CaseInsensitive) || fileName.endsWith(".zst", Qt::CaseInsensitive);
+}
+
+// Only the CompressedFile that creates the index runs the indexing pass.
+bool CompressedFile::open(OpenMode mode)
+{
+    if(mode & WriteOnly)
+        return false;
+
+    QFile file(_fileName);
+    if(!file.open(QIODevice::ReadOnly))
+        return false;
+    _compressedSize = file.size();
+
+    if(!_index)
+    {
+        uchar magic[4];
+        if(file.read((char*)magic, 4) != 4)
+            return false;
+
+        CompressedIndex::Format format;
+        if(magic[0] == 0x1f && magic[1] == 0x8b)
+            format = CompressedIndex::Gzip;
+        else if(magic[0] == 0x28 && magic[1] == 0xb5 && magic[2] == 0x2f && magic[3] == 0xfd)
+            format = CompressedIndex::Zstd;
+        else
+            return false;
+
+        _index = QSharedPointer<CompressedIndex>(new CompressedIndex(format));
+        CompressedIndex::Point start = { 0, 0, 0, true, QByteArray() };
+        _index->addPoint(start);
+        _pass = new CompressedDecoder(format, _fileName, _index.data());
+        if(!_pass->start(start))
+        {
+            delete _pass;
+            _pass = NULL;
+            return false;
+        }
+    }
+
+    // unbuffered, since decompressed chunks are cached here anyway
+    return QIODevice::open(mode | QIODevice::Unbuffered);
+}
+
+void CompressedFile::close()
+{
+    delete _pass;
+    _pass = NULL;
+    delete _random;
+    _random = NULL;
+    {
+        QMutexLocker locker(&_cacheLock);
+        _cache.clear();
+        setMemoryUsed(0);
+    }
+    QIODevice::close();
+}
+
+// Exact once the whole file has been decompressed; until then, always a
+// chunk past the decompressed part so reads carry on into it.
+qint64 CompressedFile::size() const
+{
+    if(_index && _index->isComplete())
+        return _index->size();
+    return (_pass ? _pass->outPos() : pos()) + COMPRESSED_CHUNK_SZ;
+}
+
+// Runs the indexing pass to the end of the file, or for a zstd file not yet
+// read, sizes its frames instead.
+bool CompressedFile::buildIndex()
+{
+    if(_pass && _index->format == CompressedIndex::Zstd && _pass->outPos() == 0 && buildZstdIndex())
+        return true;
+
+    Chunk chunk;
+    while(_pass && passNextChunk(&chunk))
+        ;
+    return _index && _index->isComplete();
+}
+
+// Finds the frames from their headers and decompresses those that don't
+// give their size, in parallel, placing points at frame starts as the pass
+// would. Returns false, leaving the pass to do it, if the frames can't be
+// walked; the pass then also copes with a corrupt tail.
+bool CompressedFile::buildZstdIndex()
+{
+    QFile file(_fileName);
+    QList<ZstdFrame> frames;
+    if(!file.open(QIODevice::ReadOnly) || !scanZstdFrames(&file, &frames))
+        return false;
+
+    QString fileName = _fileName;
+    QtConcurrent::blockingMap(frames, [fileName](ZstdFrame& frame) {
+        if(frame.outSize < 0)
+            frame.outSize = zstdFrameSize(fileName, frame);
+    });
+
+    qint64 out = 0, lastPoint = 0;
+    for(const ZstdFrame& frame: frames)
+    {
+        if(frame.outSize < 0)
+            return false;
+        if(out - lastPoint >= COMPRESSED_CHUNK_SZ)
+        {
+            CompressedIndex::Point point;
+            point.in = frame.in;
+            point.out = out;
+            point.bits = 0;
+            point.header = true;
+            _index->addPoint(point);
+            lastPoint = out;
+        }
+        out += frame.outSize;
+    }
+
+    _index->setComplete(out);
+    delete _pass;
+    _pass = NULL;
+    return true;
+}
+
+// Compressed bytes consumed by the indexing pass, for progress.
+qint64 CompressedFile::compressedPos() const
+{
+    return _pass ? _pass->inPos() : _compressedSize;
+}
+
+bool CompressedFile::passNextChunk(Chunk* chunk)
+{
+    bool eof;
+    chunk->begin = _pass->outPos();
+    chunk->data.resize(COMPRESSED_CHUNK_SZ);
+    qint64 n = _pass->decode(chunk->data.data(), chunk->data.size(), &eof);
+    chunk->data.resize(qMax(n, (qint64)0));
+    if(eof || n < 0)
+    {
+        // a corrupt tail ends the file where decoding stopped
+        _index->setComplete(chunk->begin + chunk->data.size());
+        delete _pass;
+        _pass = NULL;
+    }
+    return n > 0;
+}
+
+void CompressedFile::cacheChunk(const Chunk& chunk)
+{
+    int maxChunks = MemoryBudget::isOver() ? 1 : COMPRESSED_CACHE_CHUNKS;
+    _cache.prepend(chunk);
+    while(_cache.size() > maxChunks)
+        _cache.removeLast();
+
+    qint64 bytes = 0;
+    for(const Chunk& cached: _cache)
+        bytes += cached.data.capacity();
+    setMemoryUsed(bytes);
+}
+
+// Drops the cached chunks unless a read is using them.
+qint64 CompressedFile::evict()
+{
+    if(!_cacheLock.tryLock())
+        return 0;
+    qint64 bytes = 0;
+    for(const Chunk& cached: _cache)
+        bytes += cached.data.capacity();
+    _cache.clear();
+    _cacheLock.unlock();
+    return bytes;
+}
+
+// The cached chunk holding pos, decompressing it first if needed.
+const CompressedFile::Chunk* CompressedFile::chunkAt(qint64 pos)
+{
+    for(int n = 0; n < _cache.size(); n++)
+    {
+        const Chunk& chunk = _cache[n];
+        if(pos >= chunk.begin && pos < chunk.begin + chunk.data.size())
+        {
+            if(n > 0)
+                _cache.move(n, 0);
+            touch();
+            return &_cache.first();
+        }
+    }
+
+    Chunk chunk;
+    QElapsedTimer timer;
+    timer.start();
+    if(_pass && pos >= _pass->outPos())
+    {
+        do
+        {
+            if(!passNextChunk(&chunk))
+                return NULL;
+        } while(pos >= chunk.begin + chunk.data.size());
+        cacheChunk(chunk);
+        touch();
+        return &_cache.first();
+    }
+
+    if(_index->isComplete() && pos >= _index->size())
+        return NULL;
+
+    CompressedIndex::Point point;
+    if(!_index->findPoint(pos, &point))
+        return NULL;
+    if(!_random)
+        _random = new CompressedDecoder(_index->format, _fileName);
+
+    // chunks are aligned to the point, which is usually the chunk itself
+    qint64 skip = (pos - point.out) / COMPRESSED_CHUNK_SZ * COMPRESSED_CHUNK_SZ;
+    if(!_random->start(point) || !_random->skip(skip))
+        return NULL;
+
+    bool eof;
+    chunk.begin = point.out + skip;
+    chunk.data.resize(COMPRESSED_CHUNK_SZ);
+    qint64 n = _random->decode(chunk.data.data(), chunk.data.size(), &eof);
+    if(n <= 0 || pos >= chunk.begin + n)
+        return NULL;
+    chunk.data.resize(n);
+    cacheChunk(chunk);
+    touch();
+    setRebuildCost(timer.nsecsElapsed() / 1e6);
+    return &_cache.first();
+}
+
+qint64 CompressedFile::readData(char* data, qint64 maxSize)
+{
+    QMutexLocker locker(&_cacheLock);
+    qint64 pos = this->pos();
+    qint64 read = 0;
+    while(read < maxSize)
+    {
+        const Chunk* chunk = chunkAt(pos + read);
+        if(!chunk)
+            break;
+        qint64 ofs = pos + read - chunk->begin;
+        qint64 n = qMin(chunk->data.size() - ofs, maxSize - read);
+        memcpy(data + read, chunk->data.constData() + ofs, n);
+        read += n;
+    }
+    return read;
+}
+
+// Copies up to and including the next newline straight out of the chunks;
+// the default reads one byte at a time.
+qint64 CompressedFile::readLineData(char* data, qint64 maxSize)
+{
+    QMutexLocker locker(&_cacheLock);
+    qint64 pos = this->pos();
+    qint64 read = 0;
+    while(read < maxSize)
+    {
+        const Chunk* chunk = chunkAt(pos + read);
+        if(!chunk)
+            break;
+        qint64 ofs = pos + read - chunk->begin;
+        qint64 avail = qMin(chunk->data.size() - ofs, maxSize - read);
+        const char* src = chunk->data.constData() + ofs;
+        const char* newline = (const char*)memchr(src, '\n', avail);
+        qint64 n = newline ? (newline - src + 1) : avail;
+        memcpy(data + read, src, n);
+        read += n;
+        if(newline)
+            break;
+    }
+    return read;
+}
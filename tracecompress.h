@@ -0,0 +1,106 @@
+#ifndef TRACECOMPRESS_H
+#define TRACECOMPRESS_H
+
+#include <QIODevice>
+#include <QAtomicInteger>
+#include <QList>
+#include <QVector>
+#include <QMutex>
+#include <QSharedPointer>
+#include "tracememory.h"
+
+#define COMPRESSED_CHUNK_SZ     (4*1024*1024)   // decompressed bytes between access points
+#define COMPRESSED_CACHE_CHUNKS 4
+
+// Places in a gzip or zstd file where decompression can start: for gzip a
+// deflate block boundary with the 32K window before it, for zstd a frame
+// boundary. Points are added by the first sequential pass over the file,
+// at most one per COMPRESSED_CHUNK_SZ of output, and shared by every
+// CompressedFile opened on the same file afterwards. A zstd index can also
+// be built at once from the frame headers, with the frames sized in
+// parallel.
+class CompressedIndex
+{
+public:
+    enum Format { Gzip, Zstd };
+
+    struct Point {
+        qint64 in;          // compressed offset
+        qint64 out;         // decompressed offset
+        int bits;           // gzip: bits of the byte before in not yet consumed
+        bool header;        // at the start of a gzip member or zstd frame
+        QByteArray window;  // gzip: the output preceding out, for raw inflate
+    };
+
+    CompressedIndex(Format format) : format(format), _memory("compressed index") { }
+
+    bool findPoint(qint64 pos, Point* point);
+    void addPoint(const Point& point);
+
+    // read from any thread
+    bool isComplete() const { return _complete.loadAcquire() != 0; }
+    qint64 size() const { return _size.loadRelaxed(); }   // decompressed, once complete
+    void setComplete(qint64 size);
+
+    Format format;
+
+protected:
+    QAtomicInteger<qint64> _size;
+    QAtomicInt _complete;
+    QMutex _lock;
+    QVector<Point> _points;
+    MemoryClient _memory;
+};
+
+class CompressedDecoder;
+
+// Read-only random access to a gzip (.gz) or zstd (.zst) trace as if it were
+// the decompressed text. Sequential reads from the start run the indexing
+// pass; other reads decompress from the nearest access point. Either way,
+// decompressed chunks are kept in a small LRU cache, so memory stays a few
+// chunks per open file rather than the decompressed size, and one chunk
+// while the memory budget is exceeded. Open one CompressedFile per thread
+// on a shared index to decompress in parallel.
+class CompressedFile : public QIODevice, public MemoryClient
+{
+public:
+    CompressedFile(const QString& fileName, QSharedPointer<CompressedIndex> index = QSharedPointer<CompressedIndex>());
+    ~CompressedFile();
+
+    static bool isCompressed(const QString& fileName);
+
+    bool open(OpenMode mode) override;
+    void close() override;
+    bool isSequential() const override { return false; }
+    qint64 size() const override;
+
+    bool buildIndex();
+    bool buildZstdIndex();
+    qint64 compressedPos() const;
+    QSharedPointer<CompressedIndex> index() { return _index; }
+
+protected:
+    struct Chunk {
+        qint64 begin;
+        QByteArray data;
+    };
+
+    qint64 readData(char* data, qint64 maxSize) override;
+    qint64 readLineData(char* data, qint64 maxSize) override;
+    qint64 writeData(const char*, qint64) override { return -1; }
+
+    const Chunk* chunkAt(qint64 pos);
+    bool passNextChunk(Chunk* chunk);
+    void cacheChunk(const Chunk& chunk);
+    qint64 evict() override;
+
+    QString _fileName;
+    qint64 _compressedSize;
+    QSharedPointer<CompressedIndex> _index;
+    CompressedDecoder* _pass;   // the indexing pass, if this file runs it
+    CompressedDecoder* _random; // for reads behind the pass
+    QList<Chunk> _cache;        // most recently used first
+    QMutex _cacheLock;          // held while reading, as evict() runs on other threads
+};
+
+#endif // TRACECOMPRESS_H
@@ -1,9 +1,22 @@
 #include "tracedata.h"
+#include "tracepreview.h"
+#include "tracecompress.h"
+#include "tracejson.h"
+#include <ctype.h>
 #include <math.h>
 #include <stdlib.h>
+#include <limits.h>
 #include <QRegExp>
 #include <QMessageBox>
 #include <QtAlgorithms>
+#include <QMap>
+#include <QFileInfo>
+#include <QBuffer>
+#include <QScopedPointer>
+#include <QThread>
+#include <QtConcurrent>
+#include <algorithm>
+#include <queue>
 
 #define DEFAULT_CAPACITY    4096
 
@@ -11,6 +24,24 @@
 
 #define MAX_LINE_SZ         256
 
+#define SOURCE_POS_BITS     48
+#define SOURCE_POS_MASK     ((Q_INT64_C(1) << SOURCE_POS_BITS) - 1)
+#define SPAN_END_BIT        (Q_INT64_C(1) << (SOURCE_POS_BITS - 1))     // JSON X events: the end
+#define MAX_SOURCES         (1 << (63 - SOURCE_POS_BITS))
+
+#define RANGE_SLACK         0.05
+
+#define PREVIEW_CHUNK_EVENTS (256*1024)
+
+#define MIN_SORT_SEGMENT    (64*1024)
+#define MERGE_CHUNK_SZ      (1024*1024)
+
+#define STREAM_INITIAL_SLOTS 1024
+
+#define PROGRESS_STEPS      1000
+#define PROGRESS_POLL_MS    20
+#define PROGRESS_INTERVAL   65536
+
 //////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////
@@ -35,6 +66,26 @@ void Trace::findEvents(double t, int* evIdxLeftOf, int* evIdxRightOf)
     *evIdxRightOf = (left < count) ? left : -1;
 }
 
+void Trace::findEvents(TraceTicks t, int* evIdxLeftOf, int* evIdxRightOf)
+{
+    int left = 0;
+    int count = numEvents();
+    int right = count;
+    int mid;
+
+    while(left < right)
+    {
+        mid = (right+left)/2;
+        if(getEventTicks(mid) < t)
+            left = mid + 1;
+        else
+            right = mid;
+    }
+
+    *evIdxLeftOf = (left > 0) ? (left-1) : -1;
+    *evIdxRightOf = (left < count) ? left : -1;
+}
+
 int Trace::findNearestEvent(double t)
 {
     int left, right;
@@ -67,8 +118,150 @@ int Trace::eventsInRange(double begin, double end, int* idx)
 //////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////
 
+// Index of the first event of trace after time t.
+static int firstEventAfter(Trace* trace, TraceTicks t)
+{
+    int left = 0;
+    int right = trace->numEvents();
+    while(left < right)
+    {
+        int mid = (right+left)/2;
+        if(trace->getEventTicks(mid) <= t)
+            left = mid + 1;
+        else
+            right = mid;
+    }
+    return left;
+}
+
+// Index of the first event of trace at or after time t.
+template<typename Time> static int firstEventFrom(Trace* trace, Time t)
+{
+    int left, right;
+    trace->findEvents(t, &left, &right);
+    return (right == -1) ? trace->numEvents() : right;
+}
+
+TraceMerge::TraceMerge(const QList<Trace*>& traces)
+    : _traces(traces), _pos(traces.size(), 0), _ticks(traces.size(), 0), _backward(false)
+{
+}
+
+void TraceMerge::seek(double t)
+{
+    for(int n = 0; n < _traces.size(); n++)
+        _pos[n] = firstEventFrom(_traces[n], t);
+    start(false);
+}
+
+void TraceMerge::seekBack(double t)
+{
+    for(int n = 0; n < _traces.size(); n++)
+        _pos[n] = firstEventFrom(_traces[n], t);
+    start(true);
+}
+
+// Events at the same time come before this one in traces listed earlier,
+// and after it in traces listed later.
+void TraceMerge::seekAfter(int trace, int idx)
+{
+    TraceTicks t = _traces[trace]->getEventTicks(idx);
+    for(int n = 0; n < _traces.size(); n++)
+    {
+        if(n == trace)
+            _pos[n] = idx + 1;
+        else
+            _pos[n] = (n < trace) ? firstEventAfter(_traces[n], t) : firstEventFrom(_traces[n], t);
+    }
+    start(false);
+}
+
+void TraceMerge::seekBefore(int trace, int idx)
+{
+    TraceTicks t = _traces[trace]->getEventTicks(idx);
+    for(int n = 0; n < _traces.size(); n++)
+    {
+        if(n == trace)
+            _pos[n] = idx;
+        else
+            _pos[n] = (n < trace) ? firstEventAfter(_traces[n], t) : firstEventFrom(_traces[n], t);
+    }
+    start(true);
+}
+
+void TraceMerge::start(bool backward)
+{
+    _backward = backward;
+    _heap.clear();
+    for(int n = 0; n < _traces.size(); n++)
+        push(n);
+    for(int i = _heap.size()/2 - 1; i >= 0; i--)
+        siftDown(i);
+}
+
+// Appends the trace if it has an event left in the current direction; the
+// caller restores the heap order.
+void TraceMerge::push(int trace)
+{
+    int idx = _backward ? _pos[trace] - 1 : _pos[trace];
+    if(idx < 0 || idx >= _traces[trace]->numEvents())
+        return;
+    _ticks[trace] = _traces[trace]->getEventTicks(idx);
+    _heap.push_back(trace);
+}
+
+void TraceMerge::next()
+{
+    int top = _heap.first();
+    _pos[top] += _backward ? -1 : 1;
+
+    int idx = _backward ? _pos[top] - 1 : _pos[top];
+    if(idx >= 0 && idx < _traces[top]->numEvents())
+    {
+        _ticks[top] = _traces[top]->getEventTicks(idx);
+    }
+    else
+    {
+        _heap.first() = _heap.last();
+        _heap.removeLast();
+    }
+    if(!_heap.isEmpty())
+        siftDown(0);
+}
+
+bool TraceMerge::before(int a, int b) const
+{
+    if(_ticks[a] != _ticks[b])
+        return _backward ? (_ticks[a] > _ticks[b]) : (_ticks[a] < _ticks[b]);
+    return _backward ? (a > b) : (a < b);
+}
+
+void TraceMerge::siftDown(int i)
+{
+    int count = _heap.size();
+    for(;;)
+    {
+        int first = i;
+        int left = 2*i + 1;
+        int right = left + 1;
+        if(left < count && before(_heap[left], _heap[first]))
+            first = left;
+        if(right < count && before(_heap[right], _heap[first]))
+            first = right;
+        if(first == i)
+            return;
+        qSwap(_heap[i], _heap[first]);
+        i = first;
+    }
+}
+
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+
 TraceFile::TraceFile()
-    : _file(NULL)
+    : _baseTicks(0), _cropped(false), _preview(NULL), _generation(0), _widened(false),
+      _eventsMemory("events"), _textMemory("trace text")
 {
 }
 
@@ -84,96 +277,593 @@ int TraceFile::numEvents()
 
 double TraceFile::getEventTime(int idx)
 {
-    return _data.at(idx).timestamp;
+    return ticksToSeconds(_data.at(idx).ticks - _baseTicks);
 }
 
-const char* TraceFile::getEventText(int idx, bool full)
+// Binary search over integer ticks for the first event at ticks or later.
+template<typename TicksAt> static int firstEventAtOrAfter(TraceTicks ticks, int count, TicksAt ticksAt)
 {
-    QByteArray line;
-    const char* lineData;
+    int left = 0;
+    int right = count;
+    while(left < right)
+    {
+        int mid = (right+left)/2;
+        if(ticksAt(mid) < ticks)
+            left = mid + 1;
+        else
+            right = mid;
+    }
+    return left;
+}
+
+// The same for a view time t, in seconds after base. t can fall between
+// two ticks, so the answer is then moved over an event whose time rounds
+// to the other side of t, to agree with getEventTime.
+template<typename TicksAt> static int firstEventAtOrAfter(double t, TraceTicks base, int count, TicksAt ticksAt)
+{
+    int left = firstEventAtOrAfter(addTicks(secondsToTicks(t), base), count, ticksAt);
+    while(left > 0 && ticksToSeconds(ticksAt(left-1) - base) >= t)
+        --left;
+    while(left < count && ticksToSeconds(ticksAt(left) - base) < t)
+        ++left;
+    return left;
+}
+
+void TraceFile::findEvents(double t, int* evIdxLeftOf, int* evIdxRightOf)
+{
+    int count = _data.size();
+    int left = firstEventAtOrAfter(t, _baseTicks, count, [this](int idx) { return _data.at(idx).ticks; });
+    *evIdxLeftOf = (left > 0) ? (left-1) : -1;
+    *evIdxRightOf = (left < count) ? left : -1;
+}
+
+void TraceFile::findEvents(TraceTicks t, int* evIdxLeftOf, int* evIdxRightOf)
+{
+    int count = _data.size();
+    int left = firstEventAtOrAfter(t, count, [this](int idx) { return _data.at(idx).ticks; });
+    *evIdxLeftOf = (left > 0) ? (left-1) : -1;
+    *evIdxRightOf = (left < count) ? left : -1;
+}
+
+QString TraceFile::getSourceName(int src)
+{
+    if(src < 0 || src >= _sources.size())
+        return QString();
+    return _sources[src]->fileName;
+}
 
+int TraceFile::getEventSource(int idx)
+{
     if(idx < 0 || idx >= _data.size())
+        return -1;
+    return (int)(_data[idx].filePos >> SOURCE_POS_BITS);
+}
+
+// Opens a trace for reading as text, decompressing .gz and .zst files. The
+// first open of a compressed file creates its index; later opens share it.
+static QIODevice* openTraceFile(const QString& fileName, QSharedPointer<CompressedIndex>* index)
+{
+    QIODevice* file;
+    if(CompressedFile::isCompressed(fileName))
+        file = new CompressedFile(fileName, *index);
+    else
+        file = new QFile(fileName);
+
+    if(!file->open(QIODevice::ReadOnly | QIODevice::Text))
+    {
+        delete file;
         return NULL;
+    }
+    if(CompressedFile::isCompressed(fileName))
+        *index = static_cast<CompressedFile*>(file)->index();
+    return file;
+}
 
-    quint64 filePos = _data[idx].filePos;
+// Copies the text of the line at lineData into txt: the whole line if full,
+// otherwise everything after the timestamp.
+static const char* extractEventText(const char* lineData, bool full, char* txt)
+{
+    TraceTicks timestamp;
 
-    static char txt[MAX_LINE_SZ]; //bleh
-    double timestamp;
+    txt[0] = '\0';
+    if(full)
+    {
+        sscanf(lineData, "%255[^\n]", txt);
+        return txt;
+    }
+    const char* detail = parseTicks(lineData, 0, &timestamp);
+    if(detail && sscanf(detail, " %255[^\n]", txt) == 1)
+        return txt;
+    else
+        return NULL;
+}
+
+// The line of text for the event at filePos, from the file or from memory.
+// JSON events have their line formatted into jsonLine, from the whole
+// object: its lane fields may well come after a large args object.
+const char* TraceFile::readEventLine(Source* src, QIODevice* file, quint64 filePos, TraceTicks timestamp,
+                                     QByteArray* line, char* jsonLine)
+{
+    bool spanEnd = (filePos & SPAN_END_BIT) != 0;
+    filePos &= ~SPAN_END_BIT;
 
-    if(_file)
+    const char* lineData;
+    const char* dataEnd;
+    if(file)
     {
-        _file->seek(filePos);
-        line = _file->readLine();
-        lineData = line.data();
+        file->seek(filePos);
+        if(src->json)
+        {
+            line->clear();
+            for(qint64 len = JSON_MAX_OBJECT_SZ; ; len = line->size())
+            {
+                QByteArray more = file->read(len);
+                line->append(more);
+                if(more.size() < len || TraceJson::objectEnd(line->constData(), line->constData() + line->size()))
+                    break;
+            }
+        }
+        else
+            *line = file->readLine();
+        lineData = line->constData();
+        dataEnd = lineData + line->size();
     }
-    else if(_fileData)
+    else if(src->fileData)
     {
-        lineData = _fileData->data() + filePos;
+        lineData = src->fileData->data() + filePos;
+        dataEnd = src->fileData->constData() + src->fileData->size();
     }
     else
         return NULL;
 
-    if(full)
+    if(!src->json)
+        return lineData;
+
+    const char* objEnd = TraceJson::objectEnd(lineData, dataEnd);
+    if(objEnd)
+        dataEnd = objEnd;
+    TraceJson::formatEvent(lineData, dataEnd, timestamp - src->clockTicks, spanEnd, jsonLine, MAX_LINE_SZ);
+    return jsonLine;
+}
+
+const char* TraceFile::getEventText(int idx, bool full)
+{
+    QByteArray line;
+    const char* lineData;
+
+    if(idx < 0 || idx >= _data.size())
+        return NULL;
+
+    qint64 packedPos = _data[idx].filePos;
+    Source* src = _sources.at((int)(packedPos >> SOURCE_POS_BITS));
+    quint64 filePos = packedPos & SOURCE_POS_MASK;
+
+    static char txt[MAX_LINE_SZ]; //bleh
+    static char jsonLine[MAX_LINE_SZ];
+
+    lineData = readEventLine(src, src->file, filePos, _data[idx].ticks, &line, jsonLine);
+    if(!lineData)
+        return NULL;
+
+    return extractEventText(lineData, full, txt);
+}
+
+TraceFile::Reader::Reader(TraceFile* trace)
+    : _trace(trace)
+{
+    _txt.resize(MAX_LINE_SZ);
+    _jsonLine.resize(MAX_LINE_SZ);
+    for(int n = 0; n < trace->_sources.size(); n++)
+        _files.append(NULL);
+}
+
+TraceFile::Reader::~Reader()
+{
+    qDeleteAll(_files);
+}
+
+// Same as TraceFile::getEventText, but with its own buffer and file handles
+// so that each worker thread can read text at the same time.
+const char* TraceFile::Reader::getEventText(int idx, bool full)
+{
+    const char* lineData;
+
+    if(idx < 0 || idx >= _trace->_data.size())
+        return NULL;
+
+    qint64 packedPos = _trace->_data[idx].filePos;
+    int srcIdx = (int)(packedPos >> SOURCE_POS_BITS);
+    Source* src = _trace->_sources.at(srcIdx);
+    quint64 filePos = packedPos & SOURCE_POS_MASK;
+
+    QIODevice* file = NULL;
+    if(!src->fileData)
     {
-        sscanf(lineData, "%[^\n]", txt);
-        return txt;
+        file = _files[srcIdx];
+        if(!file)
+        {
+            // the index is complete by now; share it without writing to it
+            QSharedPointer<CompressedIndex> index = src->index;
+            file = openTraceFile(src->fileName, &index);
+            if(!file)
+                return NULL;
+            _files[srcIdx] = file;
+        }
     }
-    else if(sscanf(lineData, "%lf %[^\n]", &timestamp, txt) == 2)
-        return txt;
-    else
+
+    lineData = readEventLine(src, file, filePos, _trace->_data[idx].ticks, &_line, _jsonLine.data());
+    if(!lineData)
         return NULL;
+
+    return extractEventText(lineData, full, _txt.data());
 }
 
 static bool eventLessThan(const TraceFile::EvData &e1, const TraceFile::EvData &e2)
 {
-    return e1.timestamp < e2.timestamp;
+    return e1.ticks < e2.ticks;
 }
 
-bool TraceFile::openText(const QString& fileName, QProgressDialog* progDlg)
+// Number of elements taken from a when merging the sorted ranges a and b
+// produces the first k output elements. Ties are taken from a first, as
+// std::merge does.
+static qsizetype mergeCoRank(qsizetype k, const TraceFile::EvData* a, qsizetype m, const TraceFile::EvData* b, qsizetype n)
 {
-    bool isMonotonic = true;
-    unsigned int idx = 0;
-    double lastTime = 0;
+    qsizetype lo = (k > n) ? k - n : 0;
+    qsizetype hi = (k < m) ? k : m;
+    while(lo < hi)
+    {
+        qsizetype i = lo + (hi - lo)/2;
+        if(eventLessThan(b[k-i-1], a[i]))
+            hi = i;
+        else
+            lo = i + 1;
+    }
+    return lo;
+}
+
+// Stable sort for mostly sorted data. The sorted runs already present are
+// detected, grouped into segments of at least MIN_SORT_SEGMENT events and
+// then merged pairwise. Every merge is split into independent chunks of
+// output, so all rounds run across the whole thread pool. Merging adjacent
+// stably sorted blocks left-first gives exactly the std::stable_sort order.
+// Out of order events are sorted in one contiguous copy, whose blocks are
+// freed as they are copied.
+static void sortEvents(BlockList<TraceFile::EvData>& events, TraceFile::OrderStats* stats)
+{
+    typedef TraceFile::EvData EvData;
+    typedef struct { qsizetype begin, end; } Segment;
+    typedef struct { qsizetype aBegin, aEnd, bEnd, k0, k1; } MergeTask;
 
-    if(_file)
-        delete _file;
-    _file = new QFile(fileName);
+    qsizetype count = events.size();
+    QList<qsizetype> bounds;
+    QList<Segment> unsortedSegs;
+    qsizetype segBegin = 0;
+    bool segSorted = true;
 
-    if(_fileData)
+    stats->numRuns = (count > 0) ? 1 : 0;
+    stats->numOutOfOrder = 0;
+    stats->maxStepBack = 0;
+
+    bounds.push_back(0);
+    for(qsizetype n = 1; n <= count; n++)
     {
-        delete _fileData;
-        _fileData = NULL;
+        bool runEnd = (n == count) || eventLessThan(events.at(n), events.at(n-1));
+        if(n < count && runEnd)
+        {
+            double stepBack = ticksToSeconds(events.at(n-1).ticks - events.at(n).ticks);
+            if(stepBack > stats->maxStepBack)
+                stats->maxStepBack = stepBack;
+            ++stats->numRuns;
+            ++stats->numOutOfOrder;
+        }
+        if(!runEnd)
+            continue;
+
+        if(n - segBegin >= MIN_SORT_SEGMENT || n == count)
+        {
+            if(!segSorted)
+                unsortedSegs.push_back(Segment{segBegin, n});
+            bounds.push_back(n);
+            segBegin = n;
+            segSorted = true;
+        }
+        else
+            segSorted = false;
     }
 
-    _data.clear();
+    if(stats->numRuns <= 1)
+        return;
+
+    QList<EvData> data;
+    data.reserve(count);
+    for(; !events.isEmpty(); events.pop_front())
+        data.push_back(events.first());
+
+    EvData* src = data.data();
+    QtConcurrent::blockingMap(unsortedSegs, [src](const Segment& seg) {
+        std::stable_sort(src + seg.begin, src + seg.end, eventLessThan);
+    });
+
+    QList<EvData> buffer(count);
+    EvData* dst = buffer.data();
+
+    while(bounds.size() > 2)
+    {
+        QList<MergeTask> tasks;
+        QList<qsizetype> nextBounds;
+
+        for(int s = 0; s+1 < bounds.size(); s += 2)
+        {
+            qsizetype aBegin = bounds[s];
+            qsizetype aEnd = bounds[s+1];
+            qsizetype bEnd = (s+2 < bounds.size()) ? bounds[s+2] : aEnd;
+            for(qsizetype k = 0; k < bEnd - aBegin; k += MERGE_CHUNK_SZ)
+            {
+                qsizetype k1 = qMin(k + MERGE_CHUNK_SZ, bEnd - aBegin);
+                tasks.push_back(MergeTask{aBegin, aEnd, bEnd, k, k1});
+            }
+            nextBounds.push_back(aBegin);
+        }
+        nextBounds.push_back(count);
+
+        QtConcurrent::blockingMap(tasks, [src,dst](const MergeTask& t) {
+            const EvData* a = src + t.aBegin;
+            const EvData* b = src + t.aEnd;
+            qsizetype m = t.aEnd - t.aBegin;
+            qsizetype n = t.bEnd - t.aEnd;
+            qsizetype i0 = mergeCoRank(t.k0, a, m, b, n);
+            qsizetype i1 = mergeCoRank(t.k1, a, m, b, n);
+            std::merge(a + i0, a + i1, b + (t.k0 - i0), b + (t.k1 - i1), dst + t.aBegin + t.k0, eventLessThan);
+        });
+
+        std::swap(src, dst);
+        bounds = nextBounds;
+    }
+
+    if(src != data.data())
+        data.swap(buffer);
+    buffer = QList<EvData>();
+    events.append(data);
+}
+
+// Finds the first line starting at or after pos that has a timestamp.
+static bool readTimestampAt(QIODevice* file, qint64 pos, qint64* linePos, TraceTicks* timestamp)
+{
+    if(pos > 0)
+    {
+        file->seek(pos-1);
+        file->readLine();
+    }
+    else
+        file->seek(0);
 
-    if(_file->size() <= MAX_IN_MEMORY_SZ)
+    while(!file->atEnd())
     {
-        _fileData = new QByteArray();
+        *linePos = file->pos();
+        QByteArray line = file->readLine();
+        if(parseTicks(line.constData(), 0, timestamp))
+            return true;
     }
+    *linePos = file->size();
+    return false;
+}
+
+// Byte offset of the first event at or after time t, found by binary search
+// over the file. Only meaningful when timestamps are roughly monotonic.
+static qint64 findTimeOffset(QIODevice* file, TraceTicks t)
+{
+    qint64 lo = 0;
+    qint64 hi = file->size();
+    qint64 linePos;
+    TraceTicks timestamp;
 
-    if (!_file->open(QIODevice::ReadOnly | QIODevice::Text))
+    while(lo < hi)
     {
-        delete _file;
-        _file = NULL;
+        qint64 mid = lo + (hi - lo)/2;
+        if(readTimestampAt(file, mid, &linePos, &timestamp) && timestamp < t)
+            lo = linePos + 1;
+        else
+            hi = mid;
+    }
+
+    readTimestampAt(file, lo, &linePos, &timestamp);
+    return linePos;
+}
+
+// Compressed files have to be decompressed once to find their end.
+bool TraceFile::probeTimeSpan(const QString& fileName, double* first, double* last)
+{
+    if(TraceJson::isJson(fileName))
+        return false;
+
+    QSharedPointer<CompressedIndex> index;
+    QScopedPointer<QIODevice> file(openTraceFile(fileName, &index));
+    qint64 linePos;
+    TraceTicks firstTicks, lastTicks;
+
+    if(!file)
         return false;
+    if(!readTimestampAt(file.data(), 0, &linePos, &firstTicks))
+        return false;
+    if(index && !static_cast<CompressedFile*>(file.data())->buildIndex())
+        return false;
+
+    lastTicks = firstTicks;
+    for(qint64 tailSz = MAX_LINE_SZ; ; tailSz *= 2)
+    {
+        qint64 pos = qMax(file->size() - tailSz, (qint64)0);
+        bool found = false;
+        TraceTicks timestamp;
+        while(readTimestampAt(file.data(), pos, &linePos, &timestamp))
+        {
+            lastTicks = timestamp;
+            found = true;
+            pos = linePos + 1;
+        }
+        if(found || pos == 0)
+            break;
     }
+    *first = ticksToSeconds(firstTicks);
+    *last = ticksToSeconds(lastTicks);
+    return true;
+}
 
-    double timestamp;
+// The first event in the first block of a JSON file.
+static bool readJsonTimestamp(QIODevice* file, TraceTicks* timestamp)
+{
+    QBuffer head;
+    head.setData(file->read(JSON_SCAN_BLOCK_SZ));
+    head.open(QIODevice::ReadOnly);
+    QVector<qint64> objects;
+    qint64 end;
+    TraceJson::scan(&head, &objects, &end);
 
-    if(progDlg)
+    const char* data = head.data().constData();
+    for(int n = 0; n < objects.size(); n++)
     {
-        progDlg->reset();
-        progDlg->setRange(0, _file->size());
+        qint64 objEnd = (n + 1 < objects.size()) ? objects[n+1] : end;
+        TraceJson::Event ev;
+        if(TraceJson::parseEvent(data + objects[n], data + objEnd, &ev) && ev.phase != 'M')
+        {
+            *timestamp = ev.timestamp;
+            return true;
+        }
     }
+    return false;
+}
 
-    if(_fileData)
+// The first timestamp of the first file that has one, clock offset
+// included, from which view times are counted. It depends on the files
+// alone, so cropped, widened and previewed loads of them all agree on it.
+TraceTicks TraceFile::probeBaseTicks(const QStringList& fileNames, const QList<double>& clockOffsets)
+{
+    for(int n = 0; n < fileNames.size(); n++)
     {
-        *_fileData = _file->readAll();
-        _file->close();
-        delete _file;
-        _file = NULL;
+        QSharedPointer<CompressedIndex> index;
+        QScopedPointer<QIODevice> file(openTraceFile(fileNames[n], &index));
+        if(!file)
+            continue;
+
+        qint64 linePos;
+        TraceTicks timestamp;
+        bool found = TraceJson::isJson(fileNames[n]) ? readJsonTimestamp(file.data(), &timestamp)
+                                                     : readTimestampAt(file.data(), 0, &linePos, &timestamp);
+        if(found)
+            return timestamp + secondsToTicks((n < clockOffsets.size()) ? clockOffsets[n] : 0);
     }
+    return 0;
+}
+
+void TraceFile::parseRegion(Source* src, int srcIdx, qint64 begin, qint64 end)
+{
+    qint64 srcBits = (qint64)srcIdx << SOURCE_POS_BITS;
+    TraceTicks timestamp;
+
+    src->file->seek(begin);
+    qint64 pos = begin;
+    while(pos < end && !src->file->atEnd())
+    {
+        QByteArray line = src->file->readLine();
+        if(parseTicks(line.constData(), 0, &timestamp))
+        {
+            EvData ev;
+            ev.ticks = timestamp + src->clockTicks;
+            ev.filePos = srcBits | pos;
+            src->data.push_back(ev);
+        }
+        qint64 nextPos = src->file->pos();
+        src->bytesParsed.fetchAndAddRelaxed(nextPos - pos);
+        pos = nextPos;
+    }
+}
+
+// Parses only the part of the file covering [begin, end], or, if part of the
+// file is already loaded, the neighbouring regions needed to extend it. The
+// file stays open for getEventText.
+void TraceFile::parseSourceRange(Source* src, int srcIdx, double begin, double end)
+{
+    src->ok = false;
+
+    if(!src->file)
+    {
+        src->file = openTraceFile(src->fileName, &src->index);
+        if(!src->file)
+            return;
+    }
+
+    // the binary search needs the decompressed size
+    if(src->index && !static_cast<CompressedFile*>(src->file)->buildIndex())
+        return;
+
+    TraceTicks slack = secondsToTicks((end - begin) * RANGE_SLACK);
+    qint64 beginPos = findTimeOffset(src->file, secondsToTicks(begin) - src->clockTicks - slack);
+    qint64 endPos = findTimeOffset(src->file, secondsToTicks(end) - src->clockTicks + slack);
+
+    if(src->regionEnd > src->regionBegin)
+    {
+        beginPos = qMin(beginPos, src->regionBegin);
+        endPos = qMax(endPos, src->regionEnd);
+        parseRegion(src, srcIdx, beginPos, src->regionBegin);
+        parseRegion(src, srcIdx, src->regionEnd, endPos);
+    }
+    else
+    {
+        parseRegion(src, srcIdx, beginPos, endPos);
+    }
+
+    src->regionBegin = beginPos;
+    src->regionEnd = endPos;
+
+    sortEvents(src->data, &src->orderStats);
+    src->ok = true;
+}
+
+// Finds the lane ID, the first word after the timestamp.
+static const char* findLaneToken(const char* line, int* len)
+{
+    const char* ptr = line;
+    while(isblank(*ptr)) ++ptr;
+    while(*ptr && !isspace(*ptr)) ++ptr;
+    while(isblank(*ptr)) ++ptr;
+    const char* end = ptr;
+    while(*end && !isspace(*end)) ++end;
+    *len = end - ptr;
+    return ptr;
+}
+
+void TraceFile::parseSource(Source* src, int srcIdx, TracePreview* preview)
+{
+    bool isMonotonic = true;
+    unsigned int idx = 0;
+    TraceTicks lastTime = 0;
+    qint64 srcBits = (qint64)srcIdx << SOURCE_POS_BITS;
+
+    src->fileData = NULL;
+    src->ok = false;
+
+    src->file = openTraceFile(src->fileName, &src->index);
+    if(!src->file)
+        return;
+
+    // compressed sources are streamed, however small
+    CompressedFile* compressed = src->index ? static_cast<CompressedFile*>(src->file) : NULL;
+    if(!compressed && src->file->size() <= MAX_IN_MEMORY_SZ)
+    {
+        src->fileData = new QByteArray();
+    }
+
+    TraceTicks timestamp;
+
+    if(src->fileData)
+    {
+        *src->fileData = src->file->readAll();
+        src->file->close();
+        delete src->file;
+        src->file = NULL;
+    }
+
+    TracePreview::Chunk* previewChunk = preview ? preview->newChunk(srcIdx) : NULL;
+    int previewChunkEvents = 0;
 
     qint64 curFilePos = 0;
     bool eof = false;
@@ -184,16 +874,16 @@ bool TraceFile::openText(const QString& fileName, QProgressDialog* progDlg)
 
         qint64 evFilePos;
 
-        if(_file)
+        if(src->file)
         {
-            evFilePos = curFilePos = _file->pos();
-            line = _file->readLine();
-            eof = _file->atEnd();
+            evFilePos = curFilePos = src->file->pos();
+            line = src->file->readLine();
+            eof = src->file->atEnd();
             lineData = line.data();
         }
         else
         {
-            lineData = _fileData->data() + curFilePos;
+            lineData = src->fileData->data() + curFilePos;
             char* ptr = (char*)lineData;
             evFilePos = curFilePos;
             char ch;
@@ -206,14 +896,14 @@ bool TraceFile::openText(const QString& fileName, QProgressDialog* progDlg)
                 else ++ptr;
             }
             curFilePos += ptr - lineData;
-            if(curFilePos >= _fileData->length())
+            if(curFilePos >= src->fileData->length())
                 eof = true;
         }
 
-        if(progDlg)
-            progDlg->setValue(curFilePos);
+        // progress is measured against the size on disk
+        src->bytesParsed.storeRelaxed(compressed ? compressed->compressedPos() : curFilePos);
 
-        if(strlen(lineData) > 0 && (sscanf(lineData, "%lf", &timestamp) == 1))
+        if(strlen(lineData) > 0 && parseTicks(lineData, 0, &timestamp))
         {
             EvData ev;
 
@@ -221,37 +911,551 @@ bool TraceFile::openText(const QString& fileName, QProgressDialog* progDlg)
                 isMonotonic = false;
             lastTime = timestamp;
 
-            ev.timestamp = timestamp;
-            ev.filePos = evFilePos;
-            _data.push_back(ev);
+            ev.ticks = timestamp + src->clockTicks;
+            ev.filePos = srcBits | evFilePos;
+            src->data.push_back(ev);
             ++idx;
+
+            if(previewChunk)
+            {
+                int laneLen;
+                const char* lane = findLaneToken(lineData, &laneLen);
+                if(laneLen > 0)
+                    preview->addEvent(previewChunk, ev.ticks, lane, laneLen);
+                if(++previewChunkEvents == PREVIEW_CHUNK_EVENTS)
+                {
+                    preview->submit(previewChunk);
+                    previewChunk = preview->newChunk(srcIdx);
+                    previewChunkEvents = 0;
+                }
+            }
         }
     }
 
+    if(previewChunk)
+        preview->submit(previewChunk);
+
     if(!isMonotonic)
     {
         //QMessageBox::warning(NULL, "Warning", "Timestamps are not monotonic!");
-        std::stable_sort(_data.begin(), _data.end(), eventLessThan);
+        sortEvents(src->data, &src->orderStats);
+    }
+    else
+    {
+        src->orderStats.numRuns = src->data.isEmpty() ? 0 : 1;
+        src->orderStats.numOutOfOrder = 0;
+        src->orderStats.maxStepBack = 0;
+    }
+
+    src->ok = true;
+}
+
+// Chrome trace-event JSON: one streaming pass finds the event objects, then
+// chunks of them are parsed in parallel, each task reading its own byte
+// range. Only the object offsets and the events are kept. Cropping doesn't
+// apply; the whole file is loaded the first time.
+void TraceFile::parseJsonSource(Source* src, int srcIdx)
+{
+    typedef struct {
+        int first, last;
+        QList<EvData> data;
+        QList<qint64> threadNames;
+    } JsonChunk;
+
+    qint64 srcBits = (qint64)srcIdx << SOURCE_POS_BITS;
+
+    src->ok = true;
+    if(src->regionEnd > 0)
+        return;
+    src->ok = false;
+
+    src->fileData = NULL;
+    src->file = openTraceFile(src->fileName, &src->index);
+    if(!src->file)
+        return;
+
+    QVector<qint64> objects;
+    qint64 end;
+    bool scanned;
+    if(!src->index && src->file->size() <= MAX_IN_MEMORY_SZ)
+    {
+        src->fileData = new QByteArray(src->file->readAll());
+        delete src->file;
+        src->file = NULL;
+
+        QBuffer buffer(src->fileData);
+        buffer.open(QIODevice::ReadOnly);
+        scanned = TraceJson::scan(&buffer, &objects, &end, &src->bytesParsed);
+    }
+    else
+        scanned = TraceJson::scan(src->file, &objects, &end, &src->bytesParsed);
+    if(!scanned)
+        return;
+
+    QList<JsonChunk> chunks;
+    for(int n = 0; n < objects.size(); n += JSON_CHUNK_EVENTS)
+    {
+        JsonChunk chunk;
+        chunk.first = n;
+        chunk.last = qMin(n + JSON_CHUNK_EVENTS, (int)objects.size());
+        chunks.push_back(chunk);
+    }
+
+    const qint64* offsets = objects.constData();
+    int numObjects = objects.size();
+    QtConcurrent::blockingMap(chunks, [&](JsonChunk& chunk) {
+        qint64 begin = offsets[chunk.first];
+        qint64 stop = (chunk.last < numObjects) ? offsets[chunk.last] : end;
+        QByteArray buf;
+        const char* base;
+
+        if(src->fileData)
+            base = src->fileData->constData() + begin;
+        else
+        {
+            QSharedPointer<CompressedIndex> index = src->index;
+            QScopedPointer<QIODevice> file(openTraceFile(src->fileName, &index));
+            if(!file || !file->seek(begin))
+                return;
+            buf = file->read(stop - begin);
+            base = buf.constData();
+            stop = begin + buf.size();
+        }
+
+        for(int n = chunk.first; n < chunk.last && offsets[n] < stop; n++)
+        {
+            qint64 objEnd = (n + 1 < chunk.last) ? qMin(offsets[n+1], stop) : stop;
+            TraceJson::Event ev;
+            if(!TraceJson::parseEvent(base + (offsets[n] - begin), base + (objEnd - begin), &ev))
+                continue;
+
+            qint64 filePos = srcBits | offsets[n];
+            if(ev.phase == 'M')
+            {
+                chunk.threadNames.push_back(filePos);
+                continue;
+            }
+            chunk.data.push_back(EvData{ ev.timestamp + src->clockTicks, filePos });
+            if(ev.phase == 'X')
+                chunk.data.push_back(EvData{ ev.timestamp + ev.duration + src->clockTicks, filePos | SPAN_END_BIT });
+        }
+    });
+
+    // thread names have no time of their own, so they go at the start
+    TraceTicks first = LLONG_MAX;
+    for(const JsonChunk& chunk: chunks)
+    {
+        for(const EvData& ev: chunk.data)
+            first = qMin(first, ev.ticks);
+    }
+    if(first == LLONG_MAX)
+        first = src->clockTicks;
+
+    for(const JsonChunk& chunk: chunks)
+    {
+        for(qint64 filePos: chunk.threadNames)
+            src->data.push_back(EvData{ first, filePos });
+    }
+    for(JsonChunk& chunk: chunks)
+    {
+        src->data.append(chunk.data);
+        chunk.data = QList<EvData>();
+    }
+
+    sortEvents(src->data, &src->orderStats);
+    src->regionBegin = 0;
+    src->regionEnd = qMax(end, (qint64)1);
+    src->ok = true;
+}
+
+// k-way merge of the per-source event lists, which are already sorted, plus
+// any events loaded earlier. Ties are broken by list order so the result is
+// stable. Each list frees its blocks as they are drained, so the merge holds
+// little more than the lists it merges. The indices of events that weren't
+// loaded before are kept so derived lanes can update incrementally.
+void TraceFile::mergeSources(BlockList<EvData>* loaded)
+{
+    QList<BlockList<EvData>*> lists;
+    if(loaded)
+        lists.push_back(loaded);
+    for(auto src: _sources)
+        lists.push_back(&src->data);
+
+    _generation++;
+    _widened = (loaded != NULL);
+    _added.clear();
+
+    if(lists.size() == 1)
+    {
+        _data.swap(*lists[0]);
+        updateMemoryUsed();
+        return;
+    }
+
+    _data.clear();
+
+    typedef QPair<TraceTicks,int> Head;
+    std::priority_queue<Head, std::vector<Head>, std::greater<Head> > heads;
+
+    for(int n = 0; n < lists.size(); n++)
+    {
+        if(!lists[n]->isEmpty())
+            heads.push(Head(lists[n]->first().ticks, n));
+    }
+
+    while(!heads.empty())
+    {
+        int n = heads.top().second;
+        heads.pop();
+
+        BlockList<EvData>& list = *lists[n];
+        if(loaded && n > 0)
+            _added.push_back(_data.size());
+        _data.push_back(list.first());
+        list.pop_front();
+        if(!list.isEmpty())
+            heads.push(Head(list.first().ticks, n));
+    }
+    updateMemoryUsed();
+}
+
+void TraceFile::updateMemoryUsed()
+{
+    qint64 textBytes = 0;
+    for(auto src: _sources)
+        textBytes += src->fileData ? src->fileData->capacity() : 0;
+    _eventsMemory.setMemoryUsed(_data.capacity() * sizeof(EvData) + _added.capacity() * sizeof(int));
+    _textMemory.setMemoryUsed(textBytes);
+}
+
+// Splits the trace into one FilteredTrace per lane ID (the first word after
+// the timestamp), in order of first appearance. With several files loaded,
+// lane IDs are namespaced by file. A THREAD_NAME=name event renames its lane.
+QList<TraceLane> TraceFile::splitLanes(QProgressDialog* progDlg)
+{
+    QList<TraceLane> lanes;
+    QMap<QString,int> laneMap;
+    char tmpStrBuf[MAX_LINE_SZ];
+
+    if(progDlg)
+    {
+        progDlg->reset();
+        progDlg->setRange(0, numEvents());
+    }
+
+    QStringList laneNamespaces;
+    for(int src = 0; src < numSources(); src++)
+    {
+        if(numSources() > 1)
+            laneNamespaces.append(QFileInfo(getSourceName(src)).completeBaseName() + ":");
+        else
+            laneNamespaces.append(QString());
+    }
+
+    for(int n = 0; n < numEvents(); n++)
+    {
+        int ofs = 0;
+        const char* txt = getEventText(n, false);
+        if(txt && (sscanf(txt, "%s%n", tmpStrBuf, &ofs) >= 1))
+        {
+            const QString& laneNamespace = laneNamespaces.at(getEventSource(n));
+            QString laneID = laneNamespace + tmpStrBuf;
+            QString threadName;
+
+            if(sscanf(txt+ofs, " THREAD_NAME=%n%s", &ofs, tmpStrBuf) >= 1)
+                threadName = laneNamespace + tmpStrBuf;
+
+            auto iter = laneMap.find(laneID);
+            int laneIdx;
+            if(iter == laneMap.end())
+            {
+                TraceLane lane;
+                lane.id = laneID;
+                lane.name = laneID;
+                lane.data = new FilteredTrace(this);
+                lane.data->setIndex(lanes.size());
+                laneIdx = lanes.size();
+                laneMap[laneID] = laneIdx;
+                lanes.push_back(lane);
+            }
+            else
+            {
+                laneIdx = iter.value();
+            }
+
+            if(!threadName.isNull())
+                lanes[laneIdx].name = threadName;
+            lanes[laneIdx].data->addEvent(n);
+        }
+        if(progDlg && (n % PROGRESS_INTERVAL) == 0)
+            progDlg->setValue(n);
+    }
+
+    for(const TraceLane& lane: lanes)
+        lane.data->updateMemoryUsed();
+    return lanes;
+}
+
+TraceFile::OrderStats TraceFile::getOrderStats()
+{
+    OrderStats stats = { 0, 0, 0 };
+    for(auto src: _sources)
+    {
+        stats.numRuns += src->orderStats.numRuns;
+        stats.numOutOfOrder += src->orderStats.numOutOfOrder;
+        if(src->orderStats.maxStepBack > stats.maxStepBack)
+            stats.maxStepBack = src->orderStats.maxStepBack;
+    }
+    return stats;
+}
+
+bool TraceFile::openText(const QString& fileName, QProgressDialog* progDlg)
+{
+    return openText(QStringList(fileName), QList<double>(), progDlg);
+}
+
+bool TraceFile::openText(const QStringList& fileNames, const QList<double>& clockOffsets, QProgressDialog* progDlg)
+{
+    return openSources(fileNames, clockOffsets, false, 0, 0, progDlg);
+}
+
+bool TraceFile::openTextRange(const QStringList& fileNames, const QList<double>& clockOffsets,
+                              double begin, double end, QProgressDialog* progDlg)
+{
+    return openSources(fileNames, clockOffsets, true, begin, end, progDlg);
+}
+
+bool TraceFile::openSources(const QStringList& fileNames, const QList<double>& clockOffsets,
+                            bool cropped, double begin, double end, QProgressDialog* progDlg)
+{
+    close();
+
+    if(fileNames.size() > MAX_SOURCES)
+        return false;
+
+    for(int n = 0; n < fileNames.size(); n++)
+    {
+        Source* src = new Source;
+        src->fileName = fileNames[n];
+        src->clockOffset = (n < clockOffsets.size()) ? clockOffsets[n] : 0;
+        src->clockTicks = secondsToTicks(src->clockOffset);
+        src->file = NULL;
+        src->fileData = NULL;
+        src->json = TraceJson::isJson(src->fileName);
+        src->regionBegin = src->regionEnd = 0;
+        src->orderStats = OrderStats{ 0, 0, 0 };
+        src->ok = false;
+        _sources.push_back(src);
+    }
+
+    _baseTicks = probeBaseTicks(fileNames, clockOffsets);
+    _cropped = cropped;
+    if(!parseSources(begin, end, progDlg))
+    {
+        close();
+        return false;
     }
 
+    mergeSources();
+
+    return true;
+}
+
+bool TraceFile::widenRange(double begin, double end, QProgressDialog* progDlg)
+{
+    if(!_cropped)
+        return true;
+
+    begin = qMin(begin, _cropRange.first);
+    end = qMax(end, _cropRange.second);
+
+    if(!parseSources(begin, end, progDlg))
+        return false;
+
+    BlockList<EvData> loaded;
+    loaded.swap(_data);
+    mergeSources(&loaded);
+
     return true;
 }
 
+// Runs parseSource (or parseSourceRange when cropping) for every source in
+// parallel, updating the progress dialog from this thread meanwhile.
+bool TraceFile::parseSources(double begin, double end, QProgressDialog* progDlg)
+{
+    qint64 totalSize = 0;
+    for(auto src: _sources)
+    {
+        src->bytesParsed.storeRelaxed(0);
+        totalSize += QFileInfo(src->fileName).size();
+    }
+
+    if(progDlg)
+    {
+        progDlg->reset();
+        progDlg->setRange(0, PROGRESS_STEPS);
+    }
+
+    QList<int> srcIndices;
+    for(int n = 0; n < _sources.size(); n++)
+        srcIndices.push_back(n);
+
+    QFuture<void> future = QtConcurrent::map(srcIndices, [this,begin,end](int n) {
+        if(_sources[n]->json)
+            parseJsonSource(_sources[n], n);
+        else if(_cropped)
+            parseSourceRange(_sources[n], n, begin, end);
+        else
+            parseSource(_sources[n], n, _preview);
+    });
+
+    while(!future.isFinished())
+    {
+        if(progDlg && totalSize > 0)
+        {
+            qint64 bytesParsed = 0;
+            for(auto src: _sources)
+                bytesParsed += src->bytesParsed.loadRelaxed();
+            progDlg->setValue((int)(bytesParsed * PROGRESS_STEPS / totalSize));
+        }
+        QThread::msleep(PROGRESS_POLL_MS);
+    }
+
+    bool ok = true;
+    for(auto src: _sources)
+        ok = ok && src->ok;
+
+    if(ok && _cropped)
+        _cropRange = QPair<double,double>(begin, end);
+
+    return ok;
+}
+
 void TraceFile::close()
 {
-    if(_file)
-        _file->close();
-    _file = NULL;
+    for(auto src: _sources)
+    {
+        if(src->file)
+        {
+            src->file->close();
+            delete src->file;
+        }
+        delete src->fileData;
+        delete src;
+    }
+    _sources.clear();
     _data.clear();
+    _baseTicks = 0;
+    _cropped = false;
+    _generation++;
+    _widened = false;
+    _added = QVector<int>();
+    updateMemoryUsed();
 }
 
 
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+
+StreamTrace::StreamTrace(int capacity, double retention, TraceTicks baseTicks)
+    : _capacity(qMax(capacity, 1)), _head(0), _count(0), _retention(secondsToTicks(retention)), _baseTicks(baseTicks)
+{
+}
+
+StreamTrace::~StreamTrace()
+{
+}
+
+double StreamTrace::getEventTime(int idx)
+{
+    return ticksToSeconds(getEventTicks(idx) - _baseTicks);
+}
+
+TraceTicks StreamTrace::getEventTicks(int idx)
+{
+    if(idx < 0 || idx >= _count)
+        return 0;
+    return _times[slot(idx)];
+}
+
+const char* StreamTrace::getEventText(int idx, bool full)
+{
+    if(idx < 0 || idx >= _count)
+        return NULL;
+
+    const char* lineData = _lines[slot(idx)].constData();
+    if(full)
+        return lineData;
+
+    char* detail;
+    strtod(lineData, &detail);
+    while(*detail == ' ' || *detail == '\t')
+        ++detail;
+    return (*detail != '\0') ? detail : NULL;
+}
+
+// Doubles the ring, up to the capacity, with the oldest event moved to the
+// first slot.
+void StreamTrace::grow()
+{
+    int size = qMin(_capacity, qMax(STREAM_INITIAL_SLOTS, _times.size() * 2));
+    QVector<TraceTicks> times(size);
+    QVector<QByteArray> lines(size);
+    for(int n = 0; n < _count; n++)
+    {
+        times[n] = _times[slot(n)];
+        lines[n].swap(_lines[slot(n)]);
+    }
+    _times.swap(times);
+    _lines.swap(lines);
+    _head = 0;
+}
+
+void StreamTrace::append(TraceTicks timestamp, const QByteArray& line)
+{
+    if(_count == _times.size())
+    {
+        if(_times.size() < _capacity)
+            grow();
+        else
+        {
+            _lines[_head].clear();
+            _head = (_head + 1) % _times.size();
+            --_count;
+        }
+    }
+
+    // events arriving late are moved back into place to keep the buffer sorted
+    int idx = _count;
+    while(idx > 0 && _times[slot(idx-1)] > timestamp)
+    {
+        _times[slot(idx)] = _times[slot(idx-1)];
+        _lines[slot(idx)].swap(_lines[slot(idx-1)]);
+        --idx;
+    }
+
+    _times[slot(idx)] = timestamp;
+    _lines[slot(idx)] = line;
+    ++_count;
+}
+
+void StreamTrace::expire(TraceTicks latestTime)
+{
+    while(_count > 0 && _times[_head] < latestTime - _retention)
+    {
+        _lines[_head].clear();
+        _head = (_head + 1) % _times.size();
+        --_count;
+    }
+}
+
 //////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////
 
 SubTrace::SubTrace(Trace* parent)
-        : _parent(parent)
+        : _parent(parent), _file(dynamic_cast<TraceFile*>(parent)), _memory("lane indices")
 {
 }
 
@@ -259,6 +1463,11 @@ SubTrace::~SubTrace()
 {
 }
 
+void SubTrace::updateMemoryUsed()
+{
+    _memory.setMemoryUsed(_parentIndices.capacity() * sizeof(int));
+}
+
 
 double SubTrace::getEventTime(int idx)
 {
@@ -268,6 +1477,46 @@ double SubTrace::getEventTime(int idx)
 }
 
 
+TraceTicks SubTrace::getEventTicks(int idx)
+{
+    if(idx < 0 || idx >= _parentIndices.size())
+        return 0;
+    return _parent->getEventTicks(_parentIndices[idx]);
+}
+
+void SubTrace::findEvents(double t, int* evIdxLeftOf, int* evIdxRightOf)
+{
+    if(!_file)
+    {
+        Trace::findEvents(t, evIdxLeftOf, evIdxRightOf);
+        return;
+    }
+
+    TraceFile* file = _file;
+    const int* indices = _parentIndices.constData();
+    int count = _parentIndices.size();
+    int left = firstEventAtOrAfter(t, file->TraceFile::getBaseTicks(), count,
+                                   [file,indices](int idx) { return file->TraceFile::getEventTicks(indices[idx]); });
+    *evIdxLeftOf = (left > 0) ? (left-1) : -1;
+    *evIdxRightOf = (left < count) ? left : -1;
+}
+
+void SubTrace::findEvents(TraceTicks t, int* evIdxLeftOf, int* evIdxRightOf)
+{
+    if(!_file)
+    {
+        Trace::findEvents(t, evIdxLeftOf, evIdxRightOf);
+        return;
+    }
+
+    TraceFile* file = _file;
+    const int* indices = _parentIndices.constData();
+    int count = _parentIndices.size();
+    int left = firstEventAtOrAfter(t, count, [file,indices](int idx) { return file->TraceFile::getEventTicks(indices[idx]); });
+    *evIdxLeftOf = (left > 0) ? (left-1) : -1;
+    *evIdxRightOf = (left < count) ? left : -1;
+}
+
 const char* SubTrace::getEventText(int idx, bool full)
 {
     if(idx < 0 || idx >= _parentIndices.size())
@@ -280,27 +1529,29 @@ const char* SubTrace::getEventText(int idx, bool full)
 //////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////
 
-void FilteredTrace::processRegEx(const QString& regEx, QProgressDialog* progDlg)
+// Keeps the events of the parent whose text matches regEx, searching only
+// count events starting at first (or all of them).
+void FilteredTrace::processRegEx(const QString& regEx, QProgressDialog* progDlg, int first, int count)
 {
     QRegExp regex(regEx);
-    int numEvents = _parent->numEvents();
+    int end = (count < 0) ? _parent->numEvents() : first + count;
 
     clear();
 
     if(progDlg)
     {
         progDlg->reset();
-        progDlg->setRange(0, numEvents);
+        progDlg->setRange(first, end);
     }
 
-    for(int n = 0; n < numEvents; n++)
+    for(int n = first; n < end; n++)
     {
         const char* msg = _parent->getEventText(n, false);
-        if(regex.indexIn(msg) != -1)
+        if(msg && regex.indexIn(msg) != -1)
             addEvent(n);
 
-        if(progDlg)
+        if(progDlg && (n % PROGRESS_INTERVAL) == 0)
             progDlg->setValue(n);
     }
+    updateMemoryUsed();
 }
-
@@ -1,10 +1,27 @@
 #ifndef TRACELANEDATA_H
 #define TRACELANEDATA_H
 
+#include <QAtomicInteger>
 #include <QFile>
+#include <QSharedPointer>
 #include <QList>
+#include <QPair>
 #include <QProgressDialog>
+#include <QStringList>
 #include <QVariant>
+#include <QVector>
+#include "tracetime.h"
+#include "tracememory.h"
+
+class TracePreview;
+class FilteredTrace;
+class CompressedIndex;
+
+typedef struct {
+    QString id;             // lane ID as written in the file
+    QString name;           // display name
+    FilteredTrace* data;
+} TraceLane;
 
 class Trace
 {
@@ -13,11 +30,15 @@ public:
     virtual ~Trace() {}
 
     virtual void findEvents(double t, int* evIdxLeftOf, int* evIdxRightOf);
+    virtual void findEvents(TraceTicks t, int* evIdxLeftOf, int* evIdxRightOf);
     virtual int findNearestEvent(double t);
     virtual int eventsInRange(double begin, double end, int* idx);
 
+    // times are seconds after the base tick; ticks are absolute
     virtual int numEvents() = 0;
     virtual double getEventTime(int idx) = 0;
+    virtual TraceTicks getEventTicks(int idx) { return getBaseTicks() + secondsToTicks(getEventTime(idx)); }
+    virtual TraceTicks getBaseTicks() { return 0; }
     virtual const char* getEventText(int idx, bool full) = 0;
 
     void setIndex(int idx) { _idx = idx; }
@@ -40,28 +61,210 @@ public:
     virtual double getCoverage(double begin, double end) = 0;
 };
 
+#define BLOCK_LIST_BITS     16
+
+// List stored in blocks of 2^BLOCK_LIST_BITS elements, so it grows without
+// copying and, drained from the front, gives its memory back a block at a
+// time. Used for event indices, which are merged into one as they are read.
+template<typename T> class BlockList
+{
+public:
+    BlockList() : _first(0), _size(0) { }
+
+    qsizetype size() const { return _size; }
+    bool isEmpty() const { return _size == 0; }
+    qsizetype capacity() const { return (qsizetype)(_blocks.size() - (_first >> BLOCK_LIST_BITS)) << BLOCK_LIST_BITS; }
+
+    const T& at(qsizetype idx) const
+    {
+        idx += _first;
+        return _blocks.at(idx >> BLOCK_LIST_BITS).at(idx & ((1 << BLOCK_LIST_BITS) - 1));
+    }
+    const T& operator[](qsizetype idx) const { return at(idx); }
+    const T& first() const { return at(0); }
+
+    void push_back(const T& value)
+    {
+        qsizetype idx = _first + _size;
+        if((idx >> BLOCK_LIST_BITS) == _blocks.size())
+        {
+            _blocks.push_back(QList<T>());
+            _blocks.last().reserve(1 << BLOCK_LIST_BITS);
+        }
+        _blocks[idx >> BLOCK_LIST_BITS].push_back(value);
+        ++_size;
+    }
+    void append(const QList<T>& values)
+    {
+        for(const T& value: values)
+            push_back(value);
+    }
+
+    // frees each block once its last element is taken
+    void pop_front()
+    {
+        ++_first;
+        --_size;
+        if(_size == 0)
+            clear();
+        else if((_first & ((1 << BLOCK_LIST_BITS) - 1)) == 0)
+            _blocks[(_first >> BLOCK_LIST_BITS) - 1] = QList<T>();
+    }
+
+    void clear()
+    {
+        _blocks = QList<QList<T> >();
+        _first = _size = 0;
+    }
+    void swap(BlockList& other)
+    {
+        _blocks.swap(other._blocks);
+        qSwap(_first, other._first);
+        qSwap(_size, other._size);
+    }
+
+protected:
+    QList<QList<T> > _blocks;
+    qsizetype _first;       // index of the first element in the first block
+    qsizetype _size;
+};
+
 class TraceFile : public Trace
 {
 public:
     typedef struct {
-        double timestamp;
-        qint64 filePos;
+        TraceTicks ticks;
+        qint64 filePos;     // source index is packed into the top bits
     } EvData;
 
+    typedef struct {
+        qint64 numRuns;         // sorted runs the events arrived in
+        qint64 numOutOfOrder;   // events earlier than the one before them
+        double maxStepBack;     // largest backwards jump in time
+    } OrderStats;
+
+    class Reader
+    {
+    public:
+        Reader(TraceFile* trace);
+        ~Reader();
+        const char* getEventText(int idx, bool full);
+    protected:
+        TraceFile* _trace;
+        QList<QIODevice*> _files;
+        QByteArray _line;
+        QByteArray _txt;
+        QByteArray _jsonLine;
+    };
+
     TraceFile();
     virtual ~TraceFile();
 
     bool openText(const QString& fileName, QProgressDialog* progDlg = NULL);
+    bool openText(const QStringList& fileNames, const QList<double>& clockOffsets, QProgressDialog* progDlg = NULL);
+    bool openTextRange(const QStringList& fileNames, const QList<double>& clockOffsets,
+                       double begin, double end, QProgressDialog* progDlg = NULL);
+    bool widenRange(double begin, double end, QProgressDialog* progDlg = NULL);
     void close();
 
+    bool isCropped() { return _cropped; }
+    QPair<double,double> getCropRange() { return _cropRange; }
+    static bool probeTimeSpan(const QString& fileName, double* first, double* last);
+    static TraceTicks probeBaseTicks(const QStringList& fileNames, const QList<double>& clockOffsets);
+
+    // between absolute seconds, as crop ranges are given, and view times
+    double toViewTime(double seconds) { return ticksToSeconds(addTicks(secondsToTicks(seconds), -_baseTicks)); }
+    double fromViewTime(double t) { return ticksToSeconds(addTicks(secondsToTicks(t), _baseTicks)); }
+
+    void setPreview(TracePreview* preview) { _preview = preview; }
+
+    virtual void findEvents(double t, int* evIdxLeftOf, int* evIdxRightOf);
+    virtual void findEvents(TraceTicks t, int* evIdxLeftOf, int* evIdxRightOf);
     virtual int numEvents();
     virtual double getEventTime(int idx);
+    virtual TraceTicks getEventTicks(int idx) { return _data.at(idx).ticks; }
+    virtual TraceTicks getBaseTicks() { return _baseTicks; }
     virtual const char* getEventText(int idx, bool full);
 
+    int numSources() { return _sources.size(); }
+    QString getSourceName(int src);
+    int getEventSource(int idx);
+    OrderStats getOrderStats();
+    QList<TraceLane> splitLanes(QProgressDialog* progDlg = NULL);
+
+    int getGeneration() { return _generation; }
+    const QVector<int>* getAddedEvents() { return _widened ? &_added : NULL; }
+
 protected:
-    QFile* _file;
-    QByteArray* _fileData;
-    QList<EvData> _data;
+    struct Source {
+        QString fileName;
+        double clockOffset;
+        TraceTicks clockTicks;              // the offset as ticks
+        QIODevice* file;
+        QByteArray* fileData;
+        QSharedPointer<CompressedIndex> index;  // for .gz and .zst sources
+        bool json;                              // Chrome trace-event JSON
+        BlockList<EvData> data;
+        qint64 regionBegin, regionEnd;  // loaded byte range when cropped, or all of a JSON source
+        QAtomicInteger<qint64> bytesParsed;
+        OrderStats orderStats;
+        bool ok;
+    };
+
+    bool openSources(const QStringList& fileNames, const QList<double>& clockOffsets,
+                     bool cropped, double begin, double end, QProgressDialog* progDlg);
+    bool parseSources(double begin, double end, QProgressDialog* progDlg);
+    static void parseSource(Source* src, int srcIdx, TracePreview* preview);
+    static void parseSourceRange(Source* src, int srcIdx, double begin, double end);
+    static void parseRegion(Source* src, int srcIdx, qint64 begin, qint64 end);
+    static void parseJsonSource(Source* src, int srcIdx);
+    static const char* readEventLine(Source* src, QIODevice* file, quint64 filePos, TraceTicks timestamp,
+                                     QByteArray* line, char* jsonLine);
+    void mergeSources(BlockList<EvData>* loaded = NULL);
+    void updateMemoryUsed();
+
+    QList<Source*> _sources;
+    BlockList<EvData> _data;
+    TraceTicks _baseTicks;  // view time 0, from the files alone
+    bool _cropped;
+    QPair<double,double> _cropRange;
+    TracePreview* _preview;
+    int _generation;        // bumped whenever event indices change
+    bool _widened;          // last change only inserted the _added events
+    QVector<int> _added;
+    MemoryClient _eventsMemory;
+    MemoryClient _textMemory;   // sources read into memory whole
+};
+
+// Live trace backed by a ring buffer, which grows as events arrive up to its
+// capacity. Once full, or once events fall outside the retention window, the
+// oldest events are dropped.
+class StreamTrace : public Trace
+{
+public:
+    StreamTrace(int capacity, double retention, TraceTicks baseTicks);
+    virtual ~StreamTrace();
+
+    void append(TraceTicks timestamp, const QByteArray& line);
+    void expire(TraceTicks latestTime);
+
+    virtual int numEvents() { return _count; }
+    virtual double getEventTime(int idx);
+    virtual TraceTicks getEventTicks(int idx);
+    virtual TraceTicks getBaseTicks() { return _baseTicks; }
+    virtual const char* getEventText(int idx, bool full);
+
+protected:
+    int slot(int idx) { return (_head + idx) % _times.size(); }
+    void grow();
+
+    QVector<TraceTicks> _times;
+    QVector<QByteArray> _lines;
+    int _capacity;          // most events kept
+    int _head;
+    int _count;
+    TraceTicks _retention;
+    TraceTicks _baseTicks;
 };
 
 class SubTrace : public Trace
@@ -72,15 +275,26 @@ public:
     virtual ~SubTrace();
 
     void addEvent(int masterIdx) { _parentIndices.push_back(masterIdx); }
-    void clear() { _parentIndices.clear(); }
+    void clear() { _parentIndices.clear(); updateMemoryUsed(); }
+    int getParentIndex(int idx) { return _parentIndices[idx]; }
+    const QList<int>& getParentIndices() { return _parentIndices; }
+    void setParentIndices(const int* indices, int count) { _parentIndices = QList<int>(indices, indices + count); updateMemoryUsed(); }
+    void updateMemoryUsed();     // once events have been added
+    Trace* getParent() { return _parent; }
 
+    virtual void findEvents(double t, int* evIdxLeftOf, int* evIdxRightOf);
+    virtual void findEvents(TraceTicks t, int* evIdxLeftOf, int* evIdxRightOf);
     virtual int numEvents() { return _parentIndices.size(); }
     virtual double getEventTime(int idx);
+    virtual TraceTicks getEventTicks(int idx);
+    virtual TraceTicks getBaseTicks() { return _parent->getBaseTicks(); }
     virtual const char* getEventText(int idx, bool full);
 
 protected:
     QList<int> _parentIndices;
     Trace* _parent;
+    TraceFile* _file;       // the parent, when its integer timestamps can be searched
+    MemoryClient _memory;
 };
 
 class FilteredTrace : public SubTrace
@@ -88,7 +302,52 @@ class FilteredTrace : public SubTrace
 public:
     FilteredTrace(Trace* parent) : SubTrace(parent) {}
 
-    void processRegEx(const QString& regEx, QProgressDialog* progDlg = NULL);
+    void processRegEx(const QString& regEx, QProgressDialog* progDlg = NULL, int first = 0, int count = -1);
+
+    // The attribute value a lane split by attribute holds the events of,
+    // kept so the lane can be split again from another trace.
+    void setAttribute(const QString& key, const QString& value) { _attrKey = key; _attrValue = value; }
+    const QString& attributeKey() const { return _attrKey; }
+    const QString& attributeValue() const { return _attrValue; }
+
+protected:
+    QString _attrKey;
+    QString _attrValue;
+};
+
+// Visits the events of several traces in time order without collecting
+// them, keeping one cursor per trace in a binary heap ordered by tick. Ties
+// go to the trace listed first, so the order is that of a stable sort of
+// all the events by time. Seeking places every cursor by binary search, O(L log N) for L
+// traces of N events; each step after that is O(log L).
+class TraceMerge
+{
+public:
+    TraceMerge(const QList<Trace*>& traces);
+
+    void seek(double t);                    // forward from the first event at or after t
+    void seekBack(double t);                // backward from the last event before t
+    void seekAfter(int trace, int idx);     // forward from the event after this one
+    void seekBefore(int trace, int idx);    // backward from the event before this one
+
+    bool atEnd() const { return _heap.isEmpty(); }
+    int trace() const { return _heap.first(); }     // index into the traces given
+    int event() const { return _backward ? _pos[trace()] - 1 : _pos[trace()]; }
+    TraceTicks ticks() const { return _ticks[trace()]; }
+    double time() const { return _traces[trace()]->getEventTime(event()); }
+    void next();                            // in the direction of the last seek
+
+protected:
+    void start(bool backward);
+    void push(int trace);
+    void siftDown(int i);
+    bool before(int a, int b) const;
+
+    QList<Trace*> _traces;
+    QVector<int> _pos;          // per trace: the next event, or one past it backwards
+    QVector<TraceTicks> _ticks; // of that event, compared exactly
+    QVector<int> _heap;         // traces with events left, the next to visit first
+    bool _backward;
 };
 
 #endif // TRACELANEDATA_H
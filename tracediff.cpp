@@ -0,0 +1,123 @@
+#include "tracediff.h"
+#include <math.h>
+#include <QMap>
+#include <QThread>
+#include <QtConcurrent>
+
+#define PROGRESS_POLL_MS    20
+
+TraceDiff::TraceDiff()
+    : _offset(0)
+{
+}
+
+TraceDiff::~TraceDiff()
+{
+    clear();
+}
+
+void TraceDiff::clear()
+{
+    for(LaneDiff& lane: _lanes)
+    {
+        delete lane.candidatePyramid;
+        delete lane.baselinePyramid;
+    }
+    _lanes.clear();
+}
+
+static void traceSpan(const QList<TraceLane>& lanes, double offset, double* begin, double* end)
+{
+    for(const TraceLane& lane: lanes)
+    {
+        if(lane.data->numEvents() == 0)
+            continue;
+        *begin = qMin(*begin, lane.data->getEventTime(0) + offset);
+        *end = qMax(*end, lane.data->getEventTime(lane.data->numEvents()-1) + offset);
+    }
+}
+
+// Matches the lanes of the two traces by name and fills an exact count
+// pyramid for each side of each lane, in parallel over lanes. offset is
+// added to baseline times so that both traces share the candidate's clock.
+void TraceDiff::compare(const QList<TraceLane>& candidate, const QList<TraceLane>& baseline,
+                        double offset, QProgressDialog* progDlg)
+{
+    clear();
+    _offset = offset;
+
+    double candidateBegin = INFINITY, candidateEnd = -INFINITY;
+    double baselineBegin = INFINITY, baselineEnd = -INFINITY;
+    traceSpan(candidate, 0, &candidateBegin, &candidateEnd);
+    traceSpan(baseline, offset, &baselineBegin, &baselineEnd);
+    double begin = qMin(candidateBegin, baselineBegin);
+    double end = nextafter(qMax(candidateEnd, baselineEnd), INFINITY);
+    if(begin > end)
+        return;
+    double candidateSpan = candidateEnd - candidateBegin;
+    double baselineSpan = baselineEnd - baselineBegin;
+
+    QMap<QString,int> laneForName;
+    for(const TraceLane& lane: candidate)
+    {
+        LaneDiff diff = { lane.name, lane.data, NULL, NULL, NULL, 0, 0, 0, 0 };
+        laneForName[lane.name] = _lanes.size();
+        _lanes.append(diff);
+    }
+    for(const TraceLane& lane: baseline)
+    {
+        auto iter = laneForName.find(lane.name);
+        if(iter != laneForName.end() && !_lanes[iter.value()].baseline)
+        {
+            _lanes[iter.value()].baseline = lane.data;
+        }
+        else
+        {
+            LaneDiff diff = { lane.name, NULL, lane.data, NULL, NULL, 0, 0, 0, 0 };
+            _lanes.append(diff);
+        }
+    }
+
+    for(LaneDiff& lane: _lanes)
+    {
+        lane.candidatePyramid = new TracePyramid(begin, end, DIFF_PYRAMID_LEVELS);
+        lane.baselinePyramid = new TracePyramid(begin, end, DIFF_PYRAMID_LEVELS);
+    }
+
+    if(progDlg)
+    {
+        progDlg->reset();
+        progDlg->setRange(0, _lanes.size());
+    }
+
+    QAtomicInt lanesDone;
+    QFuture<void> future = QtConcurrent::map(_lanes, [&](LaneDiff& lane) {
+        auto fill = [](Trace* data, double ofs, TracePyramid* pyramid) {
+            if(data)
+            {
+                for(int n = 0; n < data->numEvents(); n++)
+                    pyramid->add(pyramid->bucketForTime(data->getEventTime(n) + ofs), 1);
+            }
+            for(int n = 0; n < pyramid->numBuckets(0); n++)
+                pyramid->setExact(n);
+            pyramid->update();
+            return data ? data->numEvents() : 0;
+        };
+        lane.candidateCount = fill(lane.candidate, 0, lane.candidatePyramid);
+        lane.baselineCount = fill(lane.baseline, offset, lane.baselinePyramid);
+        lanesDone.fetchAndAddRelaxed(1);
+    });
+
+    while(!future.isFinished())
+    {
+        if(progDlg)
+            progDlg->setValue(lanesDone.loadRelaxed());
+        QThread::msleep(PROGRESS_POLL_MS);
+    }
+
+    for(LaneDiff& lane: _lanes)
+    {
+        lane.candidateRate = (candidateSpan > 0) ? lane.candidateCount / candidateSpan : 0;
+        lane.baselineRate = (baselineSpan > 0) ? lane.baselineCount / baselineSpan : 0;
+    }
+}
@@ -0,0 +1,45 @@
+#ifndef TRACEDIFF_H
+#define TRACEDIFF_H
+
+#include <QList>
+#include <QString>
+#include <QProgressDialog>
+#include "tracedata.h"
+#include "tracepyramid.h"
+
+#define DIFF_PYRAMID_LEVELS 14
+
+// One lane of a comparison between a candidate trace and a baseline, matched
+// by lane name. Either side may be missing. Both pyramids cover the same
+// span, with the baseline shifted onto the candidate's clock.
+typedef struct {
+    QString name;
+    Trace* candidate;
+    Trace* baseline;
+    TracePyramid* candidatePyramid;
+    TracePyramid* baselinePyramid;
+    qint64 candidateCount;
+    qint64 baselineCount;
+    double candidateRate;   // events per second over the whole trace
+    double baselineRate;
+} LaneDiff;
+
+class TraceDiff
+{
+public:
+    TraceDiff();
+    ~TraceDiff();
+
+    void compare(const QList<TraceLane>& candidate, const QList<TraceLane>& baseline,
+                 double offset, QProgressDialog* progDlg = NULL);
+    void clear();
+
+    const QList<LaneDiff>& lanes() const { return _lanes; }
+    double offset() const { return _offset; }
+
+protected:
+    QList<LaneDiff> _lanes;
+    double _offset;     // added to baseline times
+};
+
+#endif // TRACEDIFF_H
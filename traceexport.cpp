@@ -0,0 +1,281 @@
+#include "traceexport.h"
+#include <zlib.h>
+#include <QFile>
+#include <QBuffer>
+#include <QImage>
+#include <QPainter>
+#include <QThread>
+#include <QtConcurrent>
+
+#define PROGRESS_POLL_MS        20
+#define EXPORT_MAX_WIDTH        32767               // raster paint engine coordinate limit
+#define EXPORT_MEMORY_BUDGET    (256*1024*1024)     // for strips in flight
+#define PNG_COMPRESSION_LEVEL   3
+#define PNG_IDAT_SIZE           (256*1024)
+
+// Receives the rendered strips from top to bottom.
+class StripWriter
+{
+public:
+    virtual ~StripWriter() {}
+    virtual bool begin(int width, int height) = 0;
+    virtual bool writeStrip(int y, const QImage& image) = 0;
+    virtual bool finish() = 0;
+};
+
+// Writes an RGB PNG one row at a time through zlib, emitting an IDAT chunk
+// whenever the compressed buffer fills up.
+class PngStripWriter : public StripWriter
+{
+public:
+    PngStripWriter(QIODevice* out) : _out(out), _open(false) { }
+    ~PngStripWriter() { if(_open) deflateEnd(&_zs); }
+
+    bool begin(int width, int height)
+    {
+        _width = width;
+        _ok = _out->write("\x89PNG\r\n\x1a\n", 8) == 8;
+
+        uchar header[13];
+        putBigEndian(header, width);
+        putBigEndian(header+4, height);
+        header[8] = 8;      // bit depth
+        header[9] = 2;      // RGB
+        header[10] = header[11] = header[12] = 0;
+        writeChunk("IHDR", header, sizeof(header));
+
+        memset(&_zs, 0, sizeof(_zs));
+        if(deflateInit(&_zs, PNG_COMPRESSION_LEVEL) != Z_OK)
+            return false;
+        _open = true;
+        _idat.resize(PNG_IDAT_SIZE);
+        _zs.next_out = (Bytef*)_idat.data();
+        _zs.avail_out = _idat.size();
+        return _ok;
+    }
+
+    bool writeStrip(int, const QImage& image)
+    {
+        QByteArray row(1 + _width*3, 0);
+        for(int y = 0; y < image.height(); y++)
+        {
+            const QRgb* src = (const QRgb*)image.constScanLine(y);
+            uchar* dst = (uchar*)row.data() + 1;    // filter type 0
+            for(int x = 0; x < _width; x++)
+            {
+                *dst++ = qRed(src[x]);
+                *dst++ = qGreen(src[x]);
+                *dst++ = qBlue(src[x]);
+            }
+            compress((const uchar*)row.constData(), row.size(), Z_NO_FLUSH);
+        }
+        return _ok;
+    }
+
+    bool finish()
+    {
+        compress(NULL, 0, Z_FINISH);
+        writeChunk("IEND", NULL, 0);
+        return _ok;
+    }
+
+protected:
+    static void putBigEndian(uchar* p, quint32 v)
+    {
+        p[0] = v >> 24; p[1] = v >> 16; p[2] = v >> 8; p[3] = v;
+    }
+
+    void writeChunk(const char* type, const uchar* data, int len)
+    {
+        uchar word[4];
+        putBigEndian(word, len);
+        _ok = _ok && _out->write((const char*)word, 4) == 4;
+        _ok = _ok && _out->write(type, 4) == 4;
+        if(len > 0)
+            _ok = _ok && _out->write((const char*)data, len) == len;
+        uLong crc = crc32(0, (const Bytef*)type, 4);
+        if(len > 0)
+            crc = crc32(crc, data, len);
+        putBigEndian(word, crc);
+        _ok = _ok && _out->write((const char*)word, 4) == 4;
+    }
+
+    void compress(const uchar* data, int len, int flush)
+    {
+        _zs.next_in = (Bytef*)data;
+        _zs.avail_in = len;
+        for(;;)
+        {
+            int ret = deflate(&_zs, flush);
+            if(ret == Z_STREAM_ERROR)
+            {
+                _ok = false;
+                return;
+            }
+            bool done = (flush == Z_FINISH) ? (ret == Z_STREAM_END) : (_zs.avail_in == 0);
+            if(_zs.avail_out == 0 || (done && flush == Z_FINISH))
+            {
+                writeChunk("IDAT", (const uchar*)_idat.constData(), _idat.size() - _zs.avail_out);
+                _zs.next_out = (Bytef*)_idat.data();
+                _zs.avail_out = _idat.size();
+            }
+            if(done)
+                return;
+        }
+    }
+
+    QIODevice* _out;
+    z_stream _zs;
+    bool _open;
+    bool _ok;
+    int _width;
+    QByteArray _idat;
+};
+
+// Writes an SVG document with each strip embedded as a PNG image.
+class SvgStripWriter : public StripWriter
+{
+public:
+    SvgStripWriter(QIODevice* out) : _out(out) { }
+
+    bool begin(int width, int height)
+    {
+        _width = width;
+        QString header = QString("<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+                                 "<svg xmlns=\"http://www.w3.org/2000/svg\" xmlns:xlink=\"http://www.w3.org/1999/xlink\" "
+                                 "width=\"%1\" height=\"%2\" viewBox=\"0 0 %1 %2\">\n").arg(width).arg(height);
+        return _out->write(header.toUtf8()) >= 0;
+    }
+
+    bool writeStrip(int y, const QImage& image)
+    {
+        QByteArray png;
+        QBuffer buffer(&png);
+        buffer.open(QIODevice::WriteOnly);
+        if(!image.save(&buffer, "PNG"))
+            return false;
+        QString element = QString("<image x=\"0\" y=\"%1\" width=\"%2\" height=\"%3\" xlink:href=\"data:image/png;base64,")
+                          .arg(y).arg(_width).arg(image.height());
+        return _out->write(element.toUtf8()) >= 0 &&
+               _out->write(png.toBase64()) >= 0 &&
+               _out->write("\"/>\n") >= 0;
+    }
+
+    bool finish()
+    {
+        return _out->write("</svg>\n") >= 0;
+    }
+
+protected:
+    QIODevice* _out;
+    int _width;
+};
+
+typedef struct {
+    int y;
+    QImage image;
+} ExportStrip;
+
+// Draws the part of the export that falls in one strip. Lanes share the
+// height equally; lanes crossing a strip boundary are drawn, clipped, into
+// both strips.
+static void renderStrip(ExportStrip& strip, const QList<Lane>& lanes,
+                        double begin, double end, int width, int height)
+{
+    strip.image.fill(Qt::black);
+    QPainter p(&strip.image);
+    p.translate(0, -strip.y);
+
+    int stripEnd = strip.y + strip.image.height();
+    int numLanes = lanes.size();
+    auto laneY = [&](int n) { return (int)((qint64)n * height / numLanes); };
+
+    for(int n = 0; n < numLanes; n++)
+    {
+        int y = laneY(n), h = laneY(n+1) - y;
+        if(y + h > strip.y && y < stripEnd)
+            TraceView::drawLaneBackground(p, n, y, width, h);
+    }
+    TraceView::drawTimeGrid(p, width, height, begin, end);
+    for(int n = 0; n < numLanes; n++)
+    {
+        int y = laneY(n), h = laneY(n+1) - y;
+        if(y + h <= strip.y || y >= stripEnd)
+            continue;
+        TraceView::drawLaneData(p, lanes[n], y, width, h, begin, end);
+        TraceView::drawLaneLabel(p, lanes[n], y);
+    }
+}
+
+bool TraceExport::writeImage(const QString& fileName, const QList<Lane>& lanes,
+                             double begin, double end, int width, int height,
+                             QProgressDialog* progDlg)
+{
+    if(lanes.isEmpty() || width <= 0 || height <= 0 || width > EXPORT_MAX_WIDTH || end <= begin)
+        return false;
+
+    QFile file(fileName);
+    if(!file.open(QIODevice::WriteOnly))
+        return false;
+
+    StripWriter* writer;
+    if(fileName.endsWith(".svg", Qt::CaseInsensitive))
+        writer = new SvgStripWriter(&file);
+    else
+        writer = new PngStripWriter(&file);
+
+    // render the next batch of strips while the previous one is encoded,
+    // with both batches together fitting the memory budget
+    int numStrips = (height + EXPORT_STRIP_ROWS - 1) / EXPORT_STRIP_ROWS;
+    qint64 stripBytes = (qint64)width * EXPORT_STRIP_ROWS * 4;
+    int batchSize = (int)qBound((qint64)1, EXPORT_MEMORY_BUDGET / (2*stripBytes), (qint64)QThread::idealThreadCount());
+
+    if(progDlg)
+    {
+        progDlg->reset();
+        progDlg->setRange(0, numStrips);
+    }
+
+    QVector<ExportStrip> batches[2];
+    QFuture<void> futures[2];
+    QAtomicInt stripsRendered;
+    int nextStrip = 0;
+    auto launch = [&](int b) {
+        batches[b].clear();
+        for(; nextStrip < numStrips && batches[b].size() < batchSize; nextStrip++)
+        {
+            int y = nextStrip * EXPORT_STRIP_ROWS;
+            ExportStrip strip = { y, QImage(width, qMin(EXPORT_STRIP_ROWS, height - y), QImage::Format_RGB32) };
+            batches[b].append(strip);
+        }
+        futures[b] = QtConcurrent::map(batches[b], [&](ExportStrip& strip) {
+            renderStrip(strip, lanes, begin, end, width, height);
+            stripsRendered.fetchAndAddRelaxed(1);
+        });
+    };
+
+    bool ok = writer->begin(width, height);
+    int cur = 0;
+    launch(cur);
+    while(!batches[cur].isEmpty())
+    {
+        if(nextStrip < numStrips)
+            launch(cur^1);
+        else
+            batches[cur^1].clear();
+
+        while(!futures[cur].isFinished())
+        {
+            if(progDlg)
+                progDlg->setValue(stripsRendered.loadRelaxed());
+            QThread::msleep(PROGRESS_POLL_MS);
+        }
+        for(const ExportStrip& strip: batches[cur])
+            ok = ok && writer->writeStrip(strip.y, strip.image);
+        cur ^= 1;
+    }
+    ok = writer->finish() && ok;
+
+    delete writer;
+    return ok;
+}
@@ -0,0 +1,25 @@
+#ifndef TRACEEXPORT_H
+#define TRACEEXPORT_H
+
+#include <QList>
+#include <QString>
+#include <QProgressDialog>
+#include "traceview.h"
+
+#define EXPORT_STRIP_ROWS   256
+
+// Renders lanes over a time range into a PNG or SVG file of any size,
+// without a window. The image is drawn in horizontal strips of
+// EXPORT_STRIP_ROWS on the thread pool with the view's lane renderer, and
+// strips are encoded in order as they finish, so memory is bounded by the
+// strips in flight rather than the image size. The format follows the file
+// name's suffix; SVG files hold the strips as embedded PNG images.
+class TraceExport
+{
+public:
+    static bool writeImage(const QString& fileName, const QList<Lane>& lanes,
+                           double begin, double end, int width, int height,
+                           QProgressDialog* progDlg = NULL);
+};
+
+#endif // TRACEEXPORT_H
@@ -0,0 +1,267 @@
+#include "traceflow.h"
+#include <string.h>
+#include <ctype.h>
+#include <algorithm>
+#include <QElapsedTimer>
+#include <QtAlgorithms>
+#include <QtConcurrent>
+
+#define FLOW_STOP_CHECK_INTERVAL    4096
+#define FLOW_SKETCH_BITS            8       // per event, in each bit set of the first pass
+
+FlowIndex::FlowIndex(TraceFile* trace, const QList<TraceLane>& lanes, QObject* parent)
+    : QThread(parent), MemoryClient("flow index", true), _trace(trace), _numFlows(0)
+{
+    for(const TraceLane& lane: lanes)
+        _lanes.append(lane.data);
+}
+
+FlowIndex::~FlowIndex()
+{
+    stop();
+    setMemoryUsed(0);
+}
+
+void FlowIndex::stop()
+{
+    _stop.storeRelaxed(1);
+    wait();
+}
+
+// Hashes the value of the first req=<id> word in txt (FNV-1a). Returns false
+// if there isn't one.
+bool FlowIndex::flowKey(const char* txt, quint64* hash)
+{
+    const size_t keyLen = strlen(FLOW_KEY);
+    const char* ptr = txt;
+
+    while((ptr = strstr(ptr, FLOW_KEY)) != NULL)
+    {
+        if(ptr == txt || isspace(ptr[-1]))
+            break;
+        ptr += keyLen;
+    }
+    if(!ptr)
+        return false;
+
+    ptr += keyLen;
+    if(!*ptr || isspace(*ptr))
+        return false;
+
+    quint64 h = 14695981039346656037ULL;
+    while(*ptr && !isspace(*ptr))
+    {
+        h ^= (unsigned char)*ptr++;
+        h *= 1099511628211ULL;
+    }
+    *hash = h ? h : 1;
+    return true;
+}
+
+// Calls fn(lane, idx, hash) for each event of the lanes with a correlation
+// ID, reading the lanes in parallel, each with its own reader. Returns false
+// if stopped meanwhile.
+template<typename F> static bool forEachFlowKey(TraceFile* trace, const QList<SubTrace*>& lanes, const QAtomicInt& stop, F fn)
+{
+    QList<int> laneIndices;
+    for(int n = 0; n < lanes.size(); n++)
+        laneIndices.append(n);
+
+    QtConcurrent::blockingMap(laneIndices, [&](int n) {
+        TraceFile::Reader reader(trace);
+        SubTrace* lane = lanes[n];
+        for(int i = 0; i < lane->numEvents(); i++)
+        {
+            if((i % FLOW_STOP_CHECK_INTERVAL) == 0 && stop.loadRelaxed())
+                return;
+
+            quint64 hash;
+            const char* txt = reader.getEventText(lane->getParentIndex(i), false);
+            if(txt && FlowIndex::flowKey(txt, &hash))
+                fn(n, i, hash);
+        }
+    });
+    return !stop.loadRelaxed();
+}
+
+// Three passes over the lanes, so nothing is held per event but the final
+// references. The first marks each hash in a bit set of those seen, or if it
+// was already marked, in one of those seen again. The second counts the
+// events of every hash seen again in a table of its own; a hash can be
+// marked by another sharing its bit, so only counts of 2 or more make flows.
+// The flows are then laid out in the index, and the third pass fills in
+// their references.
+void FlowIndex::run()
+{
+    QElapsedTimer timer;
+    timer.start();
+
+    qint64 numEvents = 0;
+    for(SubTrace* lane: _lanes)
+        numEvents += lane->numEvents();
+    quint64 numBits = 64;
+    while(numBits < (quint64)numEvents * FLOW_SKETCH_BITS)
+        numBits <<= 1;
+    QVector<QAtomicInteger<quint32> > seen(numBits / 32), seenAgain(numBits / 32);
+
+    bool ok = forEachFlowKey(_trace, _lanes, _stop, [&](int, int, quint64 hash) {
+        quint64 bit = hash & (numBits - 1);
+        quint32 mask = 1u << (bit & 31);
+        if(seen[bit >> 5].fetchAndOrRelaxed(mask) & mask)
+            seenAgain[bit >> 5].fetchAndOrRelaxed(mask);
+    });
+    if(!ok)
+        return;
+    seen = QVector<QAtomicInteger<quint32> >();
+
+    auto markedAgain = [&](quint64 hash) {
+        quint64 bit = hash & (numBits - 1);
+        return (seenAgain[bit >> 5].loadRelaxed() & (1u << (bit & 31))) != 0;
+    };
+
+    int numMarked = 0;
+    for(auto& word: seenAgain)
+        numMarked += qPopulationCount(word.loadRelaxed());
+
+    // counted in a table sized for about one hash per bit, doubled and
+    // counted again if that was too small
+    int numCounts = 1024;
+    while(numCounts < numMarked * 2)
+        numCounts <<= 1;
+    QVector<QAtomicInteger<quint64> > countHashes;
+    QVector<QAtomicInt> counts;
+    for(;;)
+    {
+        countHashes = QVector<QAtomicInteger<quint64> >(numCounts);
+        counts = QVector<QAtomicInt>(numCounts);
+        QAtomicInt used, full;
+        int mask = numCounts - 1;
+
+        ok = forEachFlowKey(_trace, _lanes, _stop, [&](int, int, quint64 hash) {
+            if(!markedAgain(hash) || full.loadRelaxed())
+                return;
+            int slot = (int)(hash & mask);
+            for(;;)
+            {
+                quint64 cur = countHashes[slot].loadRelaxed();
+                if(cur == hash)
+                    break;
+                if(!cur && countHashes[slot].testAndSetRelaxed(0, hash, cur))
+                {
+                    if(used.fetchAndAddRelaxed(1) >= numCounts * 3 / 4)
+                        full.storeRelaxed(1);
+                    break;
+                }
+                if(cur == hash)
+                    break;
+                slot = (slot + 1) & mask;
+            }
+            counts[slot].fetchAndAddRelaxed(1);
+        });
+        if(!ok)
+            return;
+        if(!full.loadRelaxed())
+            break;
+        numCounts <<= 1;
+    }
+
+    int numFlows = 0, numRefs = 0;
+    for(int n = 0; n < numCounts; n++)
+    {
+        if(counts[n].loadRelaxed() > 1)
+        {
+            numFlows++;
+            numRefs += counts[n].loadRelaxed();
+        }
+    }
+
+    int numSlots = 1;
+    while(numSlots < numFlows * 2)
+        numSlots <<= 1;
+    _slots.fill(Slot{ 0, 0, 0 }, numSlots);
+    _refs.resize(numRefs);
+
+    int first = 0;
+    for(int n = 0; n < numCounts; n++)
+    {
+        int count = counts[n].loadRelaxed();
+        if(count < 2)
+            continue;
+        quint64 hash = countHashes[n].loadRelaxed();
+        int slot = (int)(hash & (numSlots - 1));
+        while(_slots[slot].hash)
+            slot = (slot + 1) & (numSlots - 1);
+        _slots[slot] = Slot{ hash, first, count };
+        first += count;
+    }
+    countHashes = QVector<QAtomicInteger<quint64> >();
+    counts = QVector<QAtomicInt>();
+
+    QVector<QAtomicInt> filled(numSlots);
+    EventRef* refs = _refs.data();
+    ok = forEachFlowKey(_trace, _lanes, _stop, [&](int lane, int idx, quint64 hash) {
+        if(!markedAgain(hash))
+            return;
+        int slot = findSlot(hash);
+        if(slot >= 0)
+            refs[_slots[slot].first + filled[slot].fetchAndAddRelaxed(1)] = EventRef{ lane, idx };
+    });
+    if(!ok)
+        return;
+
+    _numFlows = numFlows;
+    setMemoryUsed(_slots.capacity() * sizeof(Slot) + _refs.capacity() * sizeof(EventRef));
+    setRebuildCost(timer.nsecsElapsed() / 1e6);
+    touch();
+    _ready.storeRelease(1);
+}
+
+int FlowIndex::findSlot(quint64 hash) const
+{
+    if(_slots.isEmpty())
+        return -1;
+    int mask = _slots.size() - 1;
+    int slot = (int)(hash & mask);
+    while(_slots[slot].hash && _slots[slot].hash != hash)
+        slot = (slot + 1) & mask;
+    return _slots[slot].hash ? slot : -1;
+}
+
+// Only a finished index is freed; one being built is left alone.
+qint64 FlowIndex::evict()
+{
+    if(!isReady())
+        return 0;
+    _ready.storeRelease(0);
+    _slots = QVector<Slot>();
+    _refs = QVector<EventRef>();
+    _numFlows = 0;
+    return memoryUsed();
+}
+
+// Finds the events sharing the correlation ID of event idx of lane, which
+// needn't be one of the indexed lanes, sorted by time. Returns how many
+// there are, or 0 if the event has no ID or is the only one with it.
+int FlowIndex::findFlow(Trace* lane, int idx, QVector<EventRef>* flow) const
+{
+    flow->clear();
+    touch();
+
+    quint64 hash;
+    const char* txt = lane->getEventText(idx, false);
+    if(!isReady() || !txt || !flowKey(txt, &hash))
+        return 0;
+
+    int slot = findSlot(hash);
+    if(slot < 0)
+        return 0;
+
+    const Slot& found = _slots[slot];
+    for(int n = 0; n < found.count; n++)
+        flow->append(_refs[found.first + n]);
+
+    std::sort(flow->begin(), flow->end(), [this](const EventRef& a, const EventRef& b) {
+        return _lanes[a.lane]->getEventTime(a.idx) < _lanes[b.lane]->getEventTime(b.idx);
+    });
+    return flow->size();
+}
@@ -0,0 +1,63 @@
+#ifndef TRACEFLOW_H
+#define TRACEFLOW_H
+
+#include <QThread>
+#include <QAtomicInteger>
+#include <QHash>
+#include <QList>
+#include <QVector>
+#include "tracedata.h"
+#include "tracememory.h"
+
+#define FLOW_KEY    "req="
+
+// Index from correlation ID (the value of a req=<id> word in the event text)
+// to the events carrying it, built on its own thread after a load. IDs are
+// kept as 64-bit hashes in an open addressing table pointing into one array
+// of event references grouped by ID, and IDs seen only once are dropped, so
+// the index costs 8 bytes per linked event plus the table; building it needs
+// 2 bytes per event more. Once evicted it is empty and not ready until
+// started again.
+class FlowIndex : public QThread, public MemoryClient
+{
+    Q_OBJECT
+public:
+    typedef struct {
+        int lane;   // index into the lanes the index was built from
+        int idx;    // event index within that lane
+    } EventRef;
+
+    FlowIndex(TraceFile* trace, const QList<TraceLane>& lanes, QObject* parent = NULL);
+    virtual ~FlowIndex();
+
+    void stop();
+    bool isReady() const { return _ready.loadAcquire() != 0; }
+    int numFlows() const { return _numFlows; }
+    Trace* getLane(int lane) const { return _lanes[lane]; }
+
+    int findFlow(Trace* lane, int idx, QVector<EventRef>* flow) const;
+
+    static bool flowKey(const char* txt, quint64* hash);
+
+protected:
+    typedef struct {
+        quint64 hash;   // 0 if the slot is empty
+        int first;
+        int count;
+    } Slot;
+
+    void run();
+    int findSlot(quint64 hash) const;
+    qint64 evict() override;
+
+protected:
+    TraceFile* _trace;
+    QList<SubTrace*> _lanes;
+    QVector<Slot> _slots;
+    QVector<EventRef> _refs;
+    int _numFlows;
+    QAtomicInt _stop;
+    QAtomicInt _ready;
+};
+
+#endif // TRACEFLOW_H
@@ -0,0 +1,212 @@
+#include "tracegroups.h"
+#include <math.h>
+#include <QMap>
+#include <QThread>
+#include <QtConcurrent>
+
+#define PROGRESS_POLL_MS    20
+
+#define DETAIL_WINDOW_VIEWS 3   // wide, centred on the view, so panning rarely rebuilds
+#define DETAIL_BUCKET_DIV   4   // buckets this much finer than needed, so zooming rarely rebuilds
+
+QSharedPointer<TracePyramid> GroupPyramid::detail(const QList<Trace*>& members, double t0, double t1, double maxBucketWidth) const
+{
+    QMutexLocker locker(&_detailLock);
+    if(_detail && _detail->begin() <= t0 && _detail->end() >= t1 && _detail->bucketWidth(0) <= maxBucketWidth)
+        return _detail;
+
+    double margin = (t1 - t0) * (DETAIL_WINDOW_VIEWS - 1) / 2;
+    double begin = qMax(t0 - margin, this->begin());
+    double end = qMin(t1 + margin, this->end());
+    if(end <= begin)
+        end = nextafter(begin, INFINITY);
+    int levels = 1;
+    while(levels < GROUP_DETAIL_LEVELS && (end - begin) / (1 << (levels - 1)) > maxBucketWidth / DETAIL_BUCKET_DIV)
+        ++levels;
+
+    TracePyramid* pyramid = new TracePyramid(begin, end, levels);
+    for(Trace* member: members)
+    {
+        int first, last, tmp;
+        member->findEvents(begin, &tmp, &first);
+        member->findEvents(end, &last, &tmp);
+        if(first < 0 || last < first)
+            continue;
+        for(int n = first; n <= last; n++)
+            pyramid->add(pyramid->bucketForTime(member->getEventTime(n)), 1);
+    }
+    for(int n = 0; n < pyramid->numBuckets(0); n++)
+        pyramid->setExact(n);
+    pyramid->update();
+
+    _detail = QSharedPointer<TracePyramid>(pyramid);
+    return _detail;
+}
+
+// A run of up to GROUP_CHUNK_LANES members of one group, binned into its
+// own counts and summed into the group afterwards.
+typedef struct {
+    int group;
+    QList<const Lane*> members;
+    QVector<float> counts;
+} GroupChunk;
+
+QList<Lane> LaneGroups::build(const QList<Lane>& lanes, const QStringList& groupForLane,
+                              QList<TracePyramid*>* pyramids, QProgressDialog* progDlg)
+{
+    QList<Lane> ungrouped = remove(lanes);
+
+    QStringList names;
+    QMap<QString,int> groupIdx;
+    QList<QList<const Lane*> > members;
+    double begin = INFINITY, end = -INFINITY;
+    for(int n = 0; n < ungrouped.size() && n < groupForLane.size(); n++)
+    {
+        const Lane& lane = ungrouped[n];
+        if(groupForLane[n].isEmpty())
+            continue;
+        if(!groupIdx.contains(groupForLane[n]))
+        {
+            groupIdx[groupForLane[n]] = names.size();
+            names.append(groupForLane[n]);
+            members.append(QList<const Lane*>());
+        }
+        members[groupIdx[groupForLane[n]]].append(&lane);
+
+        if(lane.data && lane.data->numEvents() > 0)
+        {
+            begin = qMin(begin, lane.data->getEventTime(0));
+            end = qMax(end, lane.data->getEventTime(lane.data->numEvents()-1));
+        }
+        else if(!lane.data && lane.pyramid)
+        {
+            begin = qMin(begin, lane.pyramid->begin());
+            end = qMax(end, lane.pyramid->end());
+        }
+    }
+    if(names.isEmpty())
+        return ungrouped;
+    if(begin > end)
+        begin = end = 0;
+    end = nextafter(end, INFINITY);
+
+    QList<TracePyramid*> groupPyramids;
+    QList<GroupChunk> chunks;
+    for(int g = 0; g < names.size(); g++)
+    {
+        groupPyramids.append(new GroupPyramid(begin, end));
+        for(int first = 0; first < members[g].size(); first += GROUP_CHUNK_LANES)
+        {
+            GroupChunk chunk;
+            chunk.group = g;
+            chunk.members = members[g].mid(first, GROUP_CHUNK_LANES);
+            chunks.append(chunk);
+        }
+    }
+
+    if(progDlg)
+    {
+        progDlg->reset();
+        progDlg->setRange(0, chunks.size());
+    }
+
+    int numBuckets = groupPyramids[0]->numBuckets(0);
+    QAtomicInt chunksDone;
+    QFuture<void> future = QtConcurrent::map(chunks, [&](GroupChunk& chunk) {
+        const TracePyramid* pyramid = groupPyramids[chunk.group];
+        chunk.counts.fill(0, numBuckets);
+        float* counts = chunk.counts.data();
+        QVector<float> sampled;
+        for(const Lane* lane: chunk.members)
+        {
+            if(lane->data)
+            {
+                for(int n = 0; n < lane->data->numEvents(); n++)
+                    counts[pyramid->bucketForTime(lane->data->getEventTime(n))] += 1;
+            }
+            else if(lane->pyramid)
+            {
+                sampled.resize(numBuckets);
+                lane->pyramid->sample(begin, end, numBuckets, sampled.data());
+                for(int n = 0; n < numBuckets; n++)
+                    counts[n] += sampled[n];
+            }
+        }
+        chunksDone.fetchAndAddRelaxed(1);
+    });
+
+    while(!future.isFinished())
+    {
+        if(progDlg)
+            progDlg->setValue(chunksDone.loadRelaxed());
+        QThread::msleep(PROGRESS_POLL_MS);
+    }
+
+    for(const GroupChunk& chunk: chunks)
+    {
+        TracePyramid* pyramid = groupPyramids[chunk.group];
+        for(int n = 0; n < numBuckets; n++)
+            pyramid->add(n, chunk.counts[n]);
+    }
+    for(TracePyramid* pyramid: groupPyramids)
+    {
+        for(int n = 0; n < numBuckets; n++)
+            pyramid->setExact(n);
+        pyramid->update();
+        pyramids->append(pyramid);
+    }
+
+    // each group takes the place of its first member, followed by the rest
+    QList<Lane> result;
+    QList<bool> groupDone;
+    for(int g = 0; g < names.size(); g++)
+        groupDone.append(false);
+    for(int n = 0; n < ungrouped.size(); n++)
+    {
+        if(n >= groupForLane.size() || groupForLane[n].isEmpty())
+        {
+            result.append(ungrouped[n]);
+            continue;
+        }
+
+        int g = groupIdx[groupForLane[n]];
+        if(groupDone[g])
+            continue;
+        groupDone[g] = true;
+
+        int idx = result.size();
+        Lane header(NULL, QString("%1 (%2)").arg(names[g]).arg(members[g].size()),
+                    QColor::fromHsv((idx*35)%255,255,255), groupPyramids[g]);
+        header.isGroup = true;
+        header.collapsed = true;
+        for(const Lane* member: members[g])
+        {
+            if(member->data)
+                header.members.append(member->data);
+        }
+        result.append(header);
+        for(const Lane* member: members[g])
+        {
+            Lane lane = *member;
+            lane.depth = 1;
+            lane.hidden = true;
+            result.append(lane);
+        }
+    }
+    return result;
+}
+
+QList<Lane> LaneGroups::remove(const QList<Lane>& lanes)
+{
+    QList<Lane> result;
+    for(const Lane& lane: lanes)
+    {
+        if(lane.isGroup)
+            continue;
+        Lane member = lane;
+        member.depth = 0;
+        member.hidden = false;
+        result.append(member);
+    }
+    return result;
+}
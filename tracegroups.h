@@ -0,0 +1,49 @@
+#ifndef TRACEGROUPS_H
+#define TRACEGROUPS_H
+
+#include <QList>
+#include <QMutex>
+#include <QSharedPointer>
+#include <QStringList>
+#include <QProgressDialog>
+#include "traceview.h"
+
+#define GROUP_PYRAMID_LEVELS    16
+#define GROUP_DETAIL_LEVELS     20      // at most, for the view of a group zoomed in
+#define GROUP_CHUNK_LANES       64
+
+// Pyramid of a group header. Zoomed in past its buckets, a group is drawn
+// from a finer pyramid over a window around the view instead, binned from
+// the events of its members there. That one is kept until the view leaves
+// the window or zooms in past it too, so a repaint costs the same as for
+// a collapsed group zoomed out, however many members the group has.
+class GroupPyramid : public TracePyramid
+{
+public:
+    GroupPyramid(double begin, double end, int levels = GROUP_PYRAMID_LEVELS) : TracePyramid(begin, end, levels) { }
+
+    QSharedPointer<TracePyramid> detail(const QList<Trace*>& members, double t0, double t1, double maxBucketWidth) const;
+
+protected:
+    mutable QMutex _detailLock;     // views and exports draw from other threads
+    mutable QSharedPointer<TracePyramid> _detail;
+};
+
+// Gathers lanes under collapsible group headers. Each header owns a pyramid
+// of the summed counts of its members, filled once from their events (or
+// their pyramids, for lanes still loading), so that a collapsed group is
+// drawn in time proportional to its width rather than its member count.
+class LaneGroups
+{
+public:
+    // groupForLane holds a group name per lane; lanes with an empty name are
+    // left ungrouped. Groups appear in order of their first member, and
+    // start collapsed. The new pyramids are appended to pyramids.
+    static QList<Lane> build(const QList<Lane>& lanes, const QStringList& groupForLane,
+                             QList<TracePyramid*>* pyramids, QProgressDialog* progDlg = NULL);
+
+    // The member lanes without their group headers.
+    static QList<Lane> remove(const QList<Lane>& lanes);
+};
+
+#endif // TRACEGROUPS_H
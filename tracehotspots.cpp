@@ -0,0 +1,140 @@
+#include "tracehotspots.h"
+#include <algorithm>
+#include <vector>
+#include <QThread>
+#include <QtConcurrent>
+
+#define HOTSPOT_BLOCK_SZ    (256*1024)
+#define PROGRESS_POLL_MS    20
+
+// Enough of the densest windows that picking the best non-overlapping ones
+// greedily from them always finds HOTSPOT_TOP_K if there are that many: each
+// pick rules out fewer than 2*HOTSPOT_BURST_EVENTS windows.
+#define BURST_POOL_SZ       (HOTSPOT_TOP_K * 2 * HOTSPOT_BURST_EVENTS)
+
+static bool longerThan(const Hotspot& a, const Hotspot& b)
+{
+    return (a.end - a.begin) > (b.end - b.begin);
+}
+
+static bool shorterThan(const Hotspot& a, const Hotspot& b)
+{
+    return (a.end - a.begin) < (b.end - b.begin);
+}
+
+// Scans each lane's timestamps in parallel blocks. Every block keeps a heap
+// of its largest gaps and one of its shortest burst windows; the blocks of a
+// lane are then merged.
+QList<LaneHotspots> LaneHotspots::find(const QList<Trace*>& lanes, QProgressDialog* progDlg)
+{
+    typedef struct {
+        int lane;
+        int begin, end;
+        std::vector<Hotspot> gaps;      // min-heap on length
+        std::vector<Hotspot> bursts;    // max-heap on length
+    } Block;
+
+    QList<Block> blocks;
+    for(int n = 0; n < lanes.size(); n++)
+    {
+        for(int begin = 0; begin < lanes[n]->numEvents(); begin += HOTSPOT_BLOCK_SZ)
+        {
+            Block block;
+            block.lane = n;
+            block.begin = begin;
+            block.end = qMin(begin + HOTSPOT_BLOCK_SZ, lanes[n]->numEvents());
+            blocks.append(block);
+        }
+    }
+
+    if(progDlg)
+    {
+        progDlg->reset();
+        progDlg->setRange(0, blocks.size());
+    }
+
+    QAtomicInt blocksDone;
+    QFuture<void> future = QtConcurrent::map(blocks, [&](Block& block) {
+        Trace* lane = lanes[block.lane];
+        int numEvents = lane->numEvents();
+        double prevTime = (block.begin > 0) ? lane->getEventTime(block.begin - 1) : 0;
+
+        for(int i = block.begin; i < block.end; i++)
+        {
+            double t = lane->getEventTime(i);
+            if(i > 0)
+            {
+                Hotspot gap = { prevTime, t, i - 1, 2 };
+                if(block.gaps.size() < HOTSPOT_TOP_K)
+                {
+                    block.gaps.push_back(gap);
+                    std::push_heap(block.gaps.begin(), block.gaps.end(), longerThan);
+                }
+                else if(longerThan(gap, block.gaps.front()))
+                {
+                    std::pop_heap(block.gaps.begin(), block.gaps.end(), longerThan);
+                    block.gaps.back() = gap;
+                    std::push_heap(block.gaps.begin(), block.gaps.end(), longerThan);
+                }
+            }
+            prevTime = t;
+
+            if(i + HOTSPOT_BURST_EVENTS <= numEvents)
+            {
+                Hotspot burst = { t, lane->getEventTime(i + HOTSPOT_BURST_EVENTS - 1), i, HOTSPOT_BURST_EVENTS };
+                if(block.bursts.size() < BURST_POOL_SZ)
+                {
+                    block.bursts.push_back(burst);
+                    std::push_heap(block.bursts.begin(), block.bursts.end(), shorterThan);
+                }
+                else if(shorterThan(burst, block.bursts.front()))
+                {
+                    std::pop_heap(block.bursts.begin(), block.bursts.end(), shorterThan);
+                    block.bursts.back() = burst;
+                    std::push_heap(block.bursts.begin(), block.bursts.end(), shorterThan);
+                }
+            }
+        }
+        blocksDone.fetchAndAddRelaxed(1);
+    });
+
+    while(!future.isFinished())
+    {
+        if(progDlg)
+            progDlg->setValue(blocksDone.loadRelaxed());
+        QThread::msleep(PROGRESS_POLL_MS);
+    }
+
+    QVector<std::vector<Hotspot> > gaps(lanes.size()), bursts(lanes.size());
+    for(const Block& block: blocks)
+    {
+        gaps[block.lane].insert(gaps[block.lane].end(), block.gaps.begin(), block.gaps.end());
+        bursts[block.lane].insert(bursts[block.lane].end(), block.bursts.begin(), block.bursts.end());
+    }
+
+    QList<LaneHotspots> result;
+    for(int n = 0; n < lanes.size(); n++)
+    {
+        LaneHotspots hotspots;
+        hotspots.lane = lanes[n];
+
+        std::sort(gaps[n].begin(), gaps[n].end(), longerThan);
+        for(size_t i = 0; i < gaps[n].size() && i < HOTSPOT_TOP_K; i++)
+            hotspots.gaps.append(gaps[n][i]);
+
+        std::sort(bursts[n].begin(), bursts[n].end(), shorterThan);
+        for(const Hotspot& burst: bursts[n])
+        {
+            bool overlaps = false;
+            for(const Hotspot& picked: hotspots.bursts)
+                overlaps = overlaps || qAbs(burst.first - picked.first) < HOTSPOT_BURST_EVENTS;
+            if(!overlaps)
+                hotspots.bursts.append(burst);
+            if(hotspots.bursts.size() >= HOTSPOT_TOP_K)
+                break;
+        }
+
+        result.append(hotspots);
+    }
+    return result;
+}
@@ -0,0 +1,32 @@
+#ifndef TRACEHOTSPOTS_H
+#define TRACEHOTSPOTS_H
+
+#include <QList>
+#include <QProgressDialog>
+#include "tracedata.h"
+
+#define HOTSPOT_TOP_K           10
+#define HOTSPOT_BURST_EVENTS    64
+
+typedef struct {
+    double begin, end;
+    int first;      // index of the first event
+    int count;      // events from begin to end inclusive
+} Hotspot;
+
+// Where a lane stalled and where it was busiest: its largest gaps between
+// consecutive events and the shortest time spans holding
+// HOTSPOT_BURST_EVENTS events, HOTSPOT_TOP_K of each. Bursts don't overlap.
+class LaneHotspots
+{
+public:
+    LaneHotspots() : lane(NULL) { }
+
+    Trace* lane;
+    QList<Hotspot> gaps;    // largest first
+    QList<Hotspot> bursts;  // densest first
+
+    static QList<LaneHotspots> find(const QList<Trace*>& lanes, QProgressDialog* progDlg = NULL);
+};
+
+#endif // TRACEHOTSPOTS_H
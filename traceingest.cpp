@@ -0,0 +1,89 @@
+#include "traceingest.h"
+#include <QLocalServer>
+#include <QLocalSocket>
+#include <QTcpServer>
+#include <QTcpSocket>
+
+#define INGEST_QUEUE_SZ     (1024*1024)
+
+TraceIngest::TraceIngest(const QString& address, QObject* parent)
+    : QThread(parent), _address(address), _queue(INGEST_QUEUE_SZ)
+{
+}
+
+TraceIngest::~TraceIngest()
+{
+    stop();
+}
+
+void TraceIngest::stop()
+{
+    quit();
+    wait();
+}
+
+void TraceIngest::run()
+{
+    QLocalServer localServer;
+    QTcpServer tcpServer;
+    bool isPort;
+    quint16 port = _address.toUShort(&isPort);
+
+    if(isPort)
+    {
+        if(!tcpServer.listen(QHostAddress::LocalHost, port))
+        {
+            emit error(tcpServer.errorString());
+            return;
+        }
+        connect(&tcpServer, &QTcpServer::newConnection, &tcpServer, [&]() {
+            while(QTcpSocket* sock = tcpServer.nextPendingConnection())
+                acceptConnection(sock);
+        });
+    }
+    else
+    {
+        QLocalServer::removeServer(_address);
+        if(!localServer.listen(_address))
+        {
+            emit error(localServer.errorString());
+            return;
+        }
+        connect(&localServer, &QLocalServer::newConnection, &localServer, [&]() {
+            while(QLocalSocket* sock = localServer.nextPendingConnection())
+                acceptConnection(sock);
+        });
+    }
+
+    exec();
+}
+
+void TraceIngest::acceptConnection(QIODevice* sock)
+{
+    connect(sock, &QIODevice::readyRead, sock, [this,sock]() { readLines(sock); });
+    connect(sock, &QIODevice::readChannelFinished, sock, [this,sock]() { readLines(sock, true); });
+    connect(sock, SIGNAL(disconnected()), sock, SLOT(deleteLater()));
+}
+
+// Once the peer has closed, a last line without a newline is taken as well.
+void TraceIngest::readLines(QIODevice* sock, bool flush)
+{
+    while(sock->canReadLine())
+        pushLine(sock->readLine());
+    if(flush && sock->bytesAvailable() > 0)
+        pushLine(sock->readAll());
+}
+
+void TraceIngest::pushLine(QByteArray line)
+{
+    Event ev;
+    ev.line = line;
+    while(ev.line.endsWith('\n') || ev.line.endsWith('\r'))
+        ev.line.chop(1);
+
+    if(!parseTicks(ev.line.constData(), 0, &ev.timestamp))
+        return;
+
+    if(!_queue.push(std::move(ev)))
+        _dropped.fetchAndAddRelaxed(1);
+}
@@ -0,0 +1,47 @@
+#ifndef TRACEINGEST_H
+#define TRACEINGEST_H
+
+#include <QThread>
+#include <QAtomicInteger>
+#include <QByteArray>
+#include "spscqueue.h"
+#include "tracetime.h"
+
+class QIODevice;
+
+// Listens on a local socket name or (if the address is a number) a localhost
+// TCP port, and parses incoming trace lines on its own thread. Parsed events
+// are handed to the UI thread through a lock-free queue.
+class TraceIngest : public QThread
+{
+    Q_OBJECT
+public:
+    typedef struct {
+        TraceTicks timestamp;
+        QByteArray line;
+    } Event;
+
+    TraceIngest(const QString& address, QObject* parent = NULL);
+    virtual ~TraceIngest();
+
+    bool popEvent(Event* ev) { return _queue.pop(ev); }
+    qint64 numDropped() { return _dropped.loadRelaxed(); }
+
+    void stop();
+
+signals:
+    void error(const QString& msg);
+
+protected:
+    void run();
+    void acceptConnection(QIODevice* sock);
+    void readLines(QIODevice* sock, bool flush = false);
+    void pushLine(QByteArray line);
+
+protected:
+    QString _address;
+    SpscQueue<Event> _queue;
+    QAtomicInteger<qint64> _dropped;
+};
+
+#endif // TRACEINGEST_H
@@ -0,0 +1,421 @@
+#include "tracejson.h"
+#include "tracecompress.h"
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define JSON_MAX_FIELDS     32
+#define JSON_MAX_KEY_SZ     64
+
+typedef struct {
+    const char* key;
+    int keyLen;
+    const char* value;
+    const char* valueEnd;
+} JsonField;
+
+bool TraceJson::isJson(const QString& fileName)
+{
+    return fileName.endsWith(".json", Qt::CaseInsensitive) ||
+           fileName.endsWith(".json.gz", Qt::CaseInsensitive) ||
+           fileName.endsWith(".json.zst", Qt::CaseInsensitive);
+}
+
+// True if any of the 8 bytes of w equals c: a byte-wise compare done eight
+// bytes at a time in an ordinary register.
+static inline bool hasByte(quint64 w, uchar c)
+{
+    const quint64 ones = Q_UINT64_C(0x0101010101010101);
+    const quint64 highs = Q_UINT64_C(0x8080808080808080);
+    quint64 x = w ^ (ones * c);
+    return ((x - ones) & ~x & highs) != 0;
+}
+
+static inline bool hasStringSpecial(const char* p)
+{
+    quint64 w;
+    memcpy(&w, p, sizeof(w));
+    return hasByte(w, '"') || hasByte(w, '\\');
+}
+
+// Tracks only strings and nesting, which is all that is needed to find the
+// event objects: everything else is skipped a byte (or, inside strings,
+// eight bytes) at a time.
+bool TraceJson::scan(QIODevice* file, QVector<qint64>* objects, qint64* end, QAtomicInteger<qint64>* progress)
+{
+    CompressedFile* compressed = dynamic_cast<CompressedFile*>(file);
+    QByteArray block(JSON_SCAN_BLOCK_SZ, 0);
+    QByteArray key;             // the last string at the top level
+    int depth = 0;
+    int eventsDepth = -1;       // depth inside the events array, once found
+    bool inString = false;
+    bool escape = false;
+    bool done = false;
+    qint64 base = file->pos();
+
+    *end = base;
+    while(!done)
+    {
+        qint64 len = file->read(block.data(), block.size());
+        if(len <= 0)
+            break;
+
+        const char* p = block.constData();
+        const char* e = p + len;
+        if(escape && p < e)
+        {
+            ++p;
+            escape = false;
+        }
+
+        while(p < e && !done)
+        {
+            if(inString)
+            {
+                const char* start = p;
+                while(p + 8 <= e && !hasStringSpecial(p))
+                    p += 8;
+                while(p < e && *p != '"' && *p != '\\')
+                    ++p;
+                if(depth == 1 && key.size() < JSON_MAX_KEY_SZ)
+                    key.append(start, qMin((int)(p - start), JSON_MAX_KEY_SZ));
+                if(p == e)
+                    break;
+                if(*p == '\\')
+                {
+                    if(p + 2 > e)
+                    {
+                        escape = true;
+                        break;
+                    }
+                    p += 2;
+                    continue;
+                }
+                inString = false;
+                ++p;
+                continue;
+            }
+
+            while(p < e && *p != '"' && *p != '{' && *p != '}' && *p != '[' && *p != ']')
+                ++p;
+            if(p == e)
+                break;
+
+            switch(*p)
+            {
+            case '"':
+                inString = true;
+                if(depth == 1)
+                    key.clear();
+                break;
+            case '{':
+            case '[':
+                if(*p == '{' && depth == eventsDepth)
+                    objects->append(base + (p - block.constData()));
+                depth++;
+                if(*p == '[' && eventsDepth < 0 && (depth == 1 || (depth == 2 && key == "traceEvents")))
+                    eventsDepth = depth;
+                break;
+            default:
+                depth--;
+                if(depth == eventsDepth && *p == '}')
+                    *end = base + (p - block.constData()) + 1;
+                // the rest of the file is metadata
+                done = (depth < eventsDepth);
+                break;
+            }
+            ++p;
+        }
+
+        base += len;
+        if(progress)
+            progress->storeRelaxed(compressed ? compressed->compressedPos() : base);
+    }
+
+    // drop an object cut off by the end of the file
+    while(!objects->isEmpty() && objects->last() >= *end)
+        objects->removeLast();
+
+    return eventsDepth >= 0;
+}
+
+static const char* skipSpace(const char* p, const char* end)
+{
+    while(p < end && isspace((uchar)*p))
+        ++p;
+    return p;
+}
+
+static const char* skipString(const char* p, const char* end)
+{
+    for(++p; p < end; ++p)
+    {
+        if(*p == '\\')
+            ++p;
+        else if(*p == '"')
+            return p + 1;
+    }
+    return end;
+}
+
+static const char* skipValue(const char* p, const char* end)
+{
+    if(p >= end)
+        return end;
+    if(*p == '"')
+        return skipString(p, end);
+    if(*p == '{' || *p == '[')
+    {
+        int depth = 0;
+        while(p < end)
+        {
+            if(*p == '"')
+            {
+                p = skipString(p, end);
+                continue;
+            }
+            if(*p == '{' || *p == '[')
+                depth++;
+            else if((*p == '}' || *p == ']') && --depth == 0)
+                return p + 1;
+            ++p;
+        }
+        return end;
+    }
+    while(p < end && *p != ',' && *p != '}' && *p != ']' && !isspace((uchar)*p))
+        ++p;
+    return p;
+}
+
+const char* TraceJson::objectEnd(const char* obj, const char* end)
+{
+    const char* p = skipSpace(obj, end);
+    if(p >= end || *p != '{')
+        return NULL;
+    int depth = 0;
+    while(p < end)
+    {
+        if(*p == '"')
+        {
+            p = skipString(p, end);
+            continue;
+        }
+        if(*p == '{' || *p == '[')
+            depth++;
+        else if((*p == '}' || *p == ']') && --depth == 0)
+            return p + 1;
+        ++p;
+    }
+    return NULL;
+}
+
+// Splits the object at obj into its top-level fields, stopping early if it
+// is cut short.
+static int objectFields(const char* obj, const char* end, JsonField* fields, int maxFields)
+{
+    const char* p = skipSpace(obj, end);
+    if(p >= end || *p != '{')
+        return 0;
+    ++p;
+
+    int count = 0;
+    while(count < maxFields)
+    {
+        p = skipSpace(p, end);
+        if(p >= end || *p != '"')
+            break;
+        const char* keyEnd = skipString(p, end);
+        JsonField& field = fields[count];
+        field.key = p + 1;
+        field.keyLen = (int)(keyEnd - p - 2);
+
+        p = skipSpace(keyEnd, end);
+        if(p >= end || *p != ':')
+            break;
+        field.value = skipSpace(p + 1, end);
+        field.valueEnd = p = skipValue(field.value, end);
+        if(field.valueEnd == field.value)
+            break;
+        count++;
+
+        p = skipSpace(p, end);
+        if(p >= end || *p != ',')
+            break;
+        ++p;
+    }
+    return count;
+}
+
+static const JsonField* findField(const JsonField* fields, int count, const char* key)
+{
+    int len = (int)strlen(key);
+    for(int n = 0; n < count; n++)
+    {
+        if(fields[n].keyLen == len && memcmp(fields[n].key, key, len) == 0)
+            return &fields[n];
+    }
+    return NULL;
+}
+
+// Times are in microseconds.
+static bool fieldTicks(const JsonField* field, TraceTicks* out)
+{
+    char buf[64];
+    int len = field ? (int)(field->valueEnd - field->value) : 0;
+    if(len <= 0 || len >= (int)sizeof(buf))
+        return false;
+    memcpy(buf, field->value, len);
+    buf[len] = '\0';
+    const char* end = parseTicks(buf, 6, out);
+    return end == buf + len;
+}
+
+static bool fieldIs(const JsonField* field, const char* str)
+{
+    int len = (int)strlen(str);
+    return field && (field->valueEnd - field->value == len + 2) &&
+           field->value[0] == '"' && memcmp(field->value + 1, str, len) == 0;
+}
+
+bool TraceJson::parseEvent(const char* obj, const char* end, Event* ev)
+{
+    JsonField fields[JSON_MAX_FIELDS];
+    int count = objectFields(obj, end, fields, JSON_MAX_FIELDS);
+
+    const JsonField* ph = findField(fields, count, "ph");
+    if(!ph || ph->valueEnd - ph->value < 3 || ph->value[0] != '"')
+        return false;
+    ev->phase = ph->value[1];
+    ev->timestamp = 0;
+    ev->duration = 0;
+
+    if(ev->phase == 'M')
+        return fieldIs(findField(fields, count, "name"), "thread_name");
+
+    if(!fieldTicks(findField(fields, count, "ts"), &ev->timestamp))
+        return false;
+    if(ev->phase == 'X' && !fieldTicks(findField(fields, count, "dur"), &ev->duration))
+        ev->duration = 0;
+    return true;
+}
+
+typedef struct {
+    char* ptr;
+    char* end;      // leaves room for the terminator
+} LineOut;
+
+static void put(LineOut* out, const char* str, int len)
+{
+    len = qMin(len, (int)(out->end - out->ptr));
+    memcpy(out->ptr, str, len);
+    out->ptr += len;
+}
+
+static void put(LineOut* out, const char* str)
+{
+    put(out, str, (int)strlen(str));
+}
+
+// Strings are unquoted, with escapes reduced to the character they escape;
+// a token (lane, key or value word) has its whitespace replaced too, so it
+// stays one word.
+static void putValue(LineOut* out, const JsonField* field, bool token)
+{
+    const char* p = field->value;
+    const char* end = field->valueEnd;
+    if(p < end && *p == '"')
+    {
+        ++p;
+        if(end > p && end[-1] == '"')
+            --end;
+    }
+
+    for(; p < end && out->ptr < out->end; ++p)
+    {
+        char c = *p;
+        if(c == '\\' && p + 1 < end)
+        {
+            c = *++p;
+            if(c == 'n' || c == 't' || c == 'r')
+                c = ' ';
+        }
+        if(token && isspace((uchar)c))
+            c = '_';
+        *out->ptr++ = c;
+    }
+}
+
+void TraceJson::formatEvent(const char* obj, const char* end, TraceTicks timestamp, bool spanEnd, char* line, int lineSz)
+{
+    JsonField fields[JSON_MAX_FIELDS];
+    int count = objectFields(obj, end, fields, JSON_MAX_FIELDS);
+    LineOut out = { line, line + lineSz - 1 };
+
+    char ts[64];
+    quint64 mag = (timestamp < 0) ? -(quint64)timestamp : (quint64)timestamp;
+    snprintf(ts, sizeof(ts), "%s%llu.%09llu ", (timestamp < 0) ? "-" : "", mag / TICKS_PER_SEC, mag % TICKS_PER_SEC);
+    put(&out, ts);
+
+    const JsonField* pid = findField(fields, count, "pid");
+    const JsonField* tid = findField(fields, count, "tid");
+    if(pid)
+        putValue(&out, pid, true);
+    if(pid && tid)
+        put(&out, "/");
+    if(tid)
+        putValue(&out, tid, true);
+    if(!pid && !tid)
+        put(&out, "0");
+
+    const JsonField* ph = findField(fields, count, "ph");
+    char phase = (ph && ph->valueEnd - ph->value >= 3) ? ph->value[1] : 'i';
+    const JsonField* name = findField(fields, count, "name");
+    const JsonField* args = findField(fields, count, "args");
+    JsonField argFields[JSON_MAX_FIELDS];
+    int argCount = args ? objectFields(args->value, args->valueEnd, argFields, JSON_MAX_FIELDS) : 0;
+
+    if(phase == 'M')
+    {
+        const JsonField* threadName = findField(argFields, argCount, "name");
+        put(&out, " THREAD_NAME=");
+        if(threadName)
+            putValue(&out, threadName, true);
+        *out.ptr = '\0';
+        return;
+    }
+
+    if(phase == 'B' || (phase == 'X' && !spanEnd))
+        put(&out, " BEGIN");
+    else if(phase == 'E' || phase == 'X')
+        put(&out, " END");
+    if(name)
+    {
+        put(&out, " ");
+        putValue(&out, name, false);
+    }
+    if(!strchr("BEXiIn", phase))
+    {
+        put(&out, " ph=");
+        put(&out, &phase, 1);
+    }
+
+    const JsonField* cat = findField(fields, count, "cat");
+    if(cat)
+    {
+        put(&out, " cat=");
+        putValue(&out, cat, true);
+    }
+
+    for(int n = 0; n < argCount; n++)
+    {
+        const JsonField& arg = argFields[n];
+        if(*arg.value == '{' || *arg.value == '[')
+            continue;
+        put(&out, " ");
+        put(&out, arg.key, arg.keyLen);
+        put(&out, "=");
+        putValue(&out, &arg, true);
+    }
+    *out.ptr = '\0';
+}
@@ -0,0 +1,55 @@
+#ifndef TRACEJSON_H
+#define TRACEJSON_H
+
+#include <QIODevice>
+#include <QVector>
+#include <QAtomicInteger>
+#include "tracetime.h"
+
+#define JSON_SCAN_BLOCK_SZ      (4*1024*1024)
+#define JSON_MAX_OBJECT_SZ      4096    // read back per event at first, doubled until the object ends
+#define JSON_CHUNK_EVENTS       65536   // events parsed per task
+
+// Chrome trace-event JSON (either {"traceEvents":[...]} or a bare array),
+// read without building a document. scan() finds where each event object
+// starts in one streaming pass, which is all that is kept per event; the
+// objects are then parsed in chunks, and turned back into TraceView's
+// "TIMESTAMP LANE DETAIL" text only when an event is displayed:
+//
+//   B/E events         TS PID/TID BEGIN NAME ... / END NAME ...
+//   X events           both of the above, at ts and ts+dur
+//   M thread_name      TS PID/TID THREAD_NAME=NAME
+//   anything else      TS PID/TID NAME ..., a tick
+//
+// followed by cat=CAT and the scalar args as KEY=VALUE words.
+class TraceJson
+{
+public:
+    typedef struct {
+        char phase;
+        TraceTicks timestamp;
+        TraceTicks duration;    // X events only
+    } Event;
+
+    static bool isJson(const QString& fileName);
+
+    // Appends the offset of every event object to objects, and sets end to
+    // the offset just past the last complete one.
+    static bool scan(QIODevice* file, QVector<qint64>* objects, qint64* end,
+                     QAtomicInteger<qint64>* progress = NULL);
+
+    // False for objects that aren't events, including metadata other than
+    // thread names, which have no timestamp of their own.
+    static bool parseEvent(const char* obj, const char* end, Event* ev);
+
+    // Just past the closing brace of the object at obj, or NULL if it is
+    // cut short by end.
+    static const char* objectEnd(const char* obj, const char* end);
+
+    // Writes the text line of the event, or of the end of an X event.
+    // The timestamp is passed in, as thread names have none of their own.
+    static void formatEvent(const char* obj, const char* end, TraceTicks timestamp, bool spanEnd,
+                            char* line, int lineSz);
+};
+
+#endif // TRACEJSON_H
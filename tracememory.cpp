@@ -0,0 +1,189 @@
+#include "tracememory.h"
+#include <math.h>
+#include <algorithm>
+#include <QMap>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QSet>
+#include <QElapsedTimer>
+#include <QRegExp>
+
+// Clients register from the constructors of globals too, so the registry is
+// created on first use rather than at static initialization.
+struct MemoryRegistry
+{
+    MemoryRegistry() : used(0), limit(DEFAULT_MEMORY_BUDGET) { clock.start(); }
+
+    QMutex lock;
+    QSet<MemoryClient*> clients;
+    QAtomicInteger<qint64> used;
+    QAtomicInteger<qint64> limit;
+    QElapsedTimer clock;
+};
+
+static MemoryRegistry& registry()
+{
+    static MemoryRegistry reg;
+    return reg;
+}
+
+MemoryClient::MemoryClient(const char* component, bool evictable)
+    : _component(component), _evictable(evictable), _bytes(0), _rebuildMs(0)
+{
+    MemoryRegistry& reg = registry();
+    _lastUse.storeRelaxed(reg.clock.elapsed());
+    QMutexLocker locker(&reg.lock);
+    reg.clients.insert(this);
+}
+
+MemoryClient::MemoryClient(const MemoryClient& other)
+    : MemoryClient(other._component, other._evictable)
+{
+    _rebuildMs = other._rebuildMs;
+    setMemoryUsed(other._bytes);
+}
+
+MemoryClient::~MemoryClient()
+{
+    MemoryRegistry& reg = registry();
+    QMutexLocker locker(&reg.lock);
+    reg.clients.remove(this);
+    reg.used.fetchAndAddRelaxed(-_bytes);
+}
+
+// Copies what the memory is used for along with the data; each client keeps
+// its own registration.
+MemoryClient& MemoryClient::operator=(const MemoryClient& other)
+{
+    if(this != &other)
+    {
+        _rebuildMs = other._rebuildMs;
+        setMemoryUsed(other._bytes);
+    }
+    return *this;
+}
+
+void MemoryClient::setMemoryUsed(qint64 bytes)
+{
+    MemoryRegistry& reg = registry();
+    QMutexLocker locker(&reg.lock);
+    reg.used.fetchAndAddRelaxed(bytes - _bytes);
+    _bytes = bytes;
+}
+
+void MemoryClient::touch() const
+{
+    _lastUse.storeRelaxed(registry().clock.elapsed());
+}
+
+void MemoryClient::setRebuildCost(double ms)
+{
+    _rebuildMs = ms;
+}
+
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+
+void MemoryBudget::setLimit(qint64 bytes)
+{
+    registry().limit.storeRelaxed(bytes);
+}
+
+qint64 MemoryBudget::limit()
+{
+    return registry().limit.loadRelaxed();
+}
+
+qint64 MemoryBudget::used()
+{
+    return registry().used.loadRelaxed();
+}
+
+// Evicts until usage is within the limit, or nothing more can go. A client
+// is worth evicting in proportion to its size and the time since it was
+// used, and in inverse proportion to what rebuilding it would cost. Returns
+// the bytes freed.
+qint64 MemoryBudget::trim()
+{
+    MemoryRegistry& reg = registry();
+    QMutexLocker locker(&reg.lock);
+    if(reg.used.loadRelaxed() <= reg.limit.loadRelaxed())
+        return 0;
+
+    qint64 now = reg.clock.elapsed();
+    QList<QPair<double,MemoryClient*> > candidates;
+    for(MemoryClient* client: reg.clients)
+    {
+        if(!client->_evictable || client->_bytes <= 0)
+            continue;
+        double idleMs = (double)(now - client->_lastUse.loadRelaxed()) + 1;
+        double score = idleMs * client->_bytes / (client->_rebuildMs + 1);
+        candidates.append(QPair<double,MemoryClient*>(-score, client));
+    }
+    std::sort(candidates.begin(), candidates.end());
+
+    qint64 freed = 0;
+    for(auto& candidate: candidates)
+    {
+        if(reg.used.loadRelaxed() <= reg.limit.loadRelaxed())
+            break;
+        MemoryClient* client = candidate.second;
+        qint64 bytes = qMin(client->evict(), client->_bytes);
+        client->_bytes -= bytes;
+        reg.used.fetchAndAddRelaxed(-bytes);
+        freed += bytes;
+    }
+    return freed;
+}
+
+// Usage summed by component, largest first.
+QList<MemoryBudget::Usage> MemoryBudget::breakdown()
+{
+    MemoryRegistry& reg = registry();
+    QMap<QString,Usage> byComponent;
+    {
+        QMutexLocker locker(&reg.lock);
+        for(MemoryClient* client: reg.clients)
+        {
+            Usage& usage = byComponent[client->_component];
+            usage.component = client->_component;
+            usage.bytes += client->_bytes;
+            if(client->_evictable)
+                usage.evictable += client->_bytes;
+            usage.clients++;
+        }
+    }
+
+    QList<Usage> list = byComponent.values();
+    std::sort(list.begin(), list.end(), [](const Usage& a, const Usage& b) { return a.bytes > b.bytes; });
+    return list;
+}
+
+QString MemoryBudget::formatBytes(qint64 bytes)
+{
+    const char* units[] = { "B", "KB", "MB", "GB", "TB" };
+    double size = bytes;
+    int unit = 0;
+    while(fabs(size) >= 1024 && unit < 4)
+    {
+        size /= 1024;
+        ++unit;
+    }
+    return (unit == 0) ? QString("%1 B").arg(bytes) : QString::asprintf("%.1f %s", size, units[unit]);
+}
+
+// A size such as "8G", "512 MB" or "1.5gb", in powers of 1024. Without a
+// unit the number is bytes.
+bool MemoryBudget::parseBytes(const QString& str, qint64* bytes)
+{
+    QRegExp regEx("\\s*([0-9]+(?:\\.[0-9]*)?)\\s*([kmgt]?)b?\\s*", Qt::CaseInsensitive);
+    if(!regEx.exactMatch(str))
+        return false;
+
+    double size = regEx.cap(1).toDouble();
+    QString unit = regEx.cap(2).toLower();
+    int shift = unit.isEmpty() ? 0 : 10 * (QString("kmgt").indexOf(unit) + 1);
+    *bytes = (qint64)(size * (double)(1LL << shift));
+    return true;
+}
@@ -0,0 +1,75 @@
+#ifndef TRACEMEMORY_H
+#define TRACEMEMORY_H
+
+#include <QList>
+#include <QString>
+#include <QAtomicInteger>
+
+#define DEFAULT_MEMORY_BUDGET   (8LL*1024*1024*1024)
+
+// Memory held by one cache, index or other large structure, counted under
+// the name of its component against the MemoryBudget shared by the whole
+// process. Structures that can be rebuilt override evict() to free it.
+class MemoryClient
+{
+public:
+    MemoryClient(const char* component, bool evictable = false);
+    MemoryClient(const MemoryClient& other);
+    virtual ~MemoryClient();
+    MemoryClient& operator=(const MemoryClient& other);
+
+    const char* component() const { return _component; }
+    qint64 memoryUsed() const { return _bytes; }
+
+    void setMemoryUsed(qint64 bytes);
+    void touch() const;                 // used now, so evicted last
+    void setRebuildCost(double ms);     // time to rebuild what evict() frees
+
+protected:
+    friend class MemoryBudget;
+
+    // Frees what can be rebuilt and returns the bytes freed, or 0 while the
+    // memory is in use. Called with the budget locked, so must not call
+    // setMemoryUsed(); the budget subtracts what is returned. Clients that
+    // evict set their usage to 0 before destroying their data, after which
+    // they are never chosen.
+    virtual qint64 evict() { return 0; }
+
+private:
+    const char* _component;
+    bool _evictable;
+    qint64 _bytes;
+    double _rebuildMs;
+    mutable QAtomicInteger<qint64> _lastUse;    // ms on the budget's clock
+};
+
+// One limit on the memory of every registered client. Usage is counted as
+// clients report it, from any thread; trim() then evicts clients, those with
+// the most memory unused for longest per ms of rebuilding first, until the
+// total is back under the limit. trim() evicts on the calling thread, so it
+// is called between operations by the thread that owns the caches; clients
+// used from worker threads lock their own data and can also check isOver()
+// to shrink themselves.
+class MemoryBudget
+{
+public:
+    typedef struct {
+        QString component;
+        qint64 bytes;
+        qint64 evictable;   // of bytes, held by clients that can evict
+        int clients;
+    } Usage;
+
+    static void setLimit(qint64 bytes);
+    static qint64 limit();
+    static qint64 used();
+    static bool isOver() { return used() > limit(); }
+
+    static qint64 trim();
+    static QList<Usage> breakdown();
+
+    static QString formatBytes(qint64 bytes);
+    static bool parseBytes(const QString& str, qint64* bytes);
+};
+
+#endif // TRACEMEMORY_H
@@ -0,0 +1,172 @@
+#include "traceoverview.h"
+#include <math.h>
+#include <QPainter>
+#include <QMouseEvent>
+
+#define OVERVIEW_HEIGHT         40
+#define OVERVIEW_BG_COLOR       QColor(0,15,30)
+#define OVERVIEW_DENSITY_COLOR  QColor(120,170,255)
+#define OVERVIEW_WINDOW_COLOR   QColor(255,255,255,50)
+#define OVERVIEW_WINDOW_EDGE    QColor(255,255,255,160)
+#define OVERVIEW_MIN_WINDOW_W   3
+
+TraceOverview::TraceOverview(TraceView* view, QWidget* parent)
+    : QWidget(parent), _view(view), _valid(false), _dragOffset(0)
+{
+    _span.set(0, 1);
+    setSizePolicy(QSizePolicy::Expanding, QSizePolicy::Fixed);
+    connect(view, SIGNAL(lanesChanged()), this, SLOT(invalidate()));
+    connect(view, SIGNAL(viewTimeChanged()), this, SLOT(update()));
+}
+
+QSize TraceOverview::sizeHint() const
+{
+    return QSize(QWidget::sizeHint().width(), OVERVIEW_HEIGHT);
+}
+
+void TraceOverview::invalidate()
+{
+    _valid = false;
+    update();
+}
+
+void TraceOverview::resizeEvent(QResizeEvent*)
+{
+    _valid = false;
+}
+
+// Sums the events of every lane per pixel column: two binary searches per
+// column for lanes with events, or the pyramid for lanes still loading.
+// Heights are log scaled so sparse regions stay visible.
+void TraceOverview::render()
+{
+    int w = width();
+    int h = height();
+
+    _image = QImage(qMax(w, 1), qMax(h, 1), QImage::Format_ARGB32_Premultiplied);
+    _image.fill(OVERVIEW_BG_COLOR);
+    _valid = true;
+
+    if(!_view->getTimeSpan(&_span) || w <= 0)
+        return;
+    if(_span.delta() <= 0)
+        _span.end = _span.begin + 1;
+
+    QVector<float> counts(w, 0);
+    QVector<float> laneCounts(w);
+    double timePerPx = _span.delta() / w;
+
+    for(int laneIdx = 0; laneIdx < _view->numLanes(); laneIdx++)
+    {
+        const Lane* lane = _view->getLane(laneIdx);
+        if(lane->isGroup)
+            continue;   // counted through its members
+        if(lane->data && lane->data->numEvents() > 0)
+        {
+            int tmp, right;
+            int prevIdx = 0;
+            for(int x = 0; x < w; x++)
+            {
+                int nextIdx = lane->data->numEvents();
+                if(x + 1 < w)
+                {
+                    lane->data->findEvents(_span.begin + (x + 1) * timePerPx, &tmp, &right);
+                    if(right != -1)
+                        nextIdx = right;
+                }
+                counts[x] += nextIdx - prevIdx;
+                prevIdx = nextIdx;
+            }
+        }
+        else if(lane->pyramid)
+        {
+            lane->pyramid->sample(_span.begin, _span.end, w, laneCounts.data());
+            for(int x = 0; x < w; x++)
+                counts[x] += laneCounts[x];
+        }
+    }
+
+    float maxCount = 0;
+    for(float count: counts)
+        maxCount = qMax(maxCount, count);
+    if(maxCount <= 0)
+        return;
+
+    QPainter p(&_image);
+    double scale = h / log1p(maxCount);
+    for(int x = 0; x < w; x++)
+    {
+        if(counts[x] <= 0)
+            continue;
+        int barH = qMax(1, (int)(log1p(counts[x]) * scale));
+        p.fillRect(x, h - barH, 1, barH, OVERVIEW_DENSITY_COLOR);
+    }
+}
+
+float TraceOverview::timeToCoord(double t)
+{
+    return (float)((t - _span.begin) / _span.delta() * width());
+}
+
+double TraceOverview::coordToTime(float x)
+{
+    return _span.begin + x * _span.delta() / width();
+}
+
+void TraceOverview::paintEvent(QPaintEvent*)
+{
+    if(!_valid || _image.size() != size())
+        render();
+
+    QPainter p(this);
+    p.drawImage(0, 0, _image);
+
+    Range<double> viewTime = _view->viewTimeRange();
+    float x0 = timeToCoord(viewTime.begin);
+    float x1 = timeToCoord(viewTime.end);
+    if(x1 - x0 < OVERVIEW_MIN_WINDOW_W)
+    {
+        float mid = (x0 + x1) / 2;
+        x0 = mid - OVERVIEW_MIN_WINDOW_W / 2.0f;
+        x1 = mid + OVERVIEW_MIN_WINDOW_W / 2.0f;
+    }
+
+    QRectF window(x0, 0, x1 - x0, height() - 1);
+    p.fillRect(window, OVERVIEW_WINDOW_COLOR);
+    p.setPen(OVERVIEW_WINDOW_EDGE);
+    p.drawRect(window);
+}
+
+void TraceOverview::moveWindowTo(double t)
+{
+    Range<double> viewTime = _view->viewTimeRange();
+    double half = viewTime.delta() / 2;
+    _view->setViewTimeRange(t - half, t + half);
+}
+
+// Clicking inside the window grabs it; clicking elsewhere centres it there.
+void TraceOverview::mousePressEvent(QMouseEvent* ev)
+{
+    if(!(ev->buttons() & Qt::LeftButton))
+        return;
+
+    Range<double> viewTime = _view->viewTimeRange();
+    double t = coordToTime(ev->position().x());
+    double mid = (viewTime.begin + viewTime.end) / 2;
+
+    if(t >= viewTime.begin && t <= viewTime.end)
+    {
+        _dragOffset = mid - t;
+    }
+    else
+    {
+        _dragOffset = 0;
+        moveWindowTo(t);
+    }
+}
+
+void TraceOverview::mouseMoveEvent(QMouseEvent* ev)
+{
+    if(ev->buttons() & Qt::LeftButton)
+        moveWindowTo(coordToTime(ev->position().x()) + _dragOffset);
+}
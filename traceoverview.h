@@ -0,0 +1,42 @@
+#ifndef TRACEOVERVIEW_H
+#define TRACEOVERVIEW_H
+
+#include <QWidget>
+#include <QImage>
+#include "traceview.h"
+
+// Strip showing the event density of all lanes over the whole trace, with
+// the time range visible in the TraceView drawn as a window that can be
+// dragged. The density is rendered to an image only when the lanes change
+// or the strip is resized.
+class TraceOverview : public QWidget
+{
+    Q_OBJECT
+public:
+    TraceOverview(TraceView* view, QWidget* parent = NULL);
+
+    QSize sizeHint() const;
+
+public slots:
+    void invalidate();
+
+protected:
+    void paintEvent(QPaintEvent*);
+    void resizeEvent(QResizeEvent*);
+    void mousePressEvent(QMouseEvent* ev);
+    void mouseMoveEvent(QMouseEvent* ev);
+
+    void render();
+    float timeToCoord(double t);
+    double coordToTime(float x);
+    void moveWindowTo(double t);
+
+protected:
+    TraceView* _view;
+    QImage _image;
+    bool _valid;
+    Range<double> _span;
+    double _dragOffset;     // from the cursor to the middle of the window
+};
+
+#endif // TRACEOVERVIEW_H
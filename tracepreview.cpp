@@ -0,0 +1,237 @@
+#include "tracepreview.h"
+#include "tracecompress.h"
+#include "tracejson.h"
+#include "tracedata.h"
+#include <math.h>
+#include <stdio.h>
+#include <QFile>
+#include <QFileInfo>
+
+#define MAX_LANE_ID_SZ  256
+
+TracePreview::TracePreview(const QStringList& fileNames, const QList<double>& clockOffsets, TraceTicks baseTicks)
+    : _fileNames(fileNames), _clockOffsets(clockOffsets), _baseTicks(baseTicks), _begin(0), _end(1), _geometry(0, 1)
+{
+    for(const QString& fileName: fileNames)
+    {
+        if(fileNames.size() > 1)
+            _laneNamespaces.append(QFileInfo(fileName).completeBaseName() + ":");
+        else
+            _laneNamespaces.append(QString());
+    }
+}
+
+TracePreview::~TracePreview()
+{
+    qDeleteAll(_pyramids);
+    qDeleteAll(_pending);
+}
+
+TracePyramid* TracePreview::pyramidForLane(const QString& laneID)
+{
+    TracePyramid* pyramid = _pyramids.value(laneID);
+    if(!pyramid)
+    {
+        pyramid = new TracePyramid(_begin, _end);
+        _pyramids[laneID] = pyramid;
+        _laneOrder.append(laneID);
+    }
+    return pyramid;
+}
+
+// Reads numSamples lines at evenly spaced byte offsets (spread over the files
+// in proportion to their size) and weights each one by the number of lines
+// it stands for. Compressed files can't be sampled before they are indexed,
+// and JSON events don't sit one per line, so both are left out.
+bool TracePreview::sample(int numSamples)
+{
+    typedef struct {
+        double timestamp;
+        QString laneID;
+        int source;
+    } Sample;
+
+    QList<Sample> samples;
+    QList<qint64> lineBytes;
+    QList<int> lineCounts;
+    qint64 totalSize = 0;
+    char laneBuf[MAX_LANE_ID_SZ];
+
+    for(const QString& fileName: _fileNames)
+        if(!CompressedFile::isCompressed(fileName) && !TraceJson::isJson(fileName))
+            totalSize += QFileInfo(fileName).size();
+    if(totalSize <= 0)
+        return false;
+
+    _begin = HUGE_VAL;
+    _end = -HUGE_VAL;
+
+    for(int src = 0; src < _fileNames.size(); src++)
+    {
+        QFile file(_fileNames[src]);
+        TraceTicks clockTicks = secondsToTicks((src < _clockOffsets.size()) ? _clockOffsets[src] : 0) - _baseTicks;
+        lineBytes.append(0);
+        lineCounts.append(0);
+
+        if(CompressedFile::isCompressed(_fileNames[src]) || TraceJson::isJson(_fileNames[src]))
+            continue;
+        if(!file.open(QIODevice::ReadOnly | QIODevice::Text))
+            continue;
+
+        qint64 size = file.size();
+        int srcSamples = (int)(numSamples * size / totalSize) + 1;
+        for(int n = 0; n < srcSamples; n++)
+        {
+            qint64 pos = size * n / srcSamples;
+            file.seek(pos > 0 ? pos-1 : 0);
+            if(pos > 0)
+                file.readLine();
+            QByteArray line = file.readLine();
+
+            TraceTicks ticks;
+            const char* lane = parseTicks(line.constData(), 0, &ticks);
+            if(!lane || sscanf(lane, " %255s", laneBuf) != 1)
+                continue;
+
+            double timestamp = ticksToSeconds(ticks + clockTicks);
+            _begin = qMin(_begin, timestamp);
+            _end = qMax(_end, timestamp);
+            lineBytes[src] += line.size();
+            lineCounts[src] += 1;
+            samples.append(Sample{ timestamp, _laneNamespaces[src] + laneBuf, src });
+        }
+
+        // the last line bounds the span, even when it wasn't sampled
+        double first, last;
+        if(TraceFile::probeTimeSpan(_fileNames[src], &first, &last))
+        {
+            _begin = qMin(_begin, ticksToSeconds(secondsToTicks(first) + clockTicks));
+            _end = qMax(_end, ticksToSeconds(secondsToTicks(last) + clockTicks));
+        }
+    }
+
+    if(samples.isEmpty())
+        return false;
+
+    _geometry = TracePyramid(_begin, _end);
+
+    for(const Sample& s: samples)
+    {
+        qint64 size = QFileInfo(_fileNames[s.source]).size();
+        double linesPerSample = (double)size / lineBytes[s.source];
+        TracePyramid* pyramid = pyramidForLane(s.laneID);
+        pyramid->add(pyramid->bucketForTime(s.timestamp), (float)(linesPerSample));
+    }
+
+    for(auto pyramid: _pyramids)
+        pyramid->update();
+
+    return true;
+}
+
+TracePreview::Chunk* TracePreview::newChunk(int source)
+{
+    Chunk* chunk = new Chunk;
+    chunk->source = source;
+    chunk->minTime = HUGE_VAL;
+    chunk->maxTime = -HUGE_VAL;
+    return chunk;
+}
+
+void TracePreview::addEvent(Chunk* chunk, TraceTicks ticks, const char* laneToken, int laneTokenLen)
+{
+    double timestamp = ticksToSeconds(ticks - _baseTicks);
+    QByteArray key = QByteArray::fromRawData(laneToken, laneTokenLen);
+    auto iter = chunk->counts.find(key);
+    if(iter == chunk->counts.end())
+        iter = chunk->counts.insert(QByteArray(laneToken, laneTokenLen), QHash<int,float>());
+    iter.value()[_geometry.bucketForTime(timestamp)] += 1;
+    chunk->minTime = qMin(chunk->minTime, timestamp);
+    chunk->maxTime = qMax(chunk->maxTime, timestamp);
+}
+
+void TracePreview::submit(Chunk* chunk)
+{
+    QMutexLocker lock(&_pendingLock);
+    _pending.append(chunk);
+}
+
+// Folds finished chunks into the lane pyramids. The first exact counts to
+// reach a bucket replace its estimate; later chunks add to them. Buckets
+// lying entirely inside a chunk's time span are taken as exact for every
+// lane of that file, so lanes that had no events there are cleared too.
+bool TracePreview::applyPending()
+{
+    QList<Chunk*> chunks;
+    {
+        QMutexLocker lock(&_pendingLock);
+        chunks.swap(_pending);
+    }
+
+    for(Chunk* chunk: chunks)
+    {
+        const QString& laneNamespace = _laneNamespaces.at(chunk->source);
+
+        if(chunk->minTime <= chunk->maxTime)
+        {
+            int first = _geometry.bucketForTime(chunk->minTime) + 1;
+            int last = _geometry.bucketForTime(chunk->maxTime) - 1;
+            for(auto iter = _pyramids.begin(); iter != _pyramids.end(); ++iter)
+            {
+                if(!iter.key().startsWith(laneNamespace))
+                    continue;
+                TracePyramid* pyramid = iter.value();
+                for(int bucket = first; bucket <= last; bucket++)
+                {
+                    if(!pyramid->isExact(bucket))
+                    {
+                        pyramid->set(bucket, 0);
+                        pyramid->setExact(bucket);
+                    }
+                }
+            }
+        }
+
+        for(auto laneIter = chunk->counts.begin(); laneIter != chunk->counts.end(); ++laneIter)
+        {
+            TracePyramid* pyramid = pyramidForLane(laneNamespace + QString::fromUtf8(laneIter.key()));
+            for(auto iter = laneIter.value().begin(); iter != laneIter.value().end(); ++iter)
+            {
+                if(!pyramid->isExact(iter.key()))
+                {
+                    pyramid->set(iter.key(), 0);
+                    pyramid->setExact(iter.key());
+                }
+                pyramid->add(iter.key(), iter.value());
+            }
+        }
+        delete chunk;
+    }
+
+    if(chunks.isEmpty())
+        return false;
+
+    for(auto pyramid: _pyramids)
+        pyramid->update();
+    return true;
+}
+
+// Called once every event has been counted: whatever is still an estimate
+// had no events.
+void TracePreview::finish()
+{
+    applyPending();
+
+    for(auto pyramid: _pyramids)
+    {
+        for(int bucket = 0; bucket < pyramid->numBuckets(0); bucket++)
+        {
+            if(!pyramid->isExact(bucket))
+            {
+                pyramid->set(bucket, 0);
+                pyramid->setExact(bucket);
+            }
+        }
+        pyramid->update();
+    }
+}
@@ -0,0 +1,59 @@
+#ifndef TRACEPREVIEW_H
+#define TRACEPREVIEW_H
+
+#include <QHash>
+#include <QList>
+#include <QMap>
+#include <QMutex>
+#include <QStringList>
+#include "tracepyramid.h"
+#include "tracetime.h"
+
+// Approximate per-lane density of a trace that is still being loaded.
+// sample() reads a few thousand evenly spaced lines to estimate the shape
+// of the whole file. While the full parse runs, the parser threads submit
+// exact counts for each chunk of events they finish, and applyPending()
+// replaces the estimate with them bucket by bucket. Times are counted from
+// the base tick the trace will have, as its lanes take over the pyramids.
+class TracePreview
+{
+public:
+    struct Chunk {
+        int source;
+        double minTime, maxTime;
+        QHash<QByteArray, QHash<int,float> > counts;    // lane -> bucket -> events
+    };
+
+    TracePreview(const QStringList& fileNames, const QList<double>& clockOffsets, TraceTicks baseTicks);
+    ~TracePreview();
+
+    bool sample(int numSamples);
+
+    QStringList laneIDs() { return _laneOrder; }
+    TracePyramid* getPyramid(const QString& laneID) { return _pyramids.value(laneID); }
+
+    // called from parser threads
+    Chunk* newChunk(int source);
+    void addEvent(Chunk* chunk, TraceTicks timestamp, const char* laneToken, int laneTokenLen);
+    void submit(Chunk* chunk);
+
+    // called from the UI thread
+    bool applyPending();
+    void finish();
+
+protected:
+    TracePyramid* pyramidForLane(const QString& laneID);
+
+    QStringList _fileNames;
+    QList<double> _clockOffsets;
+    TraceTicks _baseTicks;
+    QStringList _laneNamespaces;
+    double _begin, _end;
+    QMap<QString,TracePyramid*> _pyramids;
+    QStringList _laneOrder;
+    QMutex _pendingLock;
+    QList<Chunk*> _pending;
+    TracePyramid _geometry;     // bucket layout shared by all lanes
+};
+
+#endif // TRACEPREVIEW_H
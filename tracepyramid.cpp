@@ -0,0 +1,81 @@
+#include "tracepyramid.h"
+
+TracePyramid::TracePyramid(double begin, double end, int levels)
+    : MemoryClient("pyramids"), _begin(begin), _end(end)
+{
+    if(_end <= _begin)
+        _end = _begin + 1;
+
+    qint64 bytes = 0;
+    for(int level = 0; level < levels; level++)
+    {
+        _counts.push_back(QVector<float>(1 << (levels - 1 - level), 0));
+        bytes += _counts.last().size() * sizeof(float);
+    }
+    _exact.resize(numBuckets(0));
+    setMemoryUsed(bytes + _exact.size() / 8);
+}
+
+int TracePyramid::bucketForTime(double t) const
+{
+    int bucket = (int)((t - _begin) / bucketWidth(0));
+    if(bucket < 0) return 0;
+    if(bucket >= numBuckets(0)) return numBuckets(0) - 1;
+    return bucket;
+}
+
+// Rebuilds the coarser levels from level 0.
+void TracePyramid::update()
+{
+    for(int level = 1; level < numLevels(); level++)
+    {
+        const QVector<float>& below = _counts[level-1];
+        QVector<float>& counts = _counts[level];
+        for(int n = 0; n < counts.size(); n++)
+            counts[n] = below[n*2] + below[n*2+1];
+    }
+}
+
+// Spreads the counts over numSlices equal slices of [t0, t1), using the
+// coarsest level whose buckets are no wider than a slice. Buckets that
+// straddle slices are split in proportion to their overlap.
+void TracePyramid::sample(double t0, double t1, int numSlices, float* out) const
+{
+    for(int n = 0; n < numSlices; n++)
+        out[n] = 0;
+    if(numSlices <= 0 || t1 <= t0)
+        return;
+
+    double sliceWidth = (t1 - t0) / numSlices;
+    int level = 0;
+    while(level+1 < numLevels() && bucketWidth(level+1) <= sliceWidth)
+        ++level;
+
+    const QVector<float>& counts = _counts[level];
+    double width = bucketWidth(level);
+    int first = (int)((t0 - _begin) / width);
+    int last = (int)((t1 - _begin) / width);
+    if(first < 0) first = 0;
+    if(last >= counts.size()) last = counts.size() - 1;
+
+    for(int bucket = first; bucket <= last; bucket++)
+    {
+        float count = counts[bucket];
+        if(count == 0)
+            continue;
+
+        double bucketBegin = _begin + bucket * width;
+        double bucketEnd = bucketBegin + width;
+        double b = bucketBegin > t0 ? bucketBegin : t0;
+        double e = bucketEnd < t1 ? bucketEnd : t1;
+        int slice = (int)((b - t0) / sliceWidth);
+        while(b < e && slice < numSlices)
+        {
+            double sliceEnd = t0 + (slice + 1) * sliceWidth;
+            double overlap = (sliceEnd < e ? sliceEnd : e) - b;
+            out[slice] += count * (float)(overlap / width);
+            b = sliceEnd;
+            ++slice;
+        }
+    }
+}
@@ -0,0 +1,45 @@
+#ifndef TRACEPYRAMID_H
+#define TRACEPYRAMID_H
+
+#include <QVector>
+#include <QBitArray>
+#include "tracememory.h"
+
+#define DEFAULT_PYRAMID_LEVELS  12
+
+// Event counts for one lane at several resolutions. Level 0 splits
+// [begin, end) into (1 << (levels-1)) equal buckets and each level above
+// halves the resolution, so the top level is a single bucket. Level 0
+// buckets can be marked exact; unmarked buckets hold estimates.
+class TracePyramid : public MemoryClient
+{
+public:
+    TracePyramid(double begin, double end, int levels = DEFAULT_PYRAMID_LEVELS);
+
+    double begin() const { return _begin; }
+    double end() const { return _end; }
+    int numLevels() const { return _counts.size(); }
+    int numBuckets(int level) const { return _counts[level].size(); }
+    double bucketWidth(int level) const { return (_end - _begin) / numBuckets(level); }
+
+    int bucketForTime(double t) const;
+    float count(int level, int bucket) const { return _counts[level][bucket]; }
+    float total() const { return _counts.last()[0]; }
+
+    void add(int bucket, float count) { _counts[0][bucket] += count; }
+    void set(int bucket, float count) { _counts[0][bucket] = count; }
+    bool isExact(int bucket) const { return _exact.testBit(bucket); }
+    void setExact(int bucket) { _exact.setBit(bucket); }
+    bool isExact(double t) const { return isExact(bucketForTime(t)); }
+
+    void update();
+
+    void sample(double t0, double t1, int numSlices, float* out) const;
+
+protected:
+    double _begin, _end;
+    QVector<QVector<float> > _counts;
+    QBitArray _exact;
+};
+
+#endif // TRACEPYRAMID_H
@@ -0,0 +1,744 @@
+#include "tracequery.h"
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+#include <iterator>
+#include <QThread>
+#include <QtConcurrent>
+
+#define QUERY_BLOCK_SZ      (64*1024)
+#define PROGRESS_POLL_MS    20
+
+struct TraceQuery::Token
+{
+    enum Kind { Word, Quoted, Pattern, Op, And, Or, Not, Open, Close, End };
+    Kind kind;
+    QString text;
+};
+
+struct TraceQuery::Node
+{
+    enum Kind { And, Or, Not, Time, Lane, Text, Attr };
+
+    Node(Kind kind) : kind(kind), op(AttributeColumn::Equal), regex(false), negate(false),
+                      number(0), ticks(0), regExpSlot(-1), column(NULL) { }
+    ~Node() { qDeleteAll(children); }
+
+    // cheapest terms first: time and lane need no text, attributes need
+    // their columns and text needs the file
+    int cost() const
+    {
+        int c = 0;
+        switch(kind)
+        {
+        case Time: return 0;
+        case Lane: return 1;
+        case Attr: return 2;
+        case Text: return 3;
+        default:
+            for(auto child: children)
+                c = qMax(c, child->cost());
+            return c;
+        }
+    }
+
+    Kind kind;
+    AttributeColumn::Op op;
+    bool regex;             // ~ or !~
+    bool negate;            // !~
+    QString key;
+    QString value;
+    double number;          // for time terms, the view time of ticks, once bound
+    TraceTicks ticks;       // time terms
+    int regExpSlot;
+    QList<Node*> children;
+
+    // bound by evaluate()
+    const AttributeColumn* column;
+    QVector<quint8> table;  // per lane, or per attribute code
+};
+
+struct TraceQuery::Cursor
+{
+    TraceFile* trace;
+    TraceFile::Reader* reader;
+    QList<QRegExp> regExps;
+    const int* laneOf;
+    int idx;
+    const char* text;
+    bool haveText;
+};
+
+static bool parseTime(const QString& str, TraceTicks* t)
+{
+    static const struct { const char* suffix; int digits; } units[] = {
+        { "ns", 9 }, { "us", 6 }, { "ms", 3 }, { "s", 0 }
+    };
+
+    QByteArray number = str.toLatin1();
+    int digits = 0;
+    for(auto& unit: units)
+    {
+        if(str.endsWith(unit.suffix))
+        {
+            number.chop(strlen(unit.suffix));
+            digits = unit.digits;
+            break;
+        }
+    }
+    const char* end = parseTicks(number.constData(), digits, t);
+    return end && *end == '\0';
+}
+
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+
+TraceQuery::TraceQuery()
+    : _root(NULL)
+{
+}
+
+TraceQuery::~TraceQuery()
+{
+    delete _root;
+}
+
+bool TraceQuery::parse(const QString& expr, QString* error)
+{
+    QList<Token> tokens;
+    int pos = 0;
+
+    delete _root;
+    _root = NULL;
+    _regExps.clear();
+    _expr = expr;
+
+    while(pos < expr.size())
+    {
+        QChar c = expr[pos];
+        Token token;
+
+        if(c.isSpace())
+        {
+            pos++;
+            continue;
+        }
+        else if(c == '(' || c == ')')
+        {
+            token.kind = (c == '(') ? Token::Open : Token::Close;
+            token.text = c;
+            pos++;
+        }
+        else if(expr.mid(pos, 2) == "&&" || expr.mid(pos, 2) == "||")
+        {
+            token.kind = (c == '&') ? Token::And : Token::Or;
+            token.text = expr.mid(pos, 2);
+            pos += 2;
+        }
+        else if(c == '"' || c == '/')
+        {
+            int end = expr.indexOf(c, pos + 1);
+            if(end < 0)
+            {
+                *error = QString("Unterminated %1 at column %2").arg(c).arg(pos + 1);
+                return false;
+            }
+            token.kind = (c == '"') ? Token::Quoted : Token::Pattern;
+            token.text = expr.mid(pos + 1, end - pos - 1);
+            pos = end + 1;
+        }
+        else if(QString("=!<>~").contains(c))
+        {
+            int len = 1;
+            if(pos + 1 < expr.size() && QString("=~").contains(expr[pos+1]) && c != '~')
+                len = 2;
+            token.text = expr.mid(pos, len);
+            token.kind = (token.text == "!") ? Token::Not : Token::Op;
+            pos += len;
+        }
+        else
+        {
+            int end = pos;
+            while(end < expr.size() && !expr[end].isSpace() && !QString("()&|=!<>~\"").contains(expr[end]))
+                end++;
+            token.text = expr.mid(pos, end - pos);
+            if(token.text == "and") token.kind = Token::And;
+            else if(token.text == "or") token.kind = Token::Or;
+            else if(token.text == "not") token.kind = Token::Not;
+            else token.kind = Token::Word;
+            pos = end;
+        }
+        tokens.append(token);
+    }
+
+    Token end;
+    end.kind = Token::End;
+    tokens.append(end);
+
+    pos = 0;
+    _root = parseOr(tokens, &pos, error);
+    if(_root && tokens[pos].kind != Token::End)
+    {
+        *error = "Unexpected " + tokens[pos].text;
+        delete _root;
+        _root = NULL;
+    }
+    return _root != NULL;
+}
+
+TraceQuery::Node* TraceQuery::parseOr(QList<Token>& tokens, int* pos, QString* error)
+{
+    Node* node = parseAnd(tokens, pos, error);
+    while(node && tokens[*pos].kind == Token::Or)
+    {
+        (*pos)++;
+        Node* rhs = parseAnd(tokens, pos, error);
+        if(!rhs)
+        {
+            delete node;
+            return NULL;
+        }
+        if(node->kind != Node::Or)
+        {
+            Node* parent = new Node(Node::Or);
+            parent->children.append(node);
+            node = parent;
+        }
+        node->children.append(rhs);
+    }
+    if(node && node->kind == Node::Or)
+        sortByCost(node->children);
+    return node;
+}
+
+TraceQuery::Node* TraceQuery::parseAnd(QList<Token>& tokens, int* pos, QString* error)
+{
+    Node* node = parseUnary(tokens, pos, error);
+    while(node && tokens[*pos].kind == Token::And)
+    {
+        (*pos)++;
+        Node* rhs = parseUnary(tokens, pos, error);
+        if(!rhs)
+        {
+            delete node;
+            return NULL;
+        }
+        if(node->kind != Node::And)
+        {
+            Node* parent = new Node(Node::And);
+            parent->children.append(node);
+            node = parent;
+        }
+        node->children.append(rhs);
+    }
+    if(node && node->kind == Node::And)
+        sortByCost(node->children);
+    return node;
+}
+
+TraceQuery::Node* TraceQuery::parseUnary(QList<Token>& tokens, int* pos, QString* error)
+{
+    if(tokens[*pos].kind == Token::Not)
+    {
+        (*pos)++;
+        Node* child = parseUnary(tokens, pos, error);
+        if(!child)
+            return NULL;
+        Node* node = new Node(Node::Not);
+        node->children.append(child);
+        return node;
+    }
+    else if(tokens[*pos].kind == Token::Open)
+    {
+        (*pos)++;
+        Node* node = parseOr(tokens, pos, error);
+        if(node && tokens[*pos].kind != Token::Close)
+        {
+            *error = "Expected )";
+            delete node;
+            return NULL;
+        }
+        (*pos)++;
+        return node;
+    }
+    return parseTerm(tokens, pos, error);
+}
+
+TraceQuery::Node* TraceQuery::parseTerm(QList<Token>& tokens, int* pos, QString* error)
+{
+    const Token& field = tokens[*pos];
+    if(field.kind != Token::Word)
+    {
+        *error = (field.kind == Token::End) ? QString("Unexpected end of expression") : "Expected a field name before " + field.text;
+        return NULL;
+    }
+    const Token& op = tokens[*pos + 1];
+    if(op.kind != Token::Op)
+    {
+        *error = "Expected a comparison after " + field.text;
+        return NULL;
+    }
+    const Token& value = tokens[*pos + 2];
+    if(value.kind != Token::Word && value.kind != Token::Quoted && value.kind != Token::Pattern)
+    {
+        *error = "Expected a value after " + field.text + " " + op.text;
+        return NULL;
+    }
+    *pos += 3;
+
+    Node* node;
+    if(field.text == "time" || field.text == "t")
+        node = new Node(Node::Time);
+    else if(field.text == "lane")
+        node = new Node(Node::Lane);
+    else if(field.text == "text")
+        node = new Node(Node::Text);
+    else
+    {
+        node = new Node(Node::Attr);
+        node->key = field.text;
+    }
+    node->value = value.text;
+
+    if(op.text == "~" || op.text == "!~")
+    {
+        node->regex = true;
+        node->negate = (op.text == "!~");
+        QRegExp regExp(value.text);
+        if(!regExp.isValid() || node->kind == Node::Time)
+        {
+            *error = regExp.isValid() ? QString("time can't be matched with ~") : "Bad regular expression: " + regExp.errorString();
+            delete node;
+            return NULL;
+        }
+        node->regExpSlot = _regExps.size();
+        _regExps.append(regExp);
+    }
+    else if(!AttributeColumn::parseOp(op.text, &node->op) || node->kind == Node::Text)
+    {
+        *error = (node->kind == Node::Text) ? QString("text can only be matched with ~ or !~") : "Unknown comparison " + op.text;
+        delete node;
+        return NULL;
+    }
+    else if(node->kind == Node::Time && !parseTime(value.text, &node->ticks))
+    {
+        *error = "Expected a time in seconds: " + value.text;
+        delete node;
+        return NULL;
+    }
+    else if(node->kind == Node::Attr)
+    {
+        node->number = value.text.toDouble();
+    }
+
+    return node;
+}
+
+void TraceQuery::sortByCost(QList<Node*>& nodes)
+{
+    std::stable_sort(nodes.begin(), nodes.end(), [](const Node* a, const Node* b) {
+        return a->cost() < b->cost();
+    });
+}
+
+QStringList TraceQuery::attributeKeys() const
+{
+    QStringList keys;
+    QList<const Node*> stack;
+    if(_root)
+        stack.append(_root);
+    while(!stack.isEmpty())
+    {
+        const Node* node = stack.takeLast();
+        if(node->kind == Node::Attr && !keys.contains(node->key))
+            keys.append(node->key);
+        for(auto child: node->children)
+            stack.append(child);
+    }
+    return keys;
+}
+
+// Resolves lane terms to a table over lanes, attribute terms to their
+// column (and, for string columns, a table over dictionary codes) and time
+// terms to the trace's view time.
+void TraceQuery::bind(Node* node, TraceFile* trace, const QList<TraceLane>& lanes, const AttributeStore* attrs)
+{
+    for(auto child: node->children)
+        bind(child, trace, lanes, attrs);
+
+    if(node->kind == Node::Time)
+    {
+        node->number = ticksToSeconds(node->ticks - trace->getBaseTicks());
+    }
+    else if(node->kind == Node::Lane)
+    {
+        node->table.fill(0, lanes.size());
+        for(int n = 0; n < lanes.size(); n++)
+        {
+            bool match;
+            if(node->regex)
+            {
+                QRegExp regExp = _regExps[node->regExpSlot];
+                match = (regExp.indexIn(lanes[n].name) != -1 || regExp.indexIn(lanes[n].id) != -1) != node->negate;
+            }
+            else
+            {
+                bool equal = (lanes[n].name == node->value || lanes[n].id == node->value);
+                match = (node->op == AttributeColumn::Equal) ? equal : (node->op == AttributeColumn::NotEqual) ? !equal
+                        : AttributeColumn::compare(node->op, QString::compare(lanes[n].name, node->value), 0);
+            }
+            node->table[n] = match ? 1 : 0;
+        }
+    }
+    else if(node->kind == Node::Attr)
+    {
+        node->column = attrs ? attrs->column(node->key) : NULL;
+        if(node->column && node->column->type == AttributeColumn::String)
+        {
+            if(node->regex)
+            {
+                QRegExp regExp = _regExps[node->regExpSlot];
+                node->table.fill(0, node->column->dictionary.size() + 1);
+                for(int n = 0; n < node->column->dictionary.size(); n++)
+                    node->table[n+1] = ((regExp.indexIn(QString::fromUtf8(node->column->dictionary[n])) != -1) != node->negate) ? 1 : 0;
+            }
+            else
+            {
+                node->table = node->column->matchCodes(node->op, node->value.toUtf8());
+            }
+        }
+    }
+}
+
+bool TraceQuery::test(const Node* node, Cursor* cur) const
+{
+    switch(node->kind)
+    {
+    case Node::And:
+        for(auto child: node->children)
+        {
+            if(!test(child, cur))
+                return false;
+        }
+        return true;
+
+    case Node::Or:
+        for(auto child: node->children)
+        {
+            if(test(child, cur))
+                return true;
+        }
+        return false;
+
+    case Node::Not:
+        return !test(node->children.first(), cur);
+
+    case Node::Time:
+        // in ticks, as the difference is exact where it decides anything
+        return AttributeColumn::compare(node->op, (double)(cur->trace->getEventTicks(cur->idx) - node->ticks), 0);
+
+    case Node::Lane:
+    {
+        int lane = cur->laneOf[cur->idx];
+        return lane >= 0 && node->table[lane];
+    }
+
+    case Node::Text:
+        if(!cur->haveText)
+        {
+            cur->text = cur->reader->getEventText(cur->idx, false);
+            cur->haveText = true;
+        }
+        return (cur->text && cur->regExps[node->regExpSlot].indexIn(cur->text) != -1) != node->negate;
+
+    case Node::Attr:
+        if(!node->column)
+            return false;
+        else if(node->column->type == AttributeColumn::String)
+            return node->table[node->column->codes[cur->idx]] != 0;
+        else if(node->regex)
+        {
+            double x = node->column->numbers[cur->idx];
+            return !isnan(x) && (cur->regExps[node->regExpSlot].indexIn(QString::number(x, 'g', 15)) != -1) != node->negate;
+        }
+        return AttributeColumn::compare(node->op, node->column->numbers[cur->idx], node->number);
+    }
+    return false;
+}
+
+bool TraceQuery::testLane(const Node* node, int lane) const
+{
+    switch(node->kind)
+    {
+    case Node::And:
+        for(auto child: node->children)
+        {
+            if(!testLane(child, lane))
+                return false;
+        }
+        return true;
+    case Node::Or:
+        for(auto child: node->children)
+        {
+            if(testLane(child, lane))
+                return true;
+        }
+        return false;
+    case Node::Not:
+        return !testLane(node->children.first(), lane);
+    default:
+        return node->table[lane] != 0;
+    }
+}
+
+bool TraceQuery::isLaneOnly(const Node* node)
+{
+    if(node->kind == Node::Lane)
+        return true;
+    if(node->children.isEmpty())
+        return false;
+    for(auto child: node->children)
+    {
+        if(!isLaneOnly(child))
+            return false;
+    }
+    return true;
+}
+
+bool TraceQuery::usesLane(const Node* node)
+{
+    if(node->kind == Node::Lane)
+        return true;
+    for(auto child: node->children)
+    {
+        if(usesLane(child))
+            return true;
+    }
+    return false;
+}
+
+// Appends the indices of matching events to result, in order. Top level
+// time terms narrow the events to a range by binary search and top level
+// lane terms to the events of the matching lanes, so neither touches the
+// text. What's left is evaluated in parallel blocks, cheapest terms first,
+// reading an event's text only if a term needs it. With candidates, only
+// those events are considered.
+void TraceQuery::evaluate(TraceFile* trace, const QList<TraceLane>& lanes, const AttributeStore* attrs,
+                          const QVector<int>* candidates, QList<int>* result, QProgressDialog* progDlg)
+{
+    typedef struct {
+        int begin, end;
+        QVector<int> found;
+    } Block;
+
+    if(!_root)
+        return;
+
+    bind(_root, trace, lanes, attrs);
+
+    QList<Node*> conjuncts;
+    if(_root->kind == Node::And)
+        conjuncts = _root->children;
+    else
+        conjuncts.append(_root);
+
+    double begin = -INFINITY, end = INFINITY;
+    bool laneFiltered = false;
+    QVector<quint8> laneSet(lanes.size(), 1);
+    QList<Node*> residual;
+    bool needLaneOf = false;
+
+    for(auto node: conjuncts)
+    {
+        if(node->kind == Node::Time)
+        {
+            switch(node->op)
+            {
+            case AttributeColumn::Less:
+            case AttributeColumn::LessEqual:    end = qMin(end, node->number); break;
+            case AttributeColumn::Greater:
+            case AttributeColumn::GreaterEqual: begin = qMax(begin, node->number); break;
+            case AttributeColumn::Equal:        begin = qMax(begin, node->number); end = qMin(end, node->number); break;
+            default: break;
+            }
+            residual.append(node);
+        }
+        else if(isLaneOnly(node))
+        {
+            laneFiltered = true;
+            for(int n = 0; n < lanes.size(); n++)
+                laneSet[n] = (laneSet[n] && testLane(node, n)) ? 1 : 0;
+        }
+        else
+        {
+            needLaneOf = needLaneOf || usesLane(node);
+            residual.append(node);
+        }
+    }
+
+    if(begin > end)
+        return;
+
+    QVector<int> laneOf;
+    if(needLaneOf || (laneFiltered && candidates))
+    {
+        laneOf.fill(-1, trace->numEvents());
+        for(int n = 0; n < lanes.size(); n++)
+        {
+            for(int i = 0; i < lanes[n].data->numEvents(); i++)
+                laneOf[lanes[n].data->getParentIndex(i)] = n;
+        }
+    }
+
+    // pick the events to evaluate, either a contiguous range or a list
+    QVector<int> indices;
+    int first = 0, count = 0;
+    bool contiguous = false;
+
+    if(candidates)
+    {
+        for(int idx: *candidates)
+        {
+            double t = trace->getEventTime(idx);
+            if(t >= begin && t <= end && (!laneFiltered || (laneOf[idx] >= 0 && laneSet[laneOf[idx]])))
+                indices.append(idx);
+        }
+    }
+    else if(laneFiltered)
+    {
+        for(int n = 0; n < lanes.size(); n++)
+        {
+            if(!laneSet[n])
+                continue;
+            int laneFirst;
+            int laneCount = lanes[n].data->eventsInRange(begin, nextafter(end, INFINITY), &laneFirst);
+            for(int i = 0; i < laneCount; i++)
+                indices.append(lanes[n].data->getParentIndex(laneFirst + i));
+        }
+        std::sort(indices.begin(), indices.end());
+    }
+    else
+    {
+        count = trace->eventsInRange(begin, nextafter(end, INFINITY), &first);
+        contiguous = true;
+    }
+    if(!contiguous)
+        count = indices.size();
+
+    QList<Block> blocks;
+    for(int pos = 0; pos < count; pos += QUERY_BLOCK_SZ)
+    {
+        Block block;
+        block.begin = pos;
+        block.end = qMin(pos + QUERY_BLOCK_SZ, count);
+        blocks.append(block);
+    }
+
+    if(progDlg)
+    {
+        progDlg->reset();
+        progDlg->setRange(0, blocks.size());
+    }
+
+    QAtomicInt blocksDone;
+    const int* indexData = indices.constData();
+    const int* laneOfData = laneOf.constData();
+    QFuture<void> future = QtConcurrent::map(blocks, [&](Block& block) {
+        TraceFile::Reader reader(trace);
+        Cursor cur;
+        cur.trace = trace;
+        cur.reader = &reader;
+        cur.regExps = _regExps;
+        cur.laneOf = laneOfData;
+
+        for(int pos = block.begin; pos < block.end; pos++)
+        {
+            cur.idx = contiguous ? first + pos : indexData[pos];
+            cur.haveText = false;
+
+            bool match = true;
+            for(auto node: residual)
+            {
+                if(!test(node, &cur))
+                {
+                    match = false;
+                    break;
+                }
+            }
+            if(match)
+                block.found.append(cur.idx);
+        }
+        blocksDone.fetchAndAddRelaxed(1);
+    });
+
+    // polled only to show progress
+    while(progDlg && !future.isFinished())
+    {
+        progDlg->setValue(blocksDone.loadRelaxed());
+        QThread::msleep(PROGRESS_POLL_MS);
+    }
+    future.waitForFinished();
+
+    for(const Block& block: blocks)
+    {
+        for(int idx: block.found)
+            result->append(idx);
+    }
+}
+
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+
+QueryTrace::QueryTrace(TraceFile* parent, TraceQuery* query)
+    : SubTrace(parent), _query(query), _generation(-1)
+{
+}
+
+QueryTrace::~QueryTrace()
+{
+    delete _query;
+}
+
+// Brings the lane up to date with the trace. If the only change since the
+// last update is that events were inserted, the existing matches are shifted
+// past them and just the new events are evaluated.
+void QueryTrace::update(const QList<TraceLane>& lanes, const AttributeStore* attrs, QProgressDialog* progDlg)
+{
+    int generation = _file->getGeneration();
+    if(generation == _generation)
+        return;
+
+    const QVector<int>* added = _file->getAddedEvents();
+    if(added && generation == _generation + 1)
+    {
+        int j = 0;
+        for(int n = 0; n < _parentIndices.size(); n++)
+        {
+            while(j < added->size() && added->at(j) <= _parentIndices[n] + j)
+                j++;
+            _parentIndices[n] += j;
+        }
+
+        QList<int> found, merged;
+        _query->evaluate(_file, lanes, attrs, added, &found, progDlg);
+        merged.reserve(_parentIndices.size() + found.size());
+        std::merge(_parentIndices.begin(), _parentIndices.end(), found.begin(), found.end(), std::back_inserter(merged));
+        _parentIndices.swap(merged);
+    }
+    else
+    {
+        clear();
+        _query->evaluate(_file, lanes, attrs, NULL, &_parentIndices, progDlg);
+    }
+
+    updateMemoryUsed();
+    _generation = generation;
+}
+
+void QueryTrace::setMatches(const int* indices, int count)
+{
+    setParentIndices(indices, count);
+    _generation = _file->getGeneration();
+}
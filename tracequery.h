@@ -0,0 +1,78 @@
+#ifndef TRACEQUERY_H
+#define TRACEQUERY_H
+
+#include <QList>
+#include <QRegExp>
+#include <QStringList>
+#include <QVector>
+#include <QProgressDialog>
+#include "tracedata.h"
+#include "traceattrs.h"
+
+// Boolean expression over the events of a TraceFile, e.g.
+//
+//     lane == net && status != 200 && (size > 4096 || text ~ /retry/)
+//
+// Terms compare a field with a value using == != < <= > >= or match it with
+// a regular expression using ~ and !~. Fields are "time" (seconds, or with an
+// s/ms/us/ns suffix), "lane" (lane name or ID), "text" (the event text after
+// the timestamp) and any extracted key=value attribute. Terms combine with
+// && || ! (or and, or, not) and parentheses. Values are bare words, numbers,
+// "quoted strings" or /regular expressions/.
+class TraceQuery
+{
+public:
+    TraceQuery();
+    ~TraceQuery();
+
+    bool parse(const QString& expr, QString* error);
+    const QString& expression() const { return _expr; }
+    QStringList attributeKeys() const;
+
+    void evaluate(TraceFile* trace, const QList<TraceLane>& lanes, const AttributeStore* attrs,
+                  const QVector<int>* candidates, QList<int>* result, QProgressDialog* progDlg = NULL);
+
+protected:
+    struct Node;
+    struct Token;
+    struct Cursor;
+
+    Node* parseOr(QList<Token>& tokens, int* pos, QString* error);
+    Node* parseAnd(QList<Token>& tokens, int* pos, QString* error);
+    Node* parseUnary(QList<Token>& tokens, int* pos, QString* error);
+    Node* parseTerm(QList<Token>& tokens, int* pos, QString* error);
+
+    void bind(Node* node, TraceFile* trace, const QList<TraceLane>& lanes, const AttributeStore* attrs);
+    bool test(const Node* node, Cursor* cur) const;
+    bool testLane(const Node* node, int lane) const;
+    static void sortByCost(QList<Node*>& nodes);
+    static bool isLaneOnly(const Node* node);
+    static bool usesLane(const Node* node);
+
+    Node* _root;
+    QString _expr;
+    QList<QRegExp> _regExps;
+};
+
+// Lane holding the events that match a query. Once the trace has been
+// widened, only the added events are evaluated.
+class QueryTrace : public SubTrace
+{
+public:
+    QueryTrace(TraceFile* parent, TraceQuery* query);
+    virtual ~QueryTrace();
+
+    TraceQuery* getQuery() { return _query; }
+    void update(const QList<TraceLane>& lanes, const AttributeStore* attrs, QProgressDialog* progDlg = NULL);
+    bool isCurrent() { return _generation == _file->getGeneration(); }
+
+    // Takes matches found before, such as from a workspace, for the trace as
+    // it is now.
+    void setMatches(const int* indices, int count);
+
+protected:
+    TraceQuery* _query;
+    int _generation;
+};
+
+#endif // TRACEQUERY_H
@@ -0,0 +1,187 @@
+#include "tracerank.h"
+#include <limits.h>
+#include <math.h>
+#include <algorithm>
+#include <QtConcurrent>
+
+QStringList LaneRanking::modeNames()
+{
+    QStringList names;
+    names << "Order of appearance" << "Events in view" << "Rate" << "Largest gap" << "Busiest burst" << "Name";
+    return names;
+}
+
+// Index of the first event at or after t, numEvents() if there is none.
+static int firstEventFrom(Trace* data, double t)
+{
+    int left, right;
+    data->findEvents(t, &left, &right);
+    return left + 1;
+}
+
+// Events of a lane in each of numSlices equal slices of [t0, t1), from its
+// events once loaded and from its pyramid before. For loaded lanes the
+// index of the first event of each slice goes to firstIdx, which has room
+// for numSlices+1 entries.
+static void sliceCounts(const Lane& lane, double t0, double t1, int numSlices, float* counts, int* firstIdx)
+{
+    if(lane.data)
+    {
+        double sliceTime = (t1-t0)/numSlices;
+        firstIdx[0] = firstEventFrom(lane.data, t0);
+        for(int n = 0; n < numSlices; n++)
+        {
+            firstIdx[n+1] = firstEventFrom(lane.data, (n+1 == numSlices) ? t1 : t0 + (n+1)*sliceTime);
+            counts[n] = firstIdx[n+1] - firstIdx[n];
+        }
+    }
+    else if(lane.pyramid)
+        lane.pyramid->sample(t0, t1, numSlices, counts);
+    else
+        std::fill(counts, counts + numSlices, 0.0f);
+}
+
+// The longest stretch of [t0, t1) without events. Runs of empty slices are
+// widened to the events either side of them where those are known, so any
+// gap wider than two slices is measured exactly.
+static double largestGap(const Lane& lane, double t0, double t1, const float* counts, const int* firstIdx, int numSlices)
+{
+    double sliceTime = (t1-t0)/numSlices;
+    double largest = 0;
+    for(int n = 0; n < numSlices; )
+    {
+        if(counts[n] > 0)
+        {
+            n++;
+            continue;
+        }
+        int end = n;
+        while(end < numSlices && counts[end] <= 0)
+            end++;
+
+        double gapBegin = t0 + n*sliceTime, gapEnd = t0 + end*sliceTime;
+        if(lane.data)
+        {
+            int before = firstIdx[n] - 1, after = firstIdx[end];
+            gapBegin = (before >= 0) ? qMax(t0, lane.data->getEventTime(before)) : t0;
+            gapEnd = (after < lane.data->numEvents()) ? qMin(t1, lane.data->getEventTime(after)) : t1;
+        }
+        largest = qMax(largest, gapEnd - gapBegin);
+        n = end;
+    }
+    return largest;
+}
+
+double LaneRanking::score(const Lane& lane, Mode mode, double timeBegin, double timeEnd)
+{
+    if(timeEnd <= timeBegin)
+        return 0;
+
+    switch(mode)
+    {
+    case Appearance:
+        // lanes without events of their own keep to the end
+        return (lane.data && !lane.isGroup) ? lane.data->getIndex() : INT_MAX;
+    case Name:
+        return 0;
+    case EventsInView:
+    case Rate:
+    {
+        float count;
+        int firstIdx[2];
+        sliceCounts(lane, timeBegin, timeEnd, 1, &count, firstIdx);
+        if(mode == EventsInView)
+            return count;
+
+        // per second of the part of the view the lane is active in
+        double begin, end;
+        if(lane.data && lane.data->numEvents() > 0)
+        {
+            begin = lane.data->getEventTime(0);
+            end = lane.data->getEventTime(lane.data->numEvents()-1);
+        }
+        else if(lane.pyramid)
+        {
+            begin = lane.pyramid->begin();
+            end = lane.pyramid->end();
+        }
+        else
+            return 0;
+        double active = qMin(timeEnd, end) - qMax(timeBegin, begin);
+        return count / ((active > 0) ? active : (timeEnd - timeBegin));
+    }
+    case LargestGap:
+    case BusiestBurst:
+    {
+        float counts[RANK_SLICES];
+        int firstIdx[RANK_SLICES+1];
+        sliceCounts(lane, timeBegin, timeEnd, RANK_SLICES, counts, firstIdx);
+        if(mode == LargestGap)
+            return largestGap(lane, timeBegin, timeEnd, counts, firstIdx, RANK_SLICES);
+        float busiest = *std::max_element(counts, counts + RANK_SLICES);
+        return busiest / ((timeEnd - timeBegin)/RANK_SLICES);
+    }
+    }
+    return 0;
+}
+
+// Ranks the lanes of [begin, end) at one depth, each followed by the deeper
+// lanes under it, and appends them to order.
+static void rankRange(const QList<Lane>& lanes, const double* scores, LaneRanking::Mode mode,
+                      int begin, int end, QVector<int>* order)
+{
+    QVector<QPair<int,int> > units;
+    for(int n = begin; n < end; )
+    {
+        int unitEnd = n + 1;
+        while(unitEnd < end && lanes[unitEnd].depth > lanes[n].depth)
+            unitEnd++;
+        units.append(qMakePair(n, unitEnd));
+        n = unitEnd;
+    }
+
+    std::stable_sort(units.begin(), units.end(), [&](const QPair<int,int>& a, const QPair<int,int>& b) {
+        if(mode == LaneRanking::Name)
+            return lanes[a.first].name.compare(lanes[b.first].name, Qt::CaseInsensitive) < 0;
+        if(mode == LaneRanking::Appearance)
+            return scores[a.first] < scores[b.first];
+        return scores[a.first] > scores[b.first];
+    });
+
+    for(const QPair<int,int>& unit: units)
+    {
+        order->append(unit.first);
+        rankRange(lanes, scores, mode, unit.first + 1, unit.second, order);
+    }
+}
+
+QVector<int> LaneRanking::order(const QList<Lane>& lanes, Mode mode, double timeBegin, double timeEnd)
+{
+    QVector<double> scores(lanes.size(), 0);
+    double* scoreData = scores.data();
+    QVector<int> laneIdx(lanes.size());
+    for(int n = 0; n < lanes.size(); n++)
+        laneIdx[n] = n;
+
+    if(mode != Name)
+    {
+        QtConcurrent::blockingMap(laneIdx, [&](int n) {
+            scoreData[n] = score(lanes[n], mode, timeBegin, timeEnd);
+        });
+    }
+
+    // groups appear where their first member did
+    if(mode == Appearance)
+    {
+        for(int n = lanes.size() - 1; n >= 0; n--)
+        {
+            for(int m = n + 1; lanes[n].isGroup && m < lanes.size() && lanes[m].depth > lanes[n].depth; m++)
+                scoreData[n] = qMin(scoreData[n], scoreData[m]);
+        }
+    }
+
+    QVector<int> ranked;
+    ranked.reserve(lanes.size());
+    rankRange(lanes, scoreData, mode, 0, lanes.size(), &ranked);
+    return ranked;
+}
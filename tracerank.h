@@ -0,0 +1,29 @@
+#ifndef TRACERANK_H
+#define TRACERANK_H
+
+#include <QList>
+#include <QStringList>
+#include <QVector>
+#include "traceview.h"
+
+#define RANK_SLICES     64      // resolution of the gap and burst scores
+
+// Orders lanes by their activity in a time range. Each score takes a few
+// binary searches of a lane's events, or a sample of its pyramid for lanes
+// still loading, so ranking L lanes of N events costs O(L log N). Grouped
+// lanes stay under their header: groups are ranked by their header's
+// pyramid and members within each group.
+class LaneRanking
+{
+public:
+    enum Mode { Appearance, EventsInView, Rate, LargestGap, BusiestBurst, Name };
+
+    static QStringList modeNames();
+
+    // The lane indices in ranked order, most active first.
+    static QVector<int> order(const QList<Lane>& lanes, Mode mode, double timeBegin, double timeEnd);
+
+    static double score(const Lane& lane, Mode mode, double timeBegin, double timeEnd);
+};
+
+#endif // TRACERANK_H
@@ -0,0 +1,108 @@
+#include "tracereplay.h"
+#include <stdio.h>
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QLocalSocket>
+#include <QTcpSocket>
+#include <QThread>
+
+#define CONNECT_TIMEOUT_MS  5000
+
+int runReplay(QCoreApplication& app)
+{
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Replay a trace file into a listening TraceView.");
+    parser.addHelpOption();
+    parser.addOption(QCommandLineOption("replay", "Trace file to replay.", "file"));
+    parser.addOption(QCommandLineOption("to", "Local socket name or localhost TCP port.", "address"));
+    parser.addOption(QCommandLineOption("speed", "Replay speed multiplier (0 = as fast as possible).", "n", "1"));
+    parser.process(app);
+
+    QString fileName = parser.value("replay");
+    QString address = parser.value("to");
+    double speed = parser.value("speed").toDouble();
+
+    if(fileName.isEmpty() || address.isEmpty())
+        parser.showHelp(1);
+
+    QFile file(fileName);
+    if(!file.open(QIODevice::ReadOnly | QIODevice::Text))
+    {
+        fprintf(stderr, "Can't open %s\n", qPrintable(fileName));
+        return 1;
+    }
+
+    QLocalSocket localSock;
+    QTcpSocket tcpSock;
+    QIODevice* sock;
+    bool isPort;
+    quint16 port = address.toUShort(&isPort);
+    bool connected;
+
+    if(isPort)
+    {
+        tcpSock.connectToHost(QHostAddress::LocalHost, port);
+        connected = tcpSock.waitForConnected(CONNECT_TIMEOUT_MS);
+        sock = &tcpSock;
+    }
+    else
+    {
+        localSock.connectToServer(address);
+        connected = localSock.waitForConnected(CONNECT_TIMEOUT_MS);
+        sock = &localSock;
+    }
+
+    if(!connected)
+    {
+        fprintf(stderr, "Can't connect to %s: %s\n", qPrintable(address), qPrintable(sock->errorString()));
+        return 1;
+    }
+
+    QElapsedTimer clock;
+    bool haveFirst = false;
+    double firstTime = 0;
+    qint64 numLines = 0;
+
+    clock.start();
+    while(!file.atEnd())
+    {
+        QByteArray line = file.readLine();
+        double timestamp;
+
+        if(sscanf(line.constData(), "%lf", &timestamp) != 1)
+            continue;
+
+        if(!haveFirst)
+        {
+            firstTime = timestamp;
+            haveFirst = true;
+        }
+
+        if(speed > 0)
+        {
+            qint64 dueMs = (qint64)((timestamp - firstTime) * 1000 / speed);
+            qint64 waitMs = dueMs - clock.elapsed();
+            if(waitMs > 0)
+            {
+                sock->waitForBytesWritten(0);
+                QThread::msleep(waitMs);
+            }
+        }
+
+        if(!line.endsWith('\n'))
+            line.append('\n');
+        sock->write(line);
+        ++numLines;
+
+        if(sock->bytesToWrite() > 0)
+            sock->waitForBytesWritten(0);
+    }
+
+    while(sock->bytesToWrite() > 0 && sock->waitForBytesWritten(CONNECT_TIMEOUT_MS))
+        ;
+
+    fprintf(stderr, "Replayed %lld events in %.3fs\n", numLines, clock.elapsed() / 1000.0);
+    return 0;
+}
@@ -0,0 +1,13 @@
+#ifndef TRACEREPLAY_H
+#define TRACEREPLAY_H
+
+class QCoreApplication;
+
+// Command line tool that feeds a saved trace file to a listening TraceView
+// at N times its recorded speed:
+//
+//     TraceView --replay FILE --to ADDRESS [--speed N]
+//
+int runReplay(QCoreApplication& app);
+
+#endif // TRACEREPLAY_H
@@ -0,0 +1,81 @@
+#include "traceselection.h"
+#include <QtConcurrent>
+
+SelectionLister::SelectionLister(TraceFile* trace, int maxItems, QObject* parent)
+    : QObject(parent), _trace(trace), _maxItems(maxItems), _jobEvents(0), _numEvents(0)
+{
+    connect(&_watcher, SIGNAL(finished()), this, SLOT(onJobFinished()));
+}
+
+SelectionLister::~SelectionLister()
+{
+    cancel();
+}
+
+// The job maps lane events to the trace itself, so each lane must be a
+// direct SubTrace of it.
+bool SelectionLister::canList(const QList<Trace*>& lanes) const
+{
+    for(Trace* lane: lanes)
+    {
+        SubTrace* sub = dynamic_cast<SubTrace*>(lane);
+        if(!sub || sub->getParent() != _trace)
+            return false;
+    }
+    return true;
+}
+
+// The previous job is cancelled first, which takes no longer than reading
+// one event, so only one job at a time uses the job results.
+void SelectionLister::submit(const QList<Trace*>& lanes, const QList<QColor>& colors, double begin, double end)
+{
+    cancel();
+    int generation = _generation.fetchAndAddOrdered(1) + 1;
+    _watcher.setFuture(QtConcurrent::run([this, generation, lanes, colors, begin, end]() {
+        return list(generation, lanes, colors, begin, end) ? generation : -1;
+    }));
+}
+
+// Lanes and the trace may be changed once this returns.
+void SelectionLister::cancel()
+{
+    _generation.fetchAndAddOrdered(1);
+    _watcher.waitForFinished();
+}
+
+void SelectionLister::onJobFinished()
+{
+    if(_watcher.isCanceled() || _watcher.result() < 0 || !isCurrent(_watcher.result()))
+        return;
+    _numEvents = _jobEvents;
+    _items = _jobItems;
+    emit finished();
+}
+
+// Merged in time order, ties in lane order, as the lanes are drawn.
+bool SelectionLister::list(int generation, const QList<Trace*>& lanes, const QList<QColor>& colors, double begin, double end)
+{
+    _jobEvents = 0;
+    _jobItems.clear();
+    for(Trace* lane: lanes)
+    {
+        if(!isCurrent(generation))
+            return false;
+        int eventIdx = 0;
+        _jobEvents += lane->eventsInRange(begin, end, &eventIdx);
+    }
+    if(_jobEvents > _maxItems)
+        return true;
+
+    TraceFile::Reader reader(_trace);
+    TraceMerge merge(lanes);
+    for(merge.seek(begin); !merge.atEnd() && merge.time() < end; merge.next())
+    {
+        if(!isCurrent(generation))
+            return false;
+        SubTrace* lane = static_cast<SubTrace*>(lanes[merge.trace()]);
+        const char* txt = reader.getEventText(lane->getParentIndex(merge.event()), true);
+        _jobItems.append({ merge.time(), QString(txt), colors[merge.trace()] });
+    }
+    return true;
+}
@@ -0,0 +1,60 @@
+#ifndef TRACESELECTION_H
+#define TRACESELECTION_H
+
+#include <QObject>
+#include <QAtomicInt>
+#include <QColor>
+#include <QFutureWatcher>
+#include <QList>
+#include "tracedata.h"
+
+// Lists the events of a selected range, with their text, on a worker thread,
+// so the view never waits on the trace files while a selection is dragged.
+// Every submit() or cancel() moves to a new generation; a job that finds its
+// generation outdated stops where it is, and only the current one finishes.
+// Only lanes of the loaded trace can be listed, since the text is read with
+// a TraceFile::Reader of its own.
+class SelectionLister : public QObject
+{
+    Q_OBJECT
+public:
+    typedef struct {
+        double time;
+        QString text;
+        QColor color;
+    } Item;
+
+    SelectionLister(TraceFile* trace, int maxItems, QObject* parent = NULL);
+    virtual ~SelectionLister();
+
+    bool canList(const QList<Trace*>& lanes) const;
+    void submit(const QList<Trace*>& lanes, const QList<QColor>& colors, double begin, double end);
+
+    int numEvents() const { return _numEvents; }
+    const QList<Item>& items() const { return _items; }     // empty if more than maxItems
+
+public slots:
+    void cancel();      // returns once no job is running
+
+signals:
+    void finished();
+
+protected slots:
+    void onJobFinished();
+
+protected:
+    bool list(int generation, const QList<Trace*>& lanes, const QList<QColor>& colors, double begin, double end);
+    bool isCurrent(int generation) const { return _generation.loadAcquire() == generation; }
+
+protected:
+    TraceFile* _trace;
+    int _maxItems;
+    QAtomicInt _generation;
+    QFutureWatcher<int> _watcher;   // the generation finished, or -1
+    int _jobEvents;                 // written by the job
+    QList<Item> _jobItems;
+    int _numEvents;
+    QList<Item> _items;
+};
+
+#endif // TRACESELECTION_H
@@ -0,0 +1,320 @@
+#include "tracestats.h"
+#include <math.h>
+#include <string.h>
+#include <ctype.h>
+#include <algorithm>
+#include <QThread>
+#include <QElapsedTimer>
+#include <QtConcurrent>
+
+#define SKETCH_MIN_VALUE    1e-12
+#define SKETCH_BIN_BYTES    48      // a QMap node, for the memory budget
+#define PROGRESS_POLL_MS    20
+
+static const double sketchGamma = (1 + SKETCH_ACCURACY) / (1 - SKETCH_ACCURACY);
+static const double sketchLogGamma = log(sketchGamma);
+
+QuantileSketch::QuantileSketch()
+    : _zeroCount(0), _count(0), _min(INFINITY), _max(-INFINITY)
+{
+}
+
+void QuantileSketch::add(double v)
+{
+    if(v > SKETCH_MIN_VALUE)
+        _bins[(int)ceil(log(v) / sketchLogGamma)]++;
+    else
+        _zeroCount++;
+    _count++;
+    _min = qMin(_min, v);
+    _max = qMax(_max, v);
+}
+
+void QuantileSketch::merge(const QuantileSketch& other)
+{
+    if(other.isEmpty())
+        return;
+    if(isEmpty())
+    {
+        *this = other;
+        return;
+    }
+    for(auto iter = other._bins.begin(); iter != other._bins.end(); ++iter)
+        _bins[iter.key()] += iter.value();
+    _zeroCount += other._zeroCount;
+    _count += other._count;
+    _min = qMin(_min, other._min);
+    _max = qMax(_max, other._max);
+}
+
+double QuantileSketch::quantile(double q) const
+{
+    if(isEmpty())
+        return NAN;
+    if(q <= 0)
+        return _min;
+    if(q >= 1)
+        return _max;
+
+    qint64 rank = (qint64)(q * (_count - 1));
+    qint64 seen = _zeroCount;
+    if(rank < seen)
+        return qMax(_min, 0.0);
+
+    for(auto iter = _bins.begin(); iter != _bins.end(); ++iter)
+    {
+        seen += iter.value();
+        if(rank < seen)
+        {
+            double v = 2 * pow(sketchGamma, iter.key()) / (sketchGamma + 1);
+            return qBound(_min, v, _max);
+        }
+    }
+    return _max;
+}
+
+void SelectionStats::merge(const SelectionStats& other)
+{
+    numEvents += other.numEvents;
+    gaps.merge(other.gaps);
+    durations.merge(other.durations);
+}
+
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+
+// Returns +1 for an event whose detail (after the lane ID) starts with the
+// word BEGIN, -1 for END and 0 otherwise.
+static int beginEndMarker(const char* txt)
+{
+    const char* ptr = txt;
+    while(isblank(*ptr)) ++ptr;
+    while(*ptr && !isspace(*ptr)) ++ptr;
+    while(isblank(*ptr)) ++ptr;
+
+    if(strncmp(ptr, "BEGIN", 5) == 0 && (!ptr[5] || isspace(ptr[5])))
+        return 1;
+    if(strncmp(ptr, "END", 3) == 0 && (!ptr[3] || isspace(ptr[3])))
+        return -1;
+    return 0;
+}
+
+LaneStats::LaneStats(SubTrace* lane, double begin, double end, int levels)
+    : MemoryClient("lane statistics", true), _lane(lane), _pyramid(begin, end, levels), _built(false)
+{
+    for(int level = 0; level < levels; level++)
+    {
+        _gaps.append(QVector<QuantileSketch>(_pyramid.numBuckets(level)));
+        _durations.append(QVector<QuantileSketch>(_pyramid.numBuckets(level)));
+    }
+}
+
+LaneStats::~LaneStats()
+{
+    setMemoryUsed(0);
+}
+
+// The sketch bins and the durations, which evict() frees; the emptied
+// sketches themselves stay.
+qint64 LaneStats::binBytes() const
+{
+    qint64 bytes = (_durationEnds.capacity() + _durationValues.capacity()) * sizeof(double);
+    for(int level = 0; level < _gaps.size(); level++)
+    {
+        for(int n = 0; n < _gaps[level].size(); n++)
+            bytes += (_gaps[level][n].numBins() + _durations[level][n].numBins()) * SKETCH_BIN_BYTES;
+    }
+    return bytes;
+}
+
+qint64 LaneStats::evict()
+{
+    qint64 bytes = binBytes();
+    for(int level = 0; level < _gaps.size(); level++)
+    {
+        _gaps[level].fill(QuantileSketch());
+        _durations[level].fill(QuantileSketch());
+    }
+    _durationEnds = QVector<double>();
+    _durationValues = QVector<double>();
+    _built = false;
+    return bytes;
+}
+
+// Fills the pyramid and level 0 sketches in one pass over the lane, then
+// merges them up the levels. BEGIN and END events pair up innermost first;
+// an END with no open BEGIN is ignored. With no reader only gaps are kept.
+void LaneStats::build(TraceFile::Reader* reader)
+{
+    QElapsedTimer timer;
+    timer.start();
+
+    QVector<double> openBegins;
+    double prevTime = 0;
+
+    // counted afresh if built before being evicted
+    _pyramid = TracePyramid(_pyramid.begin(), _pyramid.end(), _pyramid.numLevels());
+
+    for(int n = 0; n < _lane->numEvents(); n++)
+    {
+        double t = _lane->getEventTime(n);
+        int bucket = _pyramid.bucketForTime(t);
+
+        _pyramid.add(bucket, 1);
+        if(n > 0)
+            _gaps[0][bucket].add(t - prevTime);
+        prevTime = t;
+
+        const char* txt = reader ? reader->getEventText(_lane->getParentIndex(n), false) : NULL;
+        int marker = txt ? beginEndMarker(txt) : 0;
+        if(marker > 0)
+        {
+            openBegins.append(t);
+        }
+        else if(marker < 0 && !openBegins.isEmpty())
+        {
+            double duration = t - openBegins.takeLast();
+            _durations[0][bucket].add(duration);
+            _durationEnds.append(t);
+            _durationValues.append(duration);
+        }
+    }
+
+    for(int n = 0; n < _pyramid.numBuckets(0); n++)
+        _pyramid.setExact(n);
+    _pyramid.update();
+
+    for(int level = 1; level < _pyramid.numLevels(); level++)
+    {
+        for(int n = 0; n < _pyramid.numBuckets(level); n++)
+        {
+            _gaps[level][n] = _gaps[level-1][n*2];
+            _gaps[level][n].merge(_gaps[level-1][n*2+1]);
+            _durations[level][n] = _durations[level-1][n*2];
+            _durations[level][n].merge(_durations[level-1][n*2+1]);
+        }
+    }
+
+    qint64 bytes = binBytes();
+    for(int level = 0; level < _gaps.size(); level++)
+        bytes += 2 * sizeof(QuantileSketch) * _gaps[level].size();
+    setMemoryUsed(bytes);
+    setRebuildCost(timer.nsecsElapsed() / 1e6);
+    touch();
+    _built = true;
+}
+
+// Builds several lanes in parallel, one reader per lane.
+void LaneStats::buildAll(const QList<LaneStats*>& lanes, TraceFile* trace, QProgressDialog* progDlg)
+{
+    if(progDlg)
+    {
+        progDlg->reset();
+        progDlg->setRange(0, lanes.size());
+    }
+
+    QAtomicInt lanesDone;
+    QFuture<void> future = QtConcurrent::map(lanes, [&](LaneStats* stats) {
+        TraceFile::Reader reader(trace);
+        stats->build(&reader);
+        lanesDone.fetchAndAddRelaxed(1);
+    });
+
+    while(progDlg && !future.isFinished())
+    {
+        progDlg->setValue(lanesDone.loadRelaxed());
+        QThread::msleep(PROGRESS_POLL_MS);
+    }
+    future.waitForFinished();
+}
+
+// Gaps ending at events first..last, each of which has a selected event
+// before it.
+void LaneStats::addGaps(int first, int last, SelectionStats* stats) const
+{
+    for(int n = first; n <= last; n++)
+        stats->gaps.add(_lane->getEventTime(n) - _lane->getEventTime(n-1));
+}
+
+void LaneStats::addDurations(double begin, double end, SelectionStats* stats) const
+{
+    auto first = std::lower_bound(_durationEnds.begin(), _durationEnds.end(), begin);
+    auto last = std::lower_bound(first, _durationEnds.end(), end);
+    for(auto iter = first; iter != last; ++iter)
+        stats->durations.add(_durationValues[iter - _durationEnds.begin()]);
+}
+
+// Adds the statistics of the events in [begin, end], both ends included as
+// eventsInRange counts them, and of the durations ending in [begin, end).
+// Pyramid buckets that lie wholly inside the range, after the bucket of its
+// first event, are taken from the sketches, coarsest level first. The first
+// event's bucket is scanned so the gap leading into the selection isn't
+// counted.
+void LaneStats::collect(double begin, double end, SelectionStats* stats) const
+{
+    touch();
+
+    int first;
+    int count = _lane->eventsInRange(begin, end, &first);
+    if(count <= 0)
+        return;
+
+    int last = first + count - 1;
+    stats->numEvents += count;
+
+    double width = _pyramid.bucketWidth(0);
+    int fullBegin = qMax(0, (int)floor((_lane->getEventTime(first) - _pyramid.begin()) / width) + 1);
+    int fullEnd = qMin(_pyramid.numBuckets(0), (int)floor((end - _pyramid.begin()) / width));
+
+    if(fullEnd <= fullBegin)
+    {
+        addGaps(first + 1, last, stats);
+        addDurations(begin, end, stats);
+        return;
+    }
+
+    double fullBeginTime = _pyramid.begin() + fullBegin * width;
+    double fullEndTime = _pyramid.begin() + fullEnd * width;
+    int left, right, tmp;
+    _lane->findEvents(fullBeginTime, &left, &tmp);
+    _lane->findEvents(fullEndTime, &tmp, &right);
+
+    addGaps(first + 1, qMin(left, last), stats);
+    if(right != -1)
+        addGaps(right, last, stats);
+    addDurations(begin, fullBeginTime, stats);
+    addDurations(fullEndTime, end, stats);
+
+    int lo = fullBegin, hi = fullEnd;
+    for(int level = 0; lo < hi; level++)
+    {
+        if(lo & 1)
+        {
+            stats->gaps.merge(_gaps[level][lo]);
+            stats->durations.merge(_durations[level][lo]);
+            lo++;
+        }
+        if(hi & 1)
+        {
+            hi--;
+            stats->gaps.merge(_gaps[level][hi]);
+            stats->durations.merge(_durations[level][hi]);
+        }
+        lo >>= 1;
+        hi >>= 1;
+    }
+}
+
+// Counts and gaps for a lane without an index, such as a live stream lane.
+void LaneStats::collectExact(Trace* lane, double begin, double end, SelectionStats* stats)
+{
+    int first;
+    int count = lane->eventsInRange(begin, end, &first);
+    if(count <= 0)
+        return;
+
+    stats->numEvents += count;
+    for(int n = first + 1; n < first + count; n++)
+        stats->gaps.add(lane->getEventTime(n) - lane->getEventTime(n-1));
+}
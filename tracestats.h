@@ -0,0 +1,84 @@
+#ifndef TRACESTATS_H
+#define TRACESTATS_H
+
+#include <QList>
+#include <QMap>
+#include <QVector>
+#include <QProgressDialog>
+#include "tracedata.h"
+#include "tracepyramid.h"
+
+#define STATS_LEVELS        10
+#define SKETCH_ACCURACY     0.01
+
+// Mergeable quantile sketch (DDSketch). Positive values are counted in
+// logarithmic bins so that any quantile is returned within SKETCH_ACCURACY
+// relative error, and two sketches merge by adding their bins.
+class QuantileSketch
+{
+public:
+    QuantileSketch();
+
+    void add(double v);
+    void merge(const QuantileSketch& other);
+
+    qint64 count() const { return _count; }
+    bool isEmpty() const { return _count == 0; }
+    int numBins() const { return _bins.size(); }
+    double min() const { return _min; }
+    double max() const { return _max; }
+    double quantile(double q) const;
+
+protected:
+    QMap<int,qint64> _bins;
+    qint64 _zeroCount;
+    qint64 _count;
+    double _min, _max;
+};
+
+class SelectionStats
+{
+public:
+    SelectionStats() : numEvents(0) { }
+    void merge(const SelectionStats& other);
+
+    qint64 numEvents;
+    QuantileSketch gaps;        // between consecutive selected events
+    QuantileSketch durations;   // BEGIN to END, by time of the END
+};
+
+// Statistics index for one lane: an exact count pyramid plus, per pyramid
+// bucket, sketches of the inter-arrival gaps and BEGIN/END durations ending
+// in that bucket. A selection is answered by merging the sketches of the
+// buckets it covers and scanning only the partial buckets at either end.
+// Evicting drops the sketches, and the lane has to be built again.
+class LaneStats : public MemoryClient
+{
+public:
+    LaneStats(SubTrace* lane, double begin, double end, int levels = STATS_LEVELS);
+    ~LaneStats();
+
+    void build(TraceFile::Reader* reader);
+    bool isBuilt() const { return _built; }
+    void collect(double begin, double end, SelectionStats* stats) const;
+    const TracePyramid& pyramid() const { return _pyramid; }
+
+    static void buildAll(const QList<LaneStats*>& lanes, TraceFile* trace, QProgressDialog* progDlg = NULL);
+    static void collectExact(Trace* lane, double begin, double end, SelectionStats* stats);
+
+protected:
+    qint64 evict() override;
+    qint64 binBytes() const;
+    void addGaps(int first, int last, SelectionStats* stats) const;
+    void addDurations(double begin, double end, SelectionStats* stats) const;
+
+    SubTrace* _lane;
+    TracePyramid _pyramid;
+    QVector<QVector<QuantileSketch> > _gaps;
+    QVector<QVector<QuantileSketch> > _durations;
+    QVector<double> _durationEnds;
+    QVector<double> _durationValues;
+    bool _built;
+};
+
+#endif // TRACESTATS_H
@@ -0,0 +1,89 @@
+#include "tracetime.h"
+#include <ctype.h>
+#include <math.h>
+#include <stdlib.h>
+#include <limits.h>
+
+#define MAX_EXACT_DIGITS    18      // of a whole part that fits in an int64
+
+static const TraceTicks POW10[] = {
+    1LL, 10LL, 100LL, 1000LL, 10000LL, 100000LL, 1000000LL, 10000000LL, 100000000LL, 1000000000LL
+};
+
+// Text that isn't a plain decimal, with an exponent or too many digits, is
+// left to strtod.
+static const char* parseTicksSlow(const char* str, int unitDigits, TraceTicks* ticks)
+{
+    char* end;
+    double v = strtod(str, &end);
+    if(end == str)
+        return NULL;
+    *ticks = secondsToTicks(v / pow(10, unitDigits));
+    return end;
+}
+
+const char* parseTicks(const char* str, int unitDigits, TraceTicks* ticks)
+{
+    const char* p = str;
+    while(isblank((uchar)*p))
+        ++p;
+    const char* start = p;
+
+    bool negative = (*p == '-');
+    if(*p == '-' || *p == '+')
+        ++p;
+
+    // whole units, then as many decimals as there are tick digits left
+    int fracDigits = TICKS_DIGITS - unitDigits;
+    TraceTicks whole = 0, frac = 0;
+    int numWhole = 0, numFrac = 0;
+    bool roundUp = false;
+    for(; isdigit((uchar)*p); ++p, ++numWhole)
+    {
+        if(numWhole < MAX_EXACT_DIGITS)
+            whole = whole*10 + (*p - '0');
+    }
+    if(*p == '.')
+    {
+        for(++p; isdigit((uchar)*p); ++p)
+        {
+            if(numFrac < fracDigits)
+                frac = frac*10 + (*p - '0');
+            else if(numFrac == fracDigits)
+                roundUp = (*p >= '5');
+            ++numFrac;
+        }
+    }
+    if(numWhole + numFrac == 0)
+        return NULL;
+    if(*p == 'e' || *p == 'E' || numWhole > MAX_EXACT_DIGITS || whole >= LLONG_MAX / POW10[fracDigits])
+        return parseTicksSlow(start, unitDigits, ticks);
+
+    if(numFrac < fracDigits)
+        frac *= POW10[fracDigits - numFrac];
+    TraceTicks t = whole*POW10[fracDigits] + frac + (roundUp ? 1 : 0);
+    *ticks = negative ? -t : t;
+    return p;
+}
+
+TraceTicks secondsToTicks(double t)
+{
+    if(t != t)
+        return 0;
+    if(t >= (double)(LLONG_MAX / TICKS_PER_SEC))
+        return LLONG_MAX;
+    if(t <= (double)(LLONG_MIN / TICKS_PER_SEC))
+        return LLONG_MIN;
+
+    // the whole seconds convert exactly; only the fraction rounds
+    double whole = floor(t);
+    return (TraceTicks)whole * TICKS_PER_SEC + llround((t - whole) * TICKS_PER_SEC);
+}
+
+QString ticksToString(TraceTicks t)
+{
+    QString str;
+    const char* sign = (t < 0) ? "-" : "";
+    quint64 mag = (t < 0) ? -(quint64)t : (quint64)t;
+    return str.asprintf("%s%llu.%09llu", sign, mag / TICKS_PER_SEC, mag % TICKS_PER_SEC);
+}
@@ -0,0 +1,45 @@
+#ifndef TRACETIME_H
+#define TRACETIME_H
+
+#include <QtGlobal>
+#include <QString>
+#include <QtNumeric>
+#include <limits.h>
+
+// Event times as integer nanoseconds. An int64 covers absolute epoch times
+// to the year 2262 at full resolution, where a double of epoch seconds only
+// resolves about 240ns. Times are parsed into ticks straight from their
+// decimal text. Each trace has a base tick, and the double seconds it hands
+// to the view are counted from there, so they keep nanoseconds for some
+// fifty days either side of it.
+typedef qint64 TraceTicks;
+
+#define TICKS_PER_SEC       1000000000LL
+#define TICKS_DIGITS        9           // decimal places of a second in a tick
+
+// Parses a decimal number of units at str, after any blanks, into ticks.
+// unitDigits is the decimal places of a second in one unit of the text: 0
+// for seconds, 6 for microseconds. Digits finer than a tick are rounded.
+// Returns the end of the number, or NULL if there is none.
+const char* parseTicks(const char* str, int unitDigits, TraceTicks* ticks);
+
+inline double ticksToSeconds(TraceTicks t)
+{
+    return (double)(t / TICKS_PER_SEC) + (double)(t % TICKS_PER_SEC) * (1.0 / TICKS_PER_SEC);
+}
+
+TraceTicks secondsToTicks(double t);
+
+// a + b, held at the ends of the range, where open-ended times are
+inline TraceTicks addTicks(TraceTicks a, TraceTicks b)
+{
+    TraceTicks sum;
+    if(qAddOverflow(a, b, &sum))
+        return (b > 0) ? LLONG_MAX : LLONG_MIN;
+    return sum;
+}
+
+// Seconds with all nine decimals, as "1700000000.000000123".
+QString ticksToString(TraceTicks t);
+
+#endif // TRACETIME_H
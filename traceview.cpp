@@ -1,4 +1,5 @@
 #include "traceview.h"
+#include "tracegroups.h"
 #include <stdlib.h>
 #include <math.h>
 #include <QPainter>
@@ -8,6 +9,7 @@
 #include <QToolTip>
 #include <QInputDialog>
 #include <QGestureEvent>
+#include <QScreen>
 
 #define NO_SELECTION    0
 #define TIME_SELECTION  1
@@ -16,6 +18,10 @@
 #define MOUSE_ZOOM_FACTOR   4.5
 #define WHEEL_ZOOM_FACTOR   1.5
 
+#define IDLE_REDRAW_MS          150
+#define SELECTION_SETTLE_MS     100
+#define INTERACTIVE_PX_STEP     4
+
 #define MIN_GRID_SIZE       5
 
 #define LANE_Y_BEGIN        20
@@ -26,18 +32,25 @@
 #define LANE_LABEL_INSET_X    6
 #define LANE_LABEL_INSET_Y    1
 #define EVT_INSET_Y         6
+#define GROUP_INDENT_X      14
+#define GROUP_DETAIL_PX     4   // draw a group from a finer pyramid when its buckets are wider
+#define CATEGORY_DETAIL_PX  4   // count a category lane's events in view when its buckets are wider
 
 #define INFO_TEXT_W         350
 #define INFO_TEXT_H         20
 #define INFO_TEXT_INSET_Y   3
 #define INFO_TEXT_INSET_X   3
 #define INFO_TEXT_FONT_SZ   10
+#define LEGEND_ROW_H        14
+#define LEGEND_SWATCH_SZ    10
 
 #define EVENT_HOVER_DIST    10
 
 #define SELECT_RANGE_COLOR      QColor(255,255,255,50)
 #define SELECT_CURSOR_COLOR     QColor(255,255,255,90)
 #define CURSOR_COLOR            QColor(220,220,255,70)
+#define DIFF_MORE_COLOR         QColor(90,230,90)
+#define DIFF_LESS_COLOR         QColor(240,80,80)
 #define GRID_COLOR              QColor(100,100,255,70)
 #define DEFAULT_EVENT_COLOR     Qt::white
 #define BG_COLOR                Qt::black
@@ -45,13 +58,26 @@
 #define LANE_BG_ALT_COLOR       QColor(20,35,40)
 #define LANE_SEPARATOR_COLOR    QColor(40,50,60)
 #define LANE_LABEL_BG_COLOR     QColor(0,0,0,180)
+#define FLOW_HOVER_COLOR        QColor(255,255,255,160)
+#define FLOW_SELECT_COLOR       QColor(255,220,100,200)
+
+#define MAX_FLOW_ARROWS     1000
+#define FLOW_ARROW_SZ       5
 
+// A collapsed group is drawn as one full lane, and an expanded group's
+// header as a thin summary above its members.
 static int laneHeight(Lane const& lane)
 {
-    return lane.isCollapsed() ? DEFAULT_LANE_HEIGHT : COLLAPSED_LANE_HEIGHT;
+    if(lane.hidden)
+        return 0;
+    if(lane.isGroup)
+        return lane.isCollapsed() ? DEFAULT_LANE_HEIGHT : COLLAPSED_LANE_HEIGHT;
+    return lane.isCollapsed() ? COLLAPSED_LANE_HEIGHT : DEFAULT_LANE_HEIGHT;
 }
 
-QString timeToString(double t, bool full)
+// A view time, or with full the absolute time it stands for given the base
+// tick of its trace, exact to the nanosecond.
+QString timeToString(double t, bool full, TraceTicks base)
 {
     QString str;
     double sec = t;
@@ -60,7 +86,16 @@ QString timeToString(double t, bool full)
     double nsec = (usec - (int)usec) * 1000;
 
     if(full)
-        return str.asprintf("%ds.%03dms.%03dus.%03dns", ((int)sec), ((int)msec), ((int)usec), ((int)nsec));
+    {
+        TraceTicks ticks = base + secondsToTicks(t);
+        const char* sign = (ticks < 0) ? "-" : "";
+        quint64 abs = (ticks < 0) ? (quint64)0 - (quint64)ticks : (quint64)ticks;
+        return str.asprintf("%s%llus.%03llums.%03lluus.%03lluns", sign,
+                            (unsigned long long)(abs / TICKS_PER_SEC),
+                            (unsigned long long)(abs / 1000000 % 1000),
+                            (unsigned long long)(abs / 1000 % 1000),
+                            (unsigned long long)(abs % 1000));
+    }
     else if(sec >= 1)
         return str.asprintf("%.3fs", sec);
     else if(msec >= 1)
@@ -141,6 +176,265 @@ static void drawEvents(QPainter& p,
 }
 
 
+// Draws a lane from its pyramid alone, for lanes whose events aren't loaded
+// yet. Buckets that are still estimates are drawn fainter than exact ones.
+static void drawPyramid(QPainter& p,
+                        const Lane& lane,
+                        int x, int y, int w, int h,
+                        double timeLeft,
+                        double timeRight)
+{
+    if(w <= 0)
+        return;
+
+    QVector<float> counts(w);
+    lane.pyramid->sample(timeLeft, timeRight, w, counts.data());
+
+    float numEventsVisible = 0;
+    for(float count: counts)
+        numEventsVisible += count;
+    double intensityScale = (numEventsVisible > 0 ? (w/numEventsVisible) : 1) * 0.3;
+    double timePerPx = (timeRight-timeLeft)/w;
+
+    p.setPen(Qt::NoPen);
+    for(int n = 0; n < w; n++)
+    {
+        if(counts[n] <= 0)
+            continue;
+        QColor color = colorForNumEvents(lane.color, (int)ceil(counts[n]), intensityScale);
+        if(!lane.pyramid->isExact(timeLeft + (n+0.5)*timePerPx))
+            color.setAlpha(color.alpha()/2);
+        p.fillRect(x+n, y, 1, h, color);
+    }
+}
+
+
+// Draws the per-pixel difference between a lane's pyramid and its baseline.
+// Columns with more events than the baseline are drawn in DIFF_MORE_COLOR,
+// fewer in DIFF_LESS_COLOR, scaled to the largest difference in view.
+static void drawDiff(QPainter& p,
+                     const Lane& lane,
+                     int x, int y, int w, int h,
+                     double timeLeft,
+                     double timeRight)
+{
+    if(w <= 0)
+        return;
+
+    QVector<float> counts(w), baseCounts(w);
+    lane.pyramid->sample(timeLeft, timeRight, w, counts.data());
+    lane.baseline->sample(timeLeft, timeRight, w, baseCounts.data());
+
+    float maxDelta = 0;
+    for(int n = 0; n < w; n++)
+        maxDelta = qMax(maxDelta, fabsf(counts[n] - baseCounts[n]));
+    if(maxDelta <= 0)
+        return;
+
+    p.setPen(Qt::NoPen);
+    for(int n = 0; n < w; n++)
+    {
+        float delta = counts[n] - baseCounts[n];
+        if(delta == 0)
+            continue;
+        QColor color = (delta > 0) ? DIFF_MORE_COLOR : DIFF_LESS_COLOR;
+        color.setAlphaF(0.15 + 0.85*sqrt(fabs(delta)/maxDelta));
+        p.fillRect(x+n, y, 1, h, color);
+    }
+}
+
+
+// Draws a lane stacked by category, each column split in proportion to the
+// events of each category in it. Zoomed out the counts come from the
+// category pyramids; zoomed in past them, from the events in view.
+static void drawCategories(QPainter& p,
+                           const Lane& lane,
+                           int x, int y, int w, int h,
+                           double timeLeft,
+                           double timeRight)
+{
+    const LaneCategories* categories = lane.categories;
+    int numCategories = categories->pyramids.size();
+    if(w <= 0 || numCategories == 0)
+        return;
+
+    const TracePyramid* anyPyramid = NULL;
+    for(const TracePyramid* pyramid: categories->pyramids)
+    {
+        if(pyramid)
+        {
+            anyPyramid = pyramid;
+            break;
+        }
+    }
+    if(!anyPyramid)
+        return;
+
+    double timePerPx = (timeRight-timeLeft)/w;
+    QVector<float> counts(numCategories*w, 0);
+    if(anyPyramid->bucketWidth(0) > CATEGORY_DETAIL_PX*timePerPx)
+    {
+        int evtIdxLeft, evtIdxRight, tmp;
+        lane.data->findEvents(timeLeft, &tmp, &evtIdxLeft);
+        lane.data->findEvents(timeRight, &evtIdxRight, &tmp);
+        int numEvents = indexRangeToCount(evtIdxLeft, evtIdxRight);
+        for(int n = 0; n < numEvents; n++)
+        {
+            int idx = evtIdxLeft + n;
+            int px = (int)((lane.data->getEventTime(idx) - timeLeft) / timePerPx);
+            if(px >= 0 && px < w)
+                counts[categories->codes[idx]*w + px] += 1;
+        }
+    }
+    else
+    {
+        for(int c = 0; c < numCategories; c++)
+        {
+            if(categories->pyramids[c])
+                categories->pyramids[c]->sample(timeLeft, timeRight, w, counts.data() + c*w);
+        }
+    }
+
+    QVector<float> totals(w, 0);
+    float numEventsVisible = 0;
+    for(int c = 0; c < numCategories; c++)
+    {
+        for(int n = 0; n < w; n++)
+            totals[n] += counts[c*w + n];
+    }
+    for(float total: totals)
+        numEventsVisible += total;
+    double intensityScale = (numEventsVisible > 0 ? (w/numEventsVisible) : 1) * 0.3;
+
+    p.setPen(Qt::NoPen);
+    for(int n = 0; n < w; n++)
+    {
+        if(totals[n] <= 0)
+            continue;
+        int alpha = colorForNumEvents(Qt::black, (int)ceil(totals[n]), intensityScale).alpha();
+        float below = 0;
+        int top = 0;
+        for(int c = 0; c < numCategories; c++)
+        {
+            float count = counts[c*w + n];
+            if(count <= 0)
+                continue;
+            below += count;
+            int bottom = (int)(h * below / totals[n] + 0.5f);
+            if(bottom <= top)
+                continue;
+            QColor color = TraceCategories::color(c, categories->other);
+            color.setAlpha(alpha);
+            p.fillRect(x+n, y+top, 1, bottom-top, color);
+            top = bottom;
+        }
+    }
+}
+
+
+// The lane renderer, shared by paintEvent and offscreen export. Each call
+// draws into the lane's rectangle at y, which is h pixels high and w wide.
+void TraceView::drawLaneBackground(QPainter& p, int laneIdx, int y, int w, int h)
+{
+    p.fillRect(0, y, w, 1, LANE_SEPARATOR_COLOR);
+    p.fillRect(0, y+1, w, h-1, (laneIdx&1) ? LANE_BG_ALT_COLOR : LANE_BG_COLOR);
+}
+
+void TraceView::drawTimeGrid(QPainter& p, int w, int h, double timeLeft, double timeRight)
+{
+    double visibleTime = timeRight - timeLeft;
+    double gridScale = visibleTime / ((double)w/MIN_GRID_SIZE);
+    gridScale = pow(10, ceil(log10(gridScale)));
+
+    QColor minorColor = GRID_COLOR;
+    {
+        double minorFactor = ((gridScale*w/visibleTime) - MIN_GRID_SIZE) / (MIN_GRID_SIZE*10 - MIN_GRID_SIZE);
+        if(minorFactor < 0) minorFactor = 0;
+        else if(minorFactor > 1) minorFactor = 1;
+        minorFactor = pow(minorFactor, 0.5); // adjust alpha curve
+        minorColor.setAlphaF(minorColor.alphaF() * minorFactor);
+    }
+
+    int64_t gridIdx = (int64_t)(timeLeft / gridScale);
+    double gridBegin = gridIdx * gridScale;
+    double gridEnd = (int64_t)(timeRight / gridScale) * gridScale;
+    double gridSpan = gridEnd - gridBegin;
+    for(double gridOfs = 0; gridOfs < gridSpan; gridOfs += gridScale)
+    {
+        double gridTime = gridBegin + gridOfs;
+        int gridX = (int)(float)(((gridTime - timeLeft) / visibleTime) * w);
+        bool isMajor = (gridIdx % 10) == 0;
+        p.fillRect(gridX, 0, 1, h, isMajor ? GRID_COLOR : minorColor);
+        ++gridIdx;
+    }
+}
+
+void TraceView::drawLaneData(QPainter& p, const Lane& lane, int y, int w, int h, double timeLeft, double timeRight)
+{
+    int evtInsetY = (h > EVT_INSET_Y*3) ? EVT_INSET_Y : 0;
+    y += evtInsetY;
+    h -= evtInsetY*2;
+
+    if(lane.baseline && lane.pyramid)
+    {
+        drawDiff(p, lane, 0, y, w, h, timeLeft, timeRight);
+    }
+    else if(lane.categories && lane.data)
+    {
+        drawCategories(p, lane, 0, y, w, h, timeLeft, timeRight);
+    }
+    else if(lane.data)
+    {
+        int evtIdxLeft, evtIdxRight, tmp;
+
+        lane.data->findEvents(timeLeft, &tmp, &evtIdxLeft);
+        lane.data->findEvents(timeRight, &evtIdxRight, &tmp);
+
+        int numEventsVisible = indexRangeToCount(evtIdxLeft, evtIdxRight);
+        double intensityScale = (numEventsVisible ? ((double)w/numEventsVisible) : 1) * 0.3;
+
+        drawEvents(p, lane, 0, y, w, h, timeLeft, timeRight, evtIdxLeft, evtIdxRight, intensityScale);
+    }
+    else if(lane.isGroup && lane.pyramid && lane.pyramid->bucketWidth(0) > GROUP_DETAIL_PX*(timeRight-timeLeft)/w)
+    {
+        // zoomed in past the group's pyramid
+        Lane detailLane = lane;
+        QSharedPointer<TracePyramid> detail;
+        if(const GroupPyramid* group = dynamic_cast<const GroupPyramid*>(lane.pyramid))
+            detail = group->detail(lane.members, timeLeft, timeRight, GROUP_DETAIL_PX*(timeRight-timeLeft)/w);
+        if(detail)
+            detailLane.pyramid = detail.data();
+        drawPyramid(p, detailLane, 0, y, w, h, timeLeft, timeRight);
+    }
+    else if(lane.pyramid)
+    {
+        drawPyramid(p, lane, 0, y, w, h, timeLeft, timeRight);
+    }
+}
+
+void TraceView::drawLaneLabel(QPainter& p, const Lane& lane, int y)
+{
+    QString labelTxt = lane.name;
+    if(labelTxt.isNull() || labelTxt.isEmpty())
+        return;
+    if(lane.isGroup)
+        labelTxt = (lane.isCollapsed() ? "+ " : "- ") + labelTxt;
+
+    int labelW = p.fontMetrics().horizontalAdvance(labelTxt);
+    int labelH = LANE_LABEL_H;
+    QRect labelRect(LANE_LABEL_INSET_X+lane.depth*GROUP_INDENT_X,LANE_LABEL_INSET_Y+y,labelW+10,labelH);
+    QPainter::RenderHints tmpHints = p.renderHints();
+    p.setRenderHint(QPainter::Antialiasing, true);
+    p.setPen(Qt::NoPen);
+    p.setBrush(LANE_LABEL_BG_COLOR);
+    p.drawRoundedRect(labelRect,7,7);
+    p.setPen(lane.color);
+    p.drawText(labelRect, Qt::AlignCenter, labelTxt);
+    p.setPen(Qt::NoPen);
+    p.setRenderHints(tmpHints);
+}
+
+
 TraceView::TraceView(QWidget* parent)
         : QWidget(parent)
 {
@@ -151,8 +445,29 @@ TraceView::TraceView(QWidget* parent)
 
     _selectTime.set(0, 0);
     _viewTime.set(0, 1);
+    _paintedViewTime.set(0, 0);
 
     _scrollYOfs = 0;
+    _followTime = -HUGE_VAL;
+    _flowIndex = NULL;
+    _otherCategory = -1;
+
+    _pendingMove = false;
+    _pendingWheelX = _pendingWheelY = _pendingScrollY = 0;
+    _interacting = false;
+
+    _frameTimer = new QTimer(this);
+    _frameTimer->setSingleShot(true);
+    _frameTimer->setTimerType(Qt::PreciseTimer);
+    connect(_frameTimer, SIGNAL(timeout()), this, SLOT(onFrame()));
+    _idleTimer = new QTimer(this);
+    _idleTimer->setSingleShot(true);
+    _idleTimer->setInterval(IDLE_REDRAW_MS);
+    connect(_idleTimer, SIGNAL(timeout()), this, SLOT(onIdle()));
+    _settleTimer = new QTimer(this);
+    _settleTimer->setSingleShot(true);
+    _settleTimer->setInterval(SELECTION_SETTLE_MS);
+    connect(_settleTimer, SIGNAL(timeout()), this, SLOT(onSelectionSettled()));
 
     setMouseTracking(true);
     setFocusPolicy(Qt::ClickFocus);
@@ -177,6 +492,12 @@ bool TraceView::event(QEvent *event)
 
 void TraceView::paintEvent(QPaintEvent*)
 {
+    if(_viewTime.begin != _paintedViewTime.begin || _viewTime.end != _paintedViewTime.end)
+    {
+        _paintedViewTime = _viewTime;
+        emit viewTimeChanged();
+    }
+
     QPainter p(this);
     p.fillRect(rect(), BG_COLOR);
 
@@ -194,8 +515,8 @@ void TraceView::paintEvent(QPaintEvent*)
     for(laneIter = _lanes.begin(); laneIter != _lanes.end(); ++laneIter)
     {
         const Lane& lane = *laneIter;
-        p.fillRect(0, laneY+yOfs, viewWidth, 1, LANE_SEPARATOR_COLOR);
-        p.fillRect(0, laneY+1+yOfs, viewWidth, laneHeight(lane)-1, (laneIdx&1) ? LANE_BG_ALT_COLOR : LANE_BG_COLOR);
+        if(laneHeight(lane) > 0)
+            drawLaneBackground(p, laneIdx, laneY+yOfs, viewWidth, laneHeight(lane));
         ++laneIdx;
         laneY += laneHeight(lane);
     }
@@ -203,33 +524,7 @@ void TraceView::paintEvent(QPaintEvent*)
         p.fillRect(0, laneY+yOfs, viewWidth, 1, LANE_SEPARATOR_COLOR);
 
     // draw time grid
-    {
-        double visibleTime = _viewTime.delta();
-        double gridScale = visibleTime / ((double)viewWidth/MIN_GRID_SIZE);
-        gridScale = pow(10, ceil(log10(gridScale)));
-
-        QColor minorColor = GRID_COLOR;
-        {
-            double minorFactor = ((gridScale*viewWidth/visibleTime) - MIN_GRID_SIZE) / (MIN_GRID_SIZE*10 - MIN_GRID_SIZE);
-            if(minorFactor < 0) minorFactor = 0;
-            else if(minorFactor > 1) minorFactor = 1;
-            minorFactor = pow(minorFactor, 0.5); // adjust alpha curve
-            minorColor.setAlphaF(minorColor.alphaF() * minorFactor);
-        }
-
-        int64_t gridIdx = (int64_t)(_viewTime.begin / gridScale);
-        double gridBegin = gridIdx * gridScale;
-        double gridEnd = (int64_t)(_viewTime.end / gridScale) * gridScale;
-        double gridSpan = gridEnd - gridBegin;
-        for(double gridOfs = 0; gridOfs < gridSpan; gridOfs += gridScale)
-        {
-            double gridTime = gridBegin + gridOfs;
-            int gridX = (int)absTimeToCoord(gridTime);
-            bool isMajor = (gridIdx % 10) == 0;
-            p.fillRect(gridX, 0, 1, viewHeight, isMajor ? GRID_COLOR : minorColor);
-            ++gridIdx;
-        }
-    }
+    drawTimeGrid(p, viewWidth, viewHeight, _viewTime.begin, _viewTime.end);
 
 
     // draw selection range
@@ -270,17 +565,30 @@ void TraceView::paintEvent(QPaintEvent*)
         int evtInsetY = EVT_INSET_Y;
         const Lane& lane = *laneIter;
 
-        int evtIdxLeft, evtIdxRight, tmp;
-
-        lane.data->findEvents(_viewTime.begin, &tmp, &evtIdxLeft);
-        lane.data->findEvents(_viewTime.end, &evtIdxRight, &tmp);
-
-        int numEventsVisible = indexRangeToCount(evtIdxLeft, evtIdxRight);
-        double intensityScale = (numEventsVisible ? ((double)viewWidth/numEventsVisible) : 1) * 0.3;
+        // lanes scrolled out of view or in collapsed groups
+        if(lane.hidden || laneY+yOfs+laneHeight(lane) < 0 || laneY+yOfs > viewHeight)
+        {
+            ++laneIdx;
+            laneY += laneHeight(lane);
+            continue;
+        }
 
-        drawEvents(p, lane, 0, laneY+evtInsetY+yOfs, width(), laneHeight(lane)-(evtInsetY*2), _viewTime.begin, _viewTime.end, evtIdxLeft, evtIdxRight, intensityScale);
+        if(_interacting)
+        {
+            // draw at reduced horizontal resolution while panning and zooming
+            int steps = (viewWidth+INTERACTIVE_PX_STEP-1) / INTERACTIVE_PX_STEP;
+            double stepsTime = _viewTime.delta() * steps * INTERACTIVE_PX_STEP / viewWidth;
+            p.save();
+            p.scale(INTERACTIVE_PX_STEP, 1);
+            drawLaneData(p, lane, laneY+yOfs, steps, laneHeight(lane), _viewTime.begin, _viewTime.begin + stepsTime);
+            p.restore();
+        }
+        else
+        {
+            drawLaneData(p, lane, laneY+yOfs, viewWidth, laneHeight(lane), _viewTime.begin, _viewTime.end);
+        }
 
-        if(laneIdx == _hoverLaneIdx && _hoverEvtIdx != -1)
+        if(laneIdx == _hoverLaneIdx && _hoverEvtIdx != -1 && lane.data)
         {
             double hoverEvtTime = lane.data->getEventTime(_hoverEvtIdx);
             int hoverEvtX = (int)absTimeToCoord(hoverEvtTime);
@@ -294,37 +602,37 @@ void TraceView::paintEvent(QPaintEvent*)
         }
 
         // draw lane label overlay
-        QString labelTxt = lane.name;
-        if(!labelTxt.isNull() && !labelTxt.isEmpty())
-        {
-            int labelW = p.fontMetrics().horizontalAdvance(labelTxt);
-            int labelH = LANE_LABEL_H;
-            QRect labelRect(LANE_LABEL_INSET_X,LANE_LABEL_INSET_Y+laneY+yOfs,labelW+10,labelH);
-            QPainter::RenderHints tmpHints = p.renderHints();
-            p.setRenderHint(QPainter::Antialiasing, true);
-            p.setPen(Qt::NoPen);
-            p.setBrush(LANE_LABEL_BG_COLOR);
-            p.drawRoundedRect(labelRect,7,7);
-            p.setPen(lane.color);
-            p.drawText(labelRect, Qt::AlignCenter, labelTxt);
-            p.setPen(Qt::NoPen);
-            p.setRenderHints(tmpHints);
-        }
+        drawLaneLabel(p, lane, laneY+yOfs);
 
         ++laneIdx;
         laneY += laneHeight(lane);
     }
-    
+
+    // draw flow arrows
+    drawFlow(p, _selectedFlow, FLOW_SELECT_COLOR);
+    if(_hoverEvtIdx != -1)
+        drawFlow(p, _hoverFlow, FLOW_HOVER_COLOR);
 
     QString infoTxt;
 
-    infoTxt = timeToString(_cursorTime, true);
+    TraceTicks base = 0;
+    for(const Lane& lane: _lanes)
+    {
+        if(lane.data)
+        {
+            base = lane.data->getBaseTicks();
+            break;
+        }
+    }
+    infoTxt = timeToString(_cursorTime, true, base);
 
     if(_haveSelection)
     {
         Range<double> range = _selectTime.fix();
         QString selTxt = QString(" - selected %1").arg(timeToString(range.end - range.begin,false));
         infoTxt.append(selTxt);
+        if(_settleTimer->isActive())
+            infoTxt.append(QString(", ~%1 events").arg(approxSelectedEvents()));
     }
 
     if(!infoTxt.isNull())
@@ -334,10 +642,31 @@ void TraceView::paintEvent(QPaintEvent*)
         p.setPen(Qt::red);
         p.drawText(rect, Qt::AlignRight|Qt::AlignTop, infoTxt);
     }
+
+    // legend of the categories lanes are colored by, below the info text
+    int legendY = INFO_TEXT_INSET_Y + INFO_TEXT_H;
+    p.setFont(QFont("Monospace", INFO_TEXT_FONT_SZ));
+    for(int n = 0; n < _categoryNames.size(); n++)
+    {
+        int swatchX = width() - INFO_TEXT_INSET_X - LEGEND_SWATCH_SZ;
+        int rowY = legendY + n*LEGEND_ROW_H;
+        p.fillRect(swatchX, rowY + (LEGEND_ROW_H-LEGEND_SWATCH_SZ)/2, LEGEND_SWATCH_SZ, LEGEND_SWATCH_SZ,
+                   TraceCategories::color(n, _otherCategory));
+        QRect rect(swatchX - INFO_TEXT_W - INFO_TEXT_INSET_X, rowY, INFO_TEXT_W, LEGEND_ROW_H);
+        p.setPen(Qt::white);
+        p.drawText(rect, Qt::AlignRight|Qt::AlignVCenter, p.fontMetrics().elidedText(_categoryNames[n], Qt::ElideRight, INFO_TEXT_W));
+    }
 }
 
 void TraceView::mousePressEvent(QMouseEvent* ev)
 {
+    // apply moves made before the press relative to the old position
+    if(_frameTimer->isActive())
+    {
+        _frameTimer->stop();
+        onFrame();
+    }
+
     double timeAtCursor = coordToAbsTime(ev->position().x());
 
     _mousePressPos = ev->pos();
@@ -357,6 +686,11 @@ void TraceView::mousePressEvent(QMouseEvent* ev)
             if(lane)
             {
                 lane->setCollapsed(!lane->isCollapsed());
+                if(lane->isGroup)
+                {
+                    for(int n = laneIdx+1; n < _lanes.size() && _lanes[n].depth > lane->depth; n++)
+                        _lanes[n].hidden = lane->isCollapsed();
+                }
                 update();
             }
         }
@@ -379,6 +713,7 @@ void TraceView::mousePressEvent(QMouseEvent* ev)
         {
             _selectTime.set(timeAtCursor, timeAtCursor);
             _haveSelection = false;
+            _selectedFlow.clear();
             if(ev->modifiers() & Qt::AltModifier)
                 laneIdx = -1; // select all lanes
 
@@ -389,25 +724,103 @@ void TraceView::mousePressEvent(QMouseEvent* ev)
     }
 }
 
+// A selection dragged to here is reported without waiting to settle, after
+// the last move, which may not have been applied yet.
 void TraceView::mouseReleaseEvent(QMouseEvent*)
 {
+    if(_frameTimer->isActive())
+    {
+        _frameTimer->stop();
+        onFrame();
+    }
+    if(_settleTimer->isActive())
+        onSelectionSettled();
 }
 
+// Input is only recorded here and applied once per display frame by
+// onFrame, so fast mice and trackpads can't queue more work than is drawn.
 void TraceView::mouseMoveEvent(QMouseEvent* ev)
 {
+    _pendingMove = true;
+    _pendingPos = ev->position();
+    _pendingButtons = ev->buttons();
+    _pendingModifiers = ev->modifiers();
+    if(ev->buttons() & Qt::RightButton)
+        startInteraction();
+    scheduleFrame();
+}
+
+void TraceView::wheelEvent(QWheelEvent* ev)
+{
+    double dx = (double)ev->pixelDelta().x() * (ev->inverted() ? -1 : 1);
+    double dy = (double)ev->pixelDelta().y() * (ev->inverted() ? -1 : 1);
+    if(ev->modifiers() & Qt::ShiftModifier)
+        _pendingScrollY += dy;
+    else
+        _pendingWheelY += dy;
+    _pendingWheelX += dx;
+    _pendingWheelPos = ev->position();
+    startInteraction();
+    scheduleFrame();
+}
+
+void TraceView::scheduleFrame()
+{
+    if(_frameTimer->isActive())
+        return;
+    double refreshRate = screen() ? screen()->refreshRate() : 60;
+    _frameTimer->start(qMax(1, (int)(1000 / qMax(refreshRate, 1.0))));
+}
+
+// Marks the view as being panned or zoomed, so it is drawn at reduced
+// detail until input has been idle for IDLE_REDRAW_MS.
+void TraceView::startInteraction()
+{
+    _interacting = true;
+    _idleTimer->start();
+}
+
+void TraceView::onIdle()
+{
+    _interacting = false;
+    update();
+}
+
+void TraceView::onFrame()
+{
+    if(_pendingWheelX != 0 || _pendingWheelY != 0 || _pendingScrollY != 0)
+    {
+        double timePerPx = _viewTime.delta() / width();
+        double timeAtCursor = _viewTime.begin + _pendingWheelPos.x() * timePerPx;
+
+        double scale = pow(WHEEL_ZOOM_FACTOR, -_pendingWheelY/120);
+        double shift = _pendingWheelX * timePerPx;
+        _scrollYOfs += _pendingScrollY;
+
+        _viewTime.begin = timeAtCursor - (timeAtCursor - _viewTime.begin) * scale + shift;
+        _viewTime.end = timeAtCursor + (_viewTime.end - timeAtCursor) * scale + shift;
+
+        _pendingWheelX = _pendingWheelY = _pendingScrollY = 0;
+        update();
+    }
+
+    if(!_pendingMove)
+        return;
+    _pendingMove = false;
+
     double timePerPx = _viewTime.delta() / width();
-    double timeAtCursor = _viewTime.begin + ev->position().x() * timePerPx;
-    int overLaneIdx = laneForCoord(ev->position().y());
+    double timeAtCursor = _viewTime.begin + _pendingPos.x() * timePerPx;
+    int overLaneIdx = laneForCoord(_pendingPos.y());
 
     _cursorTime = timeAtCursor;
 
-    if(ev->buttons() & Qt::RightButton)
+    if(_pendingButtons & Qt::RightButton)
     {
-        int deltaX = ev->position().x() - _lastMousePos.x();
-        int deltaY = ev->position().y() - _lastMousePos.y();
-        _lastMousePos = ev->pos();
+        int deltaX = _pendingPos.x() - _lastMousePos.x();
+        int deltaY = _pendingPos.y() - _lastMousePos.y();
+        _lastMousePos = _pendingPos.toPoint();
 
-        if(ev->modifiers() & Qt::ShiftModifier)
+        if(_pendingModifiers & Qt::ShiftModifier)
         {
             double timeZoom = deltaY * timePerPx * MOUSE_ZOOM_FACTOR;
             double timeZoomOfs = (double)_mousePressPos.x() / width();
@@ -422,14 +835,18 @@ void TraceView::mouseMoveEvent(QMouseEvent* ev)
             _viewTime.begin += timePan;
             _viewTime.end += timePan;
         }
+
+        // no hover while panning; it would be stale by the next frame
+        update();
+        return;
     }
-    else if(ev->buttons() & Qt::LeftButton)
+    else if(_pendingButtons & Qt::LeftButton)
     {
         _haveSelection = true;
         _selectTime.end = timeAtCursor;
         if(_selectLane.begin != -1)
             _selectLane.end = overLaneIdx;
-        updateSelectedEvents();
+        _settleTimer->start();
     }
 
     int lastHoverLane = _hoverLaneIdx;
@@ -439,11 +856,11 @@ void TraceView::mouseMoveEvent(QMouseEvent* ev)
     if(_hoverLaneIdx != -1)
     {
         Trace* data = getLane(_hoverLaneIdx)->data;
-        _hoverEvtIdx = data->findNearestEvent(timeAtCursor);
+        _hoverEvtIdx = data ? data->findNearestEvent(timeAtCursor) : -1;
         if(_hoverEvtIdx != -1)
         {
             int evPosX = (int)absTimeToCoord(data->getEventTime(_hoverEvtIdx));
-            if(abs(evPosX - ev->position().x()) > EVENT_HOVER_DIST)
+            if(abs(evPosX - _pendingPos.x()) > EVENT_HOVER_DIST)
             {
                 _hoverEvtIdx = -1;
                 _hoverLaneIdx = -1;
@@ -454,56 +871,89 @@ void TraceView::mouseMoveEvent(QMouseEvent* ev)
         _hoverEvtIdx = -1;
 
     if((_hoverLaneIdx != lastHoverLane) || (_hoverEvtIdx != lastHoverEvt))
-    {
-        if(_hoverEvtIdx != -1)
-        {
-            const Lane* lane = getLane(_hoverLaneIdx);
-            int hoverEvtX = (int)absTimeToCoord(lane->data->getEventTime(_hoverEvtIdx));
-            QString txt = lane->data->getEventText(_hoverEvtIdx, true);
-            int laneBottom = getLaneCoords(_hoverLaneIdx, NULL) + laneHeight(*lane);
-            QPoint toolTipPos(hoverEvtX, laneBottom);
-            QToolTip::showText(mapToGlobal(toolTipPos), txt, this);
-            //setToolTip();
-        }
-        else
-        {
-            //setToolTip(QString());
-            QToolTip::hideText();
-        }
-    }
+        showHoverEvent();
 
     update();
 }
 
-void TraceView::wheelEvent(QWheelEvent* ev)
+// Shows the text and flow of the highlighted event.
+void TraceView::showHoverEvent()
 {
-    if(true)
+    _hoverFlow.clear();
+    if(_hoverEvtIdx != -1)
     {
-        double timePerPx = _viewTime.delta() / width();
-        double timeAtCursor = _viewTime.begin + ev->position().x() * timePerPx;
-
-        double scale = 1;
-        double dx = (double)ev->pixelDelta().x() * (ev->inverted() ? -1 : 1);
-        double dy = (double)ev->pixelDelta().y() * (ev->inverted() ? -1 : 1);
-        if(ev->modifiers() & Qt::ShiftModifier)
-        {
-            _scrollYOfs += dy;
-        }
-        else
-        {
-            scale = pow(WHEEL_ZOOM_FACTOR, -dy/120);
-        }
-        double shift = dx * timePerPx;
+        const Lane* lane = getLane(_hoverLaneIdx);
+        if(_flowIndex)
+            _flowIndex->findFlow(lane->data, _hoverEvtIdx, &_hoverFlow);
+        int hoverEvtX = (int)absTimeToCoord(lane->data->getEventTime(_hoverEvtIdx));
+        QString txt = lane->data->getEventText(_hoverEvtIdx, true);
+        int laneBottom = getLaneCoords(_hoverLaneIdx, NULL) + laneHeight(*lane);
+        QPoint toolTipPos(hoverEvtX, laneBottom);
+        QToolTip::showText(mapToGlobal(toolTipPos), txt, this);
+        //setToolTip();
+    }
+    else
+    {
+        //setToolTip(QString());
+        QToolTip::hideText();
+    }
+}
 
-        _viewTime.begin = timeAtCursor - (timeAtCursor - _viewTime.begin) * scale + shift;
-        _viewTime.end = timeAtCursor + (_viewTime.end - timeAtCursor) * scale + shift;
+// Moves the highlight to the next or previous event in time across the
+// selected lanes, or all lanes without a selection, starting from the
+// highlighted event or else the cursor, and scrolls it into view.
+void TraceView::stepEvent(bool forward)
+{
+    QList<Trace*> traces;
+    QList<int> laneIndices;
+    Range<int> laneRange = _selectLane.fix();
+    bool inSelection = _haveSelection && laneRange.begin != -1 && laneRange.end != -1;
+    for(int n = 0; n < _lanes.size(); n++)
+    {
+        const Lane& lane = _lanes.at(n);
+        if(!lane.data || lane.hidden || (inSelection && (n < laneRange.begin || n > laneRange.end)))
+            continue;
+        traces.append(lane.data);
+        laneIndices.append(n);
+    }
 
-        update();
+    TraceMerge merge(traces);
+    int current = laneIndices.indexOf(_hoverLaneIdx);
+    if(current != -1 && _hoverEvtIdx != -1)
+    {
+        if(forward)
+            merge.seekAfter(current, _hoverEvtIdx);
+        else
+            merge.seekBefore(current, _hoverEvtIdx);
     }
     else
     {
-        ev->ignore();
+        if(forward)
+            merge.seek(_cursorTime);
+        else
+            merge.seekBack(_cursorTime);
+    }
+    if(merge.atEnd())
+        return;
+
+    _hoverLaneIdx = laneIndices[merge.trace()];
+    _hoverEvtIdx = merge.event();
+    _cursorTime = merge.time();
+
+    if(_cursorTime < _viewTime.begin || _cursorTime > _viewTime.end)
+    {
+        double halfWidth = _viewTime.delta() / 2;
+        _viewTime.set(_cursorTime - halfWidth, _cursorTime + halfWidth);
     }
+    int laneH;
+    int laneY = getLaneCoords(_hoverLaneIdx, &laneH);
+    if(laneY < LANE_Y_BEGIN)
+        _scrollYOfs -= LANE_Y_BEGIN - laneY;
+    else if(laneY + laneH > height())
+        _scrollYOfs += laneY + laneH - height();
+
+    showHoverEvent();
+    update();
 }
 
 void TraceView::keyPressEvent(QKeyEvent* ev)
@@ -519,23 +969,50 @@ void TraceView::keyPressEvent(QKeyEvent* ev)
             zoomToSelection();
         }
     }
+    else if(ev->key() == Qt::Key_F)
+    {
+        selectHoveredFlow();
+    }
+    else if(ev->key() == Qt::Key_Left || ev->key() == Qt::Key_Right)
+    {
+        stepEvent(ev->key() == Qt::Key_Right);
+    }
     else if(ev->key() == Qt::Key_X)
     {
         if(_haveSelection)
         {
+            // group headers take their members along
+            Range<int> sel = _selectLane.fix();
+            if(sel.begin == -1)
+                sel.set(0, _lanes.size() - 1);
+            sel.end = qMin(sel.end, _lanes.size() - 1);
+            for(int n = sel.begin; n <= sel.end && n < _lanes.size(); n++)
+            {
+                for(int m = n + 1; _lanes[n].isGroup && m < _lanes.size() && _lanes[m].depth > _lanes[n].depth; m++)
+                    sel.end = qMax(sel.end, m);
+            }
+
             if(ev->modifiers() & Qt::ShiftModifier)
             {
-                _lanes = _lanes.mid(_selectLane.begin, _selectLane.end - _selectLane.begin + 1);
+                _lanes = _lanes.mid(sel.begin, sel.end - sel.begin + 1);
+                // members kept without their header become ordinary lanes
+                for(int n = 0; n < _lanes.size() && _lanes[n].depth > 0; n++)
+                {
+                    _lanes[n].depth = 0;
+                    _lanes[n].hidden = false;
+                }
                 _haveSelection = false;
                 zoomAll();
+                emit lanesChanged();
             }
             else
             {
-                auto begin = _lanes.begin() + _selectLane.begin;
-                auto end = _lanes.begin() + _selectLane.end + 1;
+                auto begin = _lanes.begin() + sel.begin;
+                auto end = _lanes.begin() + sel.end + 1;
                 _lanes.erase(begin, end);
                 _haveSelection = false;
                 update();
+                emit lanesChanged();
             }
         }
     }
@@ -545,6 +1022,174 @@ void TraceView::setLanes(const QList<Lane>& lanes)
 {
     _lanes = lanes;
     update();
+    emit lanesChanged();
+}
+
+void TraceView::addLane(const Lane& lane)
+{
+    _lanes.push_back(lane);
+    update();
+    emit lanesChanged();
+}
+
+// Puts lane order[n] at position n, keeping hold of the hovered lane. The
+// lanes are only replaced when the order actually changes.
+void TraceView::reorderLanes(const QVector<int>& order)
+{
+    bool changed = false;
+    for(int n = 0; n < order.size(); n++)
+        changed |= (order[n] != n);
+    if(!changed || order.size() != _lanes.size())
+        return;
+
+    QList<Lane> lanes;
+    int hoverLaneIdx = -1;
+    for(int n = 0; n < order.size(); n++)
+    {
+        lanes.append(_lanes[order[n]]);
+        if(order[n] == _hoverLaneIdx)
+            hoverLaneIdx = n;
+    }
+    _lanes = lanes;
+    _hoverLaneIdx = hoverLaneIdx;
+    if(_hoverLaneIdx == -1)
+        _hoverEvtIdx = -1;
+    update();
+    emit lanesChanged();
+}
+
+// Scroll along with live data, unless the user has moved the view away from
+// the newest event.
+void TraceView::followTime(double t)
+{
+    if(_viewTime.end >= _followTime && t > _viewTime.end)
+    {
+        double shift = t - _viewTime.end;
+        _viewTime.begin += shift;
+        _viewTime.end += shift;
+        update();
+    }
+    _followTime = t;
+}
+
+void TraceView::setFlowIndex(FlowIndex* flowIndex)
+{
+    _flowIndex = flowIndex;
+    _hoverFlow.clear();
+    _selectedFlow.clear();
+    update();
+}
+
+// The category names shown in the legend, empty to hide it.
+void TraceView::setCategoryLegend(const QStringList& names, int other)
+{
+    _categoryNames = names;
+    _otherCategory = other;
+    update();
+}
+
+// Selects the time range and lanes spanned by the flow of the hovered event,
+// and keeps that flow drawn until the selection changes.
+void TraceView::selectHoveredFlow()
+{
+    if(_hoverFlow.isEmpty())
+        return;
+
+    _selectedFlow = _hoverFlow;
+    _selectTime.set(HUGE_VAL, -HUGE_VAL);
+    _selectLane.set(-1, -1);
+    for(const FlowIndex::EventRef& ref: _selectedFlow)
+    {
+        double t = _flowIndex->getLane(ref.lane)->getEventTime(ref.idx);
+        int laneIdx = laneForFlowRef(ref);
+        _selectTime.set(qMin(_selectTime.begin, t), qMax(_selectTime.end, t));
+        if(laneIdx != -1)
+        {
+            if(_selectLane.begin == -1)
+                _selectLane.set(laneIdx, laneIdx);
+            else
+                _selectLane.set(qMin(_selectLane.begin, laneIdx), qMax(_selectLane.end, laneIdx));
+        }
+    }
+    if(_selectLane.begin == -1)
+        _selectLane.set(0, _lanes.size() - 1);
+    _haveSelection = true;
+    updateSelectedEvents();
+    update();
+}
+
+int TraceView::laneForFlowRef(const FlowIndex::EventRef& ref)
+{
+    return laneForData(_flowIndex->getLane(ref.lane));
+}
+
+int TraceView::laneForData(Trace* data)
+{
+    for(int n = 0; n < _lanes.size(); n++)
+    {
+        if(_lanes[n].data == data)
+            return n;
+    }
+    return -1;
+}
+
+void TraceView::setSelection(int laneBegin, int laneEnd, double timeBegin, double timeEnd)
+{
+    _selectLane.set(laneBegin, laneEnd);
+    _selectTime.set(timeBegin, timeEnd);
+    _selectedFlow.clear();
+    _haveSelection = true;
+    updateSelectedEvents();
+    update();
+}
+
+// Joins the events of a flow in time order with arrows, skipping events in
+// lanes that aren't shown.
+void TraceView::drawFlow(QPainter& p, const QVector<FlowIndex::EventRef>& flow, const QColor& color)
+{
+    if(!_flowIndex || flow.size() < 2)
+        return;
+
+    QHash<Trace*,int> laneIndices;
+    for(int n = 0; n < _lanes.size(); n++)
+        laneIndices[_lanes[n].data] = n;
+
+    QPainter::RenderHints tmpHints = p.renderHints();
+    p.setRenderHint(QPainter::Antialiasing, true);
+    p.setPen(QPen(color, 1.5));
+    p.setBrush(color);
+
+    QPointF prev;
+    bool havePrev = false;
+    int numArrows = 0;
+    for(const FlowIndex::EventRef& ref: flow)
+    {
+        Trace* data = _flowIndex->getLane(ref.lane);
+        int laneIdx = laneIndices.value(data, -1);
+        if(laneIdx == -1)
+            continue;
+
+        int h;
+        int y = getLaneCoords(laneIdx, &h);
+        QPointF pt(absTimeToCoord(data->getEventTime(ref.idx)), y + h/2);
+        if(havePrev && pt != prev)
+        {
+            p.drawLine(prev, pt);
+            QLineF line(pt, prev);
+            QLineF side1 = QLineF::fromPolar(FLOW_ARROW_SZ, line.angle() + 25).translated(pt);
+            QLineF side2 = QLineF::fromPolar(FLOW_ARROW_SZ, line.angle() - 25).translated(pt);
+            QPointF head[3] = { pt, side1.p2(), side2.p2() };
+            p.drawPolygon(head, 3);
+            if(++numArrows >= MAX_FLOW_ARROWS)
+                break;
+        }
+        prev = pt;
+        havePrev = true;
+    }
+
+    p.setRenderHints(tmpHints);
+    p.setBrush(Qt::NoBrush);
+    p.setPen(Qt::NoPen);
 }
 
 void TraceView::zoomBy(double scale)
@@ -556,23 +1201,22 @@ void TraceView::zoomBy(double scale)
     update();
 }
 
-void TraceView::zoomAll()
+// Time span of the events in all lanes, or of their pyramids while loading.
+bool TraceView::getTimeSpan(Range<double>* span)
 {
-
     QList<Lane>::const_iterator laneIter;
 
     double minTime = 0, maxTime = 0;
     bool haveMinMax = false;
 
-    _scrollYOfs = 0;
-
     for(laneIter = _lanes.begin(); laneIter != _lanes.end(); ++laneIter)
     {
         Trace* data = (*laneIter).data;
-        if(data->numEvents() > 0)
+        TracePyramid* pyramid = (*laneIter).pyramid;
+        if((data && data->numEvents() > 0) || (!data && pyramid))
         {
-            double laneMin = data->getEventTime(0);
-            double laneMax = data->getEventTime(data->numEvents()-1);
+            double laneMin = data ? data->getEventTime(0) : pyramid->begin();
+            double laneMax = data ? data->getEventTime(data->numEvents()-1) : pyramid->end();
             if(haveMinMax)
             {
                 minTime = laneMin < minTime ? laneMin : minTime;
@@ -588,15 +1232,32 @@ void TraceView::zoomAll()
     }
 
     if(haveMinMax)
+        span->set(minTime, maxTime);
+    return haveMinMax;
+}
+
+void TraceView::zoomAll()
+{
+    Range<double> span;
+
+    _scrollYOfs = 0;
+
+    if(getTimeSpan(&span))
     {
-        double delta = maxTime - minTime;
+        double delta = span.delta();
         double scale = 0.5;
-        _viewTime.set(minTime - delta*scale, maxTime + delta*scale);
+        _viewTime.set(span.begin - delta*scale, span.end + delta*scale);
     }
 
     update();
 }
 
+void TraceView::setViewTimeRange(double begin, double end)
+{
+    _viewTime.set(begin, end);
+    update();
+}
+
 
 void TraceView::zoomToSelection(void)
 {
@@ -615,15 +1276,59 @@ void TraceView::clearSelection()
 {
     _selectLane.set(-1, -1);
     _haveSelection = false;
+    _selectedFlow.clear();
     updateSelectedEvents();
     update();
 }
 
 void TraceView::updateSelectedEvents()
 {
+    _settleTimer->stop();
     emit selectionChanged(_haveSelection);
 }
 
+// Listing the events of a selection reads them from the trace, so while the
+// selection is dragged it is reported only once it stays put for
+// SELECTION_SETTLE_MS; until then the info text counts its events.
+void TraceView::onSelectionSettled()
+{
+    updateSelectedEvents();
+    update();
+}
+
+// From the lane pyramids where there are any, so the count costs the same
+// however many events are selected.
+qint64 TraceView::approxSelectedEvents()
+{
+    Range<int> laneRange = _selectLane.fix();
+    Range<double> timeRange = _selectTime.fix();
+    if(laneRange.begin == -1 || laneRange.end == -1)
+    {
+        laneRange.begin = 0;
+        laneRange.end = _lanes.size() - 1;
+    }
+
+    double count = 0;
+    for(int laneIdx = laneRange.begin; laneIdx <= laneRange.end; ++laneIdx)
+    {
+        const Lane* lane = getLane(laneIdx);
+        if(!lane || lane->isGroup)
+            continue;
+        if(lane->pyramid)
+        {
+            float sample;
+            lane->pyramid->sample(timeRange.begin, timeRange.end, 1, &sample);
+            count += sample;
+        }
+        else if(lane->data)
+        {
+            int eventIdx = 0;
+            count += lane->data->eventsInRange(timeRange.begin, timeRange.end, &eventIdx);
+        }
+    }
+    return (qint64)(count + 0.5);
+}
+
 float TraceView::absTimeToCoord(double t)
 {
     return (float)(((t - _viewTime.begin) / _viewTime.delta()) * width());
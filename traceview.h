@@ -3,7 +3,11 @@
 
 #include <QWidget>
 #include <QList>
+#include <QTimer>
 #include "tracedata.h"
+#include "tracepyramid.h"
+#include "traceflow.h"
+#include "tracecategories.h"
 
 template<typename T> class Range
 {
@@ -20,13 +24,22 @@ public:
     void set(T b, T e) { begin = b; end = e; }
 };
 
+QString timeToString(double t, bool full, TraceTicks base = 0);
+
 class Lane {
 public:
-    Lane(Trace* data = NULL, const QString& name = QString(), QColor color = QColor()) : data(data), name(name), color(color), collapsed(false) { }
+    Lane(Trace* data = NULL, const QString& name = QString(), QColor color = QColor(), TracePyramid* pyramid = NULL) : data(data), name(name), color(color), collapsed(false), pyramid(pyramid), baseline(NULL), categories(NULL), isGroup(false), depth(0), hidden(false) { }
     Trace* data;
     QString name;
     QColor color;
     bool collapsed;
+    TracePyramid* pyramid;  // may be set without data while a trace is loading
+    TracePyramid* baseline; // when comparing traces, drawn as the difference to pyramid
+    const LaneCategories* categories;   // when coloring by category, drawn stacked by category
+    bool isGroup;           // header of the following lanes with depth > 0; pyramid holds their sum
+    QList<Trace*> members;  // of a group, binned again when zoomed past its pyramid
+    int depth;
+    bool hidden;            // member of a collapsed group
 public:
     void setCollapsed(bool c) { collapsed = c; }
     bool isCollapsed() const { return collapsed; }
@@ -40,6 +53,14 @@ public:
     TraceView(QWidget* parent = NULL);
 
     void setLanes(const QList<Lane>& lanes);
+    void addLane(const Lane& lane);
+    void reorderLanes(const QVector<int>& order);
+    void followTime(double t);
+    void setFlowIndex(FlowIndex* flowIndex);
+    void selectHoveredFlow();
+    void setSelection(int laneBegin, int laneEnd, double timeBegin, double timeEnd);
+    int laneForData(Trace* data);
+    const QVector<FlowIndex::EventRef>& selectedFlow() { return _selectedFlow; }
 
     void zoomBy(double scale);
     void zoomToSelection();
@@ -48,13 +69,29 @@ public:
     void clearSelection();
 
     bool hasSelection() { return _haveSelection; }
+    Range<double> viewTimeRange() { return _viewTime; }
+    void setViewTimeRange(double begin, double end);
+    bool getTimeSpan(Range<double>* span);
     inline Range<double> selectedTimeRange() { return _selectTime.fix(); }
     inline Range<int> selectedLaneRange() { return _selectLane.fix(); }
     Lane* getLane(int idx) { return (idx < 0 || idx >= _lanes.size()) ? NULL : (Lane*)&_lanes.at(idx); }
     int numLanes() const { return _lanes.size(); };
+    void setCategoryLegend(const QStringList& names, int other);
+
+    static void drawLaneBackground(QPainter& p, int laneIdx, int y, int w, int h);
+    static void drawTimeGrid(QPainter& p, int w, int h, double timeLeft, double timeRight);
+    static void drawLaneData(QPainter& p, const Lane& lane, int y, int w, int h, double timeLeft, double timeRight);
+    static void drawLaneLabel(QPainter& p, const Lane& lane, int y);
 
 signals:
     void selectionChanged(bool hasSelection);
+    void viewTimeChanged();
+    void lanesChanged();
+
+protected slots:
+    void onFrame();
+    void onIdle();
+    void onSelectionSettled();
 
 protected:
     bool event(QEvent *event);
@@ -70,9 +107,16 @@ protected:
     double coordToAbsTime(int c);
 
     void updateSelectedEvents();
+    qint64 approxSelectedEvents();
+    void showHoverEvent();
+    void stepEvent(bool forward);
+    void scheduleFrame();
+    void startInteraction();
 
     int getLaneCoords(int idx, int* height);
     int laneForCoord(int y);
+    int laneForFlowRef(const FlowIndex::EventRef& ref);
+    void drawFlow(QPainter& p, const QVector<FlowIndex::EventRef>& flow, const QColor& color);
 
 protected:
     Range<double> _viewTime;
@@ -85,6 +129,25 @@ protected:
     int _hoverLaneIdx;
     int _hoverEvtIdx;
     int _scrollYOfs;
+    double _followTime;
+    Range<double> _paintedViewTime;
+    FlowIndex* _flowIndex;
+    QVector<FlowIndex::EventRef> _hoverFlow;
+    QVector<FlowIndex::EventRef> _selectedFlow;
+    QStringList _categoryNames;
+    int _otherCategory;
+
+    // input waiting for the next frame
+    QTimer* _frameTimer;
+    QTimer* _idleTimer;
+    QTimer* _settleTimer;       // while a dragged selection is unreported
+    bool _pendingMove;
+    QPointF _pendingPos;
+    Qt::MouseButtons _pendingButtons;
+    Qt::KeyboardModifiers _pendingModifiers;
+    double _pendingWheelX, _pendingWheelY, _pendingScrollY;
+    QPointF _pendingWheelPos;
+    bool _interacting;
 };
 
 #endif // TRACEVIEW_H
@@ -0,0 +1,368 @@
+#include "traceworkspace.h"
+#include "tracegroups.h"
+#include <string.h>
+#include <QFileInfo>
+#include <QDateTime>
+#include <QMap>
+
+Workspace::Workspace()
+    : _data(NULL), _size(0)
+{
+    memset(&_header, 0, sizeof(_header));
+    _files.cropped = false;
+}
+
+// Pads out to WORKSPACE_ALIGN and appends size bytes, returning their offset.
+static quint64 appendAligned(QByteArray* out, const void* data, qint64 size)
+{
+    while(out->size() % WORKSPACE_ALIGN)
+        out->append('\0');
+    quint64 offset = out->size();
+    out->append((const char*)data, size);
+    return offset;
+}
+
+static void appendString(QByteArray* out, const QString& str, quint64* offset, quint64* size)
+{
+    QByteArray utf8 = str.toUtf8();
+    *offset = appendAligned(out, utf8.constData(), utf8.size());
+    *size = utf8.size();
+}
+
+QByteArray Workspace::save(TraceFile* trace, const WorkspaceFiles& files, const QList<TraceLane>& traceLanes,
+                           TraceView* view)
+{
+    QMap<Trace*,QString> laneIds;
+    for(const TraceLane& traceLane: traceLanes)
+        laneIds[traceLane.data] = traceLane.id;
+
+    // lanes not derived from the trace, such as live ones, aren't kept
+    QList<const Lane*> lanes;
+    QList<LaneKind> kinds;
+    QVector<int> savedIdx(view->numLanes(), -1);
+    for(int n = 0; n < view->numLanes(); n++)
+    {
+        const Lane* lane = view->getLane(n);
+        SubTrace* subTrace = dynamic_cast<SubTrace*>(lane->data);
+        LaneKind kind;
+        if(lane->isGroup && lane->pyramid)
+            kind = GroupLaneKind;
+        else if(lane->data && laneIds.contains(lane->data))
+            kind = TraceLaneKind;
+        else if(subTrace && subTrace->getParent() == trace && dynamic_cast<QueryTrace*>(subTrace))
+            kind = QueryLaneKind;
+        else if(subTrace && subTrace->getParent() == trace && dynamic_cast<FilteredTrace*>(subTrace) &&
+                !((FilteredTrace*)subTrace)->attributeKey().isEmpty())
+            kind = FilteredLaneKind;
+        else
+            continue;
+        savedIdx[n] = lanes.size();
+        lanes.append(lane);
+        kinds.append(kind);
+    }
+
+    Header header;
+    memset(&header, 0, sizeof(header));
+    header.magic = WORKSPACE_MAGIC;
+    header.version = WORKSPACE_VERSION;
+    header.numFiles = files.fileNames.size();
+    header.numLanes = lanes.size();
+    header.numEvents = trace->numEvents();
+    Range<double> viewTime = view->viewTimeRange();
+    header.viewBegin = viewTime.begin;
+    header.viewEnd = viewTime.end;
+    header.haveSelection = view->hasSelection();
+    Range<double> selectTime = view->selectedTimeRange();
+    header.selectBegin = selectTime.begin;
+    header.selectEnd = selectTime.end;
+    header.selectLaneBegin = header.selectLaneEnd = -1;
+    Range<int> selectLane = view->selectedLaneRange();
+    for(int n = qMax(selectLane.begin, 0); selectLane.begin != -1 && n <= selectLane.end && n < savedIdx.size(); n++)
+    {
+        if(savedIdx[n] == -1)
+            continue;
+        if(header.selectLaneBegin == -1)
+            header.selectLaneBegin = savedIdx[n];
+        header.selectLaneEnd = savedIdx[n];
+    }
+    header.cropped = files.cropped;
+    header.cropBegin = files.cropRange.first;
+    header.cropEnd = files.cropRange.second;
+
+    QByteArray out;
+    out.fill('\0', sizeof(Header) + header.numFiles*sizeof(FileRecord) + header.numLanes*sizeof(LaneRecord));
+
+    QList<FileRecord> fileRecords;
+    for(int n = 0; n < files.fileNames.size(); n++)
+    {
+        FileRecord rec;
+        memset(&rec, 0, sizeof(rec));
+        QFileInfo info(files.fileNames[n]);
+        appendString(&out, files.fileNames[n], &rec.nameOffset, &rec.nameSize);
+        rec.clockOffset = (n < files.clockOffsets.size()) ? files.clockOffsets[n] : 0;
+        rec.fileSize = info.size();
+        rec.modified = info.lastModified().toMSecsSinceEpoch();
+        fileRecords.append(rec);
+    }
+
+    QList<LaneRecord> laneRecords;
+    for(int n = 0; n < lanes.size(); n++)
+    {
+        const Lane* lane = lanes[n];
+        LaneRecord rec;
+        memset(&rec, 0, sizeof(rec));
+        rec.kind = kinds[n];
+        rec.flags = (lane->collapsed ? Collapsed : 0) | (lane->hidden ? Hidden : 0);
+        rec.depth = lane->depth;
+        rec.color = lane->color.rgba();
+        appendString(&out, laneIds.value(lane->data), &rec.idOffset, &rec.idSize);
+        appendString(&out, lane->name, &rec.nameOffset, &rec.nameSize);
+
+        if(kinds[n] == QueryLaneKind || kinds[n] == FilteredLaneKind)
+        {
+            SubTrace* subTrace = dynamic_cast<SubTrace*>(lane->data);
+            const QList<int>& indices = subTrace->getParentIndices();
+            rec.indicesOffset = appendAligned(&out, indices.constData(), indices.size()*sizeof(qint32));
+            rec.numIndices = indices.size();
+            if(kinds[n] == QueryLaneKind)
+                appendString(&out, ((QueryTrace*)subTrace)->getQuery()->expression(), &rec.exprOffset, &rec.exprSize);
+            else
+            {
+                FilteredTrace* filtered = (FilteredTrace*)subTrace;
+                appendString(&out, filtered->attributeKey() + "=" + filtered->attributeValue(), &rec.exprOffset, &rec.exprSize);
+            }
+        }
+        else if(kinds[n] == GroupLaneKind)
+        {
+            const TracePyramid* pyramid = lane->pyramid;
+            int numBuckets = pyramid->numBuckets(0);
+            QVector<float> counts(numBuckets);
+            QByteArray exact(numBuckets, '\0');
+            for(int b = 0; b < numBuckets; b++)
+            {
+                counts[b] = pyramid->count(0, b);
+                exact[b] = pyramid->isExact(b) ? 1 : 0;
+            }
+            rec.countsOffset = appendAligned(&out, counts.constData(), numBuckets*sizeof(float));
+            rec.exactOffset = appendAligned(&out, exact.constData(), numBuckets);
+            rec.pyramidBegin = pyramid->begin();
+            rec.pyramidEnd = pyramid->end();
+            rec.pyramidLevels = pyramid->numLevels();
+        }
+        laneRecords.append(rec);
+    }
+
+    char* dst = out.data();
+    memcpy(dst, &header, sizeof(Header));
+    dst += sizeof(Header);
+    for(const FileRecord& rec: fileRecords)
+    {
+        memcpy(dst, &rec, sizeof(FileRecord));
+        dst += sizeof(FileRecord);
+    }
+    for(const LaneRecord& rec: laneRecords)
+    {
+        memcpy(dst, &rec, sizeof(LaneRecord));
+        dst += sizeof(LaneRecord);
+    }
+    return out;
+}
+
+bool Workspace::inBounds(quint64 offset, quint64 size) const
+{
+    return offset <= (quint64)_size && size <= (quint64)_size - offset;
+}
+
+QString Workspace::string(quint64 offset, quint64 size) const
+{
+    if(!inBounds(offset, size))
+        return QString();
+    return QString::fromUtf8((const char*)_data + offset, size);
+}
+
+bool Workspace::parse(const uchar* data, qint64 size)
+{
+    _data = data;
+    _size = size;
+    _fileRecords.clear();
+    _laneRecords.clear();
+    _files = WorkspaceFiles();
+    _files.cropped = false;
+
+    if(!data || size < (qint64)sizeof(Header))
+        return false;
+    memcpy(&_header, data, sizeof(Header));
+    if(_header.magic != WORKSPACE_MAGIC || _header.version != WORKSPACE_VERSION)
+        return false;
+
+    quint64 recordsSize = (quint64)_header.numFiles*sizeof(FileRecord) + (quint64)_header.numLanes*sizeof(LaneRecord);
+    if(!inBounds(sizeof(Header), recordsSize))
+        return false;
+
+    const uchar* src = data + sizeof(Header);
+    for(quint32 n = 0; n < _header.numFiles; n++)
+    {
+        FileRecord rec;
+        memcpy(&rec, src, sizeof(FileRecord));
+        src += sizeof(FileRecord);
+        if(!inBounds(rec.nameOffset, rec.nameSize))
+            return false;
+        _fileRecords.append(rec);
+        _files.fileNames.append(string(rec.nameOffset, rec.nameSize));
+        _files.clockOffsets.append(rec.clockOffset);
+    }
+    for(quint32 n = 0; n < _header.numLanes; n++)
+    {
+        LaneRecord rec;
+        memcpy(&rec, src, sizeof(LaneRecord));
+        src += sizeof(LaneRecord);
+        _laneRecords.append(rec);
+    }
+
+    _files.cropped = _header.cropped;
+    _files.cropRange = qMakePair(_header.cropBegin, _header.cropEnd);
+    return true;
+}
+
+bool Workspace::matches(TraceFile* trace) const
+{
+    if(trace->numEvents() != _header.numEvents || trace->isCropped() != (bool)_header.cropped)
+        return false;
+    for(const FileRecord& rec: _fileRecords)
+    {
+        QFileInfo info(string(rec.nameOffset, rec.nameSize));
+        if(!info.exists() || info.size() != rec.fileSize || info.lastModified().toMSecsSinceEpoch() != rec.modified)
+            return false;
+    }
+    return true;
+}
+
+QList<Lane> Workspace::restore(TraceFile* trace, const QList<TraceLane>& traceLanes, QList<QueryTrace*>* queryLanes,
+                               QList<FilteredTrace*>* attrLanes, QList<TracePyramid*>* pyramids) const
+{
+    bool exact = matches(trace);
+    int numEvents = trace->numEvents();
+
+    QMap<QString,FilteredTrace*> laneForId;
+    for(const TraceLane& traceLane: traceLanes)
+        laneForId[traceLane.id] = traceLane.data;
+
+    // stored indices are only trusted in range, in case the file was damaged
+    auto indicesValid = [&](const LaneRecord& rec) {
+        if(!exact || rec.numIndices < 0 || rec.indicesOffset % sizeof(qint32) || !inBounds(rec.indicesOffset, 0) ||
+           (quint64)rec.numIndices > ((quint64)_size - rec.indicesOffset)/sizeof(qint32))
+            return false;
+        const qint32* indices = (const qint32*)(_data + rec.indicesOffset);
+        for(qint64 n = 0; n < rec.numIndices; n++)
+        {
+            if(indices[n] < 0 || indices[n] >= numEvents)
+                return false;
+        }
+        return true;
+    };
+
+    QList<Lane> lanes;
+    for(const LaneRecord& rec: _laneRecords)
+    {
+        QString name = string(rec.nameOffset, rec.nameSize);
+        QColor color = QColor::fromRgba(rec.color);
+        const qint32* indices = (const qint32*)(_data + rec.indicesOffset);
+        Lane lane;
+
+        if(rec.kind == TraceLaneKind)
+        {
+            FilteredTrace* data = laneForId.value(string(rec.idOffset, rec.idSize));
+            if(!data)
+                continue;
+            lane = Lane(data, name, color);
+        }
+        else if(rec.kind == FilteredLaneKind)
+        {
+            // key=value, so the lane can be split again on another trace
+            QString attr = string(rec.exprOffset, rec.exprSize);
+            int eq = attr.indexOf('=');
+            if(eq <= 0)
+                continue;
+            FilteredTrace* data = new FilteredTrace(trace);
+            data->setAttribute(attr.left(eq), attr.mid(eq + 1));
+            if(indicesValid(rec))
+                data->setParentIndices(indices, rec.numIndices);
+            data->setIndex(lanes.size());
+            attrLanes->append(data);
+            lane = Lane(data, name, color);
+        }
+        else if(rec.kind == QueryLaneKind)
+        {
+            QString error;
+            TraceQuery* query = new TraceQuery();
+            if(!query->parse(string(rec.exprOffset, rec.exprSize), &error))
+            {
+                delete query;
+                continue;
+            }
+            QueryTrace* data = new QueryTrace(trace, query);
+            if(indicesValid(rec))
+                data->setMatches(indices, rec.numIndices);
+            data->setIndex(lanes.size());
+            queryLanes->append(data);
+            lane = Lane(data, name, color);
+        }
+        else if(rec.kind == GroupLaneKind)
+        {
+            // checked against the file before the pyramid is allocated
+            if(!exact || rec.pyramidLevels < 1 || rec.pyramidLevels > GROUP_PYRAMID_LEVELS || rec.countsOffset % sizeof(float))
+                continue;
+            int numBuckets = 1 << (rec.pyramidLevels - 1);
+            if(!inBounds(rec.countsOffset, numBuckets*sizeof(float)) || !inBounds(rec.exactOffset, numBuckets))
+                continue;
+            TracePyramid* pyramid = new GroupPyramid(rec.pyramidBegin, rec.pyramidEnd, rec.pyramidLevels);
+            const float* counts = (const float*)(_data + rec.countsOffset);
+            const uchar* exactBuckets = _data + rec.exactOffset;
+            for(int b = 0; b < numBuckets; b++)
+            {
+                pyramid->set(b, counts[b]);
+                if(exactBuckets[b])
+                    pyramid->setExact(b);
+            }
+            pyramid->update();
+            pyramids->append(pyramid);
+            lane = Lane(NULL, name, color, pyramid);
+            lane.isGroup = true;
+        }
+        else
+            continue;
+
+        // without their headers, former members are ordinary lanes
+        lane.collapsed = rec.flags & Collapsed;
+        lane.depth = exact ? rec.depth : 0;
+        lane.hidden = exact && (rec.flags & Hidden);
+        lanes.append(lane);
+    }
+
+    for(int n = 0; n < lanes.size(); n++)
+    {
+        for(int m = n + 1; lanes[n].isGroup && m < lanes.size() && lanes[m].depth > lanes[n].depth; m++)
+        {
+            if(lanes[m].data)
+                lanes[n].members.append(lanes[m].data);
+        }
+    }
+
+    return lanes;
+}
+
+void Workspace::restoreView(TraceView* view) const
+{
+    if(_header.viewEnd > _header.viewBegin)
+        view->setViewTimeRange(_header.viewBegin, _header.viewEnd);
+
+    if(_header.haveSelection)
+    {
+        int laneBegin = _header.selectLaneBegin, laneEnd = _header.selectLaneEnd;
+        if(laneBegin >= view->numLanes() || laneEnd >= view->numLanes())
+            laneBegin = laneEnd = -1;
+        view->setSelection(laneBegin, laneEnd, _header.selectBegin, _header.selectEnd);
+    }
+    else
+        view->clearSelection();
+}
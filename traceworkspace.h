@@ -0,0 +1,118 @@
+#ifndef TRACEWORKSPACE_H
+#define TRACEWORKSPACE_H
+
+#include <QByteArray>
+#include <QList>
+#include <QPair>
+#include <QStringList>
+#include "tracedata.h"
+#include "tracepyramid.h"
+#include "tracequery.h"
+#include "traceview.h"
+
+#define WORKSPACE_MAGIC     0x53575654  // "TVWS"
+#define WORKSPACE_VERSION   1
+#define WORKSPACE_ALIGN     8
+
+// The trace files a workspace was made from, as MainWindow opens them.
+typedef struct {
+    QStringList fileNames;
+    QList<double> clockOffsets;
+    bool cropped;
+    QPair<double,double> cropRange;
+} WorkspaceFiles;
+
+// A snapshot of an investigation: the lanes as arranged in the view, with
+// their names, colors, order and grouping, the view time and the selection.
+// The event indices of derived lanes (attribute and query lanes) and the
+// pyramids of group headers are stored as they are in memory, so that
+// restoring them onto the same trace is a copy rather than a rescan.
+//
+// The file is a header, fixed size lane and file records, then the arrays
+// and strings they point at, each WORKSPACE_ALIGN aligned, so it can be
+// used straight from a mapping. Offsets are from the start of the file.
+class Workspace
+{
+public:
+    Workspace();
+
+    static QByteArray save(TraceFile* trace, const WorkspaceFiles& files, const QList<TraceLane>& traceLanes,
+                           TraceView* view);
+
+    // data must stay valid, and unchanged, while the workspace is used.
+    bool parse(const uchar* data, qint64 size);
+
+    const WorkspaceFiles& files() const { return _files; }
+
+    // Whether trace is the one the workspace was saved from: the same files,
+    // unchanged on disk, with the same events. Only then are stored event
+    // indices and pyramids used.
+    bool matches(TraceFile* trace) const;
+
+    // Lanes of the trace are found by ID; lanes that no longer exist are
+    // left out. Query lanes go to queryLanes, evaluated from their
+    // expressions if the trace doesn't match. Attribute lanes go to
+    // attrLanes, without events if the trace doesn't match, for the caller
+    // to split again with AttributeStore::fill(). Group pyramids go to
+    // pyramids. The caller frees all of these. Groups are only restored
+    // onto a matching trace.
+    QList<Lane> restore(TraceFile* trace, const QList<TraceLane>& traceLanes, QList<QueryTrace*>* queryLanes,
+                        QList<FilteredTrace*>* attrLanes, QList<TracePyramid*>* pyramids) const;
+
+    // Applied to the view after the lanes are set.
+    void restoreView(TraceView* view) const;
+
+protected:
+    enum LaneKind { TraceLaneKind, FilteredLaneKind, QueryLaneKind, GroupLaneKind };
+    enum LaneFlags { Collapsed = 1, Hidden = 2 };
+
+    typedef struct {
+        quint32 magic;
+        quint32 version;
+        quint32 numFiles;
+        quint32 numLanes;
+        qint64 numEvents;
+        double viewBegin, viewEnd;
+        double selectBegin, selectEnd;
+        qint32 selectLaneBegin, selectLaneEnd;
+        quint32 haveSelection;
+        quint32 cropped;
+        double cropBegin, cropEnd;
+    } Header;
+
+    typedef struct {
+        quint64 nameOffset, nameSize;
+        double clockOffset;
+        qint64 fileSize;
+        qint64 modified;        // ms since the epoch
+    } FileRecord;
+
+    typedef struct {
+        quint32 kind;
+        quint32 flags;
+        qint32 depth;
+        quint32 color;
+        quint64 idOffset, idSize;
+        quint64 nameOffset, nameSize;
+        quint64 exprOffset, exprSize;   // of a query lane, or key=value of an attribute lane
+        quint64 indicesOffset;          // qint32 event indices of a derived lane
+        qint64 numIndices;
+        quint64 countsOffset;           // float level 0 counts of a group's pyramid
+        quint64 exactOffset;            // and one byte per bucket, set where exact
+        double pyramidBegin, pyramidEnd;
+        qint32 pyramidLevels;
+        qint32 reserved;
+    } LaneRecord;
+
+    QString string(quint64 offset, quint64 size) const;
+    bool inBounds(quint64 offset, quint64 size) const;
+
+    const uchar* _data;
+    qint64 _size;
+    Header _header;
+    QList<FileRecord> _fileRecords;
+    QList<LaneRecord> _laneRecords;
+    WorkspaceFiles _files;
+};
+
+#endif // TRACEWORKSPACE_H